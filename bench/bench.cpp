@@ -0,0 +1,335 @@
+#include <llvm/ADT/StringRef.h>       // llvm::StringRef
+#include <llvm/Support/TargetSelect.h> // llvm::InitializeNativeTarget
+
+#include <algorithm> // std::min, std::fill
+#include <chrono>    // std::chrono::steady_clock
+#include <cmath>     // std::isfinite
+#include <cstddef>   // std::size_t
+#include <cstdint>   // std::intptr_t
+#include <iostream>  // std::cout, std::cerr, std::endl
+#include <iterator>  // std::begin, std::end
+#include <limits>    // std::numeric_limits
+#include <memory>    // std::unique_ptr
+#include <string>    // std::string, std::to_string
+#include <vector>    // std::vector
+
+#include "lexer.h"  // getNextToken, getCurrentToken, setInputFile
+#include "parser.h" // ParseDefinition, ParseExtern, ParseTopLevelExpr
+#include "util.h"   // isFlatASTEnabled, SetFlatAST
+
+#include "CompilationContext.h"
+#include "ExprAST.h"
+#include "FlatAST.h"
+#include "FunctionAST.h"
+#include "KaleidoscopeJIT.h"
+#include "Optimizer.h"
+
+using llvm::orc::KaleidoscopeJIT;
+using Clock = std::chrono::steady_clock;
+
+/// The stages a workload is run in, one after the other.
+enum Stage { Lex, Parse, Codegen, Optimize, JITCompile, Execute, NumStages };
+
+/// The names the stages are reported under.
+static const char *const StageNames[NumStages] = {
+    "lex", "parse", "codegen", "optimize", "jit", "execute"};
+
+/// What running a workload once, or the best of several runs, measured.
+struct Measurement {
+  /// How long each stage took, in seconds.
+  double Seconds[NumStages];
+  unsigned Tokens = 0;
+  unsigned Definitions = 0;
+  unsigned Externs = 0;
+  unsigned Expressions = 0;
+  /// The sum of the values of every top-level expression, which shows
+  /// whether a change to the compiler changed what the workload computes.
+  double Checksum = 0;
+};
+
+/// A top-level item of a workload. Every item is parsed before any code is
+/// generated, so that the phases can be timed separately: exactly one of
+/// Tree, Flat and Extern is set.
+struct Item {
+  std::unique_ptr<FunctionAST> Tree;
+  std::unique_ptr<FlatAST> Flat;
+  std::unique_ptr<PrototypeAST> Extern;
+  /// The name of the function a top-level expression is compiled into, or
+  /// empty for definitions and externs.
+  std::string ExprName;
+};
+
+/// The number of seconds since Start.
+static double secondsSince(Clock::time_point Start) {
+  return std::chrono::duration<double>(Clock::now() - Start).count();
+}
+
+/// Point the lexer of the current context at the workload in Path.
+static bool openWorkload(const std::string &Path) {
+  if (auto EC = setInputFile(Path)) {
+    std::cerr << "Could not open " << Path << ": " << EC.message()
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// Parse a function definition or top-level expression with the parser for
+/// the current AST representation.
+///
+/// @param I where to store the parsed function
+/// @param Name the name of the function to compile a top-level expression
+///        into, or empty to parse a definition
+/// @return whether the function could be parsed
+static bool parseFunction(Item &I, const std::string &Name) {
+  const PrototypeAST *Proto = nullptr;
+  if (isFlatASTEnabled()) {
+    I.Flat =
+        Name.empty() ? ParseDefinitionFlat() : ParseTopLevelExprFlat(Name);
+    if (I.Flat)
+      Proto = &I.Flat->getProto();
+  } else {
+    I.Tree = Name.empty() ? ParseDefinition() : ParseTopLevelExpr(Name);
+    if (I.Tree)
+      Proto = &I.Tree->getProto();
+  }
+  if (!Proto)
+    return false;
+  // The interpreter installs an operator's precedence when it generates the
+  // operator's code, but the rest of the workload is parsed before that.
+  if (Proto->isBinaryOp())
+    InstallBinopPrecedence(Proto->getOperatorName(),
+                           Proto->getBinaryPrecedence());
+  return true;
+}
+
+/// Run the workload in Path once, timing each stage.
+///
+/// @param Path the source file of the workload
+/// @param M where to store what was measured
+/// @return whether the workload ran without errors, which are printed
+static bool runWorkload(const std::string &Path, Measurement &M) {
+  // Lex the whole workload on its own first.
+  {
+    CompilationContext Context;
+    CompilationContext::Scope Scope(Context);
+    if (!openWorkload(Path))
+      return false;
+    const auto Start = Clock::now();
+    while (getNextToken() != tok_eof)
+      M.Tokens++;
+    M.Seconds[Lex] = secondsSince(Start);
+  }
+
+  CompilationContext Context;
+  CompilationContext::Scope Scope(Context);
+  SetupBinopPrecedences();
+  if (!openWorkload(Path))
+    return false;
+
+  std::vector<Item> Items;
+  auto Start = Clock::now();
+  getNextToken();
+  while (getCurrentToken() != tok_eof) {
+    Item I;
+    bool Parsed;
+    switch (getCurrentToken()) {
+    case ';': // ignore top-level semicolons
+      getNextToken();
+      continue;
+    case tok_def:
+      Parsed = parseFunction(I, "");
+      M.Definitions++;
+      break;
+    case tok_extern:
+      I.Extern = ParseExtern();
+      Parsed = I.Extern != nullptr;
+      M.Externs++;
+      break;
+    default:
+      // Every expression gets a function of its own, since they all end up
+      // in the same module.
+      I.ExprName = "__bench_expr" + std::to_string(M.Expressions++);
+      Parsed = parseFunction(I, I.ExprName);
+    }
+    if (!Parsed) {
+      std::cerr << Path << " could not be parsed" << std::endl;
+      return false;
+    }
+    Items.push_back(std::move(I));
+  }
+  M.Seconds[Parse] = secondsSince(Start);
+
+  // There is no optimizer in the context, so the code is generated without
+  // being optimized along the way, like the interpreter does at -O0.
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  newModule("Benchmark");
+  borrowModule().setDataLayout(JIT->getDataLayout());
+  Start = Clock::now();
+  for (auto &I : Items) {
+    bool Generated;
+    if (I.Extern)
+      Generated = I.Extern->codegen() != nullptr;
+    else if (I.Flat)
+      Generated = I.Flat->codegen() != nullptr;
+    else
+      Generated = I.Tree->codegen() != nullptr;
+    if (!Generated) {
+      std::cerr << "Could not generate code for " << Path << std::endl;
+      return false;
+    }
+  }
+  M.Seconds[Codegen] = secondsSince(Start);
+
+  // The interpreter makes its optimizer once, so making this one is not part
+  // of the measurement.
+  Optimizer FunctionOptimizer(getOptimizationLevel(),
+                              &JIT->getTargetMachine());
+  Start = Clock::now();
+  FunctionOptimizer.runOnFunctions(borrowModule());
+  M.Seconds[Optimize] = secondsSince(Start);
+
+  // The JIT compiles a module when one of its symbols is first looked up.
+  Start = Clock::now();
+  auto K = JIT->addModule(takeModule());
+  if (!K) {
+    std::cerr << toString(K.takeError()) << std::endl;
+    return false;
+  }
+  std::vector<double (*)()> Expressions;
+  for (const auto &I : Items) {
+    if (I.ExprName.empty())
+      continue;
+    auto ExprSymbol = JIT->findSymbol(llvm::StringRef(I.ExprName));
+    if (!ExprSymbol) {
+      std::cerr << toString(ExprSymbol.takeError()) << std::endl;
+      JIT->removeModule(*K);
+      return false;
+    }
+    Expressions.push_back(reinterpret_cast<double (*)()>(
+        static_cast<std::intptr_t>(ExprSymbol->getAddress())));
+  }
+  M.Seconds[JITCompile] = secondsSince(Start);
+
+  Start = Clock::now();
+  for (auto *Expression : Expressions)
+    M.Checksum += Expression();
+  M.Seconds[Execute] = secondsSince(Start);
+
+  JIT->removeModule(*K);
+  return true;
+}
+
+/// Print Value as a JSON number, or null if JSON cannot represent it.
+static void printNumber(double Value) {
+  if (std::isfinite(Value))
+    std::cout << Value;
+  else
+    std::cout << "null";
+}
+
+/// Print S as a JSON string.
+static void printString(llvm::StringRef S) {
+  std::cout << '"';
+  for (char C : S) {
+    if (C == '"' || C == '\\')
+      std::cout << '\\';
+    std::cout << C;
+  }
+  std::cout << '"';
+}
+
+/// Parse the unsigned number in Value, the value of the option called Name.
+static bool parseUnsigned(llvm::StringRef Name, llvm::StringRef Value,
+                          unsigned &Result) {
+  if (Value.getAsInteger(10, Result)) {
+    std::cerr << "Invalid value for -" << Name.str() << ": " << Value.str()
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static int usage(const char *argv0) {
+  std::cerr << "usage: " << argv0 << " [<options>] <workload>..." << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Run each Kaleidoscope workload, timing its phases separately, "
+               "and print\n"
+               "the best time of each phase as JSON on standard output.\n"
+               "\n"
+               "Options:\n"
+               "  -O<n>        optimize at level <n>, from 0 to 3 "
+               "(default: 2)\n"
+               "  -runs=<n>    run each workload <n> times (default: 5)\n"
+               "  -flat-ast    store function bodies as flat arrays of nodes"
+            << std::endl;
+  return 1;
+}
+
+int main(int argc, const char **argv) {
+  unsigned OptLevel = getOptimizationLevel();
+  unsigned Runs = 5;
+  std::vector<std::string> Workloads;
+  for (int i = 1; i < argc; i++) {
+    llvm::StringRef Arg = argv[i];
+    if (Arg.consume_front("-O")) {
+      if (!parseUnsigned("O", Arg, OptLevel))
+        return 1;
+    } else if (Arg.consume_front("-runs=")) {
+      if (!parseUnsigned("runs", Arg, Runs) || Runs == 0)
+        return 1;
+    } else if (Arg == "-flat-ast") {
+      SetFlatAST(true);
+    } else if (Arg.startswith("-")) {
+      return usage(argv[0]);
+    } else {
+      Workloads.push_back(Arg.str());
+    }
+  }
+  if (Workloads.empty() || OptLevel > 3)
+    return usage(argv[0]);
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+  SetOptimizationLevel(OptLevel);
+  // Make the JIT before the first run instead of during it.
+  KaleidoscopeJIT::getInstance();
+
+  std::cout.precision(9);
+  std::cout << "{\"opt_level\": " << OptLevel << ", \"runs\": " << Runs
+            << ", \"flat_ast\": " << (isFlatASTEnabled() ? "true" : "false")
+            << ", \"workloads\": [";
+  for (std::size_t W = 0; W < Workloads.size(); W++) {
+    // Every run does the same amount of work, so the fastest one is the
+    // one with the least noise in it.
+    Measurement Best;
+    std::fill(std::begin(Best.Seconds), std::end(Best.Seconds),
+              std::numeric_limits<double>::infinity());
+    for (unsigned R = 0; R < Runs; R++) {
+      Measurement M;
+      if (!runWorkload(Workloads[W], M))
+        return 1;
+      for (int P = 0; P < NumStages; P++)
+        M.Seconds[P] = std::min(M.Seconds[P], Best.Seconds[P]);
+      Best = M;
+    }
+
+    std::cout << (W ? ",\n  " : "\n  ") << "{\"name\": ";
+    printString(Workloads[W]);
+    std::cout << ", \"tokens\": " << Best.Tokens
+              << ", \"definitions\": " << Best.Definitions
+              << ", \"externs\": " << Best.Externs
+              << ", \"expressions\": " << Best.Expressions
+              << ", \"checksum\": ";
+    printNumber(Best.Checksum);
+    std::cout << ", \"seconds\": {";
+    for (int P = 0; P < NumStages; P++) {
+      std::cout << (P ? ", \"" : "\"") << StageNames[P] << "\": ";
+      printNumber(Best.Seconds[P]);
+    }
+    std::cout << "}}";
+  }
+  std::cout << "\n]}" << std::endl;
+  return 0;
+}
@@ -0,0 +1,26 @@
+#!/usr/bin/env bash
+# generate.sh: Print a large Kaleidoscope program, which is mostly work for the
+# front end and the JIT rather than for the generated code
+#
+# The number of functions can be given as an argument:
+# bench/generate.sh 5000 > large.ks
+
+functions=${1:-2000}
+
+echo "# Generated by bench/generate.sh with $functions functions"
+echo 'def f0(x y) x * y + 1;'
+for ((i = 1; i < functions; i++)); do
+  cat <<_EOF
+
+# Function number $i
+def f$i(x y)
+  let a = x * 0.5 + $i, b = y * 0.25 in
+  (if a < b then
+    f$((i - 1))(b, a)
+  else
+    f$((i - 1))(a, b + 1)) * 0.5 + a * b;
+_EOF
+  if ((i % 10 == 0)); then
+    echo "f$i($i, 2);"
+  fi
+done
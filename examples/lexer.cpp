@@ -1,8 +1,17 @@
-#include <iostream> // std::cout, std::endl
+#include <iostream> // std::cout, std::cerr, std::endl
 
-#include "lexer.h" // getNextToken, tokenToString
+#include "lexer.h" // getNextToken, setInputFile, tokenToString
+
+int main(int argc, const char **argv) {
+  // With a file name, lex that file instead of standard input.
+  if (argc > 1) {
+    if (auto EC = setInputFile(argv[1])) {
+      std::cerr << "Could not open " << argv[1] << ": " << EC.message()
+                << std::endl;
+      return 1;
+    }
+  }
 
-int main() {
   const int tok = getNextToken();
   std::cout << tokenToString(static_cast<Token>(tok)) << std::endl;
   return 0;
@@ -0,0 +1,66 @@
+#include <llvm/ADT/ArrayRef.h>      // llvm::ArrayRef
+#include <llvm/Support/Allocator.h> // llvm::BumpPtrAllocator
+
+#include <memory>      // std::uninitialized_copy
+#include <new>         // placement new
+#include <type_traits> // std::is_trivially_copyable, std::is_trivially_destructible
+#include <utility>     // std::forward, std::pair
+#include <vector>      // std::vector
+
+#include "stats.h" // countEvent
+
+#ifndef ASTARENA_H
+#define ASTARENA_H
+
+/// ASTArena - Owns the memory of every AST node parsed for one top-level item.
+///
+/// Nodes are bump-allocated out of large slabs, so making one costs a pointer
+/// increment instead of a call to malloc, and nodes parsed together end up
+/// next to each other in memory. Nothing is freed until the arena itself goes
+/// away, at which point the nodes are destroyed in one pass and every slab is
+/// released at once, instead of each node deleting its children in turn.
+class ASTArena {
+  llvm::BumpPtrAllocator Allocator;
+
+  /// The nodes that need their destructors run, paired with a function that
+  /// runs it, in the order they were made.
+  std::vector<std::pair<void *, void (*)(void *)>> Destructors;
+
+public:
+  ASTArena() = default;
+  ASTArena(const ASTArena &) = delete;
+  ASTArena &operator=(const ASTArena &) = delete;
+
+  /// The destructor for the ASTArena class, which destroys every node made
+  /// with it, latest first.
+  ~ASTArena();
+
+  /// Construct a node in this arena.
+  ///
+  /// @param Args the arguments to pass to the constructor of T
+  /// @return the new node, which lives as long as this arena does
+  template <typename T, typename... ArgTypes> T *make(ArgTypes &&... Args) {
+    T *Node = new (Allocator.Allocate<T>()) T(std::forward<ArgTypes>(Args)...);
+    countEvent(Counter::ASTNodes);
+    if (!std::is_trivially_destructible<T>::value)
+      Destructors.emplace_back(Node,
+                               [](void *P) { static_cast<T *>(P)->~T(); });
+    return Node;
+  }
+
+  /// Copy an array into this arena, such as the arguments of a call that the
+  /// parser collected in a temporary vector.
+  ///
+  /// @param Elements the elements to copy
+  /// @return the copied elements, which live as long as this arena does
+  template <typename T> llvm::ArrayRef<T> copy(llvm::ArrayRef<T> Elements) {
+    static_assert(std::is_trivially_copyable<T>::value &&
+                      std::is_trivially_destructible<T>::value,
+                  "arrays in an ASTArena are never destroyed");
+    T *Copy = Allocator.Allocate<T>(Elements.size());
+    std::uninitialized_copy(Elements.begin(), Elements.end(), Copy);
+    return llvm::makeArrayRef(Copy, Elements.size());
+  }
+};
+
+#endif // ASTARENA_H
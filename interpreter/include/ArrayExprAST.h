@@ -0,0 +1,61 @@
+#include "ExprAST.h"
+
+#ifndef ARRAYEXPRAST_H
+#define ARRAYEXPRAST_H
+
+/// ArrayExprAST - Expression class for making a new array, which is what a
+/// variable declared like "let a[n] in ..." is initialized with.
+///
+/// This AST node holds the expression for the number of elements, which is
+/// rounded toward zero. Every element starts out as 0. The array lives on the
+/// stack until the let/in expression declaring it is done. An ArrayExprAST is
+/// only ever made as the initializer of a variable in a LetExprAST, since an
+/// array is not a value that an expression can evaluate to.
+class ArrayExprAST : public ExprAST {
+  /// The number of elements.
+  ExprAST *Size;
+
+public:
+  /// The constructor for the ArrayExprAST class.
+  ///
+  /// @param Size the expression for the number of elements
+  explicit ArrayExprAST(ExprAST *Size);
+
+  /// Generate LLVM IR for allocating the array, returning the pointer to its
+  /// first element.
+  llvm::Value *codegen() override;
+
+  /// An array cannot be made without generating LLVM IR, since the
+  /// interpreter only knows about doubles, so this logs an error.
+  llvm::Optional<double> evaluate() override;
+
+  /// Return a helpful string representation of this ArrayExprAST useful for
+  /// debugging.
+  ///
+  /// @param depth the level of indentation to print this ArrayExprAST at,
+  ///              useful for pretty-printing (may be ignored by implementation)
+  /// @return a string of the form "ArrayExprAST(%s)", where %s is the string
+  ///         representation of the number of elements
+  std::string toString(const unsigned depth = 0) const override;
+
+  /// Generate LLVM IR for allocating an array with the given number of
+  /// elements, all set to 0, in the current stack frame.
+  ///
+  /// @param Size the number of elements, which has not been rounded yet
+  /// @return the pointer to the first element
+  static llvm::Value *codegenAllocation(llvm::Value *Size);
+
+  /// Generate LLVM IR for remembering how big the stack is, before allocating
+  /// arrays on it.
+  ///
+  /// @return the saved stack pointer
+  static llvm::Value *codegenStackSave();
+
+  /// Generate LLVM IR for freeing every array allocated since the stack was
+  /// saved.
+  ///
+  /// @param SavedStack what codegenStackSave returned
+  static void codegenStackRestore(llvm::Value *SavedStack);
+};
+
+#endif // ARRAYEXPRAST_H
@@ -11,7 +11,7 @@ class BinaryExprAST : public ExprAST {
   /// The particular operator.
   char Op;
   /// The two operands of the binary operator.
-  std::unique_ptr<ExprAST> LHS, RHS;
+  ExprAST *LHS, *RHS;
 
 public:
   /// The constructor for the BinaryExprAST class. This constuctor takes in
@@ -21,12 +21,23 @@ public:
   /// @param op the binary operator
   /// @param LHS the left-hand-side of the binary operator
   /// @param RHS the right-hand-side of the binary operator
-  BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS,
-                std::unique_ptr<ExprAST> RHS);
+  BinaryExprAST(char op, ExprAST *LHS, ExprAST *RHS);
+
+  /// Get the binary operator.
+  char getOp() const;
+
+  /// Get the left-hand side of the binary operator.
+  ExprAST *getLHS() const;
+
+  /// Get the right-hand side of the binary operator.
+  ExprAST *getRHS() const;
 
   /// Generate LLVM IR for a binary expression.
   llvm::Value *codegen() override;
 
+  /// Evaluate a binary expression without generating LLVM IR.
+  llvm::Optional<double> evaluate() override;
+
   /// Return a helpful string representation of this BinaryExprAST, useful
   /// for debugging.
   ///
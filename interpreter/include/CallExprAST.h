@@ -1,3 +1,5 @@
+#include <llvm/ADT/ArrayRef.h> // llvm::ArrayRef
+
 #include "ExprAST.h"
 
 #ifndef CALLEXPRAST_H
@@ -9,9 +11,10 @@
 /// the arguments being passed.
 class CallExprAST : public ExprAST {
   /// The function being called.
-  std::string Callee;
-  /// The values passed to the function call.
-  std::vector<std::unique_ptr<ExprAST>> Args;
+  Symbol Callee;
+  /// The values passed to the function call, stored in the same ASTArena as
+  /// this node.
+  llvm::ArrayRef<ExprAST *> Args;
 
 public:
   /// The constructor for the CallExprAST class. This constuctor accepts the
@@ -19,13 +22,16 @@ public:
   /// passed to the function.
   ///
   /// @param Callee the name of the function being called
-  /// @param Args the arguments passed to the function
-  CallExprAST(const std::string &Callee,
-              std::vector<std::unique_ptr<ExprAST>> Args);
+  /// @param Args the arguments passed to the function, which have to outlive
+  ///        this node (see ASTArena::copy)
+  CallExprAST(Symbol Callee, llvm::ArrayRef<ExprAST *> Args);
 
   /// Generate LLVM IR for a function call.
   llvm::Value *codegen() override;
 
+  /// Evaluate a function call without generating LLVM IR.
+  llvm::Optional<double> evaluate() override;
+
   /// Return a helpful string representation of this CallExprAST node
   /// useful for debugging.
   ///
@@ -36,6 +42,14 @@ public:
   ///         and %2$s, %3$s, ..., %n$s are the string representations of the
   ///         arguments being passed to this function call
   std::string toString(const unsigned depth = 0) const override;
+
+  /// Log the error for passing something other than the name of an array
+  /// variable to an array parameter.
+  ///
+  /// @param Callee the name of the function being called
+  /// @param Index the index of the parameter
+  /// @return nullptr
+  static llvm::Value *logArrayArgumentError(Symbol Callee, unsigned Index);
 };
 
 #endif // CALLEXPRAST_H
@@ -0,0 +1,105 @@
+#include <llvm/ADT/DenseMap.h>         // llvm::DenseMap
+#include <llvm/ADT/DenseSet.h>         // llvm::DenseSet
+#include <llvm/IR/IRBuilder.h>         // llvm::IRBuilder
+#include <llvm/IR/Instructions.h>      // llvm::AllocaInst
+#include <llvm/IR/LLVMContext.h>       // llvm::LLVMContext
+#include <llvm/IR/Module.h>            // llvm::Module
+#include <llvm/Support/MemoryBuffer.h> // llvm::MemoryBuffer
+#include <llvm/Target/TargetMachine.h> // llvm::TargetMachine
+
+#include <cstddef>       // std::size_t
+#include <memory>        // std::unique_ptr
+#include <string>        // std::string
+#include <unordered_map> // std::unordered_map
+#include <vector>        // std::vector
+
+#include "ASTArena.h"
+#include "Optimizer.h"
+#include "PrototypeAST.h"
+#include "Symbol.h"
+
+#ifndef COMPILATIONCONTEXT_H
+#define COMPILATIONCONTEXT_H
+
+/// CompilationContext - Everything the front-end keeps track of while it turns
+/// one stream of source code into LLVM IR: where the lexer is in its input,
+/// the operator precedences and node arena of the parser, and the LLVM
+/// context, builder, module and variables in scope that code generation works
+/// with.
+///
+/// The lexer, the parser and every ExprAST work on the current context of the
+/// thread they run on. That is the interpreter's own context unless a Scope
+/// says otherwise, so a thread can compile a source file of its own while
+/// other threads compile theirs, as long as no two threads share a context.
+struct CompilationContext {
+  // The lexer.
+
+  /// The file being lexed, when not lexing standard input.
+  std::unique_ptr<llvm::MemoryBuffer> InputBuffer;
+  /// The first character of InputBuffer that has not been lexed yet.
+  const char *BufferPtr = nullptr;
+  /// The last character read from standard input.
+  int LastChar = ' ';
+  /// The token the parser is looking at.
+  int CurTok = 0;
+  std::string IdentifierStr; // Filled in if tok_identifier
+  Symbol IdentifierSymbol;   // Filled in if tok_identifier
+  double NumVal = 0;         // Filled in if tok_number
+  /// Where the tokens being recorded are written, or nullptr.
+  std::string *TokenText = nullptr;
+  /// Where the current token starts in TokenText.
+  std::size_t CurTokStart = 0;
+
+  // The parser.
+
+  /// The precedence of each binary operator that is defined.
+  std::unordered_map<char, int> BinopPrecedence;
+  /// The arena that the top-level item being parsed makes its nodes in.
+  std::unique_ptr<ASTArena> Arena;
+
+  // Code generation. Every module gets an LLVM context of its own so that
+  // the JIT can compile modules on different threads at the same time.
+
+  std::unique_ptr<llvm::LLVMContext> Context;
+  std::unique_ptr<llvm::IRBuilder<>> Builder;
+  std::unique_ptr<llvm::Module> Module;
+  llvm::DenseMap<Symbol, llvm::AllocaInst *> NamedValues;
+  llvm::DenseMap<Symbol, double> EvaluatedValues;
+  llvm::DenseMap<Symbol, std::unique_ptr<PrototypeAST>> FunctionProtos;
+  /// The functions known to be pure, see SetFunctionPurity.
+  llvm::DenseSet<Symbol> PureFunctions;
+  /// The functions called by the function whose IR is being generated, see
+  /// RecordCall.
+  llvm::DenseSet<Symbol> CalledFunctions;
+  /// The target machine FunctionOptimizer was made for, when the context
+  /// has one of its own.
+  std::unique_ptr<llvm::TargetMachine> TM;
+  /// Unlike a legacy FunctionPassManager, the optimizer is not bound to a
+  /// module, so the same one serves every module the context makes.
+  std::unique_ptr<Optimizer> FunctionOptimizer;
+
+  /// Where LogError collects the errors reported while this context is
+  /// current, or nullptr to have them printed to standard error.
+  std::vector<std::string> *Errors = nullptr;
+
+  /// The constructor for the CompilationContext class, which starts out with
+  /// nothing lexed, no operators defined and no module.
+  CompilationContext();
+
+  /// Get the context the front-end works on in the calling thread.
+  static CompilationContext &getCurrent();
+
+  /// Scope - Makes a context the current one of the calling thread for as
+  /// long as the scope lives, and then puts the previous one back.
+  class Scope {
+    CompilationContext *Previous;
+
+  public:
+    explicit Scope(CompilationContext &Current);
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope();
+  };
+};
+
+#endif // COMPILATIONCONTEXT_H
@@ -0,0 +1,51 @@
+#include <llvm/ExecutionEngine/ObjectCache.h> // llvm::ObjectCache
+#include <llvm/IR/Module.h>                  // llvm::Module
+#include <llvm/Support/MemoryBuffer.h> // llvm::MemoryBuffer, llvm::MemoryBufferRef
+#include <llvm/Target/TargetMachine.h> // llvm::TargetMachine
+
+#include <memory> // std::unique_ptr
+#include <string> // std::string
+
+#ifndef DISKOBJECTCACHE_H
+#define DISKOBJECTCACHE_H
+
+/// DiskObjectCache - An object cache that keeps compiled modules in a directory
+/// so that they outlive the process.
+///
+/// Each object file is named after a hash of the IR of the module it was
+/// compiled from together with the target it was compiled for, so an unchanged
+/// definition compiled for the same machine is only ever compiled once, and a
+/// changed one simply misses the cache.
+class DiskObjectCache : public llvm::ObjectCache {
+  /// The directory holding the cached object files.
+  std::string CacheDir;
+  /// The target triple, CPU, and features that objects are compiled for, all
+  /// of which have to match for a cached object to be usable.
+  std::string TargetKey;
+
+  /// Get the path of the cached object file for the given module.
+  ///
+  /// @param M the module to look up
+  /// @return the path that the module's object file is stored at
+  std::string getCachePath(const llvm::Module &M) const;
+
+public:
+  /// The constructor for the DiskObjectCache class. The cache directory is
+  /// created the first time an object is stored in it.
+  ///
+  /// @param CacheDir the directory to keep object files in
+  /// @param TM the target machine that objects will be compiled with
+  DiskObjectCache(std::string CacheDir, const llvm::TargetMachine &TM);
+
+  /// Store the object file that was just compiled from the given module.
+  /// Failing to write it is not an error: the module is just compiled again
+  /// next time.
+  void notifyObjectCompiled(const llvm::Module *M,
+                            llvm::MemoryBufferRef Obj) override;
+
+  /// Load the object file previously compiled from a module with the same IR,
+  /// or return nullptr if there is none.
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override;
+};
+
+#endif // DISKOBJECTCACHE_H
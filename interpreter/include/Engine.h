@@ -0,0 +1,241 @@
+#include <llvm/ADT/ArrayRef.h>              // llvm::ArrayRef
+#include <llvm/ADT/StringRef.h>             // llvm::StringRef
+#include <llvm/ExecutionEngine/JITSymbol.h> // llvm::JITTargetAddress
+#include <llvm/ExecutionEngine/Orc/Core.h>  // llvm::orc::SymbolNameSet, llvm::orc::SymbolStringPtr
+#include <llvm/ExecutionEngine/Orc/LLJIT.h> // llvm::orc::LLJIT, llvm::orc::JITDylib
+#include <llvm/Support/Error.h>             // llvm::Error, llvm::Expected
+
+#include <atomic>      // std::atomic
+#include <cstdint>     // std::uint64_t, std::uintptr_t
+#include <memory>      // std::shared_ptr, std::unique_ptr
+#include <mutex>       // std::mutex
+#include <string>      // std::string
+#include <type_traits> // std::is_same
+#include <vector>      // std::vector
+
+#include "CompilationContext.h"
+#include "JITMemoryPool.h"
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+class Session;
+
+/// Engine - Compiles Kaleidoscope code for a program that embeds the
+/// interpreter, instead of reading it from standard input.
+///
+/// An engine owns one JIT, and with it one execution session and one pool of
+/// compile threads, which every Session made with createSession shares. The
+/// sessions are isolated from each other and from the interpreter: each one
+/// has a JITDylib and a CompilationContext of its own, so it only sees the
+/// functions and operators defined in it, and different sessions can compile
+/// code on different threads at the same time.
+///
+/// An engine has to outlive its sessions and the functions they compile. The
+/// native target has to be initialized before creating one.
+class Engine {
+  /// The memory compiled code is loaded into, which has to outlive the JIT.
+  std::unique_ptr<JITMemoryPool> Pool;
+  std::unique_ptr<llvm::orc::LLJIT> J;
+  /// The JITDylib that finds the functions of the host process, which every
+  /// session links against.
+  llvm::orc::JITDylib &Host;
+  unsigned OptLevel;
+  /// The number of sessions made so far, which names the next session.
+  std::atomic<unsigned> NumSessions{0};
+  /// The number of modules added so far, which is the key of the next one.
+  std::atomic<std::uint64_t> NumModules{0};
+  /// Guards FreeDylibs.
+  std::mutex FreeDylibsLock;
+  /// The JITDylibs of the sessions destroyed so far, emptied for the next
+  /// sessions to use, since LLVM cannot destroy a JITDylib.
+  std::vector<llvm::orc::JITDylib *> FreeDylibs;
+
+  Engine(std::unique_ptr<JITMemoryPool> Pool,
+         std::unique_ptr<llvm::orc::LLJIT> J, llvm::orc::JITDylib &Host,
+         unsigned OptLevel);
+
+  friend class Session;
+
+public:
+  /// Settings that control how an engine compiles code.
+  struct Options {
+    /// The number of threads shared by every session to compile modules on.
+    /// With 0, code is compiled on the thread that asks for it.
+    unsigned NumCompileThreads = 0;
+    /// The optimization level, from 0 (no optimization at all) to 3.
+    unsigned OptLevel = 2;
+  };
+
+  /// Make an engine for the CPU of the host machine.
+  ///
+  /// @param Opts how the engine compiles code
+  /// @return the engine, or an error if a JIT could not be made
+  static llvm::Expected<std::unique_ptr<Engine>> create(const Options &Opts);
+
+  Engine(const Engine &) = delete;
+  Engine &operator=(const Engine &) = delete;
+  ~Engine();
+
+  /// Make a new session that starts out with just the built-in operators and
+  /// the functions of the host process. This is safe to call from any thread.
+  ///
+  /// @return the session, or an error if it could not be made
+  llvm::Expected<std::unique_ptr<Session>> createSession();
+
+  /// The number of bytes of memory the code compiled by every session takes
+  /// up right now. This is safe to call from any thread.
+  std::uint64_t getCodeBytesInUse() const;
+};
+
+/// CompiledCode - The code of one expression compiled by a Session, which is
+/// taken out of the session and freed when this is destroyed.
+class CompiledCode {
+  Session &S;
+  /// The name the function is defined by in the session.
+  llvm::orc::SymbolStringPtr Name;
+  /// The key of the module the function was compiled from.
+  std::uint64_t Module;
+  llvm::JITTargetAddress Address;
+
+  CompiledCode(Session &S, llvm::orc::SymbolStringPtr Name,
+               std::uint64_t Module, llvm::JITTargetAddress Address);
+
+  friend class Session;
+
+public:
+  CompiledCode(const CompiledCode &) = delete;
+  CompiledCode &operator=(const CompiledCode &) = delete;
+  ~CompiledCode();
+
+  /// Get the address of the compiled function.
+  llvm::JITTargetAddress getAddress() const { return Address; }
+};
+
+/// CompiledFunction - A function compiled by Session::compile, which is
+/// called like the plain function pointer it holds.
+///
+/// Copies share the compiled code, which is freed along with the last of
+/// them, so the function can only be called while a copy is around. Every
+/// copy has to be gone before the session that compiled it is destroyed.
+template <typename... ArgTs> class CompiledFunction {
+public:
+  using Pointer = double (*)(ArgTs...);
+
+  /// The constructor for the CompiledFunction class.
+  ///
+  /// @param Code the code of the function
+  explicit CompiledFunction(std::shared_ptr<const CompiledCode> Code)
+      : Code(std::move(Code)),
+        Address(reinterpret_cast<Pointer>(
+            static_cast<std::uintptr_t>(this->Code->getAddress()))) {}
+
+  /// Call the compiled function.
+  double operator()(ArgTs... Args) const { return Address(Args...); }
+
+  /// Get the compiled function, which can only be called while this or a
+  /// copy of it is around.
+  Pointer get() const { return Address; }
+
+private:
+  std::shared_ptr<const CompiledCode> Code;
+  Pointer Address;
+};
+
+/// Session - One isolated set of definitions in an Engine, which expressions
+/// can be compiled against.
+///
+/// A session can be used from any thread, but compiles one thing at a time.
+/// The functions it hands out are native code that any number of threads
+/// can call at once, and which is freed once the last copy of the function
+/// is destroyed. What the session loaded is freed along with the session,
+/// which has to outlive the functions it compiled.
+class Session {
+  Engine &E;
+  llvm::orc::JITDylib &JD;
+  /// Guards everything below, which only one thread can compile with at a
+  /// time.
+  std::mutex Lock;
+  CompilationContext Context;
+  /// The number of expressions compiled so far, which names the next one.
+  unsigned NumExpressions = 0;
+  /// What every module that was loaded defines in JD.
+  llvm::orc::SymbolNameSet LoadedSymbols;
+  /// The keys of the modules that were loaded.
+  std::vector<std::uint64_t> LoadedModules;
+
+  Session(Engine &E, llvm::orc::JITDylib &JD,
+          std::unique_ptr<llvm::TargetMachine> TM);
+
+  friend class Engine;
+  friend class CompiledCode;
+
+  /// Tag the current module with the key of a new module, and get the
+  /// mangled names of what it defines.
+  ///
+  /// @param Key set to the key of the module
+  /// @return the names of the symbols the module defines
+  llvm::orc::SymbolNameSet tagModule(std::uint64_t &Key);
+
+  /// Take a compiled expression out of the session and free its code.
+  ///
+  /// @param Name the name the expression's function is defined by
+  /// @param Module the key of the module it was compiled from
+  void release(llvm::orc::SymbolStringPtr Name, std::uint64_t Module);
+
+  /// Whether every type in ArgTs is double.
+  template <typename... ArgTs> static constexpr bool areDoubles() {
+    const bool IsDouble[] = {true, std::is_same<ArgTs, double>::value...};
+    for (bool B : IsDouble)
+      if (!B)
+        return false;
+    return true;
+  }
+
+  /// Compile Expression into a function taking Params, returning its code.
+  llvm::Expected<std::shared_ptr<const CompiledCode>>
+  compileFunction(llvm::StringRef Expression,
+                  llvm::ArrayRef<std::string> Params);
+
+public:
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+  /// Free everything the session loaded, and give its JITDylib back to the
+  /// engine.
+  ~Session();
+
+  /// Compile every function definition and extern declaration in Source,
+  /// which can be called from the expressions and definitions compiled in
+  /// this session afterwards. Either all of Source is compiled, or none of it
+  /// is. A function can only be defined once per session.
+  ///
+  /// @param Source the source code of the definitions
+  /// @return an error describing everything wrong with Source, if anything is
+  llvm::Error load(llvm::StringRef Source);
+
+  /// Compile a single expression into a function. The expression can use the
+  /// parameters by name, and call every function loaded into this session.
+  ///
+  /// @tparam ArgTs the types of the parameters, which all have to be double
+  /// @param Expression the source code of the expression
+  /// @param Params the names of the parameters, one for each of ArgTs
+  /// @return the compiled function, or an error describing what is wrong
+  ///         with the expression
+  template <typename... ArgTs>
+  llvm::Expected<CompiledFunction<ArgTs...>>
+  compile(llvm::StringRef Expression, llvm::ArrayRef<std::string> Params = {}) {
+    static_assert(areDoubles<ArgTs...>(),
+                  "Kaleidoscope functions only take doubles");
+    if (Params.size() != sizeof...(ArgTs))
+      return llvm::make_error<llvm::StringError>(
+          "Expected " + std::to_string(sizeof...(ArgTs)) +
+              " parameter names but got " + std::to_string(Params.size()),
+          llvm::inconvertibleErrorCode());
+    auto Code = compileFunction(Expression, Params);
+    if (!Code)
+      return Code.takeError();
+    return CompiledFunction<ArgTs...>(std::move(*Code));
+  }
+};
+
+#endif // ENGINE_H
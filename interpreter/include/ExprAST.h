@@ -1,17 +1,25 @@
+#include <llvm/ADT/DenseMap.h> // llvm::DenseMap
+#include <llvm/ADT/Optional.h> // llvm::Optional
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h> // llvm::orc::ThreadSafeModule
 #include <llvm/IR/IRBuilder.h>         // llvm::IRBuilder
 #include <llvm/IR/LLVMContext.h>       // llvm::LLVMContext
-#include <llvm/IR/LegacyPassManager.h> // llvm::legacy::FunctionPassManager
 #include <llvm/IR/Module.h>            // llvm::Module
 
-#include <unordered_map> // std::unordered_map
+#include <memory> // std::unique_ptr
 
 #include "PrototypeAST.h"
+#include "Symbol.h"
 #include "util.h" // Showable
 
 #ifndef EXPRAST_H
 #define EXPRAST_H
 
+class Optimizer;
+
 /// ExprAST - Base class for all expression nodes.
+///
+/// Expression nodes are made in an ASTArena, which owns them. A node's
+/// children are plain pointers to nodes in the same arena.
 class ExprAST : public Showable {
 public:
   /// The destructor for the ExprAST class. Since the ExprAST class is just an
@@ -21,22 +29,33 @@ public:
 
   /// Generate LLVM IR for this AST node and all dependent AST nodes.
   virtual llvm::Value *codegen() = 0;
+
+  /// Evaluate this AST node and all dependent AST nodes directly, without
+  /// generating any LLVM IR.
+  ///
+  /// @return the value of this expression, or nothing if it could not be
+  ///         evaluated
+  virtual llvm::Optional<double> evaluate() = 0;
 };
 
-// Global variables used by subclasses of ExprAST.
+// The state used by subclasses of ExprAST, which belongs to the current
+// CompilationContext of the calling thread.
 llvm::LLVMContext &getContext();
 llvm::IRBuilder<> &getBuilder();
 
 llvm::Module &borrowModule();
 void newModule(const char *newModuleName);
-std::unique_ptr<llvm::Module> takeModule();
+llvm::orc::ThreadSafeModule takeModule();
 
-std::unordered_map<std::string, llvm::AllocaInst *> &getNamedValues();
+// The variables in scope and the known function prototypes are keyed by
+// Symbol, so saving and restoring a variable that a loop or let shadows never
+// touches the characters of its name.
+llvm::DenseMap<Symbol, llvm::AllocaInst *> &getNamedValues();
+llvm::DenseMap<Symbol, double> &getEvaluatedValues();
 
-llvm::legacy::FunctionPassManager *getFunctionPassManager();
-void resetFunctionPassManager();
+Optimizer *getOptimizer();
+void setOptimizer(std::unique_ptr<Optimizer> NewOptimizer);
 
-std::unordered_map<std::string, std::unique_ptr<PrototypeAST>> &
-getFunctionProtos();
+llvm::DenseMap<Symbol, std::unique_ptr<PrototypeAST>> &getFunctionProtos();
 
 #endif // EXPRAST_H
@@ -0,0 +1,232 @@
+#include <llvm/ADT/ArrayRef.h> // llvm::ArrayRef
+#include <llvm/ADT/Optional.h> // llvm::Optional
+#include <llvm/IR/Function.h>  // llvm::Function
+#include <llvm/IR/Value.h>     // llvm::Value
+
+#include <cstddef>       // std::nullptr_t
+#include <cstdint>       // std::uint8_t, std::uint32_t
+#include <memory>        // std::unique_ptr
+#include <string>        // std::string
+#include <utility>       // std::pair
+#include <vector>        // std::vector
+
+#include "PrototypeAST.h"
+#include "Symbol.h"
+#include "util.h" // Showable
+
+#ifndef FLATAST_H
+#define FLATAST_H
+
+/// FlatAST - A function definition whose body is stored as one flat array of
+/// nodes instead of a tree of ExprAST objects.
+///
+/// Every node is 16 bytes: an opcode saying which kind of expression it is,
+/// and up to three 32-bit operands that are indices of child nodes or of
+/// entries in the side tables. Number literals and the children of nodes that
+/// have more than three go in those side tables, while names are stored as the
+/// IDs of their symbols. Children always
+/// come before their parents, since the parser makes them first, so walking
+/// the whole body is a linear scan over the array. Generating LLVM IR and
+/// evaluating a node is a switch over its opcode rather than a virtual call.
+///
+/// The parser builds a FlatAST directly through the methods that make nodes,
+/// see ParseDefinitionFlat and ParseTopLevelExprFlat.
+class FlatAST : public Showable {
+public:
+  /// A reference to a node of a FlatAST, which is its index in the node
+  /// array. A default-constructed Ref, or one made from nullptr, refers to no
+  /// node at all.
+  class Ref {
+    static constexpr std::uint32_t None = ~std::uint32_t(0);
+    std::uint32_t Index = None;
+
+  public:
+    Ref() = default;
+    Ref(std::nullptr_t) {}
+    explicit Ref(std::uint32_t Index) : Index(Index) {}
+
+    /// Whether this refers to a node.
+    explicit operator bool() const { return Index != None; }
+
+    /// The index of the node in the node array.
+    std::uint32_t getIndex() const { return Index; }
+  };
+
+  /// The type of node the parser makes when building a FlatAST.
+  using Expr = Ref;
+
+  /// The kind of expression a node is, one for each subclass of ExprAST.
+  enum class Opcode : std::uint8_t {
+    Number,
+    Variable,
+    Unary,
+    Binary,
+    Call,
+    If,
+    For,
+    ParallelFor,
+    Let,
+    Index,
+    Array
+  };
+
+private:
+  /// A single expression. What the operands are depends on the opcode:
+  ///
+  ///         Number:   the literal's index in Numbers
+  ///         Variable: the ID of the variable's symbol
+  ///         Unary:    the operand
+  ///         Binary:   the left-hand and right-hand sides
+  ///         Call:     the ID of the callee's symbol, then where the arguments
+  ///                   start in Children and how many there are
+  ///         If:       the condition, then-clause, and else-clause
+  ///         For:      the ID of the variable's symbol, then where the start,
+  ///                   end, step, and body start in Children
+  ///         ParallelFor: like For, with the bound in place of the end
+  ///         Let:      the body, then where the bindings start in Children
+  ///                   and how many there are. Each binding takes two
+  ///                   entries, the ID of the variable's symbol followed by
+  ///                   its initializer
+  ///         Index:    the ID of the array's symbol, then the index
+  ///         Array:    the number of elements
+  ///
+  /// Optional children, like the step of a for expression, are stored as the
+  /// index of no node at all.
+  struct Node {
+    Opcode Op;
+    /// The operator of a Unary or Binary node.
+    char Operator;
+    std::uint32_t Operands[3];
+  };
+
+  static_assert(sizeof(Node) == 16, "FlatAST nodes should stay small");
+
+  /// Every node of the body, children before their parents.
+  std::vector<Node> Nodes;
+  /// The children of nodes that have more than fit in their operands.
+  std::vector<std::uint32_t> Children;
+  /// The number literals in the body.
+  std::vector<double> Numbers;
+
+  /// The prototype of this function definition.
+  std::unique_ptr<PrototypeAST> Proto;
+  /// The root of the body.
+  Ref Body;
+  /// Whether the body only calls pure functions.
+  bool Pure = false;
+  /// Whether the body is pure and refers to no variables.
+  bool Constant = false;
+
+  /// Add a node to the end of the node array.
+  ///
+  /// @return a reference to the new node
+  Ref addNode(Opcode Op, char Operator, std::uint32_t Operand0,
+              std::uint32_t Operand1 = 0, std::uint32_t Operand2 = 0);
+
+  /// Get the node a reference refers to.
+  const Node &getNode(Ref N) const { return Nodes[N.getIndex()]; }
+
+  /// Generate LLVM IR for a node of the body and all of its children.
+  llvm::Value *codegenNode(Ref N) const;
+
+  /// Evaluate a node of the body and all of its children without generating
+  /// any LLVM IR.
+  llvm::Optional<double> evaluateNode(Ref N) const;
+
+  /// Return the same string representation of a node that the matching
+  /// ExprAST would give.
+  std::string nodeToString(Ref N, const unsigned depth) const;
+
+public:
+  /// Make a number literal node.
+  Ref number(double Val);
+
+  /// Make a variable reference node.
+  Ref variable(Symbol Name);
+
+  /// Make a unary operator node.
+  Ref unary(char Op, Ref Operand);
+
+  /// Make a binary operator node.
+  Ref binary(char Op, Ref LHS, Ref RHS);
+
+  /// Make a function call node.
+  Ref call(Symbol Callee, llvm::ArrayRef<Ref> Args);
+
+  /// Make an if/then/else node.
+  Ref ifExpr(Ref Cond, Ref Then, Ref Else);
+
+  /// Make a for loop node. Step may refer to no node, in which case the
+  /// variable is incremented by 1.
+  Ref forExpr(Symbol VarName, Ref Start, Ref End, Ref Step, Ref Body);
+
+  /// Make a parallel for loop node. Step may refer to no node, in which case
+  /// the variable is incremented by 1.
+  Ref parallelFor(Symbol VarName, Ref Start, Ref Bound, Ref Step, Ref Body);
+
+  /// Make a let/in node. An initializer may refer to no node, in which case
+  /// the variable starts out at 0.
+  Ref let(llvm::ArrayRef<std::pair<Symbol, Ref>> VarNames, Ref Body);
+
+  /// Make an array element node.
+  Ref index(Symbol Array, Ref Index);
+
+  /// Make a node making a new array, which can only be the initializer of a
+  /// variable in a let/in node.
+  Ref array(Ref Size);
+
+  /// Get the value of a node if it is a number literal.
+  ///
+  /// @param N the node
+  /// @return the number, or nothing if the node is anything else
+  llvm::Optional<double> getNumber(Ref N) const;
+
+  /// Finish the function definition once its body has been made.
+  ///
+  /// @param Proto the function prototype for this function definition
+  /// @param Body the root of the body of the function
+  /// @param Pure whether the body only calls pure functions, see
+  ///        SetFunctionPurity
+  /// @param Constant whether the body is also free of variables
+  void define(std::unique_ptr<PrototypeAST> Proto, Ref Body,
+              bool Pure = false, bool Constant = false);
+
+  /// Get the prototype of this function definition.
+  const PrototypeAST &getProto() const;
+
+  /// Get the number of nodes in the body.
+  std::size_t size() const { return Nodes.size(); }
+
+  /// Whether this function takes or makes any arrays, which the interpreter
+  /// cannot handle.
+  bool usesArrays() const;
+
+  /// Whether this function only calls pure functions, just like
+  /// FunctionAST::isPure.
+  bool isPure() const { return Pure; }
+
+  /// Whether the body always evaluates to the same value, just like
+  /// FunctionAST::isConstant.
+  bool isConstant() const { return Constant; }
+
+  /// Generate LLVM IR for this function definition, just like
+  /// FunctionAST::codegen does.
+  llvm::Function *codegen() const;
+
+  /// Evaluate the body of this function directly, just like
+  /// FunctionAST::evaluate does.
+  ///
+  /// @param Args the values of the parameters, one for each parameter of the
+  ///        prototype
+  /// @return the value the body evaluates to, or nothing if it could not be
+  ///         evaluated
+  llvm::Optional<double> evaluate(llvm::ArrayRef<double> Args) const;
+
+  /// Return the same string representation that a FunctionAST with the same
+  /// prototype and body would give.
+  ///
+  /// @param depth the level of indentation to print this FlatAST at
+  std::string toString(const unsigned depth = 0) const override;
+};
+
+#endif // FLATAST_H
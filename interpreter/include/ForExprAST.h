@@ -1,3 +1,5 @@
+#include <llvm/ADT/STLExtras.h> // llvm::function_ref
+
 #include "ExprAST.h"
 
 #ifndef FOREXPRAST_H
@@ -14,15 +16,14 @@
 /// well as the body of the for loop. This for loop is very similar to C's for
 /// loop, except if the "step" is omitted it is assumed to be 1.
 class ForExprAST : public ExprAST {
-  std::string VarName; ///< The name of the iterator variable, commonly "i"
-  std::unique_ptr<ExprAST> Start; ///< The initializer expression
-  std::unique_ptr<ExprAST> End; ///< The conditional expression that determines
-                                ///< when the for loop will end
-  std::unique_ptr<ExprAST>
-      Step; ///< The value to increment the variable
-            ///< represented by VarName by.
-            ///< If negative, the variable will be decremented.
-  std::unique_ptr<ExprAST> Body; ///< The code contained within the for loop
+  Symbol VarName; ///< The name of the iterator variable, commonly "i"
+  ExprAST *Start; ///< The initializer expression
+  ExprAST *End;   ///< The conditional expression that determines
+                  ///< when the for loop will end
+  ExprAST *Step;  ///< The value to increment the variable
+                  ///< represented by VarName by.
+                  ///< If negative, the variable will be decremented.
+  ExprAST *Body;  ///< The code contained within the for loop
 
 public:
   /// The constructor for the ForExprAST class. A for expression has the
@@ -44,13 +45,15 @@ public:
   /// @param Step AST node of the value that the induction variable will be
   /// incremented by
   /// @param Body the body of the for expression
-  ForExprAST(const std::string &VarName, std::unique_ptr<ExprAST> Start,
-             std::unique_ptr<ExprAST> End, std::unique_ptr<ExprAST> Step,
-             std::unique_ptr<ExprAST> Body);
+  ForExprAST(Symbol VarName, ExprAST *Start, ExprAST *End, ExprAST *Step,
+             ExprAST *Body);
 
   /// Generate LLVM IR for a for expression.
   llvm::Value *codegen() override;
 
+  /// Evaluate a for expression without generating LLVM IR.
+  llvm::Optional<double> evaluate() override;
+
   /// Return a helpful string representation of this ForExprAST node
   /// useful for debugging.
   ///
@@ -64,6 +67,61 @@ public:
   /// %$4s is the string representation of the step amount, if present,
   /// and finally %$5s is the string representation of the body.
   std::string toString(const unsigned depth = 0) const override;
+
+  /// What is known about the parts of a for loop before generating it, which
+  /// decides how simple a loop it can be generated as.
+  struct Shape {
+    /// The value of the initial expression, if it is a number literal.
+    llvm::Optional<double> ConstantStart;
+    /// The value of the step, if it is a number literal or left out.
+    llvm::Optional<double> ConstantStep;
+    /// Whether the condition is the induction variable itself being less
+    /// than a bound, as in "i < n".
+    bool HasUpperBound = false;
+  };
+
+  /// Generate LLVM IR for a for loop whose parts are generated by the given
+  /// callbacks. This is all of what codegen does, so that loops stored some
+  /// other way, like in a FlatAST, are generated the same way.
+  ///
+  /// @param VarName the name of the induction variable
+  /// @param LoopShape what is known about the parts of the loop
+  /// @param GenerateStart generates the initial value, before the induction
+  ///        variable is in scope
+  /// @param GenerateEnd generates the condition, unless the loop can be
+  ///        counted with an integer
+  /// @param GenerateBound generates the bound the induction variable is
+  ///        compared against, which takes the place of the condition when
+  ///        the loop can be counted with an integer
+  /// @param GenerateStep generates the step, unless LoopShape has a
+  ///        ConstantStep
+  /// @param GenerateBody generates the body
+  /// @return 0.0, or nullptr if one of the callbacks failed
+  static llvm::Value *
+  codegenLoop(Symbol VarName, const Shape &LoopShape,
+              llvm::function_ref<llvm::Value *()> GenerateStart,
+              llvm::function_ref<llvm::Value *()> GenerateEnd,
+              llvm::function_ref<llvm::Value *()> GenerateBound,
+              llvm::function_ref<llvm::Value *()> GenerateStep,
+              llvm::function_ref<llvm::Value *()> GenerateBody);
+
+  /// Evaluate a for loop whose parts are evaluated by the given callbacks.
+  /// This is all of what evaluate does, so that loops stored some other way,
+  /// like in a FlatAST, are evaluated the same way.
+  ///
+  /// @param VarName the name of the induction variable
+  /// @param EvaluateStart evaluates the initial value, before the induction
+  ///        variable is in scope
+  /// @param EvaluateEnd evaluates the condition, after every iteration
+  /// @param EvaluateStep evaluates the step, after every iteration
+  /// @param EvaluateBody evaluates the body
+  /// @return 0.0, or nothing if one of the callbacks failed
+  static llvm::Optional<double>
+  evaluateLoop(Symbol VarName,
+               llvm::function_ref<llvm::Optional<double>()> EvaluateStart,
+               llvm::function_ref<llvm::Optional<double>()> EvaluateEnd,
+               llvm::function_ref<llvm::Optional<double>()> EvaluateStep,
+               llvm::function_ref<llvm::Optional<double>()> EvaluateBody);
 };
 
 #endif // FOREXPRAST_H
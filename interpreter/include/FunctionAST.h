@@ -1,3 +1,8 @@
+#include <llvm/ADT/ArrayRef.h> // llvm::ArrayRef
+#include <llvm/ADT/Optional.h> // llvm::Optional
+#include <llvm/ADT/STLExtras.h> // llvm::function_ref
+
+#include "ASTArena.h"
 #include "util.h"
 
 #ifndef FUNCTIONAST_H
@@ -9,7 +14,15 @@ class FunctionAST : public Showable {
   /// The function prototype that represents this function definition.
   std::unique_ptr<PrototypeAST> Proto;
   /// The AST that represents the code for this function definition.
-  std::unique_ptr<ExprAST> Body;
+  ExprAST *Body;
+  /// The arena that Body and everything under it were made in.
+  std::unique_ptr<ASTArena> Arena;
+  /// Whether Body indexes or declares an array anywhere.
+  bool UsesArrays;
+  /// Whether Body only calls pure functions.
+  bool Pure;
+  /// Whether Body is pure and refers to no variables.
+  bool Constant;
 
 public:
   /// The constructor for the FunctionAST class. This constructor takes in the
@@ -17,13 +30,49 @@ public:
   /// code that defines the behavior of the function.
   ///
   /// @param Proto the function prototype for this function definition
-  /// @param the body of the function
-  FunctionAST(std::unique_ptr<PrototypeAST> Proto,
-              std::unique_ptr<ExprAST> Body);
+  /// @param Body the body of the function
+  /// @param Arena the arena the body was made in, which is freed along with
+  ///        this function definition
+  /// @param UsesArrays whether the body indexes or declares an array
+  /// @param Pure whether the body only calls pure functions, see
+  ///        SetFunctionPurity
+  /// @param Constant whether the body is also free of variables
+  FunctionAST(std::unique_ptr<PrototypeAST> Proto, ExprAST *Body,
+              std::unique_ptr<ASTArena> Arena, bool UsesArrays = false,
+              bool Pure = false, bool Constant = false);
+
+  /// Get the prototype of this function definition.
+  const PrototypeAST &getProto() const;
+
+  /// Whether this function definition uses arrays, which only compiled code
+  /// can do.
+  ///
+  /// @return true if the prototype has array parameters or the body indexes
+  ///         or declares an array
+  bool usesArrays() const;
+
+  /// Whether this function only calls pure functions, itself included, as far
+  /// as was known when it was parsed.
+  bool isPure() const;
+
+  /// Whether the body always evaluates to the same value without anything
+  /// else happening, which is when it is pure and refers to no variables, so
+  /// that it can be evaluated while it is being parsed.
+  bool isConstant() const;
 
   /// Generate LLVM IR for a function definition.
   llvm::Function *codegen();
 
+  /// Evaluate the body of this function directly, without generating any LLVM
+  /// IR. The body only sees the function's own parameters, not the variables
+  /// of whoever called it.
+  ///
+  /// @param Args the values of the parameters, one for each parameter of the
+  ///        prototype
+  /// @return the value the body evaluates to, or nothing if it could not be
+  ///         evaluated
+  llvm::Optional<double> evaluate(llvm::ArrayRef<double> Args);
+
   /// Return a helpful string representation of this FunctionAST node useful
   /// for debugging.
   ///
@@ -36,6 +85,30 @@ public:
   ///         prototype, and %2$s is the string representation of this
   ///         FunctionAST's body
   std::string toString(const unsigned depth = 0) const override;
+
+  /// Generate LLVM IR for a function definition with the given prototype and
+  /// a body generated by the given callback. This is everything codegen does
+  /// apart from the body itself, so that bodies stored some other way, like
+  /// a FlatAST, are generated the same way.
+  ///
+  /// @param Proto the function prototype for the function definition
+  /// @param GenerateBody generates the body once the parameters are in
+  ///        NamedValues, returning nullptr if that fails
+  /// @return the generated function, or nullptr if generating it failed
+  static llvm::Function *
+  codegenDefinition(const PrototypeAST &Proto,
+                    llvm::function_ref<llvm::Value *()> GenerateBody);
+
+  /// Evaluate a body evaluated by the given callback in a scope holding just
+  /// the parameters of the given prototype, just like evaluate does.
+  ///
+  /// @param Proto the function prototype for the function definition
+  /// @param Args the values of the parameters
+  /// @param EvaluateBody evaluates the body once the scope is set up
+  /// @return whatever EvaluateBody returned
+  static llvm::Optional<double>
+  evaluateDefinition(const PrototypeAST &Proto, llvm::ArrayRef<double> Args,
+                     llvm::function_ref<llvm::Optional<double>()> EvaluateBody);
 };
 
 #endif // FUNCTIONAST_H
@@ -16,11 +16,10 @@
 /// statement must evaluate to a value, or like a tenrary operator in more
 /// statement-oriented languages like C or Java.
 class IfExprAST : public ExprAST {
-  std::unique_ptr<ExprAST> Cond; ///< The condition to evaluate
-  std::unique_ptr<ExprAST> Then; ///< The expression to evaluate if Cond
-                                 ///< evaluates to a non-zero value
-  std::unique_ptr<ExprAST>
-      Else; ///< The expression to evaluate if Cond evalutates to 0.0
+  ExprAST *Cond; ///< The condition to evaluate
+  ExprAST *Then; ///< The expression to evaluate if Cond
+                 ///< evaluates to a non-zero value
+  ExprAST *Else; ///< The expression to evaluate if Cond evalutates to 0.0
 
 public:
   /// The constructor for the IfExprAST class.
@@ -28,12 +27,14 @@ public:
   /// @param Cond the condition that the if expression evaluates
   /// @param Then the code to evaluate if the condition is true
   /// @param Else the code to evaluate if the condition is false
-  IfExprAST(std::unique_ptr<ExprAST> Cond, std::unique_ptr<ExprAST> Then,
-            std::unique_ptr<ExprAST> Else);
+  IfExprAST(ExprAST *Cond, ExprAST *Then, ExprAST *Else);
 
   /// Generate LLVM IR for an if expression.
   llvm::Value *codegen() override;
 
+  /// Evaluate an if expression without generating LLVM IR.
+  llvm::Optional<double> evaluate() override;
+
   /// Return a helpful string representation of this IfExprAST node
   /// useful for debugging.
   ///
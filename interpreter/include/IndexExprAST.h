@@ -0,0 +1,60 @@
+#include "ExprAST.h"
+
+#ifndef INDEXEXPRAST_H
+#define INDEXEXPRAST_H
+
+/// IndexExprAST - Expression class for an element of an array, like "a[i]".
+///
+/// This AST node holds the name of the array variable and the expression for
+/// the index of the element. The index is rounded toward zero, and is not
+/// checked against the size of the array, just like in C.
+struct IndexExprAST : public ExprAST {
+  /// The name of the array variable.
+  const Symbol Array;
+  /// The index of the element.
+  ExprAST *const Index;
+
+  /// The constructor for the IndexExprAST class.
+  ///
+  /// @param Array the name of the array variable
+  /// @param Index the expression for the index of the element
+  IndexExprAST(Symbol Array, ExprAST *Index);
+
+  /// Generate LLVM IR for loading an element of an array.
+  llvm::Value *codegen() override;
+
+  /// An element of an array cannot be evaluated without generating LLVM IR,
+  /// since the interpreter only knows about doubles, so this logs an error.
+  llvm::Optional<double> evaluate() override;
+
+  /// Return a helpful string representation of this IndexExprAST useful for
+  /// debugging.
+  ///
+  /// @param depth the level of indentation to print this IndexExprAST at,
+  ///              useful for pretty-printing (may be ignored by implementation)
+  /// @return a string of the form "IndexExprAST(%1$s[%2$s])", where %1$s is
+  ///         the name of the array and %2$s is the string representation of
+  ///         the index
+  std::string toString(const unsigned depth = 0) const override;
+
+  /// Generate LLVM IR for loading the pointer to the first element of the
+  /// array variable with the given name, which is also how an array is passed
+  /// to a function.
+  ///
+  /// @param Array the name of the array variable
+  /// @return the pointer, or nullptr if there is no array with that name
+  static llvm::Value *codegenArray(Symbol Array);
+
+  /// Generate LLVM IR for the address of an element of an array, which is
+  /// loaded to read the element and stored to to assign it.
+  ///
+  /// @param Array the name of the array variable
+  /// @param Index the index of the element, which has not been rounded yet
+  /// @return the address, or nullptr if there is no array with that name
+  static llvm::Value *codegenElementAddress(Symbol Array, llvm::Value *Index);
+
+  /// Log the error that the interpreter gives for anything to do with arrays.
+  static llvm::Optional<double> logInterpretedArrayError();
+};
+
+#endif // INDEXEXPRAST_H
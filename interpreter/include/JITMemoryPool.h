@@ -0,0 +1,144 @@
+#include <llvm/ADT/Optional.h>             // llvm::Optional
+#include <llvm/ADT/StringRef.h>            // llvm::StringRef
+#include <llvm/ExecutionEngine/RuntimeDyld.h> // llvm::RuntimeDyld::MemoryManager
+
+#include <cstddef> // std::size_t
+#include <cstdint> // std::uint64_t
+#include <map>     // std::map, std::multimap
+#include <memory>  // std::unique_ptr
+#include <mutex>   // std::mutex
+#include <string>  // std::string
+#include <vector>  // std::vector
+
+#ifndef JITMEMORYPOOL_H
+#define JITMEMORYPOOL_H
+
+/// JITMemoryPool - The memory that the JIT loads compiled code into, carved
+/// out of a few large slabs instead of being mapped anew for every object.
+///
+/// Each object gets a memory manager of its own from the pool, which takes
+/// every section of the object from the pool as it is loaded. Sections of
+/// different objects are packed right next to each other, so an object only
+/// takes up the bytes of its sections, each rounded up to MinAlignment and
+/// aligned as it asks to be, rather than pages of its own.
+///
+/// Code goes into slabs that are mapped twice where the system lets the pool
+/// do that: once writable, which is where the object is written and
+/// relocated, and once executable, which is where the code runs. Neither
+/// mapping ever changes how it is protected, so the code of one object can
+/// run while the next object is being written into the same page. Where a
+/// slab cannot be mapped twice, it is mapped readable, writable and
+/// executable at once instead. Read-only data goes into the writable
+/// slabs along with the rest of the data, since protecting it would take
+/// pages of its own again.
+///
+/// The memory of an object is given back to the pool once the module it was
+/// compiled from is released, and is then reused for the objects loaded
+/// after it. The memory managers themselves are owned by the JIT, which keeps
+/// all of them until it is destroyed, so they have to be destroyed before the
+/// pool.
+class JITMemoryPool {
+public:
+  /// The least alignment, and the granularity, of what the pool hands out.
+  static constexpr std::size_t MinAlignment = 16;
+
+  JITMemoryPool() = default;
+  JITMemoryPool(const JITMemoryPool &) = delete;
+  JITMemoryPool &operator=(const JITMemoryPool &) = delete;
+  ~JITMemoryPool();
+
+  /// Make a memory manager that loads one object into memory from this pool.
+  std::unique_ptr<llvm::RuntimeDyld::MemoryManager> createMemoryManager();
+
+  /// Get the module identifier that lets the pool tell which module the
+  /// objects compiled from a module came from. The JIT names objects after
+  /// their modules, so the tag ends up in the name of every object compiled
+  /// from the module, partitions of it included.
+  ///
+  /// @param Identifier the identifier of the module
+  /// @param Module the key of the module
+  /// @return the identifier to give the module instead
+  static std::string tagModuleIdentifier(llvm::StringRef Identifier,
+                                         std::uint64_t Module);
+
+  /// Get the key of the module an object came from, given the name of the
+  /// object.
+  ///
+  /// @param Name the name of the object
+  /// @return the key the module was tagged with, or nothing if it was not
+  static llvm::Optional<std::uint64_t> getModuleKey(llvm::StringRef Name);
+
+  /// Give the memory of every object compiled from a module back to the pool.
+  /// Nothing may call or refer to the code of the module anymore.
+  ///
+  /// @param Module the key the module was tagged with
+  void release(std::uint64_t Module);
+
+  /// The number of bytes of memory handed out to objects right now.
+  std::uint64_t getBytesInUse() const;
+
+  /// The most bytes of memory that were ever handed out to objects at once.
+  std::uint64_t getHighWaterMark() const;
+
+private:
+  class ObjectMemoryManager;
+
+  /// The kinds of memory the pool hands out, which come from slabs of their
+  /// own since they are mapped differently.
+  enum Kind { Code, Data, NumKinds };
+
+  /// Block - Memory handed out by the pool, or a free range of it.
+  struct Block {
+    /// Where the memory is written.
+    char *Writable = nullptr;
+    /// Where the memory is executed or read by the code, which is the same
+    /// as Writable unless it is code in a slab that is mapped twice.
+    char *Target = nullptr;
+    std::size_t Size = 0;
+  };
+
+  /// Get memory for a section, mapping a slab if none of the free ranges of
+  /// the kind is big enough.
+  ///
+  /// @param K the kind of memory
+  /// @param Size the least number of bytes the memory has to hold
+  /// @param Alignment what the address the code sees has to be aligned to
+  /// @return the memory, or an empty block if no memory could be mapped
+  Block allocate(Kind K, std::size_t Size, unsigned Alignment);
+
+  /// Give memory back, merging it with the free ranges around it.
+  ///
+  /// @param K the kind of memory
+  /// @param Memory a block returned by allocate
+  void free(Kind K, Block Memory);
+
+  /// Map a slab of memory of the given kind, and add it to its free ranges.
+  /// Called with Lock held.
+  ///
+  /// @return whether the memory could be mapped
+  bool mapSlab(Kind K, std::size_t Size);
+
+  /// Remember which module the object loaded by a memory manager was
+  /// compiled from.
+  void addObject(std::uint64_t Module, ObjectMemoryManager &Object);
+
+  /// Forget about the object loaded by a memory manager that is going away.
+  void removeObject(std::uint64_t Module, ObjectMemoryManager &Object);
+
+  /// Guards everything below, since the JIT can load objects on several
+  /// compile threads at once.
+  mutable std::mutex Lock;
+  /// The slabs the pool has mapped, with both of their addresses.
+  std::vector<Block> Slabs[NumKinds];
+  /// Where the last slab ends, which the next one goes right after if it can.
+  char *LastSlabEnd = nullptr;
+  /// The ranges of each kind that are not handed out, by where they are
+  /// written.
+  std::map<char *, Block> FreeRanges[NumKinds];
+  /// The objects compiled from each module that is still loaded.
+  std::multimap<std::uint64_t, ObjectMemoryManager *> Objects;
+  std::uint64_t BytesInUse = 0;
+  std::uint64_t HighWaterMark = 0;
+};
+
+#endif // JITMEMORYPOOL_H
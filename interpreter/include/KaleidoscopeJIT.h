@@ -13,64 +13,256 @@
 #ifndef LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
 #define LLVM_EXECUTIONENGINE_ORC_KALEIDOSCOPEJIT_H
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Optional.h>
 #include <llvm/ADT/STLExtras.h>
-#include <llvm/ADT/iterator_range.h>
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/JITSymbol.h>
 #include <llvm/ExecutionEngine/Orc/CompileUtils.h>
-#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
-#include <llvm/ExecutionEngine/Orc/LambdaResolver.h>
-#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
-#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
-#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/Mangler.h>
 #include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
-#include <algorithm>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "DiskObjectCache.h"
+#include "JITMemoryPool.h"
+#include "PerfMapListener.h"
+#include "Symbol.h"
+
 namespace llvm {
 namespace orc {
 
 class KaleidoscopeJIT {
 public:
-  using ObjLayerT = LegacyRTDyldObjectLinkingLayer;
-  using CompileLayerT = LegacyIRCompileLayer<ObjLayerT, SimpleCompiler>;
+  /// Settings that control how the JIT is built. These must be set with
+  /// setOptions before the first call to getInstance.
+  struct Options {
+    /// The number of threads to compile modules on. With 0, a module is
+    /// compiled on whichever thread first looks up one of its symbols.
+    unsigned NumCompileThreads = 0;
+    /// Whether to compile each function only the first time it is called,
+    /// going through a compile-on-demand stub until then.
+    bool Lazy = false;
+    /// Optimizations to run on a module right before it is compiled, or
+    /// nothing. In lazy mode this means functions that are never called are
+    /// never optimized either.
+    std::function<void(Module &)> Optimize;
+    /// The directory to keep compiled object files in across runs, or empty
+    /// to compile every module from scratch.
+    std::string CacheDir;
+    /// Register compiled code with debuggers through the GDB JIT interface.
+    bool GDBEvents = false;
+    /// Write jitdump files for `perf inject`, if LLVM was built with perf
+    /// support.
+    bool PerfEvents = false;
+    /// Tell Intel VTune about compiled code, if LLVM was built with support
+    /// for it.
+    bool IntelEvents = false;
+    /// Write /tmp/perf-<pid>.map for perf to name compiled functions with.
+    bool PerfMap = false;
+    /// Keep a copy of the objects compiled from each module for as long as
+    /// the module is in the session, for getObjects.
+    bool KeepObjects = false;
+  };
 
   KaleidoscopeJIT(KaleidoscopeJIT &) = delete;
 
   void operator=(const KaleidoscopeJIT &) = delete;
 
+  static void setOptions(const Options &Opts);
+
   static KaleidoscopeJIT *getInstance();
 
   TargetMachine &getTargetMachine();
 
-  VModuleKey addModule(std::unique_ptr<Module> M);
+  const DataLayout &getDataLayout() const;
+
+  /// Whether function bodies are compiled the first time they are called
+  /// instead of when they are added.
+  bool isLazy() const;
+
+  /// Add a module to the session. Any function it defines replaces an earlier
+  /// definition of the same name. When there are compile threads, the module
+  /// starts compiling in the background right away.
+  Expected<VModuleKey> addModule(ThreadSafeModule TSM);
+
+  /// Add several modules to the session at once, like addModule does with
+  /// each of them in turn, except that none of them starts compiling until
+  /// they are all defined. Modules calling each other then get linked against
+  /// each other, rather than against what they supersede. If one of them
+  /// cannot be added, the ones added before it are removed again.
+  ///
+  /// @return the keys of the modules, in the order they were given
+  Expected<std::vector<VModuleKey>>
+  addModules(std::vector<ThreadSafeModule> Modules);
+
+  /// Add a module whose functions implement others under different names, and
+  /// redirect every call to those others to their new implementations. Calls
+  /// go through an indirect stub, made the first time a function is
+  /// redirected, so code that was compiled before, and has the stub's address
+  /// already, ends up calling the new implementation just the same. The
+  /// module is compiled right away, since the stubs need its addresses.
+  ///
+  /// @param TSM the module to add
+  /// @param Impls the name of the function the module defines to implement
+  ///        each redirected function, by the name of the redirected function
+  Expected<VModuleKey>
+  addModuleBehindStubs(ThreadSafeModule TSM,
+                       const StringMap<std::string> &Impls);
 
+  /// Add an object file to the session. Any function it defines replaces an
+  /// earlier definition of the same name, just like with addModule. The
+  /// object is not copied, so its memory has to stay around for as long as
+  /// the JIT does.
+  Expected<VModuleKey> addObject(MemoryBufferRef Obj);
+
+  /// Get the objects compiled from every module that still provides one of
+  /// the wanted symbols, in the order the modules were added, compiling the
+  /// ones that were not compiled yet. A module that cannot be compiled, or
+  /// linked against the rest of the session, is left out. This only works
+  /// with Options::KeepObjects.
+  ///
+  /// @param IsWanted whether a symbol is wanted, by its unmangled name
+  std::vector<MemoryBufferRef>
+  getObjects(function_ref<bool(StringRef)> IsWanted);
+
+  /// Remove a module from the session. The memory its code was loaded into
+  /// is reused, so nothing may call into the module anymore. With event
+  /// listeners, which cannot be told that code is gone, it is kept instead.
   void removeModule(VModuleKey K);
 
-  JITSymbol findSymbol(const std::string Name);
+  /// Get the module or object that the current definition of a function
+  /// came from, without compiling anything.
+  ///
+  /// @param Name the unmangled name of the function
+  /// @return the key of the module, or nothing if the function is not
+  ///         defined by a module, but by the host process or a stub
+  Optional<VModuleKey> getModule(Symbol Name);
+
+  /// Take the current definition of a function out of the session, so that
+  /// code linked from then on cannot find it until it is defined again. Its
+  /// code stays in memory along with the rest of its module.
+  ///
+  /// @param Name the unmangled name of the function
+  Error removeSymbol(Symbol Name);
+
+  /// Whether a module or object still provides the current definition of
+  /// any symbol, rather than only code superseded by later definitions.
+  bool definesSymbols(VModuleKey K) const;
+
+  /// Look up the newest definition of a symbol, falling back on the host
+  /// process. Addresses are remembered until the symbol is redefined or its
+  /// module removed, so looking a symbol up again is a single hash lookup.
+  Expected<JITEvaluatedSymbol> findSymbol(StringRef Name);
+
+  /// Look up a symbol like the overload taking a string does, mangling its
+  /// name only the first time it is looked up with any JIT.
+  Expected<JITEvaluatedSymbol> findSymbol(Symbol Name);
 
 private:
-  KaleidoscopeJIT();
+  explicit KaleidoscopeJIT(const Options &Opts);
+
+  /// Get the name the linker knows the given function by.
+  std::string mangle(StringRef Name) const;
+
+  /// Look up a symbol by the name the linker knows it by.
+  Expected<JITEvaluatedSymbol> findMangledSymbol(SymbolStringPtr Name);
+
+  /// Whether the host process defines the given symbol. Only called by the
+  /// generator that looks symbols up in the host process, from any thread.
+  bool isHostSymbol(const SymbolStringPtr &Name);
+
+  /// Take the current definitions of the given symbols out of the session,
+  /// host process symbols included, so that they can be defined again.
+  Error supersede(const SymbolNameSet &Names);
+
+  /// Kick off materialization of the given symbols without waiting for it.
+  void compileInBackground(const SymbolNameSet &Names);
 
-  std::string mangle(const std::string &Name);
+  /// Remove the given symbols from a JITDylib, waiting for any in-flight
+  /// compilation of them to finish first.
+  Error removeSymbols(JITDylib &JD, const SymbolNameSet &Names);
 
-  JITSymbol findMangledSymbol(const std::string &Name);
+  /// Remove the given symbols from the session, including the function
+  /// bodies kept behind the compile-on-demand stubs in lazy mode.
+  Error removeDefinitions(const SymbolNameSet &Names);
 
-  ExecutionSession ES;
-  std::shared_ptr<SymbolResolver> Resolver;
   std::unique_ptr<TargetMachine> TM;
-  const DataLayout DL;
-  ObjLayerT ObjectLayer;
-  CompileLayerT CompileLayer;
-  std::vector<VModuleKey> ModuleKeys;
+  /// The on-disk object cache, or nullptr. It has to outlive the JIT, which
+  /// holds on to it in its compiler.
+  std::unique_ptr<DiskObjectCache> Cache;
+  /// The listeners told about every object the JIT loads. They have to
+  /// outlive the JIT too. Only PerfMap is owned here, LLVM's own listeners
+  /// are never destroyed.
+  std::unique_ptr<PerfMapListener> PerfMap;
+  std::vector<JITEventListener *> Listeners;
+  /// The memory compiled code is loaded into. The memory managers the JIT
+  /// holds on to get their memory from it, so it has to outlive the JIT.
+  std::unique_ptr<JITMemoryPool> Pool;
+  /// The stubs made by addModuleBehindStubs, or nullptr until the first one.
+  std::unique_ptr<IndirectStubsManager> Stubs;
+  /// The JIT outside of lazy mode, or nullptr.
+  std::unique_ptr<LLJIT> EagerJ;
+  /// The JIT in lazy mode, or nullptr.
+  std::unique_ptr<LLLazyJIT> LazyJ;
+  /// Whichever of EagerJ and LazyJ is in use.
+  LLJIT *J;
+  /// The JITDylib holding every definition made in this session.
+  JITDylib *Session;
+  const bool Concurrent;
+
+  /// The owner of the symbols found in the host process rather than in a
+  /// module.
+  static constexpr VModuleKey HostProcess = ~VModuleKey(0);
+  /// The owner of the indirect stubs that calls are redirected through.
+  static constexpr VModuleKey StubOwner = ~VModuleKey(1);
+
+  /// Where the current definition of a symbol comes from.
+  struct SymbolEntry {
+    /// The module providing the symbol, HostProcess or StubOwner.
+    VModuleKey Owner;
+    /// The symbol's address, or a null symbol until it is first looked up.
+    JITEvaluatedSymbol Resolved;
+  };
+
+  VModuleKey NextModuleKey = 0;
+  /// The symbols each module currently provides.
+  std::map<VModuleKey, SymbolNameSet> ModuleSymbols;
+  /// Every symbol defined by a module, and every symbol looked up so far.
+  DenseMap<SymbolStringPtr, SymbolEntry> Symbols;
+
+  /// Guards KeptObjects, which is filled in on whichever thread compiles a
+  /// module.
+  std::mutex KeptObjectsLock;
+  /// The objects compiled from each module, with Options::KeepObjects.
+  std::map<VModuleKey, std::vector<std::unique_ptr<MemoryBuffer>>> KeptObjects;
+
+  /// Guards HostSymbols, which is filled in on whichever thread is linking.
+  std::mutex HostSymbolsLock;
+  /// Whether the host process defines each symbol it was searched for. A
+  /// symbol that is not there is never searched for again, and one that is
+  /// gets defined in the session by the generator, and has to be taken out
+  /// again if a module redefines it.
+  DenseMap<SymbolStringPtr, bool> HostSymbols;
 
+  static Options TheOptions;
   static std::unique_ptr<KaleidoscopeJIT> TheInstance;
 };
 
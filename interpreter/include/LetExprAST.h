@@ -6,7 +6,8 @@
 /// LetExprAST - A "let"/"in" expression for defining local variables.
 ///
 /// A LetExprAST node contains a vector of pairs mapping variable names
-/// to values and a body that uses those variables.
+/// to values and a body that uses those variables. A variable declared with
+/// a size, like "let a[n] in", is an array, and its value is an ArrayExprAST.
 class LetExprAST : public ExprAST {
   /// All the variable names paired with the values.
   /// For example the let statement
@@ -21,22 +22,24 @@ class LetExprAST : public ExprAST {
   ///   {{"a", NumberExprAST(1)}, {"b", NumberExprAST(2)}}
   ///
   /// for this field.
-  std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+  std::vector<std::pair<Symbol, ExprAST *>> VarNames;
   /// The code after the "in" keyword.
-  std::unique_ptr<ExprAST> Body;
+  ExprAST *Body;
 
 public:
   /// The constructor for the LetExprAST class.
   ///
   /// @param VarNames the variable names and values for the let/in expression
   /// @param Body the body of the let/in expression.
-  LetExprAST(
-      std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames,
-      std::unique_ptr<ExprAST> Body);
+  LetExprAST(std::vector<std::pair<Symbol, ExprAST *>> VarNames,
+             ExprAST *Body);
 
   /// Generate LLVM IR for a let/in expression.
   llvm::Value *codegen() override;
 
+  /// Evaluate a let/in expression without generating LLVM IR.
+  llvm::Optional<double> evaluate() override;
+
   /// Return a helpful string representation of this LetExprAST node
   /// useful for debugging.
   ///
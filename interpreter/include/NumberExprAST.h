@@ -17,9 +17,15 @@ public:
   /// @param Val the numeric value that this node of the AST represents
   explicit NumberExprAST(double Val);
 
+  /// Get the numeric value of this literal.
+  double getValue() const;
+
   /// Generate LLVM IR for a numeric constant.
   llvm::Value *codegen() override;
 
+  /// Evaluate a numeric constant without generating LLVM IR.
+  llvm::Optional<double> evaluate() override;
+
   /// Return a helpful string representation of this NumberExprAST useful
   /// for debugging.
   ///
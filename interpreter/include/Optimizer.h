@@ -0,0 +1,90 @@
+#include <llvm/IR/Function.h>    // llvm::Function
+#include <llvm/IR/Module.h>      // llvm::Module
+#include <llvm/IR/PassManager.h> // llvm::FunctionPassManager, llvm::FunctionAnalysisManager, llvm::ModuleAnalysisManager
+#include <llvm/Passes/PassBuilder.h> // llvm::PassBuilder, llvm::LoopAnalysisManager, llvm::CGSCCAnalysisManager
+#include <llvm/Target/TargetMachine.h> // llvm::TargetMachine
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+/// Optimizer - Runs the optimization pipelines of the new pass manager at one
+/// of the levels -O0 to -O3.
+///
+/// An Optimizer is not tied to any module, so one instance can be kept around
+/// for as many modules as need optimizing. It is not thread-safe, though:
+/// optimizing on several threads at once takes an Optimizer per thread.
+class Optimizer {
+  /// The optimization level all pipelines are built for.
+  llvm::PassBuilder::OptimizationLevel Level;
+
+  /// What builds the pipelines and the analyses they use. It is declared
+  /// before the analysis managers so that it outlives them.
+  llvm::PassBuilder PB;
+
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+
+  /// The pipeline run on every function as soon as it is generated.
+  llvm::FunctionPassManager FunctionPasses;
+
+  /// Forget every analysis result computed so far. Results are cached by the
+  /// address of the IR they describe, which is reused once a module is gone.
+  void clearAnalyses();
+
+public:
+  /// The constructor for the Optimizer class.
+  ///
+  /// @param OptLevel the optimization level, from 0 (no optimization at all)
+  ///        to 3
+  /// @param TM the target machine the optimized code will be compiled for,
+  ///        which lets target-dependent passes like the vectorizers know what
+  ///        the hardware supports. May be nullptr
+  ///
+  /// The vectorizers call the vector math functions of the library set with
+  /// SetVectorLibrary at the time, see mathlib.h.
+  Optimizer(unsigned OptLevel, llvm::TargetMachine *TM);
+
+  /// Optimize a single function: promote allocas to registers, simplify it,
+  /// and from -O2 on vectorize and unroll its loops. Without a whole module
+  /// to look at, this cannot inline anything.
+  ///
+  /// @param F the function to optimize
+  void runOnFunction(llvm::Function &F);
+
+  /// Run the function pipeline on every function defined in the given module.
+  ///
+  /// @param M the module whose functions to optimize
+  void runOnFunctions(llvm::Module &M);
+
+  /// Run the full per-module pipeline on the given module, inliner included.
+  /// At -O0, this only inlines functions marked alwaysinline.
+  ///
+  /// @param M the module to optimize
+  void runOnModule(llvm::Module &M);
+
+  /// Run the pipeline clang runs before writing bitcode for ThinLTO, which
+  /// leaves inlining across modules and most of the loop optimizations to the
+  /// link. At -O0, this only inlines functions marked alwaysinline.
+  ///
+  /// @param M the module to optimize
+  void runThinLTOPreLink(llvm::Module &M);
+
+  /// Inline every call to a function marked alwaysinline in the given module,
+  /// whatever the optimization level.
+  ///
+  /// @param M the module to inline calls in
+  void runAlwaysInliner(llvm::Module &M);
+};
+
+/// Set the optimization level to build Optimizers for.
+///
+/// @param OptLevel the optimization level, from 0 to 3
+void SetOptimizationLevel(unsigned OptLevel);
+
+/// Get the optimization level set with SetOptimizationLevel, which is 2 unless
+/// set otherwise.
+unsigned getOptimizationLevel();
+
+#endif // OPTIMIZER_H
@@ -0,0 +1,149 @@
+#include <llvm/ADT/STLExtras.h> // llvm::function_ref
+#include <llvm/IR/Function.h>   // llvm::Function
+
+#include <cstdint> // std::int64_t
+
+#include "ExprAST.h"
+
+#ifndef PARALLELFOREXPRAST_H
+#define PARALLELFOREXPRAST_H
+
+/// ParallelForExprAST - This class encapsulates the AST node for a for loop
+/// whose iterations are independent of each other, which looks like
+///
+/// parallel for i = 0, i < n in
+/// 	work(i)
+///
+/// and which evaluates to the sum of the values of its body, so that it is a
+/// parallel map and reduce in one.
+///
+/// The loop runs the body for the same values of the induction variable as
+/// the for loop it is written like: the start, the start plus the step, and
+/// so on, up to and including the first value that is not less than the
+/// bound. Unlike in a for loop, the bound and the step are worked out once,
+/// before the loop starts, and the iterations are split up into chunks that
+/// run on the threads of a WorkStealingPool at the same time. Every iteration
+/// gets its own copy of the variables in scope, so assigning to one is only
+/// seen by the rest of that iteration, while arrays are shared by all of
+/// them. The chunks are added up in order, and how the iterations are split
+/// into chunks only depends on how many there are, so the sum is the same
+/// however many threads the loop ran on.
+class ParallelForExprAST : public ExprAST {
+  Symbol VarName; ///< The name of the iterator variable, commonly "i"
+  ExprAST *Start; ///< The initializer expression
+  ExprAST *Bound; ///< The value the induction variable goes up to
+  ExprAST *Step;  ///< The value to increment the variable by, or nullptr
+                  ///< for 1
+  ExprAST *Body;  ///< The code contained within the for loop
+
+public:
+  /// The constructor for the ParallelForExprAST class.
+  ///
+  /// @param VarName the name of the induction variable
+  /// @param Start AST node for the initial expression
+  /// @param Bound AST node for what the induction variable is compared
+  ///        against, which is "n" in "i < n"
+  /// @param Step AST node of the value that the induction variable will be
+  ///        incremented by, or nullptr for 1
+  /// @param Body the body of the loop
+  ParallelForExprAST(Symbol VarName, ExprAST *Start, ExprAST *Bound,
+                     ExprAST *Step, ExprAST *Body);
+
+  /// Generate LLVM IR for a parallel for expression.
+  llvm::Value *codegen() override;
+
+  /// Evaluate a parallel for expression without generating LLVM IR, which
+  /// runs its iterations one after the other.
+  llvm::Optional<double> evaluate() override;
+
+  /// Return a helpful string representation of this ParallelForExprAST node
+  /// useful for debugging.
+  ///
+  /// @param depth the level of indentation to print this ParallelForExprAST
+  ///              at, useful for pretty-printing (may be ignored by
+  ///              implementation)
+  /// @return a string of the form "ParallelForExprAST(%1$s = %2$s, %$3s,
+  ///		%$4s,
+  ///		%$5s
+  /// )" where %1$s is the induction variable, %$2s is the string
+  /// representation of the initializer expression, %$3s is the string
+  /// representation of the bound, %$4s is the string representation of the
+  /// step amount, if present, and finally %$5s is the string representation
+  /// of the body.
+  std::string toString(const unsigned depth = 0) const override;
+
+  /// Generate LLVM IR for a parallel for loop whose parts are generated by
+  /// the given callbacks. This is all of what codegen does, so that loops
+  /// stored some other way, like in a FlatAST, are generated the same way.
+  ///
+  /// The body is generated into a function of its own, which runs a chunk of
+  /// iterations, and which the loop hands to the interpreter's pool, or just
+  /// calls for each chunk when the code is not going to run in the
+  /// interpreter, see SetParallelLoops.
+  ///
+  /// @param VarName the name of the induction variable
+  /// @param GenerateStart generates the initial value
+  /// @param GenerateBound generates the bound
+  /// @param GenerateStep generates the step
+  /// @param GenerateBody generates the body, in the function of its own
+  /// @return the sum of the values of the body, or nullptr if one of the
+  ///         callbacks failed
+  static llvm::Value *
+  codegenLoop(Symbol VarName, llvm::function_ref<llvm::Value *()> GenerateStart,
+              llvm::function_ref<llvm::Value *()> GenerateBound,
+              llvm::function_ref<llvm::Value *()> GenerateStep,
+              llvm::function_ref<llvm::Value *()> GenerateBody);
+
+  /// Evaluate a parallel for loop whose parts are evaluated by the given
+  /// callbacks, adding up the iterations in the same chunks as the
+  /// generated code does.
+  ///
+  /// @param VarName the name of the induction variable
+  /// @param EvaluateStart evaluates the initial value
+  /// @param EvaluateBound evaluates the bound
+  /// @param EvaluateStep evaluates the step
+  /// @param EvaluateBody evaluates the body
+  /// @return the sum of the values of the body, or nothing if one of the
+  ///         callbacks failed
+  static llvm::Optional<double>
+  evaluateLoop(Symbol VarName,
+               llvm::function_ref<llvm::Optional<double>()> EvaluateStart,
+               llvm::function_ref<llvm::Optional<double>()> EvaluateBound,
+               llvm::function_ref<llvm::Optional<double>()> EvaluateStep,
+               llvm::function_ref<llvm::Optional<double>()> EvaluateBody);
+
+  /// Remove a function whose IR could not be generated from its module,
+  /// along with the functions made for the bodies of the parallel loops in
+  /// it, which could otherwise still call it. If other functions in the
+  /// module call the function, only its body is removed, leaving a
+  /// declaration that the module is linked against instead.
+  ///
+  /// @param F the function to remove
+  static void eraseFunction(llvm::Function &F);
+};
+
+/// Set whether parallel loops run on the interpreter's pool of threads.
+/// Code compiled to object code cannot call into the interpreter, so
+/// without this, the chunks of a parallel loop run one after the other.
+///
+/// @param Enabled whether to run parallel loops in parallel
+void SetParallelLoops(bool Enabled);
+
+/// The function generated code calls to run a parallel loop on the
+/// interpreter's pool of threads, splitting its iterations up into chunks,
+/// running them, and adding them up in order.
+///
+/// @param Body the function made for the body of the loop, which runs the
+///        chunk [Begin, End) of iterations, where iteration K has the
+///        induction variable at Start + K * Step, and returns their sum
+/// @param Env what gives the body the variables in scope
+/// @param Start the initial value of the induction variable
+/// @param Step the step
+/// @param Count the number of iterations, which is at least 1
+/// @return the sum of the values of the body
+extern "C" double kaleidoscope_parallel_for(
+    double (*Body)(void **Env, double Start, double Step, std::int64_t Begin,
+                   std::int64_t End),
+    void **Env, double Start, double Step, std::int64_t Count);
+
+#endif // PARALLELFOREXPRAST_H
@@ -0,0 +1,45 @@
+#include <llvm/ExecutionEngine/JITEventListener.h> // llvm::JITEventListener
+#include <llvm/ExecutionEngine/RuntimeDyld.h> // llvm::RuntimeDyld::LoadedObjectInfo
+#include <llvm/Object/ObjectFile.h>           // llvm::object::ObjectFile
+#include <llvm/Support/raw_ostream.h>         // llvm::raw_fd_ostream
+
+#include <memory> // std::unique_ptr
+#include <mutex>  // std::mutex
+#include <string> // std::string
+
+#ifndef PERFMAPLISTENER_H
+#define PERFMAPLISTENER_H
+
+/// PerfMapListener - A JIT event listener that tells perf where the JIT put
+/// each function, by writing /tmp/perf-<pid>.map.
+///
+/// perf looks for that file when it finds samples in memory that no file is
+/// mapped at, and names the functions in it in its reports. Each line of the
+/// file is the start address, the size and the name of a function, both
+/// numbers in hexadecimal. Unlike the jitdump files written by LLVM's own perf
+/// listener, no `perf inject` is needed. Nothing is ever removed from the map:
+/// a redefined function takes up new memory, so the old lines do not get in
+/// the way.
+class PerfMapListener : public llvm::JITEventListener {
+  /// Guards the map file, since the JIT can load objects on several compile
+  /// threads at once.
+  std::mutex Lock;
+  std::unique_ptr<llvm::raw_fd_ostream> Map;
+
+public:
+  /// The constructor for the PerfMapListener class, which creates the map
+  /// file, replacing whatever an earlier process with the same ID left there.
+  /// If the file cannot be created, a warning is printed and nothing is
+  /// written.
+  PerfMapListener();
+
+  /// Where perf looks for the map of this process.
+  static std::string getPath();
+
+  /// Add every function in an object the JIT just loaded to the map.
+  void
+  notifyObjectLoaded(ObjectKey K, const llvm::object::ObjectFile &Obj,
+                     const llvm::RuntimeDyld::LoadedObjectInfo &L) override;
+};
+
+#endif // PERFMAPLISTENER_H
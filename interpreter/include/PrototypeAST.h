@@ -1,3 +1,4 @@
+#include "Symbol.h"
 #include "util.h"
 
 #ifndef PROTOTYPEAST_H
@@ -9,13 +10,22 @@
 class PrototypeAST : public Showable {
   /// The name of the function.
   std::string Name;
+  /// The name of the function as a symbol.
+  Symbol NameSymbol;
   /// The names of the formal paramters of the function.
   std::vector<std::string> Args;
+  /// The names of the formal parameters as symbols.
+  std::vector<Symbol> ArgSymbols;
+  /// Which of the formal parameters are arrays, passed as a pointer to their
+  /// first element, or nothing if none of them are.
+  std::vector<bool> ArrayArgs;
   /// Is this a unary or binary operator?
   bool IsOperator;
   /// The precedence if this is a binary operator, or 0 if
   /// this is not
   unsigned Precedence;
+  /// Was this declared with 'extern', rather than by a definition?
+  bool IsExtern;
 
 public:
   /// The constructor for the PrototypeAST class.
@@ -27,12 +37,36 @@ public:
   ///        unary or binary operator
   /// @param Precedence the precedence of this binary operator of this Prototype
   ///        AST node represents a binary operator
+  /// @param ArrayArgs whether each parameter is an array, or nothing if none of
+  ///        them are
+  /// @param IsExtern whether the function was declared with 'extern', so that
+  ///        it is defined outside of Kaleidoscope
   PrototypeAST(const std::string &Name, std::vector<std::string> Args,
-               bool IsOperator = false, unsigned Precedence = 0);
+               bool IsOperator = false, unsigned Precedence = 0,
+               std::vector<bool> ArrayArgs = {}, bool IsExtern = false);
 
   /// Get the name of the function that this is a prototype for.
   const std::string &getName() const;
 
+  /// Get the name of the function as a symbol, which is what maps of
+  /// functions are keyed by.
+  Symbol getSymbol() const;
+
+  /// Get the names of the formal parameters of the function.
+  const std::vector<std::string> &getArgs() const;
+
+  /// Get the names of the formal parameters of the function as symbols.
+  const std::vector<Symbol> &getArgSymbols() const;
+
+  /// Is the formal parameter with the given index an array?
+  bool isArrayArg(std::size_t Index) const;
+
+  /// Does the function take any arrays?
+  bool hasArrayArgs() const;
+
+  /// Was the function declared with 'extern' rather than defined?
+  bool isExtern() const;
+
   /// Generate LLVM IR for a function prototype.
   llvm::Function *codegen();
 
@@ -44,7 +78,7 @@ public:
   /// @return a string of the form "PrototypeAST(%1$s(%2$s, %3$s, ..., %n$s))"
   ///         where %1$s is the name of the function that this PrototypeAST
   ///         represents, and %2$s, %3$s, ..., %n$s are the names of the formal
-  ///         parameters of this PrototypeAST
+  ///         parameters of this PrototypeAST, followed by "[]" for arrays
   std::string toString(const unsigned depth = 0) const override;
 
   /// Is this a function prototype for a unary operator?
@@ -0,0 +1,95 @@
+#include <llvm/ADT/DenseMapInfo.h> // llvm::DenseMapInfo
+#include <llvm/ADT/STLExtras.h>    // llvm::function_ref
+#include <llvm/ADT/StringRef.h>    // llvm::StringRef
+
+#include <cstddef>    // std::size_t
+#include <cstdint>    // std::uint32_t
+#include <functional> // std::hash
+#include <string>     // std::string
+
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+/// Symbol - An interned name, such as that of a variable or a function.
+///
+/// Every distinct name is stored once, in a table shared by the whole
+/// interpreter, and a Symbol is just the 32-bit index of its entry. Comparing
+/// and hashing symbols is then comparing and hashing integers, so maps keyed
+/// by name, like the variables in scope, never copy or rehash the characters
+/// of a name. The table also caches the name the JIT knows each symbol by.
+///
+/// The table is safe to use from any thread, and only interning a name takes
+/// a lock. A default-constructed Symbol is the empty name.
+class Symbol {
+  std::uint32_t ID = 0;
+
+  explicit Symbol(std::uint32_t ID) : ID(ID) {}
+
+  friend struct llvm::DenseMapInfo<Symbol>;
+
+public:
+  Symbol() = default;
+
+  /// Get the symbol for the given name, adding the name to the table if this
+  /// is the first time it is seen.
+  ///
+  /// @param Name the name to intern
+  /// @return the symbol for Name
+  static Symbol intern(llvm::StringRef Name);
+
+  /// Get the symbol for the function implementing a user-defined binary
+  /// operator, "binary" followed by the operator. These are cached, so no
+  /// string is built after the first time.
+  ///
+  /// @param Op the operator
+  static Symbol binaryOperator(char Op);
+
+  /// Get the symbol for the function implementing a user-defined unary
+  /// operator, "unary" followed by the operator.
+  ///
+  /// @param Op the operator
+  static Symbol unaryOperator(char Op);
+
+  /// Get the name this symbol stands for. The characters stay where they are
+  /// for as long as the interpreter runs.
+  llvm::StringRef str() const;
+
+  /// Get the name the JIT knows this symbol by, mangling it the first time
+  /// this is asked for. The mangling has to be the same every time.
+  ///
+  /// @param Mangle turns a name into its mangled form
+  /// @return the mangled name
+  llvm::StringRef
+  getMangledName(llvm::function_ref<std::string(llvm::StringRef)> Mangle) const;
+
+  /// Get the index of this symbol in the table.
+  std::uint32_t getID() const { return ID; }
+
+  /// Get the symbol with the given index in the table, as returned by getID.
+  /// This lets compact representations store symbols as plain integers.
+  static Symbol fromID(std::uint32_t ID) { return Symbol(ID); }
+
+  bool operator==(Symbol Other) const { return ID == Other.ID; }
+  bool operator!=(Symbol Other) const { return ID != Other.ID; }
+};
+
+namespace llvm {
+/// Lets symbols be the keys of DenseMaps.
+template <> struct DenseMapInfo<Symbol> {
+  static Symbol getEmptyKey() { return Symbol(~std::uint32_t(0)); }
+  static Symbol getTombstoneKey() { return Symbol(~std::uint32_t(0) - 1); }
+  static unsigned getHashValue(Symbol S) {
+    return DenseMapInfo<std::uint32_t>::getHashValue(S.ID);
+  }
+  static bool isEqual(Symbol LHS, Symbol RHS) { return LHS == RHS; }
+};
+} // namespace llvm
+
+namespace std {
+/// Lets symbols be the keys of unordered maps.
+template <> struct hash<Symbol> {
+  std::size_t operator()(Symbol S) const { return S.getID(); }
+};
+} // namespace std
+
+#endif // SYMBOL_H
@@ -11,7 +11,7 @@ class UnaryExprAST : public ExprAST {
   /// The particular operator.
   char Op;
   /// The operand of the unary operator.
-  std::unique_ptr<ExprAST> Operand;
+  ExprAST *Operand;
 
 public:
   /// The constructor for the UnaryExprAST class. This constuctor takes in the
@@ -20,11 +20,14 @@ public:
   ///
   /// @param Opcode the unary operator
   /// @param Operand the expression being acted upon
-  UnaryExprAST(char Opcode, std::unique_ptr<ExprAST> Operand);
+  UnaryExprAST(char Opcode, ExprAST *Operand);
 
   /// Generate LLVM IR for a unary expression.
   llvm::Value *codegen() override;
 
+  /// Evaluate a unary expression without generating LLVM IR.
+  llvm::Optional<double> evaluate() override;
+
   /// Return a helpful string representation of this UnaryExprAST, useful for
   /// debugging.
   ///
@@ -8,17 +8,20 @@
 /// This AST node just hold the name of a variable reference.
 struct VariableExprAST : public ExprAST {
   /// The name of the variable.
-  const std::string Name;
+  const Symbol Name;
 
   /// The constructor for the VariableExprAST class.
   ///
   /// @param Name the name of the variable that this AST node
   /// represents
-  explicit VariableExprAST(const std::string &Name);
+  explicit VariableExprAST(Symbol Name);
 
   /// Generate LLVM IR for a variable reference.
   llvm::Value *codegen() override;
 
+  /// Evaluate a variable reference without generating LLVM IR.
+  llvm::Optional<double> evaluate() override;
+
   /// Return a helpful string representation of this VariableExprAST useful
   /// for debugging.
   ///
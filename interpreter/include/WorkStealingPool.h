@@ -0,0 +1,129 @@
+#include <llvm/ADT/STLExtras.h> // llvm::function_ref
+
+#include <atomic>             // std::atomic
+#include <condition_variable> // std::condition_variable
+#include <cstddef>            // std::size_t
+#include <deque>              // std::deque
+#include <memory>             // std::unique_ptr
+#include <mutex>              // std::mutex
+#include <thread>             // std::thread
+#include <vector>             // std::vector
+
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+/// WorkStealingPool - A fixed set of worker threads that run the tasks of a
+/// parallel loop together with the thread that started it.
+///
+/// Every thread has a deque of ranges of tasks. A thread takes the newest
+/// range off its own deque, splits it in half until a single task is left,
+/// and puts the half it does not run right away back. A thread whose deque is
+/// empty steals the oldest range of another thread, which is the largest one,
+/// so the work spreads out in a few steals however uneven the tasks are.
+///
+/// One loop runs at a time. A loop started by one of its own tasks, like a
+/// parallel loop nested in another, is run by the thread that started it,
+/// one task after the other.
+class WorkStealingPool {
+public:
+  /// The constructor for the WorkStealingPool class, which starts the
+  /// workers and leaves them waiting for a loop.
+  ///
+  /// @param NumWorkers the number of threads to start, besides the threads
+  ///        starting loops, which can be 0
+  explicit WorkStealingPool(unsigned NumWorkers);
+
+  /// Stop the workers, once they are done with the loop they are running.
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  /// Set the number of threads that the parallel loops of the shared pool
+  /// run on, counting the thread that starts them. This only has an effect
+  /// before the pool is first used.
+  ///
+  /// @param NumThreads the number of threads, or 0 for one per hardware
+  ///        thread
+  static void setNumThreads(unsigned NumThreads);
+
+  /// Get the pool shared by the whole process, which is made the first time
+  /// it is needed, see setNumThreads.
+  static WorkStealingPool &getInstance();
+
+  /// The number of threads the pool started.
+  unsigned getNumWorkers() const { return Workers.size(); }
+
+  /// Run Task(I) for every I in [0, NumTasks), spread out over the workers
+  /// and the calling thread, and wait for all of them to finish. Tasks run in
+  /// no particular order, and can run at the same time as each other.
+  ///
+  /// @param NumTasks the number of tasks to run
+  /// @param Task the task to run each time, given its number
+  void run(std::size_t NumTasks, llvm::function_ref<void(std::size_t)> Task);
+
+private:
+  /// The loop being run.
+  struct Job {
+    llvm::function_ref<void(std::size_t)> Task;
+    /// The number of tasks that have not finished yet.
+    std::atomic<std::size_t> Remaining;
+  };
+
+  /// A range [Begin, End) of the tasks of the loop.
+  struct Range {
+    std::size_t Begin;
+    std::size_t End;
+  };
+
+  /// The ranges of tasks one thread has yet to run or give away.
+  struct Deque {
+    std::mutex Lock;
+    std::deque<Range> Ranges;
+  };
+
+  /// Run ranges of a loop, from the given deque or stolen from the others,
+  /// until the loop is done.
+  ///
+  /// @param Self the deque of the calling thread
+  /// @param J the loop to run
+  void work(unsigned Self, Job &J);
+
+  /// Take a range to run: the newest one of the thread's own deque, or else
+  /// the oldest one of another thread's.
+  ///
+  /// @param Self the deque of the calling thread
+  /// @param R where to put the range that was taken
+  /// @return whether there was a range to take
+  bool take(unsigned Self, Range &R);
+
+  /// Run a range of tasks, giving away the upper half until one is left.
+  void runRange(unsigned Self, Range R, Job &J);
+
+  /// What each worker runs until the pool is destroyed.
+  void workerLoop(unsigned Self);
+
+  /// The deques of the thread starting loops, which is the first one, and
+  /// then of each worker.
+  std::vector<std::unique_ptr<Deque>> Deques;
+  std::vector<std::thread> Workers;
+  /// Lets one loop run at a time.
+  std::mutex RunLock;
+  /// Guards everything below.
+  std::mutex Lock;
+  /// Wakes the workers up when a loop starts or the pool is destroyed.
+  std::condition_variable Wake;
+  /// Tells the thread that started a loop that no worker is running it
+  /// anymore.
+  std::condition_variable Done;
+  /// The loop being run, or nullptr while the workers wait for one.
+  Job *Current = nullptr;
+  /// The number of loops started so far, which tells a worker that finished
+  /// one loop whether Current is another one.
+  std::size_t Generation = 0;
+  /// The number of workers running Current.
+  unsigned Busy = 0;
+  bool Stopping = false;
+};
+
+#endif // WORKSTEALINGPOOL_H
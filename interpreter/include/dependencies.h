@@ -0,0 +1,133 @@
+#include <llvm/ADT/ArrayRef.h>                        // llvm::ArrayRef
+#include <llvm/ADT/DenseSet.h>                        // llvm::DenseSet
+#include <llvm/ADT/STLExtras.h>                       // llvm::function_ref
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h> // llvm::orc::ThreadSafeModule
+#include <llvm/IR/Module.h>                           // llvm::Module
+#include <llvm/Support/Error.h>                       // llvm::Error
+
+#include <memory> // std::shared_ptr, std::unique_ptr
+#include <string> // std::string
+#include <vector> // std::vector
+
+#include "FlatAST.h"
+#include "FunctionAST.h"
+#include "Symbol.h"
+
+#ifndef DEPENDENCIES_H
+#define DEPENDENCIES_H
+
+/// KeptDefinition - A function definition whose code has been handed over to
+/// the JIT, kept so that the code can be generated again once a function it
+/// calls is redefined.
+struct KeptDefinition {
+  /// The name of the function.
+  Symbol Name;
+  /// The definition. Exactly one of these is set: the definition as it was
+  /// parsed, either way, or the bitcode of a module defining the function,
+  /// which may define other functions as well.
+  std::unique_ptr<FunctionAST> Definition;
+  std::unique_ptr<FlatAST> FlatDefinition;
+  std::shared_ptr<const std::string> Bitcode;
+  /// The functions the definition calls.
+  llvm::DenseSet<Symbol> Callees;
+};
+
+/// Forget the calls recorded in the current context so far, as happens when
+/// the IR of a function definition starts being generated.
+void StartRecordingCalls();
+
+/// Record that the function whose IR is being generated in the current
+/// context calls the function with the given name. The code generator calls
+/// this for every call it makes, user-defined operators included.
+///
+/// @param Callee the name of the function called
+void RecordCall(Symbol Callee);
+
+/// Keep a function definition whose IR has just been generated in the
+/// current context, along with the calls recorded for it.
+///
+/// @param Function the function definition
+/// @return the definition, ready for CompileModule
+KeptDefinition KeepDefinition(std::unique_ptr<FunctionAST> Function);
+
+/// Keep a function definition just like the overload taking a FunctionAST.
+///
+/// @param Function the function definition
+/// @return the definition, ready for CompileModule
+KeptDefinition KeepDefinition(std::unique_ptr<FlatAST> Function);
+
+/// Hand a function definition whose IR has just been generated in the
+/// current module over to the JIT, replacing any earlier definition.
+///
+/// Compiled code calls the functions it calls at the address they had when
+/// it was linked, so code calling an earlier definition would go on calling
+/// it. Every compiled function that calls the new one, directly or through
+/// other functions, is marked stale instead, and has its IR generated again
+/// only once something is about to call it: a module handed over to the JIT,
+/// see CompileStaleCallees, or the interpreter. A function that no longer
+/// fits what it calls, because it passes the wrong number of arguments, has
+/// the error reported when it is needed, and is taken out of the JIT until
+/// its IR can be generated again, since its old code may never have been
+/// linked, and would be linked against what it no longer fits. A module
+/// is removed from the JIT once none of the functions compiled in it are
+/// current anymore and no old code that is still around can call into it.
+///
+/// @param Function the function definition
+/// @return false if the module could not be added to the JIT, in which case
+///         the error has been logged and the function is not defined
+bool CompileDefinition(std::unique_ptr<FunctionAST> Function);
+
+/// Hand a function definition over to the JIT just like the overload taking
+/// a FunctionAST, generating IR again off of the flat node array.
+///
+/// @param Function the function definition
+/// @return false if the module could not be added to the JIT
+bool CompileDefinition(std::unique_ptr<FlatAST> Function);
+
+/// Hand a module defining the given functions over to the JIT, just like
+/// CompileDefinition does with a single definition. Variables the module
+/// defines keep it in the JIT for good, and so does anything else it defines
+/// for as long as it is not redefined.
+///
+/// @param Definitions the definitions of the functions, from KeepDefinition
+///        or the bitcode the module was read from
+/// @param TakeModule takes the module defining every function in
+///        Definitions, with takeModuleForJIT, once the functions calling them
+///        are stale and their bodies are no longer imported
+/// @return an error if the module could not be added to the JIT
+llvm::Error
+CompileModule(std::vector<KeptDefinition> Definitions,
+              llvm::function_ref<llvm::orc::ThreadSafeModule()> TakeModule);
+
+/// Keep the definitions of functions that the JIT has code for already, as
+/// when a snapshot is loaded, so that the code is generated again once a
+/// function it calls is redefined, just like CompileModule does.
+///
+/// @param Definitions the definitions, which have to hold bitcode
+void RecordDefinitions(std::vector<KeptDefinition> Definitions);
+
+/// Generate the code of every stale function that a module calls, or has
+/// inlined, again and hand it over to the JIT, along with the stale functions
+/// those call. This has to happen before the module is handed over itself.
+///
+/// @param M the module
+/// @return false if one of the functions could not be generated again, in
+///         which case the error is reported and the module cannot be linked
+bool CompileStaleCallees(const llvm::Module &M);
+
+/// Generate the code of the given functions again if they are stale, and
+/// hand it over to the JIT, so that looking them up finds current code.
+///
+/// @param Names the names of the functions
+/// @return false if one of the functions could not be generated again, in
+///         which case the error is reported and it cannot be looked up
+bool CompileStaleFunctions(llvm::ArrayRef<Symbol> Names);
+
+/// Get the definition of every function handed over to the JIT as bitcode,
+/// for RecordDefinitions to take back later. The definitions are sorted by
+/// name, and ones whose IR cannot be generated anymore are left out.
+///
+/// @return the definitions
+std::vector<KeptDefinition> ExportDefinitions();
+
+#endif // DEPENDENCIES_H
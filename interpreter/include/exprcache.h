@@ -0,0 +1,51 @@
+#include <llvm/ExecutionEngine/Orc/Core.h> // llvm::orc::VModuleKey
+
+#include <string> // std::string
+#include <vector> // std::vector
+
+#include "Symbol.h"
+
+#ifndef EXPRCACHE_H
+#define EXPRCACHE_H
+
+/// A top-level expression compiled into a function taking no arguments.
+using CompiledExpression = double (*)();
+
+/// Set how many compiled top-level expressions to keep around. An expression
+/// that lexes the same as one that is kept is not compiled again, its
+/// function is just called again. Once the cache is full, the expression
+/// that was used the longest time ago makes room for the new one.
+///
+/// @param N the most expressions to keep, or 0 to compile every expression
+///        anew and throw it away once it has run
+void SetExpressionCacheSize(unsigned N);
+
+/// Whether compiled top-level expressions are kept around.
+bool isExpressionCacheEnabled();
+
+/// Get the compiled function of the expression that lexes as Key, if it is
+/// kept, making it the most recently used one.
+///
+/// @param Key the recording of the tokens of the expression
+/// @return the function, or nullptr if the expression is not kept
+CompiledExpression lookupCachedExpression(const std::string &Key);
+
+/// Keep a compiled expression around, together with the module the JIT
+/// compiled it in. The module is removed from the JIT once the expression is
+/// evicted or invalidated.
+///
+/// @param Key the recording of the tokens of the expression
+/// @param Module the module the expression was compiled in
+/// @param Function the compiled expression
+/// @param References every function the module calls or inlined
+void cacheExpression(std::string Key, llvm::orc::VModuleKey Module,
+                     CompiledExpression Function,
+                     std::vector<Symbol> References);
+
+/// Forget every kept expression that refers to the function with the given
+/// name, which is about to be defined or declared again.
+///
+/// @param Name the name of the function
+void invalidateCachedExpressions(Symbol Name);
+
+#endif // EXPRCACHE_H
@@ -0,0 +1,55 @@
+#include <llvm/ADT/Optional.h> // llvm::Optional
+
+#include "Symbol.h"
+
+#ifndef FOLD_H
+#define FOLD_H
+
+/// Set whether the parser folds constant expressions into number literals.
+///
+/// With constant folding, a built-in operator applied to two numbers and an
+/// if/then/else with a number for a condition are replaced by what they
+/// evaluate to as they are parsed, in function bodies and top-level
+/// expressions alike. A top-level expression that only calls pure functions
+/// and refers to no variables is then evaluated right away instead of being
+/// compiled, calling the compiled code of the functions it calls.
+///
+/// @param Enabled whether to fold constant expressions
+void SetConstantFolding(bool Enabled);
+
+/// Whether the parser folds constant expressions.
+bool isConstantFoldingEnabled();
+
+/// Record whether the function with the given name is pure, which is when it
+/// only calls pure functions, itself included. Functions declared with
+/// 'extern' never are, since nothing is known about what they do, except for
+/// the functions of the math library, see isMathFunction. Once a
+/// pure function is redefined to be impure, every function that calls it may
+/// have become impure too, so every function is forgotten about.
+///
+/// Purity is kept in the current CompilationContext, so it is only known for
+/// the functions defined through that context.
+///
+/// @param Name the name of the function
+/// @param Pure whether the function is pure
+void SetFunctionPurity(Symbol Name, bool Pure);
+
+/// Whether the function with the given name is known to be pure, which makes
+/// calling it with the same arguments always give the same value without
+/// anything else happening.
+bool isPureFunction(Symbol Name);
+
+/// Evaluate one of the built-in binary operators other than assignment, the
+/// same way fcmp and the floating-point instructions do.
+///
+/// @param Op the operator
+/// @param L the left-hand side
+/// @param R the right-hand side
+/// @return the value, or nothing if Op is not a built-in operator
+llvm::Optional<double> evaluateBuiltinOperator(char Op, double L, double R);
+
+/// Whether a value counts as true for if/then/else, which is when it is not
+/// 0 and not NaN, like fcmp one with 0 does.
+inline bool isTrue(double Value) { return Value < 0.0 || Value > 0.0; }
+
+#endif // FOLD_H
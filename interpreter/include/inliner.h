@@ -0,0 +1,45 @@
+#include <llvm/ADT/StringRef.h>                       // llvm::StringRef
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h> // llvm::orc::ThreadSafeModule
+
+#ifndef INLINER_H
+#define INLINER_H
+
+/// Set whether calls to functions defined in earlier modules can be inlined.
+///
+/// Every definition lives in a module of its own, so normally a caller only
+/// ever sees a declaration of its callee. With cross-module inlining, the IR of
+/// each definition is kept around after it goes to the JIT, and a new module
+/// gets available_externally copies of the functions it calls before the
+/// per-module optimization pipeline runs. The inliner can then inline them,
+/// and the copies are thrown away again before code generation.
+///
+/// @param Enabled whether to inline across modules
+void SetCrossModuleInlining(bool Enabled);
+
+/// Set whether user-defined unary and binary operators are marked
+/// alwaysinline. Their IR is then kept around the same way as with
+/// cross-module inlining, but only operators are imported into the modules
+/// that use them, and only the always-inliner runs, so even at -O0 applying
+/// an operator compiles down to the arithmetic in its body.
+///
+/// @param Enabled whether to always inline operators
+void SetOperatorInlining(bool Enabled);
+
+/// Whether user-defined operators are marked alwaysinline.
+bool isOperatorInliningEnabled();
+
+/// Stop importing the recorded IR of a function, whose code calls a function
+/// that has been redefined since, until a module defining it is taken for the
+/// JIT again.
+///
+/// @param Name the name of the function
+void ForgetInlineDefinition(llvm::StringRef Name);
+
+/// Take the current module to hand over to the JIT. With cross-module or
+/// operator inlining, the module's definitions are recorded and the bodies of
+/// its callees are inlined into it first. Otherwise this is just takeModule().
+///
+/// @return the module together with the context that owns it
+llvm::orc::ThreadSafeModule takeModuleForJIT();
+
+#endif // INLINER_H
@@ -1,3 +1,11 @@
+#include <llvm/Support/MemoryBuffer.h> // llvm::MemoryBuffer
+
+#include <memory>       // std::unique_ptr
+#include <string>       // std::string
+#include <system_error> // std::error_code
+
+#include "Symbol.h"
+
 #ifndef LEXER_H
 #define LEXER_H
 
@@ -41,7 +49,11 @@ enum Token {
 
   // user-defined local variables
   /// the "let" keyword
-  tok_let = -14
+  tok_let = -14,
+
+  // parallelism
+  /// The "parallel" keyword
+  tok_parallel = -15
 };
 
 /// Return a string representation of enum Token suitable for printing
@@ -70,6 +82,23 @@ const std::string tokenToString(Token tok);
 ///         or the ASCII value of the first character read
 static int gettok();
 
+/// Lex the file at the given path instead of standard input. The whole file
+/// is loaded into memory (or mapped into memory, if it is large enough) up
+/// front, and tokens are cut straight out of it from then on. Standard input
+/// is never read after this by the current CompilationContext, which the file
+/// belongs to.
+///
+/// @param Path the path of the file to lex
+/// @return an error code if the file could not be read
+std::error_code setInputFile(const std::string &Path);
+
+/// Lex the given buffer instead of standard input, the same way as a file set
+/// with setInputFile().
+///
+/// @param Buffer the source code to lex, which must be null-terminated like
+///        every buffer made by llvm::MemoryBuffer::getMemBufferCopy
+void setInputBuffer(std::unique_ptr<llvm::MemoryBuffer> Buffer);
+
 /// Get the next token as lexed by gettok(), updating the internal token buffer.
 /// When getting the next token, this funcion should be preferred to gettok()
 /// since gettok() does not update the internal token buffer, and getting
@@ -79,6 +108,18 @@ static int gettok();
 /// @return the next token lexed by gettok()
 int getNextToken();
 
+/// Start recording the tokens lexed from here on, starting with the current
+/// token. Each one is written into Text the same way whatever whitespace and
+/// comments were around it and however a number was spelled, so two pieces
+/// of code that lex the same get the same text.
+///
+/// @param Text where to write the tokens, which must outlive the recording
+void startRecordingTokens(std::string &Text);
+
+/// Stop recording tokens. The current token is left out of the recording,
+/// since it is the one a parser reads past the end of whatever it parsed.
+void stopRecordingTokens();
+
 /// Get the current token in the token buffer without updating it.
 ///
 /// The difference between this function and getNextToken() is that
@@ -97,6 +138,13 @@ int getCurrentToken();
 /// @return the last read identifier as a read-only reference
 const std::string &getIdentifierStr();
 
+/// Get the name of the current identifier last read by the lexer as a symbol,
+/// which is interned as soon as the identifier is lexed. This will be the
+/// empty name if no identifier has been read.
+///
+/// @return the last read identifier as a symbol
+Symbol getIdentifierSymbol();
+
 /// Get the current numeric value last read in by the lexer. This will be
 /// uninitialized data if no numeric literal has been lexed yet.
 ///
@@ -0,0 +1,66 @@
+#include <llvm/ADT/ArrayRef.h>  // llvm::ArrayRef
+#include <llvm/ADT/StringRef.h> // llvm::StringRef
+#include <llvm/IR/Module.h>     // llvm::Module
+#include <llvm/Support/Error.h> // llvm::Error
+
+#include <string> // std::string
+#include <vector> // std::vector
+
+#include "dependencies.h" // KeptDefinition
+
+#ifndef LOADER_H
+#define LOADER_H
+
+/// Compile the function definitions and extern declarations in each of the
+/// given source files and hand them over to the JIT, so that the interpreter
+/// can call them from then on.
+///
+/// Every file is lexed, parsed and turned into LLVM IR on a thread of its own,
+/// in a CompilationContext of its own, and its functions are optimized there
+/// too. A program split over several files then loads in about the time its
+/// largest file takes. Once every file is done, their modules go to the JIT
+/// one after the other in the order the files were given, so when two files
+/// define the same function, the later one wins.
+///
+/// Each file starts out knowing the functions and operators the interpreter
+/// knows when this is called, but not the ones in the other files: calling a
+/// function defined in another file takes an extern declaration of it, and a
+/// binary operator can only be used in the file that defines it. Everything
+/// the files declare and define is known to the interpreter afterwards. Top-
+/// level expressions are not run, they are reported and skipped. The
+/// definitions are kept just like CompileDefinition keeps one, so code that
+/// calls a function a file redefines is generated again once it is needed,
+/// and so is the code in a file once a function it calls is redefined.
+///
+/// A file whose name ends in ".bc" or ".ll" is read as LLVM bitcode or
+/// textual IR instead, such as a session compiled to bitcode earlier. Every
+/// function in it that takes and returns doubles is declared to the
+/// interpreter, with its parameters named as in the IR, and binary operators
+/// get the precedence RecordOperatorPrecedences recorded for them. Their
+/// definitions are kept as the bitcode of the optimized module.
+///
+/// @param Paths the paths of the source files to compile
+/// @return an error if a file could not be read, or its module could not be
+///         handed over to the JIT
+llvm::Error LoadSourceFiles(llvm::ArrayRef<std::string> Paths);
+
+/// Record the precedence of every binary operator defined in the given module
+/// in the module itself, so that the operators can be parsed again when it is
+/// written out as IR and loaded with LoadSourceFiles.
+///
+/// @param M the module to record the precedences in
+void RecordOperatorPrecedences(llvm::Module &M);
+
+/// Compile every function definition and extern declaration that the lexer of
+/// the current CompilationContext reads from its input into the current
+/// module, until the end of the input. Definitions are optimized if the
+/// context has an optimizer, but nothing is printed. Top-level expressions
+/// are reported with LogError and skipped.
+///
+/// @param Origin what to call the input in error messages
+/// @param Kept where to keep the definitions whose code was generated, or
+///        nullptr to drop them
+void CompileDefinitions(llvm::StringRef Origin,
+                        std::vector<KeptDefinition> *Kept = nullptr);
+
+#endif // LOADER_H
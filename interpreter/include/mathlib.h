@@ -0,0 +1,126 @@
+#include <llvm/ADT/Optional.h>                 // llvm::Optional
+#include <llvm/ADT/STLExtras.h>                // llvm::function_ref
+#include <llvm/ADT/StringRef.h>                // llvm::StringRef
+#include <llvm/Analysis/TargetLibraryInfo.h>   // llvm::TargetLibraryInfoImpl
+#include <llvm/ExecutionEngine/JITSymbol.h>    // llvm::JITTargetAddress
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h> // llvm::orc::ThreadSafeModule
+#include <llvm/IR/DataLayout.h>                // llvm::DataLayout
+#include <llvm/IR/Function.h>                  // llvm::Function
+#include <llvm/Support/Error.h>                // llvm::Error
+#include <llvm/Target/TargetMachine.h>         // llvm::TargetMachine
+
+#include "PrototypeAST.h"
+#include "Symbol.h"
+
+#ifndef MATHLIB_H
+#define MATHLIB_H
+
+/// The libraries of vector math functions that the vectorizers can call in
+/// place of a math function, so that loops calling one still get vectorized.
+enum class VectorLibrary {
+  /// No library: loops calling math functions that have no vector
+  /// instruction only get vectorized by calling the function once per lane.
+  None,
+  /// The interpreter's own vector functions, see getVectorMathModule, which
+  /// only exist in the JIT.
+  Runtime,
+  /// The vector functions of glibc's libmvec, on x86-64.
+  Libmvec,
+  /// Intel's Short Vector Math Library.
+  SVML,
+  /// IBM's Mathematical Acceleration Subsystem, on PowerPC.
+  MASSV,
+  /// Apple's Accelerate framework.
+  Accelerate,
+};
+
+/// Set the library of vector math functions that Optimizers are built for.
+///
+/// @param Library the library, which the code being optimized has to be
+///        linked against
+void SetVectorLibrary(VectorLibrary Library);
+
+/// Get the library set with SetVectorLibrary, which is None unless set
+/// otherwise.
+VectorLibrary getVectorLibrary();
+
+/// Get the library of vector math functions with the given name, as given to
+/// -veclib: "none", "runtime", "libmvec", "svml", "massv" or "accelerate".
+///
+/// @param Name the name of the library, in any case
+/// @return the library, or nothing if there is none by that name
+llvm::Optional<VectorLibrary> parseVectorLibrary(llvm::StringRef Name);
+
+/// Make the functions of the given library of vector math functions callable
+/// from the JIT, loading it into the process if it is the kind of library
+/// that can be, which is only the case for libmvec. The others have to be
+/// linked into the interpreter or preloaded.
+///
+/// @param Library the library to load
+/// @return an error if the library could not be loaded
+llvm::Error loadVectorLibrary(VectorLibrary Library);
+
+/// Tell LLVM about the vector variants of the math functions in the library
+/// set with SetVectorLibrary, so that the vectorizers call them.
+///
+/// @param TLII the library info to add the vector functions to
+/// @param TM the target machine the code is compiled for, which decides the
+///        widths of vector some libraries have functions for. May be nullptr
+void addVectorMathFunctions(llvm::TargetLibraryInfoImpl &TLII,
+                            const llvm::TargetMachine *TM);
+
+/// Whether an extern declaration is of one of the functions of the math
+/// library, like sin(x) or pow(x y), named and taking numbers like its C
+/// counterpart. The math library is the part of the C library that the JIT
+/// defines itself, and whose functions LLVM knows about: calls to them are
+/// pure, get constant folded and vectorized, and many of them are compiled
+/// into a few instructions rather than a call.
+///
+/// @param Proto the prototype of a function
+/// @return whether the prototype is an extern declaration of a math function
+bool isMathFunction(const PrototypeAST &Proto);
+
+/// Whether LLVM takes the given function for the function of the C library
+/// with its name and type, like sin or puts, and optimizes calls to it by
+/// what that function does.
+///
+/// @param F the declaration or definition of a function
+/// @return whether LLVM knows of a library function like it
+bool isLibraryFunction(const llvm::Function &F);
+
+/// Mark a declaration of a math function for what it is: a function that
+/// only computes its value from its arguments, which lets LLVM move and
+/// vectorize calls to it.
+///
+/// @param F the declaration of a function that isMathFunction is true for
+void addMathFunctionAttributes(llvm::Function &F);
+
+/// Get the intrinsic that is called in place of the given function in the
+/// current module, if the function is a math function that LLVM has an
+/// intrinsic for, the way clang calls llvm.sqrt.f64 for sqrt.
+///
+/// @param Callee the name of the function being called
+/// @return the declaration of the intrinsic, or nullptr if Callee is not
+///         declared as a math function or it has no intrinsic
+llvm::Function *getMathIntrinsic(Symbol Callee);
+
+/// Call the given function with the name and address of every function of
+/// the math library, whether or not it was declared, so that a JIT can
+/// define them all up front.
+///
+/// @param Define called with the unmangled name and the address of each
+///        function
+void forEachMathFunction(
+    llvm::function_ref<void(llvm::StringRef Name, llvm::JITTargetAddress)>
+        Define);
+
+/// Generate the module holding the vector math functions of the Runtime
+/// library. Each one calls the math function it stands for on every lane,
+/// so that a loop calling math functions is still vectorized even when
+/// there is no faster way to compute them for a whole vector at once.
+///
+/// @param DL the data layout of the JIT that the module is compiled by
+/// @return the module, in a context of its own
+llvm::orc::ThreadSafeModule getVectorMathModule(const llvm::DataLayout &DL);
+
+#endif // MATHLIB_H
@@ -0,0 +1,52 @@
+#include <llvm/ADT/Optional.h>         // llvm::Optional
+#include <llvm/ADT/STLExtras.h>        // llvm::function_ref
+#include <llvm/ADT/StringRef.h>        // llvm::StringRef
+#include <llvm/IR/Module.h>            // llvm::Module
+#include <llvm/Support/CodeGen.h>      // llvm::Reloc::Model
+#include <llvm/Support/Error.h>        // llvm::Error
+#include <llvm/Target/TargetMachine.h> // llvm::TargetMachine
+
+#include <memory> // std::unique_ptr
+
+#ifndef OBJECTCODE_H
+#define OBJECTCODE_H
+
+/// Makes a target machine for the CPU the session is being compiled for, with
+/// the given relocation model or the target's default one.
+using TargetMachineFactory =
+    llvm::function_ref<std::unique_ptr<llvm::TargetMachine>(
+        llvm::Optional<llvm::Reloc::Model>)>;
+
+/// Optimize the given module and compile it into the file called Filename.
+///
+/// What kind of file that is depends on its extension. A ".a" file is a
+/// static archive and a ".so" file a shared library, linked by the system C
+/// compiler. For both, the functions in the module are split up between
+/// NumThreads partitions of about the same size, and each partition is
+/// optimized and compiled on a thread of its own, so compile times scale with
+/// the number of cores. A ".s" file is assembly, and anything else a single
+/// object file, which are optimized and compiled as one module on the calling
+/// thread.
+///
+/// A ".bc" file is bitcode and a ".ll" file textual IR, optimized with the
+/// pipeline clang runs before writing bitcode for ThinLTO. Bitcode comes with
+/// a module summary, so it can take part in a ThinLTO link with bitcode
+/// compiled from other languages by `clang -flto=thin`, and the interpreter
+/// can load both again with LoadSourceFiles.
+///
+/// Splitting the module means a function can only be inlined into the callers
+/// that end up in its partition.
+///
+/// @param M the module to compile, which must have its data layout and target
+///        triple set. It is left in an unspecified state
+/// @param Filename the name of the file to write
+/// @param CreateTargetMachine makes a target machine for each thread, which
+///        may be called on several threads at once
+/// @param NumThreads how many partitions to compile in parallel for an
+///        archive or shared library. 0 is the same as 1
+/// @return an error if the module could not be compiled or written
+llvm::Error writeObjectCode(llvm::Module &M, llvm::StringRef Filename,
+                            TargetMachineFactory CreateTargetMachine,
+                            unsigned NumThreads);
+
+#endif // OBJECTCODE_H
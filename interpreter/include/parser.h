@@ -2,6 +2,7 @@
 #define PARSER_H
 
 #include "ExprAST.h"
+#include "FlatAST.h"
 #include "FunctionAST.h"
 
 /// Update the internal binary operator precedence table with the appropriate
@@ -28,6 +29,11 @@ int InstallBinopPrecedence(const char Op, const int Precedence);
 /// @return if the given binary operator existed in the first place
 bool UninstallBinopPrecedence(const char Op);
 
+// The expression parsers below make their nodes in the ASTArena of the
+// top-level item being parsed, which ParseDefinition and ParseTopLevelExpr
+// hand over to the FunctionAST they return. Nodes parsed before an error are
+// freed along with the arena when the next top-level item starts.
+
 /// Transform the floating point number tokenized by gettok() into an AST node
 /// that represents a numerical expression.
 ///
@@ -44,7 +50,7 @@ bool UninstallBinopPrecedence(const char Op);
 ///             inaccurate.
 ///
 /// @return an AST node wrapping a numerical value
-std::unique_ptr<ExprAST> ParseNumberExpr();
+ExprAST *ParseNumberExpr();
 
 /// Consume a '(' token, then another expression, and then another ')' token,
 /// and build an AST node representing the value in parenthesis.
@@ -57,7 +63,7 @@ std::unique_ptr<ExprAST> ParseNumberExpr();
 ///
 /// @return an AST node that represents the value after evaluating the
 ///         expression in parentheses, or a nullptr as described above
-std::unique_ptr<ExprAST> ParseParenExpr();
+ExprAST *ParseParenExpr();
 
 /// Create an AST node representing either a variable reference or a function
 /// call.
@@ -73,10 +79,10 @@ std::unique_ptr<ExprAST> ParseParenExpr();
 ///
 /// @return an AST node represting either a variable reference or a function
 /// call
-std::unique_ptr<ExprAST> ParseIdentififerExpr();
+ExprAST *ParseIdentififerExpr();
 
 /// TODO Documentation
-std::unique_ptr<ExprAST> ParseLetExpr();
+ExprAST *ParseLetExpr();
 
 /// This function will parse one of the following:
 ///
@@ -90,7 +96,7 @@ std::unique_ptr<ExprAST> ParseLetExpr();
 /// create an AST node.
 ///
 /// @return an AST node based on the current token lexed by getNextToken()
-std::unique_ptr<ExprAST> ParsePrimary();
+ExprAST *ParsePrimary();
 
 /// If the current token as returned by getNextToken() is a binary operator,
 /// return the precedence of that operator, otherwise return -1.
@@ -122,7 +128,7 @@ int GetTokPrecedence();
 /// expression,
 ///         or just the primary expression if there is no unary operator, or
 ///         nullptr if there was an error with parsing
-std::unique_ptr<ExprAST> ParseUnary();
+ExprAST *ParseUnary();
 
 /// Parse a sequence of primary expressions (see ParsePrimary) conjoined by
 /// binary operators, after having already parsed the initial primary expression
@@ -152,8 +158,7 @@ std::unique_ptr<ExprAST> ParseUnary();
 ///         the first binary operator with too low of a predence, or up to the
 ///         end of the expression if no such binary operator is encountered, or
 ///         nullptr is a binary operator has no Right-Hand Side
-std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
-                                       std::unique_ptr<ExprAST> LHS);
+ExprAST *ParseBinOpRHS(int ExprPrec, ExprAST *LHS);
 
 /// Parse a sequence of primary expressions conjoined by binary operators. This
 /// is very similar to ParseBinOpRHS, in fact it just parses the leftmost
@@ -165,7 +170,7 @@ std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
 /// handles parsing the left-most expression before the first binary operator.
 ///
 /// @return an AST node (tree) represending the parsed expression
-std::unique_ptr<ExprAST> ParseExpression();
+ExprAST *ParseExpression();
 
 /// Parse a function prototype definition, e.g.
 ///
@@ -178,11 +183,12 @@ std::unique_ptr<ExprAST> ParseExpression();
 /// will also return a nullprt if an opening parenthesis isn't found after the
 /// initial function name, and if a closing parenthesis isn't found.
 ///
+/// @param IsExtern whether the prototype is part of an extern declaration
 /// @return an AST node representing the function prototype declaration, or
 /// nullptr if the current
 ///         token is not an identifier, or if opening and closing parentheses
 ///         cannot be found
-std::unique_ptr<PrototypeAST> ParsePrototype();
+std::unique_ptr<PrototypeAST> ParsePrototype(bool IsExtern = false);
 
 /// Parse a complete function definition, which looks like
 ///
@@ -199,6 +205,13 @@ std::unique_ptr<PrototypeAST> ParsePrototype();
 ///         function prototype or expression is not able to be parsed
 std::unique_ptr<FunctionAST> ParseDefinition();
 
+/// Parse a complete function definition just like ParseDefinition, but build
+/// its body as a FlatAST instead of a tree of ExprAST nodes.
+///
+/// @return the function definition, or nullptr if a function prototype or
+///         expression is not able to be parsed
+std::unique_ptr<FlatAST> ParseDefinitionFlat();
+
 /// Parse an extern function declaration, which is the 'extern' keyword followed
 /// by a function prototype definition, and return an AST node representing the
 /// function prototype. This function expects the current token as returned by
@@ -225,7 +238,7 @@ std::unique_ptr<PrototypeAST> ParseExtern();
 ///
 /// @return an AST node representing the parsed if expression, or nullptr if one
 ///         could not be parsed
-std::unique_ptr<ExprAST> ParseIfExpr();
+ExprAST *ParseIfExpr();
 
 /// Parse a for loop, which is of the form
 ///
@@ -243,16 +256,28 @@ std::unique_ptr<ExprAST> ParseIfExpr();
 ///
 /// @return an AST node representing the parsed for loop, or nullptr if any of
 ///         the expressions that compose a for loop could not be parsed properly
-std::unique_ptr<ExprAST> ParseForExpr();
+ExprAST *ParseForExpr();
 
 /// Parse an expression declared outside of a function. This function exists to
 /// allow the user to interact with the interpreter using a REPL, and just
 /// creates an AST node for an anonymous function definition using the parsed
 /// expression.
 ///
+/// @param Name the name to give the anonymous function
 /// @return an AST node for a complete function definition containing an
 ///         expression that is parsed at the top-level, i.e. outside of a
 ///         function
-std::unique_ptr<FunctionAST> ParseTopLevelExpr();
+std::unique_ptr<FunctionAST>
+ParseTopLevelExpr(const std::string &Name = "__anon_expr");
+
+/// Parse an expression declared outside of a function just like
+/// ParseTopLevelExpr, but build it as a FlatAST instead of a tree of ExprAST
+/// nodes.
+///
+/// @param Name the name to give the anonymous function
+/// @return an anonymous function definition containing the parsed expression,
+///         or nullptr if it could not be parsed
+std::unique_ptr<FlatAST>
+ParseTopLevelExprFlat(const std::string &Name = "__anon_expr");
 
 #endif
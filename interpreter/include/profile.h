@@ -0,0 +1,59 @@
+#include <llvm/IR/Function.h> // llvm::Function
+
+#include <cstdint> // std::uint64_t
+#include <memory>  // std::unique_ptr
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/// FunctionProfile - The counts collected by the instrumented code of a
+/// function while it runs.
+///
+/// The counters live in memory owned by the profile, and the instrumented code
+/// adds to them directly, so a profile has to outlive the code. There is one
+/// counter for the function's entry, one for each edge out of every
+/// conditional branch, and one for each call.
+/// Branches and calls are numbered in the order they appear in the function,
+/// which is the same every time the function is generated from the same AST.
+class FunctionProfile {
+  /// The entry counter, then two counters for each branch, where the first is
+  /// for the true successor, then a counter for each call.
+  std::unique_ptr<std::uint64_t[]> Counts;
+  unsigned NumBranches;
+  unsigned NumCalls;
+
+public:
+  /// The constructor for the FunctionProfile class, with every counter at 0.
+  ///
+  /// @param NumBranches the number of conditional branches to count
+  /// @param NumCalls the number of calls to count
+  FunctionProfile(unsigned NumBranches, unsigned NumCalls);
+
+  /// How many times the function was called.
+  std::uint64_t getEntryCount() const { return Counts[0]; }
+
+  /// How much the function has run: the number of times it was called plus
+  /// the number of conditional branches it took, loops included.
+  std::uint64_t getHotness() const;
+
+  /// Add instructions to a function that count how many times it is called,
+  /// which way each of its conditional branches goes and how many times each
+  /// of its calls is made.
+  ///
+  /// @param F the function to instrument, which should not be changed
+  ///        afterwards, or the counts no longer match what the code does
+  /// @return the profile the instrumented code counts into
+  static std::unique_ptr<FunctionProfile> instrument(llvm::Function &F);
+
+  /// Annotate a function with what its profile counted: the entry count,
+  /// branch weights on every conditional branch, and an inline hint on every
+  /// function called at least once per call of F on average. The function
+  /// has to have been generated from the same AST as the instrumented one.
+  ///
+  /// @param F the function to annotate
+  /// @return false if the branches and calls of F do not match the profile,
+  ///         in which case F is left alone
+  bool applyTo(llvm::Function &F) const;
+};
+
+#endif // PROFILE_H
@@ -0,0 +1,41 @@
+#include <llvm/ADT/StringRef.h> // llvm::StringRef
+#include <llvm/Support/Error.h> // llvm::Error
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/// Save the state of the interpreter's session to a single file, which
+/// LoadSnapshot can pick the session up from again: the prototype of every
+/// function and extern declared, the precedence of every binary operator, the
+/// object code of every function compiled, and the definitions of the
+/// functions as bitcode, which their code is generated again from once a
+/// function they call is redefined.
+///
+/// Every definition that has not been compiled yet is compiled first, and so
+/// is every function that calls a function that was redefined. Only
+/// the code of the newest definition of each function is saved, and code
+/// that could not be linked, because it calls a function that was never
+/// defined, is left out. The JIT has to have been made with
+/// KaleidoscopeJIT::Options::KeepObjects.
+///
+/// The file is written to a temporary file first and then moved into place,
+/// so a process loading it never sees half of a snapshot.
+///
+/// @param Path the name of the file to write
+/// @return an error if the file could not be written
+llvm::Error SaveSnapshot(llvm::StringRef Path);
+
+/// Pick up the session saved by SaveSnapshot, as though its definitions had
+/// just been entered, but without lexing, parsing or compiling any of them.
+///
+/// The file is memory-mapped if it is large, and the object code in it goes
+/// to the JIT as it is, to be linked the first time one of its functions is
+/// looked up. The file stays loaded until the process exits. A snapshot only
+/// loads on the kind of machine it was saved on.
+///
+/// @param Path the name of the file to read
+/// @return an error if the file could not be read, is not a snapshot, was
+///         made for another target, or its code could not be added to the JIT
+llvm::Error LoadSnapshot(llvm::StringRef Path);
+
+#endif // SNAPSHOT_H
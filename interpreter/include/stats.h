@@ -0,0 +1,121 @@
+#include <llvm/Support/raw_ostream.h> // llvm::raw_ostream
+
+#include <cstdint>      // std::uint64_t
+#include <string>       // std::string
+#include <system_error> // std::error_code
+
+#ifndef STATS_H
+#define STATS_H
+
+namespace llvm {
+class Timer;
+} // namespace llvm
+
+/// The phases of running a program that -time-passes times.
+enum class Phase : unsigned {
+  /// Turning characters into tokens, in getNextToken.
+  Lex,
+  /// Turning tokens into ASTs, not counting the lexing it asks for.
+  Parse,
+  /// Generating LLVM IR for a function, before it is optimized.
+  Codegen,
+  /// Running an Optimizer over a function or module.
+  Optimize,
+  /// Adding modules to the JIT and looking up their symbols, which is when
+  /// the JIT compiles them unless it is lazy.
+  JIT,
+  /// Running top-level expressions, compiled or interpreted.
+  Execute,
+};
+
+/// The things that -time-passes counts.
+enum class Counter : unsigned {
+  /// Tokens lexed.
+  Tokens,
+  /// Nodes made for ASTs, whether trees or FlatASTs.
+  ASTNodes,
+  /// Instructions in functions as they are generated, before optimization.
+  IRInstructions,
+  /// Modules added to the JIT.
+  ModulesAdded,
+  /// Modules removed from the JIT.
+  ModulesRemoved,
+  /// Symbols looked up in the JIT.
+  SymbolLookups,
+  /// The most bytes of memory compiled code was loaded into at once.
+  JITMemoryPeak,
+  /// Bytes of memory given back by compiled code that was removed.
+  JITMemoryFreed,
+  /// Parallel loops run.
+  ParallelLoops,
+  /// Ranges of tasks that a thread of a parallel loop stole from another.
+  ParallelSteals,
+};
+
+/// Set whether every phase gets timed and every counter counts. Only the
+/// thread that calls this times anything, so it should be the one running the
+/// interpreter loop; counters count on every thread.
+///
+/// @param Enabled whether to collect statistics
+void SetStatistics(bool Enabled);
+
+/// Whether statistics are collected.
+bool areStatisticsEnabled();
+
+/// Add to one of the counters, if statistics are collected.
+///
+/// @param C the counter to add to
+/// @param N how much to add
+void countEvent(Counter C, std::uint64_t N = 1);
+
+/// Raise one of the counters that keep a high-water mark to the given value,
+/// if statistics are collected and it is lower.
+///
+/// @param C the counter to raise
+/// @param Value the value the counter has to be at least
+void raiseCounter(Counter C, std::uint64_t Value);
+
+/// PhaseRegion - Time everything done until the end of the scope as part of
+/// a phase, like llvm::TimeRegion does with a timer.
+///
+/// Phases nest: a phase that starts while another one is being timed, such as
+/// the lexing a parser asks for, pauses the other phase until it is done. Every
+/// moment is then counted towards exactly one phase, and the times of all
+/// phases add up to the time spent in them. Without statistics, or on any
+/// other thread than the one timing, a PhaseRegion does nothing.
+class PhaseRegion {
+  /// The timer of this region's phase, or nullptr if it is not timed.
+  llvm::Timer *Timer = nullptr;
+  /// The timer that was running before this region started, if any.
+  llvm::Timer *Outer = nullptr;
+
+public:
+  /// Start timing a phase.
+  ///
+  /// @param P the phase the code in this scope is part of
+  explicit PhaseRegion(Phase P);
+
+  PhaseRegion(const PhaseRegion &) = delete;
+  PhaseRegion &operator=(const PhaseRegion &) = delete;
+
+  /// Stop timing the phase, and go back to timing the outer phase.
+  ~PhaseRegion();
+};
+
+/// Print a table of how long each phase took and what was counted, in the
+/// same format as LLVM's -time-passes, and reset every timer.
+///
+/// @param OS where to print the table
+void PrintStatistics(llvm::raw_ostream &OS);
+
+/// Write how long each phase took and what was counted to a file, as a JSON
+/// object like {"timers": {"time.kaleidoscope.parse.wall": 1.0e-02, ...},
+/// "counters": {"tokens": 120, ...}} with times in seconds, the way LLVM's
+/// -stats-json writes its timers. This has to be done before PrintStatistics,
+/// which resets the timers.
+///
+/// @param Path the file to write
+/// @return an error if the file could not be written
+std::error_code WriteStatisticsJSON(const std::string &Path);
+
+#endif // STATS_H
@@ -0,0 +1,34 @@
+#include <llvm/IR/Function.h> // llvm::Function
+
+#ifndef TAILCALLS_H
+#define TAILCALLS_H
+
+/// Set whether every call in tail position is compiled into a jump, whatever
+/// the optimization level, so that recursion in tail position runs in
+/// constant stack space. A call is in tail position when the function returns
+/// whatever the call returns, as when it is the body of a function or a
+/// branch of an if/then/else that is. It only becomes a jump if the arguments
+/// of the callee fit where the caller's arguments were, which they always do
+/// when they are passed in registers, as up to eight doubles are on x86-64.
+///
+/// @param Enabled whether to compile tail calls into jumps
+void SetTailCalls(bool Enabled);
+
+/// Whether calls in tail position are compiled into jumps.
+bool areTailCallsEnabled();
+
+/// Put every call in tail position in a function right in front of a return
+/// of its own, and mark it as a tail call, which is what code generation
+/// turns into a jump. Both branches of an if/then/else that the function
+/// returns the value of get a copy of the return, instead of branching to a
+/// phi that picks their value.
+///
+/// No call made while the function has a local array is in tail position,
+/// since the array has to be freed after it, so a tail call never gets to
+/// refer to the stack frame of the function it replaces.
+///
+/// @param F the function to place tail calls in, which has just been
+///        generated
+void PlaceTailCalls(llvm::Function &F);
+
+#endif // TAILCALLS_H
@@ -0,0 +1,83 @@
+#include <llvm/ADT/ArrayRef.h>  // llvm::ArrayRef
+#include <llvm/ADT/Optional.h>  // llvm::Optional
+
+#include <memory> // std::unique_ptr
+
+#include "FlatAST.h"
+#include "FunctionAST.h"
+#include "Symbol.h"
+
+#ifndef TIERING_H
+#define TIERING_H
+
+/// The most arguments the interpreter knows how to pass to native code.
+constexpr unsigned MaxNativeArgs = 6;
+
+/// Set how hot a function has to get before it is compiled. A function starts
+/// out being interpreted by walking its AST, and every call to it and every
+/// loop iteration run inside of it counts towards the threshold. Once the
+/// threshold is reached, the function is handed over to the JIT together with
+/// every interpreted function it calls, and runs natively from then on.
+///
+/// @param Threshold how many calls and loop iterations a function may be
+///        interpreted for, or 0 to compile everything up front instead
+void SetTierUpThreshold(unsigned Threshold);
+
+/// Whether function definitions and top-level expressions start out being
+/// interpreted rather than compiled.
+bool isTieringEnabled();
+
+/// Set how hot compiled code has to get before it is compiled again with a
+/// profile. With a threshold, functions are compiled with instrumentation once
+/// they leave the interpreter, counting their calls and which way each of
+/// their branches goes. Whenever the interpreter calls a function whose code
+/// has been called and has branched that many times in total, the function
+/// and every hot function it calls are recompiled at -O3 with branch weights
+/// and inline hints from the counts. Every function is called through an
+/// indirect stub, so native callers switch to the new code as well.
+///
+/// @param Threshold how many calls and branches of instrumented code make a
+///        function hot, or 0 to compile functions once without
+///        instrumentation
+void SetReoptimizationThreshold(unsigned Threshold);
+
+/// Make the given function definition available to the interpreter, replacing
+/// any earlier definition of the same name. Nothing is compiled until the
+/// function gets hot, except for functions using arrays, which the
+/// interpreter cannot run and so are compiled right away.
+///
+/// @param Function the function definition to interpret
+/// @return false if the function uses arrays and could not be compiled, in
+///         which case it is not defined
+bool DefineInterpretedFunction(std::unique_ptr<FunctionAST> Function);
+
+/// Make the given function definition available to the interpreter just like
+/// the overload taking a FunctionAST, interpreting its body off of the flat
+/// node array.
+///
+/// @param Function the function definition to interpret
+/// @return false if the function uses arrays and could not be compiled, in
+///         which case it is not defined
+bool DefineInterpretedFunction(std::unique_ptr<FlatAST> Function);
+
+/// Call the function with the given name, interpreting it if it has not been
+/// compiled yet and calling the native code otherwise. Functions that were
+/// only declared with 'extern' are always called natively.
+///
+/// @param Name the name of the function to call
+/// @param Args the values to pass to the function
+/// @return the value the function returned, or nothing if there is no such
+///         function or calling it failed
+llvm::Optional<double> CallFunction(Symbol Name, llvm::ArrayRef<double> Args);
+
+/// Forget the address of a function's native code that CallFunction looked
+/// up, since the function is about to get code at a new address.
+///
+/// @param Name the name of the function
+void ForgetNativeAddress(Symbol Name);
+
+/// Count one iteration of a loop towards the hotness of the function being
+/// interpreted, if any.
+void CountLoopIteration();
+
+#endif // TIERING_H
@@ -1,7 +1,14 @@
+#include <llvm/ADT/Optional.h>    // llvm::Optional
+#include <llvm/ADT/StringRef.h>   // llvm::StringRef
 #include <llvm/IR/Function.h>     // llvm::Function
 #include <llvm/IR/Instructions.h> // llvm::PHINode, llvm::AllocaInst
+#include <llvm/IR/Module.h>       // llvm::Module
+#include <llvm/IR/Operator.h>     // llvm::FastMathFlags
 #include <llvm/IR/Value.h>        // llvm::Value
-#include <llvm/IR/LegacyPassManager.h> // llvm::legacy::PassManagerBase
+
+#include <cstddef> // std::nullptr_t
+
+#include "Symbol.h"
 
 #ifndef loop
 /// Infinite loop.
@@ -32,10 +39,12 @@ class PrototypeAST;
 /// Sequence of characters that are considered whitespace.
 #define WHITESPACE_CHARS " \f\n\r\t\v"
 
-/// Apply a set of optimization passes to the given Pass Manager.
+/// Run the function optimization pipeline for the current optimization level
+/// over every function defined in the given module. This is safe to call from
+/// any thread.
 ///
-/// @param pass the Pass Manager instance to add passes to
-void AddPasses(llvm::legacy::PassManagerBase *pass);
+/// @param M the module to optimize
+void OptimizeModule(llvm::Module &M);
 
 /// Set up the internal module for the interpreter and initialize all
 /// optimizations.
@@ -60,7 +69,7 @@ void InitializeModuleAndPassManager(bool native);
 /// @param Name the name of the function to search for
 /// @returns a function with the given name, or nullptr if the function didn't
 ///          exist and code generation for it failed
-llvm::Function *getFunction(const std::string &Name);
+llvm::Function *getFunction(Symbol Name);
 
 /// Create an LLVM alloca instruction for storing a variable named VarName on
 /// the stack inside of the given function. This alloca instruction will then
@@ -72,9 +81,66 @@ llvm::Function *getFunction(const std::string &Name);
 ///
 /// @param Function the function to create a local, stack-allocated variable for
 /// @param VarName the name of the local variable
+/// @param Type the type of the variable, or nullptr for a double
 /// @return the alloca instruction
 llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *Function,
-                                         const std::string &VarName);
+                                         llvm::StringRef VarName,
+                                         llvm::Type *Type = nullptr);
+
+/// Whether a variable made by CreateEntryBlockAlloca names an array, holding a
+/// pointer to the first element, rather than a double.
+///
+/// @param Variable the alloca instruction of the variable
+bool isArrayVariable(const llvm::AllocaInst *Variable);
+
+/// Set whether HandleDefinition and HandleTopLevelExpression parse function
+/// bodies into a FlatAST, one flat array of nodes, rather than a tree of
+/// ExprAST nodes. Either way the same LLVM IR is generated and the same values
+/// are interpreted.
+///
+/// @param Enabled whether to use FlatASTs
+void SetFlatAST(bool Enabled);
+
+/// Whether function bodies are parsed into FlatASTs.
+bool isFlatASTEnabled();
+
+/// Set whether floating-point arithmetic is generated with the fast-math flags
+/// that let LLVM reassociate it, which vectorizes loops that sum or multiply
+/// up values, and contract multiplies and adds into fused multiply-adds. Both
+/// change how results are rounded, but not the handling of NaNs, infinities
+/// or signed zeros. This only affects modules made from then on.
+///
+/// @param Enabled whether to generate code with fast-math flags
+void SetFastMath(bool Enabled);
+
+/// The fast-math flags that floating-point instructions are generated with,
+/// none unless SetFastMath enabled them.
+llvm::FastMathFlags getFastMathFlags();
+
+/// Set whether the interpreter runs non-interactively, as when a program is
+/// piped in. In batch mode no prompt is printed and the values of top-level
+/// expressions are written to standard output, which is buffered, instead of
+/// to standard error. Generated IR is only printed if asked for with
+/// SetIRPrinting.
+///
+/// @param Enabled whether to run in batch mode
+void SetBatchMode(bool Enabled);
+
+/// Whether the interpreter runs non-interactively.
+bool isBatchModeEnabled();
+
+/// Set whether HandleDefinition and HandleExtern print the LLVM IR they
+/// generate, which they do by default.
+///
+/// @param Enabled whether to print generated IR
+void SetIRPrinting(bool Enabled);
+
+/// Print the value of a top-level expression where the user will see it:
+/// standard error in the interactive interpreter, and standard output in
+/// batch mode.
+///
+/// @param Value the value the expression evaluated to
+void PrintResult(double Value);
 
 /// What to do when a function definition is encountered at the REPL.
 ///
@@ -92,6 +158,18 @@ void HandleExtern();
 ///        to the native architecture the interpreter is running on
 void HandleTopLevelExpression(bool native);
 
+/// Set how many consecutive top-level expressions HandleTopLevelExpression
+/// collects into one module before compiling and running them. With 0 or 1,
+/// every expression is compiled and run as soon as it is parsed.
+///
+/// @param N the most expressions to compile together
+void SetTopLevelExpressionBatchSize(unsigned N);
+
+/// Compile and run the top-level expressions collected so far, printing their
+/// results in the order they were entered. This does nothing when no
+/// expressions are pending.
+void FlushTopLevelExpressions();
+
 /// Helper function for adding n tabs to the output stream os.
 ///
 /// @param os the ostream to write to
@@ -106,11 +184,16 @@ std::ostream &insert_indent(std::ostream &os, const unsigned n);
 ///          Note that this function mutates the given string as well as returning it
 std::string &strltrim(std::string &s);
 
-/// These are basic helper functions for basic error handling.
-std::unique_ptr<ExprAST> LogError(const char *Str);
+/// These are basic helper functions for basic error handling. LogError
+/// returns nullptr so that parsers can return its result whatever kind of
+/// node they make. Errors are printed to standard error unless the current
+/// CompilationContext collects them.
+std::nullptr_t LogError(const char *Str);
 
 std::unique_ptr<PrototypeAST> LogErrorP(const char *Str);
 
 llvm::Value *LogErrorV(const char *Str);
 
+llvm::Optional<double> LogErrorD(const char *Str);
+
 #endif // UTIL_H
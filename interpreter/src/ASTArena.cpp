@@ -0,0 +1,8 @@
+#include "ASTArena.h"
+
+/// The destructor for the ASTArena class.
+ASTArena::~ASTArena() {
+  // The memory itself goes back when Allocator is destroyed.
+  for (auto It = Destructors.rbegin(); It != Destructors.rend(); ++It)
+    It->second(It->first);
+}
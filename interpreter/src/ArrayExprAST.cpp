@@ -0,0 +1,63 @@
+#include <llvm/IR/Intrinsics.h> // llvm::Intrinsic
+
+#include <sstream> // std::ostringstream
+
+#include "ArrayExprAST.h"
+#include "IndexExprAST.h"
+
+/// The constructor for the ArrayExprAST class.
+ArrayExprAST::ArrayExprAST(ExprAST *Size) : Size(Size) {}
+
+/// Generate LLVM IR for allocating an array.
+llvm::Value *ArrayExprAST::codegen() {
+  llvm::Value *SizeVal = Size->codegen();
+  if (!SizeVal)
+    return nullptr;
+  return codegenAllocation(SizeVal);
+}
+
+llvm::Value *ArrayExprAST::codegenAllocation(llvm::Value *Size) {
+  auto &Builder = getBuilder();
+  llvm::Value *Count =
+      Builder.CreateFPToUI(Size, Builder.getInt64Ty(), "count");
+
+  // The array is allocated wherever it is declared rather than in the entry
+  // block, since its size is only known there. The let/in expression that
+  // declares it gives the stack space back once it is done.
+  llvm::Value *Array = Builder.CreateAlloca(
+      llvm::Type::getDoubleTy(getContext()), Count, "array");
+
+  // Every element starts out as 0, like a variable declared without an
+  // initial value.
+  llvm::Value *Bytes = Builder.CreateNUWMul(
+      Count, Builder.getInt64(sizeof(double)), "bytes");
+  Builder.CreateMemSet(Array, Builder.getInt8(0), Bytes,
+                       llvm::MaybeAlign(alignof(double)));
+  return Array;
+}
+
+llvm::Value *ArrayExprAST::codegenStackSave() {
+  auto *StackSave = llvm::Intrinsic::getDeclaration(&borrowModule(),
+                                                    llvm::Intrinsic::stacksave);
+  return getBuilder().CreateCall(StackSave, {}, "savedstack");
+}
+
+void ArrayExprAST::codegenStackRestore(llvm::Value *SavedStack) {
+  auto *StackRestore = llvm::Intrinsic::getDeclaration(
+      &borrowModule(), llvm::Intrinsic::stackrestore);
+  getBuilder().CreateCall(StackRestore, SavedStack);
+}
+
+/// Evaluate the allocation of an array.
+llvm::Optional<double> ArrayExprAST::evaluate() {
+  return IndexExprAST::logInterpretedArrayError();
+}
+
+/// "ArrayExprAST(%s)"
+std::string ArrayExprAST::toString(const unsigned depth) const {
+  std::ostringstream repr;
+  auto SizeS = Size->toString(depth);
+  insert_indent(repr, depth);
+  repr << "ArrayExprAST(" << strltrim(SizeS) << ')';
+  return repr.str();
+}
@@ -1,15 +1,53 @@
 #include <sstream> // std::ostringstream
 
+#include "dependencies.h" // RecordCall
+#include "fold.h"         // evaluateBuiltinOperator
+#include "tiering.h"      // CallFunction
+
 #include "BinaryExprAST.h"
+#include "IndexExprAST.h"
 #include "VariableExprAST.h"
 
 /// The constuctor for the BinaryExprAST class.
-BinaryExprAST::BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS,
-                             std::unique_ptr<ExprAST> RHS)
-    : Op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+BinaryExprAST::BinaryExprAST(char op, ExprAST *LHS, ExprAST *RHS)
+    : Op(op), LHS(LHS), RHS(RHS) {}
+
+/// Getter for the "Op" field of instances of BinaryExprAST.
+char BinaryExprAST::getOp() const { return Op; }
+
+/// Getter for the "LHS" field of instances of BinaryExprAST.
+ExprAST *BinaryExprAST::getLHS() const { return LHS; }
+
+/// Getter for the "RHS" field of instances of BinaryExprAST.
+ExprAST *BinaryExprAST::getRHS() const { return RHS; }
+
+/// Generate LLVM IR for assigning to an element of an array.
+///
+/// @param LHS the element
+/// @param RHS the value to assign to it
+/// @return the value assigned, or nullptr if generating LLVM IR failed
+static llvm::Value *codegenElementAssignment(const IndexExprAST &LHS,
+                                             ExprAST *RHS) {
+  llvm::Value *Index = LHS.Index->codegen();
+  llvm::Value *R = RHS->codegen();
+  if (!Index || !R)
+    return nullptr;
+
+  llvm::Value *Element = IndexExprAST::codegenElementAddress(LHS.Array, Index);
+  if (!Element)
+    return nullptr;
+  getBuilder().CreateStore(R, Element);
+  return R;
+}
 
 /// Generate LLVM IR for a binary expression.
 llvm::Value *BinaryExprAST::codegen() {
+  // An element of an array is assigned by storing to it, without loading it
+  // first.
+  if (Op == '=')
+    if (const auto *Element = dynamic_cast<IndexExprAST *>(LHS))
+      return codegenElementAssignment(*Element, RHS);
+
   llvm::Value *L = LHS->codegen();
   llvm::Value *R = RHS->codegen();
   if (!L || !R)
@@ -57,27 +95,23 @@ llvm::Value *BinaryExprAST::codegen() {
     // For the variable assignment operator =, the LHS is not emitted as an
     // expression. We require the LHS to be a variable name since it doesn't
     // make sense to assign a value to another value. Sort of like how C and C++
-    // distinguish between lvalues and rvalues, in this case the only lvalue we
-    // have is a variable name.
-
-    // Call .get() on LHS instead of using the dereference operator -> since we
-    // want to extract the ExprAST from the unique pointer instead of call a
-    // method on the underlying ExprAST.
+    // distinguish between lvalues and rvalues, in this case the only lvalues we
+    // have are variable names and elements of arrays (handled above).
 
     // Use dynamic_cast to downcast the underlying ExprAST to a VariableAST.
     // If we used static_cast and the conversion failed (meaning the LHS was NOT
     // a variable expression) then that would be undefined behavior, whereas a
     // dynamic_vast just return nullptr.
-    VariableExprAST *LHSE = dynamic_cast<VariableExprAST *>(LHS.get());
+    VariableExprAST *LHSE = dynamic_cast<VariableExprAST *>(LHS);
     if (!LHSE) {
       errMsg << LHSS << " is not a variable expression.";
       return LogErrorV(errMsg.str().c_str());
     }
 
     // Look up the variable value by name.
-    llvm::Value *Var = getNamedValues().at(LHSE->Name);
+    llvm::Value *Var = getNamedValues().lookup(LHSE->Name);
     if (!Var) {
-      errMsg << LHSE->Name << " is an unknown variable name.";
+      errMsg << LHSE->Name.str().str() << " is an unknown variable name.";
       return LogErrorV(errMsg.str().c_str());
     }
 
@@ -87,13 +121,58 @@ llvm::Value *BinaryExprAST::codegen() {
   }
 
   // If we have gotten to this point, then Op is a user-defined binary operator
-  llvm::Function *F = getFunction(std::string("binary") + Op);
+  llvm::Function *F = getFunction(Symbol::binaryOperator(Op));
   assert(F);
+  RecordCall(Symbol::binaryOperator(Op));
 
   llvm::Value *Operands[2] = {L, R};
   return Builder.CreateCall(F, Operands, "binop");
 }
 
+/// Evaluate a binary expression.
+llvm::Optional<double> BinaryExprAST::evaluate() {
+  if (Op == '=') {
+    if (dynamic_cast<IndexExprAST *>(LHS))
+      return IndexExprAST::logInterpretedArrayError();
+
+    // As with codegen, the LHS has to be a variable rather than a value.
+    VariableExprAST *LHSE = dynamic_cast<VariableExprAST *>(LHS);
+    if (!LHSE) {
+      std::string RHSS = RHS->toString(), LHSS = LHS->toString();
+      std::ostringstream errMsg("Could not assign value ", std::ios_base::ate);
+      errMsg << RHSS << " to " << LHSS << " beacuse " << LHSS
+             << " is not a variable expression.";
+      return LogErrorD(errMsg.str().c_str());
+    }
+
+    auto R = RHS->evaluate();
+    if (!R)
+      return llvm::None;
+
+    auto &EvaluatedValues = getEvaluatedValues();
+    auto Var = EvaluatedValues.find(LHSE->Name);
+    if (Var == EvaluatedValues.end()) {
+      std::ostringstream errMsg("Unknown variable name: ", std::ios_base::ate);
+      errMsg << LHSE->Name.str().str();
+      return LogErrorD(errMsg.str().c_str());
+    }
+    Var->second = *R;
+    return R;
+  }
+
+  auto L = LHS->evaluate();
+  auto R = RHS->evaluate();
+  if (!L || !R)
+    return llvm::None;
+
+  if (auto Result = evaluateBuiltinOperator(Op, *L, *R))
+    return Result;
+
+  // If we have gotten to this point, then Op is a user-defined binary operator
+  const double Operands[2] = {*L, *R};
+  return CallFunction(Symbol::binaryOperator(Op), Operands);
+}
+
 /// "lhs op rhs"
 std::string BinaryExprAST::toString(const unsigned depth) const {
   std::ostringstream repr;
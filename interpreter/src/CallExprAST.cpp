@@ -1,12 +1,25 @@
 #include <sstream> // std::ostringstream
 
+#include "dependencies.h" // RecordCall
+#include "mathlib.h"      // getMathIntrinsic
+#include "tiering.h"      // CallFunction
+
 #include "CallExprAST.h"
+#include "IndexExprAST.h"
+#include "VariableExprAST.h"
 
 using std::size_t;
 
-CallExprAST::CallExprAST(const std::string &Callee,
-                         std::vector<std::unique_ptr<ExprAST>> Args)
-    : Callee(Callee), Args(std::move(Args)) {}
+CallExprAST::CallExprAST(Symbol Callee, llvm::ArrayRef<ExprAST *> Args)
+    : Callee(Callee), Args(Args) {}
+
+llvm::Value *CallExprAST::logArrayArgumentError(Symbol Callee,
+                                                unsigned Index) {
+  std::ostringstream errMsg;
+  errMsg << "Argument " << Index + 1 << " of " << Callee.str().str()
+         << " has to be the name of an array";
+  return LogErrorV(errMsg.str().c_str());
+}
 
 /// Generate LLVM IR for a function call.
 llvm::Value *CallExprAST::codegen() {
@@ -15,7 +28,7 @@ llvm::Value *CallExprAST::codegen() {
   // Look up the function name in the global module table.
   llvm::Function *CalleeF = getFunction(Callee);
   if (!CalleeF) {
-    errMsg << "Unknown function referenced: " << Callee;
+    errMsg << "Unknown function referenced: " << Callee.str().str();
     return LogErrorV(errMsg.str().c_str());
   }
 
@@ -23,26 +36,52 @@ llvm::Value *CallExprAST::codegen() {
   const size_t expected = CalleeF->arg_size();
   const size_t actual = Args.size();
   if (expected != actual) {
-    errMsg << "Wrong number of arguments passed to " << Callee << ", expecting "
-           << expected << " but got " << actual;
+    errMsg << "Wrong number of arguments passed to " << Callee.str().str()
+           << ", expecting " << expected << " but got " << actual;
     return LogErrorV(errMsg.str().c_str());
   }
+  RecordCall(Callee);
 
   std::vector<llvm::Value *> ArgsV;
   for (unsigned i = 0; i < actual; i++) {
-    ArgsV.push_back(Args[i]->codegen());
+    if (CalleeF->getArg(i)->getType()->isPointerTy()) {
+      // An array parameter takes the name of an array variable.
+      const auto *Array = dynamic_cast<const VariableExprAST *>(Args[i]);
+      if (!Array)
+        return logArrayArgumentError(Callee, i);
+      ArgsV.push_back(IndexExprAST::codegenArray(Array->Name));
+    } else {
+      ArgsV.push_back(Args[i]->codegen());
+    }
     if (!ArgsV.back())
       return nullptr;
   }
 
+  // Calls to a math function LLVM has an intrinsic for go to the intrinsic,
+  // which its optimizations know what to do with.
+  if (auto *Intrinsic = getMathIntrinsic(Callee))
+    CalleeF = Intrinsic;
   return getBuilder().CreateCall(CalleeF, ArgsV, "calltmp");
 }
 
+/// Evaluate a function call.
+llvm::Optional<double> CallExprAST::evaluate() {
+  std::vector<double> ArgValues;
+  for (auto &Arg : Args) {
+    auto ArgValue = Arg->evaluate();
+    if (!ArgValue)
+      return llvm::None;
+    ArgValues.push_back(*ArgValue);
+  }
+
+  return CallFunction(Callee, ArgValues);
+}
+
 /// "CallExprAST(function(arg0, arg1, ..., argn))"
 std::string CallExprAST::toString(const unsigned depth) const {
   std::ostringstream repr;
   insert_indent(repr, depth);
-  repr << "CallExprAST(" << Callee << '(';
+  repr << "CallExprAST(" << Callee.str().str() << '(';
   for (auto it = Args.begin(); it != Args.end(); it++) {
     auto argS = (*it)->toString(depth);
     repr << strltrim(argS);
@@ -0,0 +1,28 @@
+#include "CompilationContext.h"
+#include "util.h" // getFastMathFlags
+
+CompilationContext::CompilationContext()
+    : Context(std::make_unique<llvm::LLVMContext>()),
+      Builder(std::make_unique<llvm::IRBuilder<>>(*Context)) {
+  Builder->setFastMathFlags(getFastMathFlags());
+}
+
+/// The context of the interpreter itself, which every thread works on unless
+/// it has made another one current. It is made the first time it is needed.
+static CompilationContext &getInterpreterContext() {
+  static CompilationContext Interpreter;
+  return Interpreter;
+}
+
+/// The context made current by the innermost Scope on this thread, if any.
+static thread_local CompilationContext *Current = nullptr;
+
+CompilationContext &CompilationContext::getCurrent() {
+  return Current ? *Current : getInterpreterContext();
+}
+
+CompilationContext::Scope::Scope(CompilationContext &C) : Previous(Current) {
+  Current = &C;
+}
+
+CompilationContext::Scope::~Scope() { Current = Previous; }
@@ -0,0 +1,71 @@
+#include <llvm/ADT/SmallString.h>     // llvm::SmallString
+#include <llvm/ADT/StringExtras.h>    // llvm::toHex
+#include <llvm/Support/FileSystem.h>  // llvm::sys::fs::TempFile, llvm::sys::fs::create_directories
+#include <llvm/Support/Path.h>        // llvm::sys::path::append
+#include <llvm/Support/SHA1.h>        // llvm::SHA1
+#include <llvm/Support/raw_ostream.h> // llvm::raw_fd_ostream, llvm::raw_string_ostream
+
+#include "DiskObjectCache.h"
+
+/// The constructor for the DiskObjectCache class.
+DiskObjectCache::DiskObjectCache(std::string CacheDir,
+                                 const llvm::TargetMachine &TM)
+    : CacheDir(std::move(CacheDir)) {
+  TargetKey = TM.getTargetTriple().str() + '\n' + TM.getTargetCPU().str() +
+              '\n' + TM.getTargetFeatureString().str() + '\n';
+}
+
+/// Hash the module's IR together with the target to get the file name.
+std::string DiskObjectCache::getCachePath(const llvm::Module &M) const {
+  // Leave the module identifier out of the hash: the same definition gets a
+  // different one depending on how the JIT split up the module it came from.
+  std::string IR = TargetKey + M.getDataLayoutStr() + '\n';
+  llvm::raw_string_ostream OS(IR);
+  for (const auto &G : M.global_values())
+    G.print(OS);
+  OS.flush();
+
+  llvm::SHA1 Hasher;
+  Hasher.update(IR);
+
+  llvm::SmallString<128> Path(CacheDir);
+  llvm::sys::path::append(Path, llvm::toHex(Hasher.result()) + ".o");
+  return Path.str().str();
+}
+
+/// Write the object file to a temporary file first and then move it into
+/// place, so that another process reading the cache never sees half of it.
+void DiskObjectCache::notifyObjectCompiled(const llvm::Module *M,
+                                           llvm::MemoryBufferRef Obj) {
+  if (llvm::sys::fs::create_directories(CacheDir))
+    return;
+
+  const auto Path = getCachePath(*M);
+  auto Temp = llvm::sys::fs::TempFile::create(Path + ".%%%%%%.tmp");
+  if (!Temp) {
+    llvm::consumeError(Temp.takeError());
+    return;
+  }
+
+  llvm::raw_fd_ostream OS(Temp->FD, /* shouldClose */ false);
+  OS << Obj.getBuffer();
+  OS.flush();
+  if (OS.has_error()) {
+    OS.clear_error();
+    llvm::consumeError(Temp->discard());
+    return;
+  }
+  llvm::consumeError(Temp->keep(Path));
+}
+
+/// Load the object file for the module if it has been compiled before. The
+/// object is named after the module, just like a freshly compiled one is.
+std::unique_ptr<llvm::MemoryBuffer>
+DiskObjectCache::getObject(const llvm::Module *M) {
+  auto Obj = llvm::MemoryBuffer::getFile(getCachePath(*M), /* FileSize */ -1,
+                                         /* RequiresNullTerminator */ false);
+  if (!Obj)
+    return nullptr;
+  return llvm::MemoryBuffer::getMemBufferCopy((*Obj)->getBuffer(),
+                                              M->getModuleIdentifier());
+}
@@ -0,0 +1,311 @@
+#include <llvm/ADT/DenseSet.h>                                // llvm::DenseSet
+#include <llvm/ADT/SmallVector.h>                             // llvm::SmallVector
+#include <llvm/ADT/Triple.h>                                  // llvm::Triple
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>          // llvm::orc::DynamicLibrarySearchGenerator
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h> // llvm::orc::JITTargetMachineBuilder
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h> // llvm::orc::RTDyldObjectLinkingLayer
+#include <llvm/Support/MemoryBuffer.h>                        // llvm::MemoryBuffer
+
+#include <unordered_map> // std::unordered_map
+
+#include "lexer.h"  // getNextToken, getCurrentToken, setInputBuffer, tokenToString
+#include "loader.h" // CompileDefinitions
+#include "parser.h" // SetupBinopPrecedences, ParseDefinition
+#include "util.h"   // LogError
+
+#include "Engine.h"
+#include "ExprAST.h"
+#include "Optimizer.h"
+
+using llvm::orc::JITDylib;
+
+namespace {
+/// What a session knew before it started compiling something, so that it can
+/// go back to that if compiling fails.
+struct Checkpoint {
+  /// The functions that had a prototype.
+  llvm::DenseSet<Symbol> Protos;
+  std::unordered_map<char, int> BinopPrecedence;
+
+  explicit Checkpoint(const CompilationContext &C)
+      : BinopPrecedence(C.BinopPrecedence) {
+    for (const auto &Proto : C.FunctionProtos)
+      Protos.insert(Proto.first);
+  }
+
+  /// Forget every prototype and operator added since the checkpoint.
+  void restore(CompilationContext &C) const {
+    llvm::SmallVector<Symbol, 8> Added;
+    for (const auto &Proto : C.FunctionProtos)
+      if (!Protos.count(Proto.first))
+        Added.push_back(Proto.first);
+    for (auto Name : Added)
+      C.FunctionProtos.erase(Name);
+    C.BinopPrecedence = BinopPrecedence;
+  }
+};
+} // namespace
+
+/// Make an error with the given message.
+static llvm::Error makeError(const llvm::Twine &Message) {
+  return llvm::make_error<llvm::StringError>(Message,
+                                             llvm::inconvertibleErrorCode());
+}
+
+/// Make one error out of the errors collected while compiling, one per line.
+static llvm::Error joinErrors(llvm::ArrayRef<std::string> Errors) {
+  std::string Message;
+  for (const auto &Error : Errors) {
+    if (!Message.empty())
+      Message += '\n';
+    Message += Error;
+  }
+  return makeError(Message);
+}
+
+/// Make a target machine for the host CPU.
+static llvm::Expected<std::unique_ptr<llvm::TargetMachine>>
+createHostTargetMachine() {
+  auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+  if (!JTMB)
+    return JTMB.takeError();
+  return JTMB->createTargetMachine();
+}
+
+Engine::Engine(std::unique_ptr<JITMemoryPool> Pool,
+               std::unique_ptr<llvm::orc::LLJIT> J, JITDylib &Host,
+               unsigned OptLevel)
+    : Pool(std::move(Pool)), J(std::move(J)), Host(Host), OptLevel(OptLevel) {
+}
+
+Engine::~Engine() = default;
+
+llvm::Expected<std::unique_ptr<Engine>> Engine::create(const Options &Opts) {
+  auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+  if (!JTMB)
+    return JTMB.takeError();
+  // Compiled code goes into a pool, which frees the code of a module when
+  // a session is done with it.
+  auto Pool = std::make_unique<JITMemoryPool>();
+  auto *P = Pool.get();
+  const auto CreateObjectLayer =
+      [P](llvm::orc::ExecutionSession &ES,
+          const llvm::Triple &TT) -> std::unique_ptr<llvm::orc::ObjectLayer> {
+    auto Layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+        ES, [P] { return P->createMemoryManager(); });
+    if (TT.isOSBinFormatCOFF()) {
+      Layer->setOverrideObjectFlagsWithResponsibilityFlags(true);
+      Layer->setAutoClaimResponsibilityForObjectSymbols(true);
+    }
+    return Layer;
+  };
+  // With compile threads, LLJIT hands every materialization off to a thread
+  // pool that all sessions share.
+  auto J = llvm::orc::LLJITBuilder()
+               .setJITTargetMachineBuilder(std::move(*JTMB))
+               .setNumCompileThreads(Opts.NumCompileThreads)
+               .setObjectLinkingLayerCreator(CreateObjectLayer)
+               .create();
+  if (!J)
+    return J.takeError();
+
+  // The functions of the host process are defined in a JITDylib of their
+  // own as they are found, so that the JITDylibs of sessions only ever hold
+  // what the sessions compiled.
+  auto Host = (*J)->createJITDylib("host");
+  if (!Host)
+    return Host.takeError();
+  auto Generator =
+      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          (*J)->getDataLayout().getGlobalPrefix());
+  if (!Generator)
+    return Generator.takeError();
+  Host->addGenerator(std::move(*Generator));
+
+  return std::unique_ptr<Engine>(
+      new Engine(std::move(Pool), std::move(*J), *Host, Opts.OptLevel));
+}
+
+llvm::Expected<std::unique_ptr<Session>> Engine::createSession() {
+  JITDylib *JD = nullptr;
+  {
+    std::lock_guard<std::mutex> Guard(FreeDylibsLock);
+    if (!FreeDylibs.empty()) {
+      JD = FreeDylibs.back();
+      FreeDylibs.pop_back();
+    }
+  }
+  if (!JD) {
+    auto NewJD = J->createJITDylib("session." + std::to_string(NumSessions++));
+    if (!NewJD)
+      return NewJD.takeError();
+    // Every session can call the functions of the host process, but none of
+    // the other sessions'.
+    NewJD->addToLinkOrder(Host);
+    JD = &*NewJD;
+  }
+
+  // Sessions optimize what they compile themselves, and optimizers are not
+  // thread-safe, so every session gets its own.
+  auto TM = createHostTargetMachine();
+  if (!TM) {
+    std::lock_guard<std::mutex> Guard(FreeDylibsLock);
+    FreeDylibs.push_back(JD);
+    return TM.takeError();
+  }
+  return std::unique_ptr<Session>(new Session(*this, *JD, std::move(*TM)));
+}
+
+std::uint64_t Engine::getCodeBytesInUse() const {
+  return Pool->getBytesInUse();
+}
+
+CompiledCode::CompiledCode(Session &S, llvm::orc::SymbolStringPtr Name,
+                           std::uint64_t Module, llvm::JITTargetAddress Address)
+    : S(S), Name(std::move(Name)), Module(Module), Address(Address) {}
+
+CompiledCode::~CompiledCode() { S.release(std::move(Name), Module); }
+
+Session::Session(Engine &E, JITDylib &JD,
+                 std::unique_ptr<llvm::TargetMachine> TM)
+    : E(E), JD(JD) {
+  CompilationContext::Scope Scope(Context);
+  SetupBinopPrecedences();
+  Context.TM = std::move(TM);
+  setOptimizer(std::make_unique<Optimizer>(E.OptLevel, Context.TM.get()));
+}
+
+Session::~Session() {
+  // Nothing the session compiled can run anymore, so what it loaded can go,
+  // and the emptied JITDylib can be used by another session. If it cannot
+  // be emptied, it is left as it is rather than handed to a session that
+  // would find these definitions in it.
+  if (!LoadedSymbols.empty())
+    if (auto Err = JD.remove(LoadedSymbols)) {
+      llvm::consumeError(std::move(Err));
+      return;
+    }
+  for (auto Module : LoadedModules)
+    E.Pool->release(Module);
+  E.J->getExecutionSession().getSymbolStringPool()->clearDeadEntries();
+  std::lock_guard<std::mutex> Guard(E.FreeDylibsLock);
+  E.FreeDylibs.push_back(&JD);
+}
+
+llvm::orc::SymbolNameSet Session::tagModule(std::uint64_t &Key) {
+  Key = E.NumModules++;
+  auto &M = borrowModule();
+  M.setModuleIdentifier(
+      JITMemoryPool::tagModuleIdentifier(M.getModuleIdentifier(), Key));
+  llvm::orc::SymbolNameSet Names;
+  for (const auto &GV : M.global_values())
+    if (!GV.isDeclaration() && !GV.hasLocalLinkage())
+      Names.insert(E.J->mangleAndIntern(GV.getName()));
+  return Names;
+}
+
+void Session::release(llvm::orc::SymbolStringPtr Name, std::uint64_t Module) {
+  // This only works on the JIT and the pool, which are both thread-safe, so
+  // it does not have to wait for whatever the session is compiling.
+  if (auto Err = JD.remove({Name})) {
+    llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(),
+                                "Could not remove compiled code: ");
+    return;
+  }
+  E.Pool->release(Module);
+  Name = llvm::orc::SymbolStringPtr();
+  E.J->getExecutionSession().getSymbolStringPool()->clearDeadEntries();
+}
+
+llvm::Error Session::load(llvm::StringRef Source) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  CompilationContext::Scope Scope(Context);
+  const Checkpoint Saved(Context);
+
+  std::vector<std::string> Errors;
+  Context.Errors = &Errors;
+  setInputBuffer(llvm::MemoryBuffer::getMemBufferCopy(Source, JD.getName()));
+  newModule(JD.getName().c_str());
+  borrowModule().setDataLayout(E.J->getDataLayout());
+  CompileDefinitions(JD.getName());
+  Context.Errors = nullptr;
+
+  if (!Errors.empty()) {
+    Saved.restore(Context);
+    return joinErrors(Errors);
+  }
+  std::uint64_t Module;
+  auto Names = tagModule(Module);
+  if (auto Err = E.J->addIRModule(JD, takeModule())) {
+    Saved.restore(Context);
+    return Err;
+  }
+  LoadedSymbols.insert(Names.begin(), Names.end());
+  LoadedModules.push_back(Module);
+  return llvm::Error::success();
+}
+
+llvm::Expected<std::shared_ptr<const CompiledCode>>
+Session::compileFunction(llvm::StringRef Expression,
+                         llvm::ArrayRef<std::string> Params) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  CompilationContext::Scope Scope(Context);
+
+  // The expression is compiled as the body of a definition, which puts the
+  // parameters in scope.
+  const auto Name = "__expr_" + std::to_string(NumExpressions++);
+  std::string Source = "def " + Name + "(";
+  for (const auto &Param : Params)
+    Source += Param + " ";
+  Source += ") ";
+  Source += Expression;
+
+  std::vector<std::string> Errors;
+  Context.Errors = &Errors;
+  setInputBuffer(llvm::MemoryBuffer::getMemBufferCopy(Source, Name));
+  newModule(Name.c_str());
+  borrowModule().setDataLayout(E.J->getDataLayout());
+
+  getNextToken(); // Get the 'def' keyword
+  if (auto Definition = ParseDefinition()) {
+    while (getCurrentToken() == ';')
+      getNextToken();
+    if (getCurrentToken() != tok_eof)
+      LogError(("Unexpected " +
+                tokenToString(static_cast<Token>(getCurrentToken())) +
+                " after the expression")
+                   .c_str());
+    // A parameter that is not a single identifier comes out as more or fewer
+    // parameters, if the definition parses at all.
+    else if (!llvm::makeArrayRef(Definition->getProto().getArgs())
+                  .equals(Params))
+      LogError("Invalid parameter names");
+    else
+      Definition->codegen();
+  }
+  // Nothing can call the function by name, so its prototype is not kept.
+  getFunctionProtos().erase(Symbol::intern(Name));
+  Context.Errors = nullptr;
+
+  if (!Errors.empty())
+    return joinErrors(Errors);
+  std::uint64_t Module;
+  tagModule(Module);
+  if (auto Err = E.J->addIRModule(JD, takeModule()))
+    return Err;
+
+  auto &ES = E.J->getExecutionSession();
+  auto MangledName = E.J->mangleAndIntern(Name);
+  auto Function = ES.lookup(
+      llvm::orc::makeJITDylibSearchOrder(
+          &JD, llvm::orc::JITDylibLookupFlags::MatchAllSymbols),
+      MangledName);
+  if (!Function) {
+    // Whatever could not be linked is of no use to anyone.
+    llvm::consumeError(JD.remove({MangledName}));
+    E.Pool->release(Module);
+    return Function.takeError();
+  }
+  return std::shared_ptr<const CompiledCode>(new CompiledCode(
+      *this, std::move(MangledName), Module, Function->getAddress()));
+}
@@ -1,39 +1,54 @@
+#include "CompilationContext.h"
 #include "ExprAST.h"
+#include "Optimizer.h"
+#include "util.h" // getFastMathFlags
 
 using llvm::LLVMContext;
 
-static LLVMContext Context;
-static llvm::IRBuilder<> Builder(Context);
-static std::unique_ptr<llvm::Module> Module;
-static std::unordered_map<std::string, llvm::AllocaInst *> NamedValues;
-static std::unique_ptr<llvm::legacy::FunctionPassManager> FunctionPassManager =
-    nullptr;
-static std::unordered_map<std::string, std::unique_ptr<PrototypeAST>>
-    FunctionProtos;
+// The state code generation works with belongs to the current
+// CompilationContext of the calling thread.
 
-LLVMContext &getContext() { return Context; }
-llvm::IRBuilder<> &getBuilder() { return Builder; }
+LLVMContext &getContext() { return *CompilationContext::getCurrent().Context; }
+llvm::IRBuilder<> &getBuilder() {
+  return *CompilationContext::getCurrent().Builder;
+}
 
-llvm::Module &borrowModule() { return *Module; }
-std::unique_ptr<llvm::Module> takeModule() { return std::move(Module); }
+llvm::Module &borrowModule() {
+  return *CompilationContext::getCurrent().Module;
+}
+llvm::orc::ThreadSafeModule takeModule() {
+  auto &C = CompilationContext::getCurrent();
+  // The module leaves together with the context that owns it.
+  return llvm::orc::ThreadSafeModule(std::move(C.Module), std::move(C.Context));
+}
 void newModule(const char *newModuleName) {
-  Module = std::make_unique<llvm::Module>(newModuleName, Context);
+  auto &C = CompilationContext::getCurrent();
+  // Whatever is left of the previous module refers to the previous context,
+  // so it has to go first.
+  C.Module.reset();
+  C.Builder.reset();
+  C.Context = std::make_unique<LLVMContext>();
+  C.Builder = std::make_unique<llvm::IRBuilder<>>(*C.Context);
+  C.Builder->setFastMathFlags(getFastMathFlags());
+  C.Module = std::make_unique<llvm::Module>(newModuleName, *C.Context);
+}
+
+llvm::DenseMap<Symbol, llvm::AllocaInst *> &getNamedValues() {
+  return CompilationContext::getCurrent().NamedValues;
 }
 
-std::unordered_map<std::string, llvm::AllocaInst *> &getNamedValues() {
-  return NamedValues;
+llvm::DenseMap<Symbol, double> &getEvaluatedValues() {
+  return CompilationContext::getCurrent().EvaluatedValues;
 }
 
-llvm::legacy::FunctionPassManager *getFunctionPassManager() {
-  return FunctionPassManager.get();
+Optimizer *getOptimizer() {
+  return CompilationContext::getCurrent().FunctionOptimizer.get();
 }
 
-void resetFunctionPassManager() {
-  FunctionPassManager =
-      std::make_unique<llvm::legacy::FunctionPassManager>(Module.get());
+void setOptimizer(std::unique_ptr<Optimizer> NewOptimizer) {
+  CompilationContext::getCurrent().FunctionOptimizer = std::move(NewOptimizer);
 }
 
-std::unordered_map<std::string, std::unique_ptr<PrototypeAST>> &
-getFunctionProtos() {
-  return FunctionProtos;
+llvm::DenseMap<Symbol, std::unique_ptr<PrototypeAST>> &getFunctionProtos() {
+  return CompilationContext::getCurrent().FunctionProtos;
 }
@@ -0,0 +1,713 @@
+#include <algorithm> // std::any_of
+#include <sstream>   // std::ostringstream
+
+#include "dependencies.h" // RecordCall
+#include "fold.h"         // evaluateBuiltinOperator, isTrue
+#include "mathlib.h"      // getMathIntrinsic
+#include "stats.h"        // countEvent
+#include "tiering.h"      // CallFunction
+
+#include "ArrayExprAST.h"
+#include "CallExprAST.h"
+#include "ExprAST.h"
+#include "FlatAST.h"
+#include "ForExprAST.h"
+#include "FunctionAST.h"
+#include "IndexExprAST.h"
+#include "ParallelForExprAST.h"
+
+FlatAST::Ref FlatAST::addNode(Opcode Op, char Operator, std::uint32_t Operand0,
+                              std::uint32_t Operand1, std::uint32_t Operand2) {
+  Nodes.push_back({Op, Operator, {Operand0, Operand1, Operand2}});
+  countEvent(Counter::ASTNodes);
+  return Ref(static_cast<std::uint32_t>(Nodes.size() - 1));
+}
+
+FlatAST::Ref FlatAST::number(double Val) {
+  Numbers.push_back(Val);
+  return addNode(Opcode::Number, 0, Numbers.size() - 1);
+}
+
+FlatAST::Ref FlatAST::variable(Symbol Name) {
+  return addNode(Opcode::Variable, 0, Name.getID());
+}
+
+FlatAST::Ref FlatAST::unary(char Op, Ref Operand) {
+  return addNode(Opcode::Unary, Op, Operand.getIndex());
+}
+
+FlatAST::Ref FlatAST::binary(char Op, Ref LHS, Ref RHS) {
+  return addNode(Opcode::Binary, Op, LHS.getIndex(), RHS.getIndex());
+}
+
+FlatAST::Ref FlatAST::call(Symbol Callee, llvm::ArrayRef<Ref> Args) {
+  const auto Start = Children.size();
+  for (auto Arg : Args)
+    Children.push_back(Arg.getIndex());
+  return addNode(Opcode::Call, 0, Callee.getID(), Start, Args.size());
+}
+
+FlatAST::Ref FlatAST::ifExpr(Ref Cond, Ref Then, Ref Else) {
+  return addNode(Opcode::If, 0, Cond.getIndex(), Then.getIndex(),
+                 Else.getIndex());
+}
+
+FlatAST::Ref FlatAST::forExpr(Symbol VarName, Ref Start, Ref End, Ref Step,
+                              Ref Body) {
+  const auto First = Children.size();
+  for (auto Child : {Start, End, Step, Body})
+    Children.push_back(Child.getIndex());
+  return addNode(Opcode::For, 0, VarName.getID(), First);
+}
+
+FlatAST::Ref FlatAST::parallelFor(Symbol VarName, Ref Start, Ref Bound,
+                                  Ref Step, Ref Body) {
+  const auto First = Children.size();
+  for (auto Child : {Start, Bound, Step, Body})
+    Children.push_back(Child.getIndex());
+  return addNode(Opcode::ParallelFor, 0, VarName.getID(), First);
+}
+
+FlatAST::Ref FlatAST::let(llvm::ArrayRef<std::pair<Symbol, Ref>> VarNames,
+                          Ref Body) {
+  const auto Start = Children.size();
+  for (const auto &NameValuePair : VarNames) {
+    Children.push_back(NameValuePair.first.getID());
+    Children.push_back(NameValuePair.second.getIndex());
+  }
+  return addNode(Opcode::Let, 0, Body.getIndex(), Start, VarNames.size());
+}
+
+FlatAST::Ref FlatAST::index(Symbol Array, Ref Index) {
+  return addNode(Opcode::Index, 0, Array.getID(), Index.getIndex());
+}
+
+FlatAST::Ref FlatAST::array(Ref Size) {
+  return addNode(Opcode::Array, 0, Size.getIndex());
+}
+
+llvm::Optional<double> FlatAST::getNumber(Ref N) const {
+  if (getNode(N).Op != Opcode::Number)
+    return llvm::None;
+  return Numbers[getNode(N).Operands[0]];
+}
+
+void FlatAST::define(std::unique_ptr<PrototypeAST> Proto, Ref Body,
+                     bool Pure, bool Constant) {
+  this->Proto = std::move(Proto);
+  this->Body = Body;
+  this->Pure = Pure;
+  this->Constant = Constant;
+}
+
+/// Getter for the "Proto" field of instances of FlatAST.
+const PrototypeAST &FlatAST::getProto() const { return *Proto; }
+
+/// Whether the prototype has array parameters or the body has array nodes.
+bool FlatAST::usesArrays() const {
+  return Proto->hasArrayArgs() ||
+         std::any_of(Nodes.begin(), Nodes.end(), [](const Node &N) {
+           return N.Op == Opcode::Index || N.Op == Opcode::Array;
+         });
+}
+
+/// Generate LLVM IR for a function definition.
+llvm::Function *FlatAST::codegen() const {
+  return FunctionAST::codegenDefinition(*Proto,
+                                        [this] { return codegenNode(Body); });
+}
+
+/// Evaluate the body of a function definition.
+llvm::Optional<double> FlatAST::evaluate(llvm::ArrayRef<double> Args) const {
+  return FunctionAST::evaluateDefinition(
+      *Proto, Args, [this] { return evaluateNode(Body); });
+}
+
+/// Generate LLVM IR for a node. Each case does what the codegen method of the
+/// matching ExprAST subclass does.
+llvm::Value *FlatAST::codegenNode(Ref N) const {
+  const auto &Node = getNode(N);
+  const auto *Operands = Node.Operands;
+  auto &Builder = getBuilder();
+  auto &Context = getContext();
+  auto &NamedValues = getNamedValues();
+  // A string stream for holding potential error messages.
+  std::ostringstream errMsg;
+
+  switch (Node.Op) {
+  case Opcode::Number:
+    return llvm::ConstantFP::get(Context, llvm::APFloat(Numbers[Operands[0]]));
+
+  case Opcode::Variable: {
+    const auto Name = Symbol::fromID(Operands[0]);
+    auto V = NamedValues.find(Name);
+    if (V == NamedValues.end() || !V->second) {
+      errMsg << "Unknown variable name: " << Name.str().str();
+      return LogErrorV(errMsg.str().c_str());
+    }
+    if (isArrayVariable(V->second)) {
+      errMsg << Name.str().str()
+             << " is an array, so it can only be indexed or passed to a "
+                "function";
+      return LogErrorV(errMsg.str().c_str());
+    }
+    return Builder.CreateLoad(V->second->getAllocatedType(), V->second,
+                              Name.str());
+  }
+
+  case Opcode::Unary: {
+    llvm::Value *OperandValue = codegenNode(Ref(Operands[0]));
+    if (!OperandValue)
+      return nullptr;
+
+    llvm::Function *Operator =
+        getFunction(Symbol::unaryOperator(Node.Operator));
+    if (!Operator) {
+      errMsg << "Unknown unary operator " << Node.Operator;
+      return LogErrorV(errMsg.str().c_str());
+    }
+    RecordCall(Symbol::unaryOperator(Node.Operator));
+    return Builder.CreateCall(Operator, OperandValue, "unop");
+  }
+
+  case Opcode::Binary: {
+    const Ref LHS(Operands[0]), RHS(Operands[1]);
+    if (Node.Operator == '=' && getNode(LHS).Op == Opcode::Index) {
+      // An element of an array is stored to without loading it first.
+      const auto *ElementOperands = getNode(LHS).Operands;
+      llvm::Value *Index = codegenNode(Ref(ElementOperands[1]));
+      llvm::Value *R = codegenNode(RHS);
+      if (!Index || !R)
+        return nullptr;
+
+      llvm::Value *Element = IndexExprAST::codegenElementAddress(
+          Symbol::fromID(ElementOperands[0]), Index);
+      if (!Element)
+        return nullptr;
+      Builder.CreateStore(R, Element);
+      return R;
+    }
+    if (Node.Operator == '=') {
+      // The LHS is not emitted as an expression, it has to name a variable.
+      llvm::Value *R = codegenNode(RHS);
+      if (!R)
+        return nullptr;
+
+      const auto LHSS = nodeToString(LHS, 0);
+      errMsg << "Could not assign value " << nodeToString(RHS, 0) << " to "
+             << LHSS << " beacuse ";
+      if (getNode(LHS).Op != Opcode::Variable) {
+        errMsg << LHSS << " is not a variable expression.";
+        return LogErrorV(errMsg.str().c_str());
+      }
+
+      const auto Name = Symbol::fromID(getNode(LHS).Operands[0]);
+      auto Var = NamedValues.find(Name);
+      if (Var == NamedValues.end() || !Var->second) {
+        errMsg << Name.str().str() << " is an unknown variable name.";
+        return LogErrorV(errMsg.str().c_str());
+      }
+      Builder.CreateStore(R, Var->second);
+      return R;
+    }
+
+    llvm::Value *L = codegenNode(LHS);
+    llvm::Value *R = codegenNode(RHS);
+    if (!L || !R)
+      return nullptr;
+
+    switch (Node.Operator) {
+    case '+':
+      return Builder.CreateFAdd(L, R, "addtmp");
+    case '-':
+      return Builder.CreateFSub(L, R, "subtmp");
+    case '*':
+      return Builder.CreateFMul(L, R, "multmp");
+    case '/':
+      return Builder.CreateFDiv(L, R, "divtmp");
+    case '<':
+      L = Builder.CreateFCmpULT(L, R, "cmpulttmp");
+      return Builder.CreateUIToFP(L, llvm::Type::getDoubleTy(Context),
+                                  "booltmp");
+    case '>':
+      L = Builder.CreateFCmpUGT(L, R, "cmpugttmp");
+      return Builder.CreateUIToFP(L, llvm::Type::getDoubleTy(Context),
+                                  "booltmp");
+    }
+
+    // Otherwise, this is a user-defined binary operator.
+    llvm::Function *F = getFunction(Symbol::binaryOperator(Node.Operator));
+    if (!F) {
+      errMsg << "Unknown binary operator " << Node.Operator;
+      return LogErrorV(errMsg.str().c_str());
+    }
+    RecordCall(Symbol::binaryOperator(Node.Operator));
+    llvm::Value *BinopOperands[2] = {L, R};
+    return Builder.CreateCall(F, BinopOperands, "binop");
+  }
+
+  case Opcode::Call: {
+    const auto Callee = Symbol::fromID(Operands[0]);
+    llvm::Function *CalleeF = getFunction(Callee);
+    if (!CalleeF) {
+      errMsg << "Unknown function referenced: " << Callee.str().str();
+      return LogErrorV(errMsg.str().c_str());
+    }
+
+    const std::size_t expected = CalleeF->arg_size();
+    const std::size_t actual = Operands[2];
+    if (expected != actual) {
+      errMsg << "Wrong number of arguments passed to " << Callee.str().str()
+             << ", expecting " << expected << " but got " << actual;
+      return LogErrorV(errMsg.str().c_str());
+    }
+    RecordCall(Callee);
+
+    std::vector<llvm::Value *> ArgsV;
+    for (std::uint32_t i = 0; i < actual; i++) {
+      const Ref Arg(Children[Operands[1] + i]);
+      if (CalleeF->getArg(i)->getType()->isPointerTy()) {
+        // An array parameter takes the name of an array variable.
+        if (getNode(Arg).Op != Opcode::Variable)
+          return CallExprAST::logArrayArgumentError(Callee, i);
+        ArgsV.push_back(IndexExprAST::codegenArray(
+            Symbol::fromID(getNode(Arg).Operands[0])));
+      } else {
+        ArgsV.push_back(codegenNode(Arg));
+      }
+      if (!ArgsV.back())
+        return nullptr;
+    }
+    // Math functions go to their intrinsics, like in CallExprAST::codegen.
+    if (auto *Intrinsic = getMathIntrinsic(Callee))
+      CalleeF = Intrinsic;
+    return Builder.CreateCall(CalleeF, ArgsV, "calltmp");
+  }
+
+  case Opcode::If: {
+    llvm::Value *CondV = codegenNode(Ref(Operands[0]));
+    if (!CondV)
+      return nullptr;
+    CondV = Builder.CreateFCmpONE(
+        CondV, llvm::ConstantFP::get(Context, llvm::APFloat(0.0)), "ifcond");
+
+    llvm::Function *Function = Builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *ThenBuildingBlock =
+        llvm::BasicBlock::Create(Context, "then", Function);
+    llvm::BasicBlock *ElseBuildingBlock =
+        llvm::BasicBlock::Create(Context, "else");
+    llvm::BasicBlock *Merged = llvm::BasicBlock::Create(Context, "ifcont");
+    Builder.CreateCondBr(CondV, ThenBuildingBlock, ElseBuildingBlock);
+
+    Builder.SetInsertPoint(ThenBuildingBlock);
+    llvm::Value *ThenV = codegenNode(Ref(Operands[1]));
+    if (!ThenV)
+      return nullptr;
+    Builder.CreateBr(Merged);
+    ThenBuildingBlock = Builder.GetInsertBlock();
+
+    Function->getBasicBlockList().push_back(ElseBuildingBlock);
+    Builder.SetInsertPoint(ElseBuildingBlock);
+    llvm::Value *ElseV = codegenNode(Ref(Operands[2]));
+    if (!ElseV)
+      return nullptr;
+    Builder.CreateBr(Merged);
+    ElseBuildingBlock = Builder.GetInsertBlock();
+
+    Function->getBasicBlockList().push_back(Merged);
+    Builder.SetInsertPoint(Merged);
+    llvm::PHINode *PhiNode =
+        Builder.CreatePHI(llvm::Type::getDoubleTy(Context), 2, "iftmp");
+    PhiNode->addIncoming(ThenV, ThenBuildingBlock);
+    PhiNode->addIncoming(ElseV, ElseBuildingBlock);
+    return PhiNode;
+  }
+
+  case Opcode::For: {
+    const auto VarName = Symbol::fromID(Operands[0]);
+    const Ref Start(Children[Operands[1]]), End(Children[Operands[1] + 1]),
+        Step(Children[Operands[1] + 2]), Body(Children[Operands[1] + 3]);
+
+    ForExprAST::Shape LoopShape;
+    if (getNode(Start).Op == Opcode::Number)
+      LoopShape.ConstantStart = Numbers[getNode(Start).Operands[0]];
+    if (!Step)
+      LoopShape.ConstantStep = 1.0;
+    else if (getNode(Step).Op == Opcode::Number)
+      LoopShape.ConstantStep = Numbers[getNode(Step).Operands[0]];
+
+    // Look for a condition like "i < n".
+    const auto &Condition = getNode(End);
+    if (Condition.Op == Opcode::Binary && Condition.Operator == '<') {
+      const auto &Variable = getNode(Ref(Condition.Operands[0]));
+      LoopShape.HasUpperBound = Variable.Op == Opcode::Variable &&
+                                Variable.Operands[0] == VarName.getID();
+    }
+
+    return ForExprAST::codegenLoop(
+        VarName, LoopShape, [&] { return codegenNode(Start); },
+        [&] { return codegenNode(End); },
+        [&] { return codegenNode(Ref(Condition.Operands[1])); },
+        [&] { return codegenNode(Step); }, [&] { return codegenNode(Body); });
+  }
+
+  case Opcode::ParallelFor: {
+    const Ref Start(Children[Operands[1]]), Bound(Children[Operands[1] + 1]),
+        Step(Children[Operands[1] + 2]), Body(Children[Operands[1] + 3]);
+    return ParallelForExprAST::codegenLoop(
+        Symbol::fromID(Operands[0]), [&] { return codegenNode(Start); },
+        [&] { return codegenNode(Bound); },
+        [&]() -> llvm::Value * {
+          if (Step)
+            return codegenNode(Step);
+          return llvm::ConstantFP::get(Context, llvm::APFloat(1.0));
+        },
+        [&] { return codegenNode(Body); });
+  }
+
+  case Opcode::Let: {
+    const std::uint32_t Start = Operands[1], Count = Operands[2];
+    std::vector<llvm::AllocaInst *> OldBindings;
+    llvm::Value *SavedStack = nullptr;
+
+    llvm::Function *Function = Builder.GetInsertBlock()->getParent();
+    for (std::uint32_t i = 0; i < Count; i++) {
+      const auto VarName = Symbol::fromID(Children[Start + 2 * i]);
+      const Ref InitialExpr(Children[Start + 2 * i + 1]);
+      if (!SavedStack && InitialExpr &&
+          getNode(InitialExpr).Op == Opcode::Array)
+        SavedStack = ArrayExprAST::codegenStackSave();
+
+      // The initial value is generated before the variable is in scope.
+      llvm::Value *InitialValue =
+          InitialExpr ? codegenNode(InitialExpr)
+                      : llvm::ConstantFP::get(Context, llvm::APFloat(0.0));
+      if (!InitialValue)
+        return nullptr;
+
+      llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(
+          Function, VarName.str(), InitialValue->getType());
+      Builder.CreateStore(InitialValue, Alloca);
+      OldBindings.push_back(NamedValues[VarName]);
+      NamedValues[VarName] = Alloca;
+    }
+
+    llvm::Value *BodyVal = codegenNode(Ref(Operands[0]));
+    if (!BodyVal)
+      return nullptr;
+    if (SavedStack)
+      ArrayExprAST::codegenStackRestore(SavedStack);
+
+    // Restore the old values of the variables, latest first in case the same
+    // name was bound more than once.
+    for (std::uint32_t i = Count; i-- > 0;)
+      NamedValues[Symbol::fromID(Children[Start + 2 * i])] = OldBindings[i];
+    return BodyVal;
+  }
+
+  case Opcode::Index: {
+    llvm::Value *Index = codegenNode(Ref(Operands[1]));
+    if (!Index)
+      return nullptr;
+    const auto Array = Symbol::fromID(Operands[0]);
+    llvm::Value *Element = IndexExprAST::codegenElementAddress(Array, Index);
+    if (!Element)
+      return nullptr;
+    return Builder.CreateLoad(llvm::Type::getDoubleTy(Context), Element,
+                              Array.str());
+  }
+
+  case Opcode::Array: {
+    llvm::Value *Size = codegenNode(Ref(Operands[0]));
+    if (!Size)
+      return nullptr;
+    return ArrayExprAST::codegenAllocation(Size);
+  }
+  }
+  llvm_unreachable("unknown FlatAST opcode");
+}
+
+/// Evaluate a node. Each case does what the evaluate method of the matching
+/// ExprAST subclass does.
+llvm::Optional<double> FlatAST::evaluateNode(Ref N) const {
+  const auto &Node = getNode(N);
+  const auto *Operands = Node.Operands;
+  auto &EvaluatedValues = getEvaluatedValues();
+  // A string stream for holding potential error messages.
+  std::ostringstream errMsg;
+
+  switch (Node.Op) {
+  case Opcode::Number:
+    return Numbers[Operands[0]];
+
+  case Opcode::Variable: {
+    const auto Name = Symbol::fromID(Operands[0]);
+    auto V = EvaluatedValues.find(Name);
+    if (V == EvaluatedValues.end()) {
+      errMsg << "Unknown variable name: " << Name.str().str();
+      return LogErrorD(errMsg.str().c_str());
+    }
+    return V->second;
+  }
+
+  case Opcode::Unary: {
+    auto OperandValue = evaluateNode(Ref(Operands[0]));
+    if (!OperandValue)
+      return llvm::None;
+
+    const auto Operator = Symbol::unaryOperator(Node.Operator);
+    if (!getFunctionProtos().count(Operator)) {
+      errMsg << "Unknown unary operator " << Node.Operator;
+      return LogErrorD(errMsg.str().c_str());
+    }
+    return CallFunction(Operator, *OperandValue);
+  }
+
+  case Opcode::Binary: {
+    const Ref LHS(Operands[0]), RHS(Operands[1]);
+    if (Node.Operator == '=' && getNode(LHS).Op == Opcode::Index)
+      return IndexExprAST::logInterpretedArrayError();
+    if (Node.Operator == '=') {
+      if (getNode(LHS).Op != Opcode::Variable) {
+        const auto LHSS = nodeToString(LHS, 0);
+        errMsg << "Could not assign value " << nodeToString(RHS, 0) << " to "
+               << LHSS << " beacuse " << LHSS
+               << " is not a variable expression.";
+        return LogErrorD(errMsg.str().c_str());
+      }
+
+      auto R = evaluateNode(RHS);
+      if (!R)
+        return llvm::None;
+
+      const auto Name = Symbol::fromID(getNode(LHS).Operands[0]);
+      auto Var = EvaluatedValues.find(Name);
+      if (Var == EvaluatedValues.end()) {
+        errMsg << "Unknown variable name: " << Name.str().str();
+        return LogErrorD(errMsg.str().c_str());
+      }
+      Var->second = *R;
+      return R;
+    }
+
+    auto L = evaluateNode(LHS);
+    auto R = evaluateNode(RHS);
+    if (!L || !R)
+      return llvm::None;
+
+    if (auto Result = evaluateBuiltinOperator(Node.Operator, *L, *R))
+      return Result;
+
+    // Otherwise, this is a user-defined binary operator.
+    const double BinopOperands[2] = {*L, *R};
+    return CallFunction(Symbol::binaryOperator(Node.Operator), BinopOperands);
+  }
+
+  case Opcode::Call: {
+    std::vector<double> ArgValues;
+    for (std::uint32_t i = 0; i < Operands[2]; i++) {
+      auto ArgValue = evaluateNode(Ref(Children[Operands[1] + i]));
+      if (!ArgValue)
+        return llvm::None;
+      ArgValues.push_back(*ArgValue);
+    }
+    return CallFunction(Symbol::fromID(Operands[0]), ArgValues);
+  }
+
+  case Opcode::If: {
+    auto CondV = evaluateNode(Ref(Operands[0]));
+    if (!CondV)
+      return llvm::None;
+    if (isTrue(*CondV))
+      return evaluateNode(Ref(Operands[1]));
+    return evaluateNode(Ref(Operands[2]));
+  }
+
+  case Opcode::For: {
+    const Ref Start(Children[Operands[1]]), End(Children[Operands[1] + 1]),
+        Step(Children[Operands[1] + 2]), Body(Children[Operands[1] + 3]);
+    return ForExprAST::evaluateLoop(
+        Symbol::fromID(Operands[0]), [&] { return evaluateNode(Start); },
+        [&] { return evaluateNode(End); },
+        [&]() -> llvm::Optional<double> {
+          if (Step)
+            return evaluateNode(Step);
+          return 1.0;
+        },
+        [&] { return evaluateNode(Body); });
+  }
+
+  case Opcode::ParallelFor: {
+    const Ref Start(Children[Operands[1]]), Bound(Children[Operands[1] + 1]),
+        Step(Children[Operands[1] + 2]), Body(Children[Operands[1] + 3]);
+    return ParallelForExprAST::evaluateLoop(
+        Symbol::fromID(Operands[0]), [&] { return evaluateNode(Start); },
+        [&] { return evaluateNode(Bound); },
+        [&]() -> llvm::Optional<double> {
+          if (Step)
+            return evaluateNode(Step);
+          return 1.0;
+        },
+        [&] { return evaluateNode(Body); });
+  }
+
+  case Opcode::Let: {
+    const std::uint32_t Start = Operands[1], Count = Operands[2];
+    std::vector<llvm::Optional<double>> OldBindings;
+
+    for (std::uint32_t i = 0; i < Count; i++) {
+      const auto VarName = Symbol::fromID(Children[Start + 2 * i]);
+      const Ref InitialExpr(Children[Start + 2 * i + 1]);
+
+      auto InitialValue = InitialExpr ? evaluateNode(InitialExpr)
+                                      : llvm::Optional<double>(0.0);
+      if (!InitialValue)
+        return llvm::None;
+
+      auto Old = EvaluatedValues.find(VarName);
+      OldBindings.push_back(Old == EvaluatedValues.end()
+                                ? llvm::Optional<double>()
+                                : llvm::Optional<double>(Old->second));
+      EvaluatedValues[VarName] = *InitialValue;
+    }
+
+    auto BodyVal = evaluateNode(Ref(Operands[0]));
+    if (!BodyVal)
+      return llvm::None;
+
+    for (std::uint32_t i = Count; i-- > 0;) {
+      const auto VarName = Symbol::fromID(Children[Start + 2 * i]);
+      if (OldBindings[i])
+        EvaluatedValues[VarName] = *OldBindings[i];
+      else
+        EvaluatedValues.erase(VarName);
+    }
+    return BodyVal;
+  }
+
+  case Opcode::Index:
+  case Opcode::Array:
+    return IndexExprAST::logInterpretedArrayError();
+  }
+  llvm_unreachable("unknown FlatAST opcode");
+}
+
+/// Print a node the way the toString method of the matching ExprAST subclass
+/// does.
+std::string FlatAST::nodeToString(Ref N, const unsigned depth) const {
+  const auto &Node = getNode(N);
+  const auto *Operands = Node.Operands;
+  std::ostringstream repr;
+  insert_indent(repr, depth);
+
+  switch (Node.Op) {
+  case Opcode::Number:
+    repr << "NumberExprAST(" << Numbers[Operands[0]] << ')';
+    break;
+
+  case Opcode::Variable:
+    repr << "VariableExprAST(" << Symbol::fromID(Operands[0]).str().str()
+         << ')';
+    break;
+
+  case Opcode::Unary: {
+    auto OperandS = nodeToString(Ref(Operands[0]), depth);
+    repr << Node.Operator << strltrim(OperandS);
+    break;
+  }
+
+  case Opcode::Binary: {
+    auto LHSS = nodeToString(Ref(Operands[0]), depth),
+         RHSS = nodeToString(Ref(Operands[1]), depth);
+    repr << strltrim(LHSS) << ' ' << Node.Operator << ' ' << strltrim(RHSS);
+    break;
+  }
+
+  case Opcode::Call:
+    repr << "CallExprAST(" << Symbol::fromID(Operands[0]).str().str() << '(';
+    for (std::uint32_t i = 0; i < Operands[2]; i++) {
+      auto ArgS = nodeToString(Ref(Children[Operands[1] + i]), depth);
+      repr << (i ? ", " : "") << strltrim(ArgS);
+    }
+    repr << "))";
+    break;
+
+  case Opcode::If: {
+    auto CondS = nodeToString(Ref(Operands[0]), depth + 1),
+         ThenS = nodeToString(Ref(Operands[1]), depth + 1),
+         ElseS = nodeToString(Ref(Operands[2]), depth + 1);
+    repr << "IfExprAST(" << strltrim(CondS) << std::endl;
+    insert_indent(repr, depth + 1);
+    repr << "? " << strltrim(ThenS) << std::endl;
+    insert_indent(repr, depth + 1);
+    repr << ": " << strltrim(ElseS) << std::endl;
+    insert_indent(repr, depth);
+    repr << ')';
+    break;
+  }
+
+  case Opcode::For:
+  case Opcode::ParallelFor: {
+    const Ref Start(Children[Operands[1]]), End(Children[Operands[1] + 1]),
+        Step(Children[Operands[1] + 2]), Body(Children[Operands[1] + 3]);
+    auto StartS = nodeToString(Start, depth + 1),
+         EndS = nodeToString(End, depth + 1);
+    repr << (Node.Op == Opcode::For ? "ForExprAST(" : "ParallelForExprAST(")
+         << Symbol::fromID(Operands[0]).str().str() << " = "
+         << strltrim(StartS) << ", " << strltrim(EndS);
+    if (Step) {
+      auto StepS = nodeToString(Step, depth + 1);
+      repr << ", " << strltrim(StepS);
+    }
+    repr << ',' << std::endl << nodeToString(Body, depth + 1) << std::endl;
+    insert_indent(repr, depth);
+    repr << ')';
+    break;
+  }
+
+  case Opcode::Let: {
+    const std::uint32_t Start = Operands[1], Count = Operands[2];
+    repr << "LetExprAST(" << std::endl;
+    for (std::uint32_t i = 0; i < Count; i++) {
+      const Ref InitialExpr(Children[Start + 2 * i + 1]);
+      auto InitialExprS =
+          InitialExpr ? nodeToString(InitialExpr, depth + 1)
+                      : std::string("NumberExprAST(0)");
+      insert_indent(repr, depth + 1);
+      repr << Symbol::fromID(Children[Start + 2 * i]).str().str() << " = "
+           << strltrim(InitialExprS) << (i == Count - 1 ? ';' : ',')
+           << std::endl;
+    }
+    repr << nodeToString(Ref(Operands[0]), depth + 1) << std::endl;
+    insert_indent(repr, depth);
+    repr << ')';
+    break;
+  }
+
+  case Opcode::Index: {
+    auto IndexS = nodeToString(Ref(Operands[1]), depth);
+    repr << "IndexExprAST(" << Symbol::fromID(Operands[0]).str().str() << '['
+         << strltrim(IndexS) << "])";
+    break;
+  }
+
+  case Opcode::Array: {
+    auto SizeS = nodeToString(Ref(Operands[0]), depth);
+    repr << "ArrayExprAST(" << strltrim(SizeS) << ')';
+    break;
+  }
+  }
+  return repr.str();
+}
+
+/// "FunctionAST(prototype, body)"
+std::string FlatAST::toString(const unsigned depth) const {
+  std::ostringstream repr;
+  insert_indent(repr, depth);
+  repr << "FunctionAST(" << std::endl
+       << Proto->toString(depth + 1) << ',' << std::endl
+       << nodeToString(Body, depth + 1) << std::endl;
+  insert_indent(repr, depth);
+  repr << ')';
+  return repr.str();
+}
@@ -1,17 +1,100 @@
+#include <llvm/ADT/STLExtras.h> // llvm::all_of, llvm::make_early_inc_range
+#include <llvm/IR/Intrinsics.h> // llvm::Intrinsic
+
+#include <cmath>   // std::abs, std::trunc
+#include <cstdint> // std::int64_t
 #include <sstream> // std::ostringstream
 
+#include "tiering.h" // CountLoopIteration
+
+#include "BinaryExprAST.h"
 #include "ForExprAST.h"
+#include "NumberExprAST.h"
+#include "VariableExprAST.h"
 
 /// The constructor for the ForExprAST class.
-ForExprAST::ForExprAST(const std::string &Name, std::unique_ptr<ExprAST> Start,
-                       std::unique_ptr<ExprAST> End,
-                       std::unique_ptr<ExprAST> Step,
-                       std::unique_ptr<ExprAST> Body)
-    : VarName(Name), Start(std::move(Start)), End(std::move(End)),
-      Step(std::move(Step)), Body(std::move(Body)) {}
+ForExprAST::ForExprAST(Symbol Name, ExprAST *Start, ExprAST *End,
+                       ExprAST *Step, ExprAST *Body)
+    : VarName(Name), Start(Start), End(End), Step(Step), Body(Body) {}
 
 /// Generate LLVM IR for a for expression.
 llvm::Value *ForExprAST::codegen() {
+  // The start and the step are constants if they are number literals, and so
+  // is a step that is left out, which is 1.
+  Shape LoopShape;
+  if (const auto *Number = dynamic_cast<NumberExprAST *>(Start))
+    LoopShape.ConstantStart = Number->getValue();
+  if (!Step)
+    LoopShape.ConstantStep = 1.0;
+  else if (const auto *Number = dynamic_cast<NumberExprAST *>(Step))
+    LoopShape.ConstantStep = Number->getValue();
+
+  // Look for a condition like "i < n".
+  const auto *Condition = dynamic_cast<BinaryExprAST *>(End);
+  if (Condition && Condition->getOp() == '<') {
+    const auto *Variable =
+        dynamic_cast<VariableExprAST *>(Condition->getLHS());
+    LoopShape.HasUpperBound = Variable && Variable->Name == VarName;
+  }
+
+  return codegenLoop(
+      VarName, LoopShape, [this] { return Start->codegen(); },
+      [this] { return End->codegen(); },
+      [Condition] { return Condition->getRHS()->codegen(); },
+      [this] { return Step->codegen(); }, [this] { return Body->codegen(); });
+}
+
+/// The largest magnitude up to which every integer is a double, which is as
+/// far as a counted loop counts.
+static constexpr double MaxExactInteger = 9007199254740992.0; // 2^53
+
+/// Whether a loop with the given shape can be counted with an integer, which
+/// takes on exactly the same values as the double it replaces would.
+///
+/// @param LoopShape what is known about the parts of the loop
+/// @return true if the loop starts at an integer, and goes up by an integral
+///         step while the variable is less than the bound
+static bool isCountable(const ForExprAST::Shape &LoopShape) {
+  if (!LoopShape.ConstantStart || !LoopShape.ConstantStep ||
+      !LoopShape.HasUpperBound)
+    return false;
+  const double Start = *LoopShape.ConstantStart,
+               Step = *LoopShape.ConstantStep;
+  if (std::trunc(Start) != Start || std::abs(Start) > MaxExactInteger ||
+      std::trunc(Step) != Step || std::abs(Step) > MaxExactInteger)
+    return false;
+  // Counting down would go on until the integer overflows.
+  return Step > 0;
+}
+
+/// Generate LLVM IR for the integer that the loop counter is compared
+/// against, so that the counter being less than it is the same thing as the
+/// induction variable being less than the bound.
+///
+/// @param Bound the bound the induction variable is compared against
+/// @return the integer bound
+static llvm::Value *codegenIntegerBound(llvm::Value *Bound) {
+  auto &Builder = getBuilder();
+  // Clamp the bound to where the counter stops counting. A NaN bound makes
+  // "i < n" true, and minnum returns the other operand for it, so the loop
+  // keeps going just like it does for the double.
+  Bound = Builder.CreateMinNum(
+      Bound, llvm::ConstantFP::get(Bound->getType(), MaxExactInteger));
+  Bound = Builder.CreateMaxNum(
+      Bound, llvm::ConstantFP::get(Bound->getType(), -MaxExactInteger));
+  // An integer is less than the bound exactly when it is less than the bound
+  // rounded up.
+  Bound = Builder.CreateUnaryIntrinsic(llvm::Intrinsic::ceil, Bound);
+  return Builder.CreateFPToSI(Bound, Builder.getInt64Ty(), "bound");
+}
+
+llvm::Value *ForExprAST::codegenLoop(
+    Symbol VarName, const Shape &LoopShape,
+    llvm::function_ref<llvm::Value *()> GenerateStart,
+    llvm::function_ref<llvm::Value *()> GenerateEnd,
+    llvm::function_ref<llvm::Value *()> GenerateBound,
+    llvm::function_ref<llvm::Value *()> GenerateStep,
+    llvm::function_ref<llvm::Value *()> GenerateBody) {
   auto &Builder = getBuilder();
   // Generate the basic block for the start of the loop body,
   // taking into account that that block could have multiple
@@ -21,17 +104,17 @@ llvm::Value *ForExprAST::codegen() {
   // Create an alloca for the variable in the entry block.
   // This is required because we allow the user (programmer) to
   // mutate induction variables in loops.
-  llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(Function, VarName);
+  llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(Function, VarName.str());
 
   // Emit LLVM IR for the initial expression without the
   // induction variable in scope
-  llvm::Value *StartVal = Start->codegen();
+  llvm::Value *StartVal = GenerateStart();
   if (!StartVal)
     return nullptr;
 
   // Use the alloca instruction we created above to store
   // StartVal on the stack.
-  Builder.CreateStore(StartVal, Alloca);
+  llvm::StoreInst *StartStore = Builder.CreateStore(StartVal, Alloca);
 
   llvm::BasicBlock *LoopHeaderBasicBlock = Builder.GetInsertBlock();
   llvm::BasicBlock *LoopBasicBlock =
@@ -43,6 +126,28 @@ llvm::Value *ForExprAST::codegen() {
   // Start insterting code into the LoopBasicBlock
   Builder.SetInsertPoint(LoopBasicBlock);
 
+  // With a constant step, the induction variable can be a phi node that goes
+  // up by the step every iteration, which is the shape of loop that LLVM's
+  // loop passes know how to analyze. Better yet, a loop like
+  // "for i = 0, i < n in" can count with an integer that is converted to the
+  // variable, and compared against the bound instead of the variable, so
+  // that the number of iterations can be worked out ahead of time. That only
+  // works if nothing in the loop assigns to the variable, which is only known
+  // once the loop has been generated, so the phi node is made up front and
+  // thrown away if not.
+  const bool Countable = isCountable(LoopShape);
+  llvm::PHINode *Counter = nullptr;
+  llvm::Instruction *Variable = nullptr;
+  if (Countable) {
+    Counter =
+        Builder.CreatePHI(Builder.getInt64Ty(), 2, VarName.str() + ".count");
+    Variable = llvm::cast<llvm::Instruction>(Builder.CreateSIToFP(
+        Counter, llvm::Type::getDoubleTy(getContext()), VarName.str()));
+  } else if (LoopShape.ConstantStep) {
+    Variable = Builder.CreatePHI(llvm::Type::getDoubleTy(getContext()), 2,
+                                 VarName.str());
+  }
+
   // Save the old value of the variable with this name in case
   // it shadows an earlier one
   auto &NamedValues = getNamedValues();
@@ -51,41 +156,111 @@ llvm::Value *ForExprAST::codegen() {
 
   // Emit LLVM IR for the loop body. Keep in mind doing this
   // can change the current basic block
-  if (!Body->codegen())
+  if (!GenerateBody())
     return nullptr; // Don't allow an error
 
-  // Emit the step value, setting it to 1.0 if it does not exist
+  // Emit the step value, which is only emitted once per iteration
+  // when it is not a constant
   llvm::Value *StepVal = nullptr;
-  if (Step) {
-    StepVal = Step->codegen();
+  if (LoopShape.ConstantStep) {
+    StepVal = llvm::ConstantFP::get(getContext(),
+                                    llvm::APFloat(*LoopShape.ConstantStep));
+  } else {
+    StepVal = GenerateStep();
     if (!StepVal)
       return nullptr;
+  }
+
+  // Emit the conditional expression. A loop that can be counted only emits
+  // the bound, since the variable is compared against it differently
+  // depending on how the variable ends up being generated.
+  llvm::Value *CondVal = nullptr, *ComparedVal = nullptr, *BoundVal = nullptr;
+  if (Countable) {
+    ComparedVal = Builder.CreateLoad(Alloca);
+    BoundVal = GenerateBound();
+    if (!BoundVal)
+      return nullptr;
   } else {
-    StepVal = llvm::ConstantFP::get(getContext(), llvm::APFloat(1.0));
+    CondVal = GenerateEnd();
+    if (!CondVal)
+      return nullptr;
+    // Convert condition to a boolean by comparing not-equal to 0.0
+    CondVal = Builder.CreateFCmpONE(
+        CondVal, llvm::ConstantFP::get(getContext(), llvm::APFloat(0.0)),
+        "loopcond");
   }
 
-  // Emit the conditional expression
-  llvm::Value *CondVal = End->codegen();
-  if (!CondVal)
-    return nullptr;
+  // The only store to the alloca is the initial one unless the loop assigns
+  // to the induction variable.
+  llvm::BasicBlock *LoopEndBasicBlock = Builder.GetInsertBlock();
+  if (Variable && llvm::all_of(Alloca->users(), [&](llvm::User *U) {
+        return U == StartStore || llvm::isa<llvm::LoadInst>(U);
+      })) {
+    // Every read of the variable becomes the phi node, or what the counter
+    // converts to, which starts out as StartVal and is incremented at the
+    // end of the loop.
+    for (auto *U : llvm::make_early_inc_range(Alloca->users())) {
+      if (auto *Load = llvm::dyn_cast<llvm::LoadInst>(U)) {
+        Load->replaceAllUsesWith(Variable);
+        Load->eraseFromParent();
+      }
+    }
+    StartStore->eraseFromParent();
+    Alloca->eraseFromParent();
+
+    if (Counter) {
+      // Indexing an array with the variable converts it right back to the
+      // counter, which it can be without rounding.
+      for (auto *U : llvm::make_early_inc_range(Variable->users())) {
+        auto *Conversion = llvm::dyn_cast<llvm::FPToSIInst>(U);
+        if (Conversion && Conversion->getDestTy() == Counter->getType()) {
+          Conversion->replaceAllUsesWith(Counter);
+          Conversion->eraseFromParent();
+        }
+      }
+
+      // Exact integers never overflow on the way to the clamped bound.
+      llvm::Value *IncrementedCounter = Builder.CreateNSWAdd(
+          Counter,
+          Builder.getInt64(static_cast<std::int64_t>(*LoopShape.ConstantStep)),
+          "incremented");
+      Counter->addIncoming(
+          Builder.getInt64(static_cast<std::int64_t>(*LoopShape.ConstantStart)),
+          LoopHeaderBasicBlock);
+      Counter->addIncoming(IncrementedCounter, LoopEndBasicBlock);
+
+      CondVal = Builder.CreateICmpSLT(Counter, codegenIntegerBound(BoundVal),
+                                      "loopcond");
+    } else {
+      auto *Phi = llvm::cast<llvm::PHINode>(Variable);
+      llvm::Value *IncrementedVar =
+          Builder.CreateFAdd(Phi, StepVal, "incremented");
+      Phi->addIncoming(StartVal, LoopHeaderBasicBlock);
+      Phi->addIncoming(IncrementedVar, LoopEndBasicBlock);
+    }
+  } else {
+    if (Variable)
+      Variable->eraseFromParent();
+    if (Counter)
+      Counter->eraseFromParent();
+
+    // A loop that could have been counted compares the variable the same way
+    // the '<' operator does.
+    if (Countable)
+      CondVal = Builder.CreateFCmpULT(ComparedVal, BoundVal, "loopcond");
 
-  // Reload, increment, and store the alloca instruction.
-  // This is necessary because the loop body couuld mutate
-  // the induction variable.
-  llvm::Value *CurrentVal = Builder.CreateLoad(Alloca);
-  // Add an increment at the end of the loop, similar to manually adding
-  // i++ at the end of a while loop
-  llvm::Value *IncrementedVar =
-      Builder.CreateFAdd(CurrentVal, StepVal, "incremented");
-  Builder.CreateStore(IncrementedVar, Alloca);
-
-  // Convert condition to a boolean by comparing not-equal to 0.0
-  CondVal = Builder.CreateFCmpONE(
-      CondVal, llvm::ConstantFP::get(getContext(), llvm::APFloat(0.0)),
-      "loopcond");
+    // Reload, increment, and store the alloca instruction.
+    // This is necessary because the loop body couuld mutate
+    // the induction variable.
+    llvm::Value *CurrentVal = Builder.CreateLoad(Alloca);
+    // Add an increment at the end of the loop, similar to manually adding
+    // i++ at the end of a while loop
+    llvm::Value *IncrementedVar =
+        Builder.CreateFAdd(CurrentVal, StepVal, "incremented");
+    Builder.CreateStore(IncrementedVar, Alloca);
+  }
 
   // Create an insert the basic block that goes after the loop
-  llvm::BasicBlock *LoopEndBasicBlock = Builder.GetInsertBlock();
   llvm::BasicBlock *AfterBasicBlock =
       llvm::BasicBlock::Create(getContext(), "afterloop", Function);
 
@@ -106,14 +281,79 @@ llvm::Value *ForExprAST::codegen() {
   return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(getContext()));
 }
 
+/// Evaluate a for expression.
+llvm::Optional<double> ForExprAST::evaluate() {
+  return evaluateLoop(
+      VarName, [this] { return Start->evaluate(); },
+      [this] { return End->evaluate(); },
+      [this]() -> llvm::Optional<double> {
+        if (Step)
+          return Step->evaluate();
+        return 1.0;
+      },
+      [this] { return Body->evaluate(); });
+}
+
+llvm::Optional<double> ForExprAST::evaluateLoop(
+    Symbol VarName, llvm::function_ref<llvm::Optional<double>()> EvaluateStart,
+    llvm::function_ref<llvm::Optional<double>()> EvaluateEnd,
+    llvm::function_ref<llvm::Optional<double>()> EvaluateStep,
+    llvm::function_ref<llvm::Optional<double>()> EvaluateBody) {
+  // Evaluate the initial expression without the
+  // induction variable in scope
+  auto StartVal = EvaluateStart();
+  if (!StartVal)
+    return llvm::None;
+
+  // Save the old value of the variable with this name in case
+  // it shadows an earlier one
+  auto &EvaluatedValues = getEvaluatedValues();
+  auto Old = EvaluatedValues.find(VarName);
+  llvm::Optional<double> OldVal;
+  if (Old != EvaluatedValues.end())
+    OldVal = Old->second;
+  EvaluatedValues[VarName] = *StartVal;
+
+  // Like the generated code, run the body before checking the condition, and
+  // check the condition before incrementing the induction variable.
+  loop {
+    if (!EvaluateBody())
+      return llvm::None;
+
+    auto StepVal = EvaluateStep();
+    if (!StepVal)
+      return llvm::None;
+
+    auto CondVal = EvaluateEnd();
+    if (!CondVal)
+      return llvm::None;
+
+    // The body could have mutated the induction variable, so look it up again.
+    EvaluatedValues[VarName] += *StepVal;
+    CountLoopIteration();
+
+    if (!(*CondVal < 0.0 || *CondVal > 0.0))
+      break;
+  }
+
+  // Restore the variable that was potentially shadowed before entering the loop
+  if (OldVal)
+    EvaluatedValues[VarName] = *OldVal;
+  else
+    EvaluatedValues.erase(VarName);
+
+  // A for expression evaluates to 0.0 (what other value would make sense?)
+  return 0.0;
+}
+
 /// "ForExprAST(var = init, cond, step, body)"
 std::string ForExprAST::toString(const unsigned depth) const {
   std::ostringstream repr;
   auto StartS = Start->toString(depth + 1), EndS = End->toString(depth + 1);
 
   insert_indent(repr, depth);
-  repr << "ForExprAST(" << VarName << " = " << strltrim(StartS) << ", "
-       << strltrim(EndS);
+  repr << "ForExprAST(" << VarName.str().str() << " = " << strltrim(StartS)
+       << ", " << strltrim(EndS);
   if (Step) {
     auto StepS = Step->toString(depth + 1);
     repr << ", " << strltrim(StepS);
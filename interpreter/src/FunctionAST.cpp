@@ -2,24 +2,54 @@
 
 #include <sstream> // std::ostringstream
 
-#include "parser.h" // InstallBinopPrecedence
+#include "dependencies.h" // StartRecordingCalls
+#include "parser.h"       // InstallBinopPrecedence
+#include "stats.h"        // PhaseRegion, countEvent
+#include "tailcalls.h"    // PlaceTailCalls, areTailCallsEnabled
 
 #include "ExprAST.h"
 #include "FunctionAST.h"
+#include "Optimizer.h"
+#include "ParallelForExprAST.h"
 
-FunctionAST::FunctionAST(std::unique_ptr<PrototypeAST> Proto,
-                         std::unique_ptr<ExprAST> Body)
-    : Proto(std::move(Proto)), Body(std::move(Body)) {}
+FunctionAST::FunctionAST(std::unique_ptr<PrototypeAST> Proto, ExprAST *Body,
+                         std::unique_ptr<ASTArena> Arena, bool UsesArrays,
+                         bool Pure, bool Constant)
+    : Proto(std::move(Proto)), Body(Body), Arena(std::move(Arena)),
+      UsesArrays(UsesArrays), Pure(Pure), Constant(Constant) {}
+
+/// Getter for the "Proto" field of instances of FunctionAST.
+const PrototypeAST &FunctionAST::getProto() const { return *Proto; }
+
+/// Whether the prototype has array parameters or the body uses arrays.
+bool FunctionAST::usesArrays() const {
+  return UsesArrays || Proto->hasArrayArgs();
+}
+
+/// Getter for the "Pure" field of instances of FunctionAST.
+bool FunctionAST::isPure() const { return Pure; }
+
+/// Getter for the "Constant" field of instances of FunctionAST.
+bool FunctionAST::isConstant() const { return Constant; }
 
 /// Generate LLVM IR for a function definition.
 llvm::Function *FunctionAST::codegen() {
-  const auto &P = *Proto;
+  return codegenDefinition(*Proto, [this] { return Body->codegen(); });
+}
+
+/// Generate LLVM IR for a function definition, without optimizing it.
+static llvm::Function *
+generateDefinition(const PrototypeAST &P,
+                   llvm::function_ref<llvm::Value *()> GenerateBody) {
+  // Keep a prototype of our own so that this function can be generated again,
+  // as happens when the interpreter hands it over to the JIT.
   auto &FunctionProtos = getFunctionProtos();
-  FunctionProtos[Proto->getName()] = std::move(Proto);
+  FunctionProtos[P.getSymbol()] = std::make_unique<PrototypeAST>(P);
   // Check for an existing function made by an 'extern' declaration.
-  llvm::Function *Function = getFunction(P.getName());
+  llvm::Function *Function = getFunction(P.getSymbol());
   if (!Function)
     return nullptr;
+  StartRecordingCalls();
 
   // If this is a binary operator, add it to
   // the binary operator precedence table.
@@ -48,40 +78,42 @@ llvm::Function *FunctionAST::codegen() {
   // Record the function arguments in the NamedValues map.
   auto &NamedValues = getNamedValues();
   NamedValues.clear();
+  const auto &ArgSymbols = P.getArgSymbols();
   for (auto &Arg : Function->args()) {
     // Create an alloca for this function argument.
     // This allows the user (programmer) to mutate
-    // function parameters.
+    // function parameters. An array parameter holds a pointer.
     llvm::AllocaInst *Alloca =
-        CreateEntryBlockAlloca(Function, Arg.getName().str());
+        CreateEntryBlockAlloca(Function, Arg.getName(), Arg.getType());
 
     // Store the passed-in parameter value in the alloca instruction.
     Builder.CreateStore(&Arg, Alloca);
 
     // Add arguments to the current scope.
-    NamedValues[Arg.getName().str()] = Alloca;
+    NamedValues[ArgSymbols[Arg.getArgNo()]] = Alloca;
   }
 
   // Generate the LLVM IR for the root expression of this function.
-  if (llvm::Value *RetVal = Body->codegen()) {
+  if (llvm::Value *RetVal = GenerateBody()) {
     // If that succeeded, then create an LLVM ret instruction to
     // return from the function...
     Builder.CreateRet(RetVal);
-
-    // ...and validate the generated code, checking for consistency.
-    llvm::verifyFunction(*Function);
-
-    // Run optimizations on the generated code.
-    auto pass = getFunctionPassManager();
-    if (pass)
-      pass->run(*Function);
+    if (areTailCallsEnabled())
+      PlaceTailCalls(*Function);
+
+#ifndef NDEBUG
+    // ...and validate the generated code, checking for consistency. This is
+    // for catching bugs in the code generator rather than in the program
+    // being run, so release builds skip it.
+    llvm::verifyFunction(*Function, &llvm::errs());
+#endif
     return Function;
   }
   // Otherwise, generating the LLVM IR for the root expression failed,
   // so remove the function from the symbol table, which allows the user
   // to redefine it. Otherwise, the namespace would be polluted with
-  // a faulty function.
-  Function->eraseFromParent();
+  // a faulty function. The functions made for its parallel loops go too.
+  ParallelForExprAST::eraseFunction(*Function);
 
   if (P.isBinaryOp())
     UninstallBinopPrecedence(P.getOperatorName());
@@ -89,6 +121,47 @@ llvm::Function *FunctionAST::codegen() {
   return nullptr;
 }
 
+llvm::Function *FunctionAST::codegenDefinition(
+    const PrototypeAST &P, llvm::function_ref<llvm::Value *()> GenerateBody) {
+  llvm::Function *Function;
+  {
+    PhaseRegion Region(Phase::Codegen);
+    Function = generateDefinition(P, GenerateBody);
+  }
+  if (!Function)
+    return nullptr;
+  countEvent(Counter::IRInstructions, Function->getInstructionCount());
+
+  // Run optimizations on the generated code.
+  if (auto *FunctionOptimizer = getOptimizer())
+    FunctionOptimizer->runOnFunction(*Function);
+  return Function;
+}
+
+/// Evaluate the body of a function definition.
+llvm::Optional<double> FunctionAST::evaluate(llvm::ArrayRef<double> Args) {
+  return evaluateDefinition(*Proto, Args, [this] { return Body->evaluate(); });
+}
+
+llvm::Optional<double> FunctionAST::evaluateDefinition(
+    const PrototypeAST &P, llvm::ArrayRef<double> Args,
+    llvm::function_ref<llvm::Optional<double>()> EvaluateBody) {
+  const auto &ArgNames = P.getArgSymbols();
+  assert(Args.size() == ArgNames.size() && "wrong number of arguments");
+
+  // Give the body a scope of its own holding just the parameters, then put
+  // the caller's scope back once it has been evaluated.
+  llvm::DenseMap<Symbol, double> Scope;
+  for (unsigned i = 0; i < Args.size(); i++)
+    Scope[ArgNames[i]] = Args[i];
+
+  auto &EvaluatedValues = getEvaluatedValues();
+  std::swap(EvaluatedValues, Scope);
+  auto Result = EvaluateBody();
+  std::swap(EvaluatedValues, Scope);
+  return Result;
+}
+
 /// "FunctionAST(prototype, body)"
 std::string FunctionAST::toString(const unsigned depth) const {
   std::ostringstream repr;
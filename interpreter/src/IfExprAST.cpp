@@ -1,12 +1,12 @@
 #include <sstream> // std::ostringstream
 
+#include "fold.h" // isTrue
+
 #include "IfExprAST.h"
 
 /// The constructor for the IfExprAST class.
-IfExprAST::IfExprAST(std::unique_ptr<ExprAST> Cond,
-                     std::unique_ptr<ExprAST> Then,
-                     std::unique_ptr<ExprAST> Else)
-    : Cond(std::move(Cond)), Then(std::move(Then)), Else(std::move(Else)) {}
+IfExprAST::IfExprAST(ExprAST *Cond, ExprAST *Then, ExprAST *Else)
+    : Cond(Cond), Then(Then), Else(Else) {}
 
 /// Generate LLVM IR for an if expression.
 llvm::Value *IfExprAST::codegen() {
@@ -71,6 +71,17 @@ llvm::Value *IfExprAST::codegen() {
   return PhiNode;
 }
 
+/// Evaluate an if expression.
+llvm::Optional<double> IfExprAST::evaluate() {
+  auto CondV = Cond->evaluate();
+  if (!CondV)
+    return llvm::None;
+
+  if (isTrue(*CondV))
+    return Then->evaluate();
+  return Else->evaluate();
+}
+
 /// "IfExprAST(cond ? ifTrue : ifFalse)"
 std::string IfExprAST::toString(const unsigned depth) const {
   std::ostringstream repr;
@@ -0,0 +1,65 @@
+#include <sstream> // std::ostringstream
+
+#include "IndexExprAST.h"
+
+/// The constructor for the IndexExprAST class.
+IndexExprAST::IndexExprAST(Symbol Array, ExprAST *Index)
+    : Array(Array), Index(Index) {}
+
+/// Generate LLVM IR for loading an element of an array.
+llvm::Value *IndexExprAST::codegen() {
+  llvm::Value *IndexVal = Index->codegen();
+  if (!IndexVal)
+    return nullptr;
+
+  llvm::Value *Address = codegenElementAddress(Array, IndexVal);
+  if (!Address)
+    return nullptr;
+  return getBuilder().CreateLoad(llvm::Type::getDoubleTy(getContext()),
+                                 Address, Array.str());
+}
+
+llvm::Value *IndexExprAST::codegenArray(Symbol Array) {
+  llvm::AllocaInst *V = getNamedValues().lookup(Array);
+  if (!V || !isArrayVariable(V)) {
+    std::ostringstream errMsg;
+    errMsg << (V ? "Not an array: " : "Unknown array name: ")
+           << Array.str().str();
+    return LogErrorV(errMsg.str().c_str());
+  }
+  return getBuilder().CreateLoad(V->getAllocatedType(), V, Array.str());
+}
+
+llvm::Value *IndexExprAST::codegenElementAddress(Symbol Array,
+                                                 llvm::Value *Index) {
+  llvm::Value *Pointer = codegenArray(Array);
+  if (!Pointer)
+    return nullptr;
+
+  // Round the index toward zero, just like a cast from double to an integer
+  // in C does.
+  auto &Builder = getBuilder();
+  llvm::Value *Offset =
+      Builder.CreateFPToSI(Index, Builder.getInt64Ty(), "index");
+  return Builder.CreateInBoundsGEP(llvm::Type::getDoubleTy(getContext()),
+                                   Pointer, Offset, "element");
+}
+
+/// Evaluate an element of an array.
+llvm::Optional<double> IndexExprAST::evaluate() {
+  return logInterpretedArrayError();
+}
+
+llvm::Optional<double> IndexExprAST::logInterpretedArrayError() {
+  return LogErrorD("Arrays can only be used in compiled code");
+}
+
+/// "IndexExprAST(%s[%s])"
+std::string IndexExprAST::toString(const unsigned depth) const {
+  std::ostringstream repr;
+  auto IndexS = Index->toString(depth);
+  insert_indent(repr, depth);
+  repr << "IndexExprAST(" << Array.str().str() << '[' << strltrim(IndexS)
+       << "])";
+  return repr.str();
+}
@@ -0,0 +1,318 @@
+#include <llvm/ADT/Optional.h> // llvm::Optional
+#include <llvm/ADT/Twine.h>    // llvm::Twine
+#include <llvm/ExecutionEngine/RTDyldMemoryManager.h> // llvm::RTDyldMemoryManager
+#include <llvm/Object/ObjectFile.h>  // llvm::object::ObjectFile
+#include <llvm/Support/Alignment.h>  // llvm::Align, llvm::alignAddr
+#include <llvm/Support/MathExtras.h> // llvm::alignTo
+#include <llvm/Support/Memory.h>     // llvm::sys::Memory, llvm::sys::MemoryBlock
+#include <llvm/Support/Process.h>    // llvm::sys::Process
+
+#include <algorithm> // std::max
+#include <iterator>  // std::prev
+
+#ifdef __linux__
+#include <sys/mman.h> // memfd_create, mmap, munmap
+#include <unistd.h>   // close, ftruncate
+#endif
+
+#include "JITMemoryPool.h"
+#include "stats.h" // Counter, countEvent, raiseCounter
+
+using llvm::sys::Memory;
+using llvm::sys::MemoryBlock;
+
+/// The least number of bytes the pool maps at a time.
+static constexpr std::size_t SlabSize = 256 * 1024;
+
+constexpr std::size_t JITMemoryPool::MinAlignment;
+
+/// What tagModuleIdentifier puts in front of the key of a module.
+static constexpr char ModuleTag[] = "#module";
+
+/// Get the size of a page of memory.
+static std::size_t getPageSize() {
+  static const std::size_t PageSize =
+      llvm::sys::Process::getPageSizeEstimate();
+  return PageSize;
+}
+
+/// JITMemoryPool::ObjectMemoryManager - Loads a single object into memory
+/// from the pool, and gives it back once the module the object was compiled
+/// from is released.
+class JITMemoryPool::ObjectMemoryManager : public llvm::RTDyldMemoryManager {
+public:
+  explicit ObjectMemoryManager(JITMemoryPool &Pool) : Pool(Pool) {}
+
+  ~ObjectMemoryManager() override {
+    if (Module)
+      Pool.removeObject(*Module, *this);
+    release();
+  }
+
+  using llvm::RTDyldMemoryManager::notifyObjectLoaded;
+
+  std::uint8_t *allocateCodeSection(std::uintptr_t Size, unsigned Alignment,
+                                    unsigned, llvm::StringRef) override {
+    return allocate(Code, Size, Alignment);
+  }
+
+  std::uint8_t *allocateDataSection(std::uintptr_t Size, unsigned Alignment,
+                                    unsigned, llvm::StringRef,
+                                    bool) override {
+    return allocate(Data, Size, Alignment);
+  }
+
+  void notifyObjectLoaded(llvm::RuntimeDyld &RTDyld,
+                          const llvm::object::ObjectFile &Obj) override {
+    // Code is relocated for where it runs, not where it is written.
+    for (const auto &Section : Sections)
+      if (Section.Memory.Target != Section.Memory.Writable)
+        RTDyld.mapSectionAddress(Section.Memory.Writable,
+                                 reinterpret_cast<std::uintptr_t>(
+                                     Section.Memory.Target));
+    Module = getModuleKey(Obj.getFileName());
+    if (Module)
+      Pool.addObject(*Module, *this);
+  }
+
+  bool finalizeMemory(std::string *) override {
+    for (const auto &Section : Sections)
+      if (Section.K == Code)
+        Memory::InvalidateInstructionCache(Section.Memory.Target,
+                                           Section.Memory.Size);
+    return false;
+  }
+
+  /// Give all of the memory of the object back to the pool. Called once the
+  /// module the object was compiled from is released.
+  void release() {
+    Module = llvm::None;
+    deregisterEHFrames();
+    for (const auto &Section : Sections)
+      Pool.free(Section.K, Section.Memory);
+    Sections.clear();
+  }
+
+private:
+  /// The memory a section of the object was loaded into.
+  struct Section {
+    Kind K;
+    Block Memory;
+  };
+
+  /// Take the memory for a section from the pool.
+  ///
+  /// @return where the section is written, or nullptr if the pool ran out
+  std::uint8_t *allocate(Kind K, std::uintptr_t Size, unsigned Alignment) {
+    auto Memory = Pool.allocate(K, Size, Alignment);
+    if (!Memory.Writable)
+      return nullptr;
+    Sections.push_back(Section{K, Memory});
+    return reinterpret_cast<std::uint8_t *>(Memory.Writable);
+  }
+
+  JITMemoryPool &Pool;
+  std::vector<Section> Sections;
+  /// The key of the module the object was compiled from, if it was tagged
+  /// with one and not released yet.
+  llvm::Optional<std::uint64_t> Module;
+};
+
+std::unique_ptr<llvm::RuntimeDyld::MemoryManager>
+JITMemoryPool::createMemoryManager() {
+  return std::make_unique<ObjectMemoryManager>(*this);
+}
+
+std::string JITMemoryPool::tagModuleIdentifier(llvm::StringRef Identifier,
+                                               std::uint64_t Module) {
+  return (Identifier + ModuleTag + llvm::Twine(Module)).str();
+}
+
+llvm::Optional<std::uint64_t>
+JITMemoryPool::getModuleKey(llvm::StringRef Name) {
+  // The object is named after the module, with whatever the JIT added.
+  const auto Tag = Name.rfind(ModuleTag);
+  std::uint64_t Key;
+  if (Tag == llvm::StringRef::npos ||
+      Name.drop_front(Tag + sizeof(ModuleTag) - 1).consumeInteger(10, Key))
+    return llvm::None;
+  return Key;
+}
+
+void JITMemoryPool::release(std::uint64_t Module) {
+  std::vector<ObjectMemoryManager *> Released;
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    auto Range = Objects.equal_range(Module);
+    for (auto Object = Range.first; Object != Range.second; ++Object)
+      Released.push_back(Object->second);
+    Objects.erase(Range.first, Range.second);
+  }
+  for (auto *Object : Released)
+    Object->release();
+}
+
+std::uint64_t JITMemoryPool::getBytesInUse() const {
+  std::lock_guard<std::mutex> Guard(Lock);
+  return BytesInUse;
+}
+
+std::uint64_t JITMemoryPool::getHighWaterMark() const {
+  std::lock_guard<std::mutex> Guard(Lock);
+  return HighWaterMark;
+}
+
+/// Map a slab of code twice, once writable and once executable, so that
+/// both mappings share the same memory.
+///
+/// @param Size the size of the slab, a multiple of the page size
+/// @param Near where to put the executable mapping, if the system lets us
+/// @param Writable set to where the slab is mapped writable
+/// @param Executable set to where the slab is mapped executable
+/// @return whether it could be mapped
+static bool mapTwice(std::size_t Size, char *Near, char *&Writable,
+                     char *&Executable) {
+#ifdef __linux__
+  const int FD = memfd_create("kaleidoscope-jit", MFD_CLOEXEC);
+  if (FD < 0)
+    return false;
+  void *W = MAP_FAILED, *X = MAP_FAILED;
+  if (!ftruncate(FD, static_cast<off_t>(Size))) {
+    W = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, FD, 0);
+    X = mmap(Near, Size, PROT_READ | PROT_EXEC, MAP_SHARED, FD, 0);
+  }
+  // The mappings keep the memory around without the file.
+  close(FD);
+  if (W == MAP_FAILED || X == MAP_FAILED) {
+    if (W != MAP_FAILED)
+      munmap(W, Size);
+    if (X != MAP_FAILED)
+      munmap(X, Size);
+    return false;
+  }
+  Writable = static_cast<char *>(W);
+  Executable = static_cast<char *>(X);
+  return true;
+#else
+  return false;
+#endif
+}
+
+JITMemoryPool::~JITMemoryPool() {
+  for (auto &KindSlabs : Slabs)
+    for (auto &Slab : KindSlabs) {
+      MemoryBlock Writable(Slab.Writable, Slab.Size);
+      Memory::releaseMappedMemory(Writable);
+      if (Slab.Target != Slab.Writable) {
+        MemoryBlock Target(Slab.Target, Slab.Size);
+        Memory::releaseMappedMemory(Target);
+      }
+    }
+}
+
+bool JITMemoryPool::mapSlab(Kind K, std::size_t Size) {
+  Size = llvm::alignTo(std::max(Size, SlabSize), getPageSize());
+  // Sections of an object refer to each other with 32-bit offsets, so
+  // every slab goes as close to the last one as the system lets it.
+  Block Slab;
+  Slab.Size = Size;
+  if (K != Code || !mapTwice(Size, LastSlabEnd, Slab.Writable, Slab.Target)) {
+    const MemoryBlock Near(LastSlabEnd, 0);
+    const unsigned Flags = K == Code ? Memory::MF_READ | Memory::MF_WRITE |
+                                           Memory::MF_EXEC
+                                     : Memory::MF_READ | Memory::MF_WRITE;
+    std::error_code EC;
+    auto Mapped = Memory::allocateMappedMemory(
+        Size, LastSlabEnd ? &Near : nullptr, Flags, EC);
+    if (EC)
+      return false;
+    Slab.Writable = Slab.Target = static_cast<char *>(Mapped.base());
+    Slab.Size = Mapped.allocatedSize();
+  }
+  Slabs[K].push_back(Slab);
+  FreeRanges[K][Slab.Writable] = Slab;
+  LastSlabEnd = Slab.Target + Slab.Size;
+  return true;
+}
+
+JITMemoryPool::Block JITMemoryPool::allocate(Kind K, std::size_t Size,
+                                             unsigned Alignment) {
+  const llvm::Align SectionAlign(
+      std::max<std::size_t>(Alignment, MinAlignment));
+  Size = llvm::alignTo(std::max<std::size_t>(Size, 1), MinAlignment);
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  // The first free range that is big enough keeps what is left on either
+  // side of the block.
+  const auto TakeFrom = [&](Block Free) {
+    auto *Target =
+        reinterpret_cast<char *>(llvm::alignAddr(Free.Target, SectionAlign));
+    const std::size_t Before = Target - Free.Target;
+    if (Before + Size > Free.Size)
+      return Block();
+    FreeRanges[K].erase(Free.Writable);
+    if (Before)
+      FreeRanges[K][Free.Writable] = Block{Free.Writable, Free.Target, Before};
+    if (const auto After = Free.Size - Before - Size)
+      FreeRanges[K][Free.Writable + Before + Size] =
+          Block{Free.Writable + Before + Size, Target + Size, After};
+    return Block{Free.Writable + Before, Target, Size};
+  };
+  Block Memory;
+  for (const auto &Free : FreeRanges[K])
+    if ((Memory = TakeFrom(Free.second)).Writable)
+      break;
+  if (!Memory.Writable) {
+    if (!mapSlab(K, Size + SectionAlign.value() - 1))
+      return Block();
+    Memory = TakeFrom(Slabs[K].back());
+  }
+
+  BytesInUse += Memory.Size;
+  HighWaterMark = std::max(HighWaterMark, BytesInUse);
+  raiseCounter(Counter::JITMemoryPeak, HighWaterMark);
+  return Memory;
+}
+
+void JITMemoryPool::free(Kind K, Block Memory) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  BytesInUse -= Memory.Size;
+  countEvent(Counter::JITMemoryFreed, Memory.Size);
+
+  // Ranges only merge when they are next to each other in both mappings,
+  // which is never the case for ranges of different slabs mapped twice.
+  auto &Free = FreeRanges[K];
+  auto Next = Free.lower_bound(Memory.Writable);
+  if (Next != Free.end() &&
+      Memory.Writable + Memory.Size == Next->second.Writable &&
+      Memory.Target + Memory.Size == Next->second.Target) {
+    Memory.Size += Next->second.Size;
+    Next = Free.erase(Next);
+  }
+  if (Next != Free.begin()) {
+    auto &Prev = std::prev(Next)->second;
+    if (Prev.Writable + Prev.Size == Memory.Writable &&
+        Prev.Target + Prev.Size == Memory.Target) {
+      Prev.Size += Memory.Size;
+      return;
+    }
+  }
+  Free.emplace_hint(Next, Memory.Writable, Memory);
+}
+
+void JITMemoryPool::addObject(std::uint64_t Module,
+                              ObjectMemoryManager &Object) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  Objects.emplace(Module, &Object);
+}
+
+void JITMemoryPool::removeObject(std::uint64_t Module,
+                                 ObjectMemoryManager &Object) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto Range = Objects.equal_range(Module);
+  for (auto Entry = Range.first; Entry != Range.second; ++Entry)
+    if (Entry->second == &Object) {
+      Objects.erase(Entry);
+      return;
+    }
+}
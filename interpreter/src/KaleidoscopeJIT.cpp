@@ -1,97 +1,568 @@
+#include <llvm/ExecutionEngine/Orc/ObjectTransformLayer.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/Object/ObjectFile.h>
+
 #include "KaleidoscopeJIT.h"
+#include "mathlib.h" // forEachMathFunction, getVectorMathModule
+#include "stats.h"   // PhaseRegion, countEvent
 
 namespace llvm {
 namespace orc {
 
-KaleidoscopeJIT::KaleidoscopeJIT()
-    : Resolver(createLegacyLookupResolver(
-          ES,
-          [this](StringRef Name) {
-            return findMangledSymbol(std::string(Name));
-          },
-          [](Error Err) { cantFail(std::move(Err), "lookupFlags failed"); })),
-      TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
-      ObjectLayer(AcknowledgeORCv1Deprecation, ES,
-                  [this](VModuleKey) {
-                    return ObjLayerT::Resources{
-                        std::make_shared<SectionMemoryManager>(), Resolver};
-                  }),
-      CompileLayer(AcknowledgeORCv1Deprecation, ObjectLayer,
-                   SimpleCompiler(*TM)) {
-  llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+KaleidoscopeJIT::KaleidoscopeJIT(const Options &Opts)
+    : Concurrent(Opts.NumCompileThreads > 0 && !Opts.Lazy) {
+  auto JTMB = cantFail(JITTargetMachineBuilder::detectHost());
+  TM = cantFail(JTMB.createTargetMachine());
+
+  // Without a cache, leave the choice of compiler to LLJIT. With one, make
+  // the same choice it would, just with the cache attached.
+  LLJITBuilderState::CompileFunctionCreator CreateCompiler;
+  if (!Opts.CacheDir.empty()) {
+    Cache = std::make_unique<DiskObjectCache>(Opts.CacheDir, *TM);
+    CreateCompiler = [this, Concurrent = Opts.NumCompileThreads > 0](
+                         JITTargetMachineBuilder JTMB)
+        -> Expected<std::unique_ptr<IRCompileLayer::IRCompiler>> {
+      if (Concurrent)
+        return std::make_unique<ConcurrentIRCompiler>(std::move(JTMB),
+                                                      Cache.get());
+      auto CompileTM = JTMB.createTargetMachine();
+      if (!CompileTM)
+        return CompileTM.takeError();
+      return std::make_unique<TMOwningSimpleCompiler>(std::move(*CompileTM),
+                                                      Cache.get());
+    };
+  }
+
+  // The object linking layer is made here the same way LLJIT would make it,
+  // just with memory from the pool. Profilers and debuggers also only know
+  // about JIT code that the layer tells them about.
+  const auto AddListener = [this](JITEventListener *Listener,
+                                  const char *Name) {
+    if (Listener)
+      Listeners.push_back(Listener);
+    else
+      errs() << "LLVM was built without support for " << Name
+             << " JIT events, ignoring them\n";
+  };
+  if (Opts.GDBEvents)
+    AddListener(JITEventListener::createGDBRegistrationListener(), "GDB");
+  if (Opts.PerfEvents)
+    AddListener(JITEventListener::createPerfJITEventListener(), "perf");
+  if (Opts.IntelEvents)
+    AddListener(JITEventListener::createIntelJITEventListener(), "Intel");
+  if (Opts.PerfMap) {
+    PerfMap = std::make_unique<PerfMapListener>();
+    Listeners.push_back(PerfMap.get());
+  }
+  Pool = std::make_unique<JITMemoryPool>();
+  const auto CreateObjectLayer = [this](ExecutionSession &ES,
+                                        const Triple &TT)
+      -> std::unique_ptr<ObjectLayer> {
+    auto Layer = std::make_unique<RTDyldObjectLinkingLayer>(
+        ES, [this] { return Pool->createMemoryManager(); });
+    if (TT.isOSBinFormatCOFF()) {
+      Layer->setOverrideObjectFlagsWithResponsibilityFlags(true);
+      Layer->setAutoClaimResponsibilityForObjectSymbols(true);
+    }
+    for (auto *Listener : Listeners)
+      Layer->registerJITEventListener(*Listener);
+    return Layer;
+  };
+
+  // With compile threads, LLJIT hands every materialization off to a thread
+  // pool, so independent modules compile in parallel.
+  if (Opts.Lazy) {
+    LazyJ = cantFail(LLLazyJITBuilder()
+                         .setJITTargetMachineBuilder(std::move(JTMB))
+                         .setNumCompileThreads(Opts.NumCompileThreads)
+                         .setCompileFunctionCreator(CreateCompiler)
+                         .setObjectLinkingLayerCreator(CreateObjectLayer)
+                         .create());
+    // Split modules up so that only the function that was actually called
+    // gets compiled, rather than everything that shares its module.
+    LazyJ->setPartitionFunction(CompileOnDemandLayer::compileRequested);
+    J = LazyJ.get();
+  } else {
+    EagerJ = cantFail(LLJITBuilder()
+                          .setJITTargetMachineBuilder(std::move(JTMB))
+                          .setNumCompileThreads(Opts.NumCompileThreads)
+                          .setCompileFunctionCreator(CreateCompiler)
+                          .setObjectLinkingLayerCreator(CreateObjectLayer)
+                          .create());
+    J = EagerJ.get();
+  }
+
+  // Optimizing in the transform layer defers the work to whoever
+  // materializes the module: a compile thread or, in lazy mode, the first
+  // call through a stub. A profiler walks the stack of JIT code by its frame
+  // pointers, since there are no unwind tables for it to use instead.
+  const bool KeepFramePointers = !Listeners.empty();
+  if (Opts.Optimize || KeepFramePointers)
+    J->getIRTransformLayer().setTransform(
+        [Optimize = Opts.Optimize,
+         KeepFramePointers](ThreadSafeModule TSM,
+                            const MaterializationResponsibility &)
+            -> Expected<ThreadSafeModule> {
+          TSM.withModuleDo([&](Module &M) {
+            if (Optimize)
+              Optimize(M);
+            if (KeepFramePointers)
+              for (auto &F : M)
+                if (!F.isDeclaration())
+                  F.addFnAttr("frame-pointer", "all");
+          });
+          return TSM;
+        });
+
+  // Every object goes through the object transform layer on its way to the
+  // linker, whether it was just compiled, came from the cache or was added
+  // with addObject.
+  if (Opts.KeepObjects)
+    J->getObjTransformLayer().setTransform(
+        [this](std::unique_ptr<MemoryBuffer> Obj)
+            -> Expected<std::unique_ptr<MemoryBuffer>> {
+          auto K = JITMemoryPool::getModuleKey(Obj->getBufferIdentifier());
+          if (K) {
+            std::lock_guard<std::mutex> Guard(KeptObjectsLock);
+            KeptObjects[*K].push_back(MemoryBuffer::getMemBufferCopy(
+                Obj->getBuffer(), Obj->getBufferIdentifier()));
+          }
+          return Obj;
+        });
+
+  Session = &cantFail(J->createJITDylib("session"));
+
+  // If we can't find a symbol in the JIT, try looking in the host process,
+  // but only once for each symbol it turns out not to have.
+  Session->addGenerator(
+      cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          J->getDataLayout().getGlobalPrefix(),
+          [this](const SymbolStringPtr &Name) { return isHostSymbol(Name); })));
+
+  // The math library is defined up front, so that its functions are never
+  // searched for in the host process, and so are the vector variants the
+  // vectorizers call with the Runtime vector library. A module defining one
+  // of them supersedes it like any other definition.
+  SymbolMap MathFunctions;
+  forEachMathFunction([&](StringRef Name, JITTargetAddress Address) {
+    MathFunctions[J->mangleAndIntern(Name)] = JITEvaluatedSymbol(
+        Address, JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+  });
+  cantFail(Session->define(absoluteSymbols(MathFunctions)));
+  for (auto &F : MathFunctions)
+    Symbols[F.first] = SymbolEntry{HostProcess, F.second};
+  cantFail(addModule(getVectorMathModule(getDataLayout())));
 }
 
+KaleidoscopeJIT::Options KaleidoscopeJIT::TheOptions;
 std::unique_ptr<KaleidoscopeJIT> KaleidoscopeJIT::TheInstance;
 
+void KaleidoscopeJIT::setOptions(const Options &Opts) {
+  assert(!TheInstance && "JIT options must be set before the JIT is created");
+  TheOptions = Opts;
+}
+
 KaleidoscopeJIT *KaleidoscopeJIT::getInstance() {
   if (!TheInstance)
-    TheInstance = std::unique_ptr<KaleidoscopeJIT>(new KaleidoscopeJIT);
+    TheInstance =
+        std::unique_ptr<KaleidoscopeJIT>(new KaleidoscopeJIT(TheOptions));
   return TheInstance.get();
 }
 
 TargetMachine &KaleidoscopeJIT::getTargetMachine() { return *TM; }
 
-VModuleKey KaleidoscopeJIT::addModule(std::unique_ptr<Module> M) {
-  auto K = ES.allocateVModule();
-  cantFail(CompileLayer.addModule(K, std::move(M)));
-  ModuleKeys.push_back(K);
+const DataLayout &KaleidoscopeJIT::getDataLayout() const {
+  return J->getDataLayout();
+}
+
+bool KaleidoscopeJIT::isLazy() const { return LazyJ != nullptr; }
+
+Expected<VModuleKey> KaleidoscopeJIT::addModule(ThreadSafeModule TSM) {
+  std::vector<ThreadSafeModule> Modules;
+  Modules.push_back(std::move(TSM));
+  auto Keys = addModules(std::move(Modules));
+  if (!Keys)
+    return Keys.takeError();
+  return Keys->front();
+}
+
+Expected<std::vector<VModuleKey>>
+KaleidoscopeJIT::addModules(std::vector<ThreadSafeModule> Modules) {
+  PhaseRegion Region(Phase::JIT);
+  std::vector<VModuleKey> Keys;
+  SymbolNameSet Added;
+  const auto removeAdded = [&] {
+    for (auto K : Keys)
+      removeModule(K);
+  };
+  for (auto &TSM : Modules) {
+    countEvent(Counter::ModulesAdded);
+    SymbolNameSet Defined;
+    TSM.withModuleDo([&](Module &M) {
+      for (auto &F : M)
+        // Available externally bodies are only there to be inlined and are
+        // never emitted, so they have to come from somewhere else. Local
+        // functions are never looked up.
+        if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage() &&
+            !F.hasLocalLinkage())
+          Defined.insert(J->mangleAndIntern(F.getName()));
+    });
+
+    // A JITDylib only holds one definition per symbol, so drop the ones this
+    // module supersedes. This keeps the REPL semantics of binding to the
+    // newest available definition.
+    if (auto Err = supersede(Defined)) {
+      removeAdded();
+      return Err;
+    }
+
+    // Objects are named after their modules, which lets the memory pool tell
+    // which module they were compiled from.
+    auto K = NextModuleKey++;
+    TSM.withModuleDo([K](Module &M) {
+      M.setModuleIdentifier(
+          JITMemoryPool::tagModuleIdentifier(M.getModuleIdentifier(), K));
+    });
+    if (auto Err = LazyJ ? LazyJ->addLazyIRModule(*Session, std::move(TSM))
+                         : J->addIRModule(*Session, std::move(TSM))) {
+      removeAdded();
+      return Err;
+    }
+
+    for (auto &Name : Defined)
+      Symbols[Name] = SymbolEntry{K, JITEvaluatedSymbol()};
+    ModuleSymbols[K] = Defined;
+    Added.insert(Defined.begin(), Defined.end());
+    Keys.push_back(K);
+  }
+
+  // Only now that every module is defined can the ones calling each other
+  // be linked against each other.
+  if (Concurrent)
+    compileInBackground(Added);
+  return Keys;
+}
+
+Expected<VModuleKey> KaleidoscopeJIT::addObject(MemoryBufferRef Obj) {
+  PhaseRegion Region(Phase::JIT);
+  auto File = object::ObjectFile::createObjectFile(Obj);
+  if (!File)
+    return File.takeError();
+  SymbolNameSet Defined;
+  for (const auto &Sym : (*File)->symbols()) {
+    auto Flags = Sym.getFlags();
+    if (!Flags)
+      return Flags.takeError();
+    if ((*Flags & object::SymbolRef::SF_Undefined) ||
+        !(*Flags & object::SymbolRef::SF_Global))
+      continue;
+    auto Name = Sym.getName();
+    if (!Name)
+      return Name.takeError();
+    Defined.insert(J->getExecutionSession().intern(*Name));
+  }
+
+  if (auto Err = supersede(Defined))
+    return Err;
+
+  auto K = NextModuleKey++;
+  if (auto Err = J->addObjectFile(
+          *Session, MemoryBuffer::getMemBuffer(
+                        Obj.getBuffer(),
+                        JITMemoryPool::tagModuleIdentifier(
+                            Obj.getBufferIdentifier(), K),
+                        /* RequiresNullTerminator */ false)))
+    return Err;
+
+  for (auto &Name : Defined)
+    Symbols[Name] = SymbolEntry{K, JITEvaluatedSymbol()};
+  ModuleSymbols[K] = Defined;
+
+  if (Concurrent)
+    compileInBackground(Defined);
+  return K;
+}
+
+std::vector<MemoryBufferRef>
+KaleidoscopeJIT::getObjects(function_ref<bool(StringRef)> IsWanted) {
+  assert(TheOptions.KeepObjects && "Objects are only kept with KeepObjects");
+  auto &ES = J->getExecutionSession();
+  // In lazy mode, looking up a function only makes its stub, and the body
+  // is compiled once it is looked up behind the stub.
+  auto *Impl =
+      LazyJ ? ES.getJITDylibByName(Session->getName() + ".impl") : nullptr;
+  const char GlobalPrefix = getDataLayout().getGlobalPrefix();
+
+  std::vector<MemoryBufferRef> Objects;
+  for (const auto &Module : ModuleSymbols) {
+    const bool Wanted =
+        any_of(Module.second, [&](const SymbolStringPtr &Name) {
+          StringRef Unmangled = *Name;
+          if (GlobalPrefix && Unmangled.front() == GlobalPrefix)
+            Unmangled = Unmangled.drop_front();
+          return IsWanted(Unmangled);
+        });
+    if (!Wanted)
+      continue;
+
+    auto Compiled = ES.lookup(
+        makeJITDylibSearchOrder(Session, JITDylibLookupFlags::MatchAllSymbols),
+        SymbolLookupSet(Module.second));
+    // Functions that came from an object have no body behind a stub.
+    if (Compiled && Impl)
+      Compiled = ES.lookup(
+          makeJITDylibSearchOrder(Impl, JITDylibLookupFlags::MatchAllSymbols),
+          SymbolLookupSet(Module.second,
+                          SymbolLookupFlags::WeaklyReferencedSymbol));
+    if (!Compiled) {
+      consumeError(Compiled.takeError());
+      continue;
+    }
+
+    std::lock_guard<std::mutex> Guard(KeptObjectsLock);
+    auto Kept = KeptObjects.find(Module.first);
+    if (Kept != KeptObjects.end())
+      for (const auto &Obj : Kept->second)
+        Objects.push_back(Obj->getMemBufferRef());
+  }
+  return Objects;
+}
+
+Expected<VModuleKey>
+KaleidoscopeJIT::addModuleBehindStubs(ThreadSafeModule TSM,
+                                      const StringMap<std::string> &Impls) {
+  if (!Stubs) {
+    auto CreateStubs =
+        createLocalIndirectStubsManagerBuilder(TM->getTargetTriple());
+    if (!CreateStubs)
+      return make_error<StringError>("Indirect stubs are not supported on " +
+                                         TM->getTargetTriple().str(),
+                                     inconvertibleErrorCode());
+    Stubs = CreateStubs();
+  }
+
+  // The module calls the redirected functions by their own names, so the
+  // stubs have to be defined before it can be linked. A new stub points
+  // nowhere until the module is compiled, but nothing can call it before.
+  const auto Flags = JITSymbolFlags::Exported | JITSymbolFlags::Callable;
+  SymbolMap NewStubs;
+  for (auto &Impl : Impls) {
+    auto Name = J->mangleAndIntern(Impl.first());
+    auto Entry = Symbols.find(Name);
+    if (Entry != Symbols.end() && Entry->second.Owner == StubOwner)
+      continue;
+    // A stub stays around when something else redefines its function, and
+    // is just defined again once the function is redirected again.
+    auto Stub = Stubs->findStub(Impl.first(), false);
+    if (!Stub) {
+      if (auto Err = Stubs->createStub(Impl.first(), 0, Flags))
+        return Err;
+      Stub = Stubs->findStub(Impl.first(), false);
+    }
+    NewStubs[Name] = Stub;
+  }
+  if (!NewStubs.empty()) {
+    SymbolNameSet Names;
+    for (auto &Stub : NewStubs)
+      Names.insert(Stub.first);
+    if (auto Err = supersede(Names))
+      return Err;
+    if (auto Err = Session->define(absoluteSymbols(NewStubs)))
+      return Err;
+    for (auto &Stub : NewStubs)
+      Symbols[Stub.first] = SymbolEntry{StubOwner, Stub.second};
+  }
+
+  auto K = addModule(std::move(TSM));
+  if (!K)
+    return K.takeError();
+  for (auto &Impl : Impls) {
+    auto Address = findSymbol(StringRef(Impl.second));
+    if (!Address) {
+      removeModule(*K);
+      return Address.takeError();
+    }
+    if (auto Err = Stubs->updatePointer(Impl.first(), Address->getAddress())) {
+      removeModule(*K);
+      return Err;
+    }
+  }
   return K;
 }
 
 void KaleidoscopeJIT::removeModule(VModuleKey K) {
-  ModuleKeys.erase(find(ModuleKeys, K));
-  cantFail(CompileLayer.removeModule(K));
+  auto Entry = ModuleSymbols.find(K);
+  if (Entry == ModuleSymbols.end())
+    return;
+  countEvent(Counter::ModulesRemoved);
+  for (auto &Name : Entry->second)
+    Symbols.erase(Name);
+  if (auto Err = removeDefinitions(Entry->second))
+    logAllUnhandledErrors(std::move(Err), errs(), "removeModule failed: ");
+  else if (Listeners.empty())
+    Pool->release(K);
+  ModuleSymbols.erase(Entry);
+  std::lock_guard<std::mutex> Guard(KeptObjectsLock);
+  KeptObjects.erase(K);
 }
 
-JITSymbol KaleidoscopeJIT::findSymbol(const std::string Name) {
-  return findMangledSymbol(mangle(Name));
+Error KaleidoscopeJIT::removeSymbol(Symbol Name) {
+  return supersede({J->getExecutionSession().intern(
+      Name.getMangledName([this](StringRef N) { return mangle(N); }))});
 }
 
-std::string KaleidoscopeJIT::mangle(const std::string &Name) {
+bool KaleidoscopeJIT::definesSymbols(VModuleKey K) const {
+  auto Entry = ModuleSymbols.find(K);
+  return Entry != ModuleSymbols.end() && !Entry->second.empty();
+}
+
+Optional<VModuleKey> KaleidoscopeJIT::getModule(Symbol Name) {
+  auto Entry = Symbols.find(J->getExecutionSession().intern(
+      Name.getMangledName([this](StringRef N) { return mangle(N); })));
+  if (Entry == Symbols.end() || Entry->second.Owner == HostProcess ||
+      Entry->second.Owner == StubOwner)
+    return None;
+  return Entry->second.Owner;
+}
+
+Expected<JITEvaluatedSymbol> KaleidoscopeJIT::findSymbol(StringRef Name) {
+  return findMangledSymbol(J->mangleAndIntern(Name));
+}
+
+Expected<JITEvaluatedSymbol> KaleidoscopeJIT::findSymbol(Symbol Name) {
+  return findMangledSymbol(J->getExecutionSession().intern(
+      Name.getMangledName([this](StringRef N) { return mangle(N); })));
+}
+
+Expected<JITEvaluatedSymbol>
+KaleidoscopeJIT::findMangledSymbol(SymbolStringPtr Name) {
+  PhaseRegion Region(Phase::JIT);
+  countEvent(Counter::SymbolLookups);
+  auto Entry = Symbols.find(Name);
+  if (Entry != Symbols.end() && Entry->second.Resolved)
+    return Entry->second.Resolved;
+
+  auto Resolved = J->getExecutionSession().lookup(
+      makeJITDylibSearchOrder(Session, JITDylibLookupFlags::MatchAllSymbols),
+      Name);
+  if (!Resolved)
+    return Resolved.takeError();
+
+  // Every symbol a module defines is indexed already, so anything else was
+  // found in the host process.
+  if (Entry == Symbols.end())
+    Entry = Symbols
+                .insert({Name, SymbolEntry{HostProcess, JITEvaluatedSymbol()}})
+                .first;
+  Entry->second.Resolved = *Resolved;
+  return *Resolved;
+}
+
+bool KaleidoscopeJIT::isHostSymbol(const SymbolStringPtr &Name) {
+  std::lock_guard<std::mutex> Guard(HostSymbolsLock);
+  auto Known = HostSymbols.find(Name);
+  if (Known != HostSymbols.end())
+    return Known->second;
+
+  // Search the process the same way the generator is about to, which is
+  // without the global prefix.
+  StringRef Unprefixed = *Name;
+  const char GlobalPrefix = getDataLayout().getGlobalPrefix();
+  bool Found = false;
+  if (!GlobalPrefix || Unprefixed.front() == GlobalPrefix) {
+    if (GlobalPrefix)
+      Unprefixed = Unprefixed.drop_front();
+    Found = sys::DynamicLibrary::getPermanentLibrary(nullptr)
+                .getAddressOfSymbol(Unprefixed.str().c_str()) != nullptr;
+  }
+  HostSymbols[Name] = Found;
+  return Found;
+}
+
+std::string KaleidoscopeJIT::mangle(StringRef Name) const {
   std::string MangledName;
+  raw_string_ostream OS(MangledName);
+  Mangler::getNameWithPrefix(OS, Name, getDataLayout());
+  return OS.str();
+}
+
+Error KaleidoscopeJIT::supersede(const SymbolNameSet &Names) {
+  SymbolNameSet Superseded;
+  for (auto &Name : Names) {
+    auto Entry = Symbols.find(Name);
+    if (Entry == Symbols.end())
+      continue;
+    const auto Owner = Entry->second.Owner;
+    if (Owner != HostProcess && Owner != StubOwner)
+      ModuleSymbols[Owner].erase(Name);
+    Symbols.erase(Entry);
+    Superseded.insert(Name);
+  }
   {
-    raw_string_ostream MangledNameStream(MangledName);
-    Mangler::getNameWithPrefix(MangledNameStream, Name, DL);
+    // Host symbols pulled in while linking other modules are only known to
+    // the generator.
+    std::lock_guard<std::mutex> Guard(HostSymbolsLock);
+    for (auto &Name : Names) {
+      auto Host = HostSymbols.find(Name);
+      if (Host == HostSymbols.end() || !Host->second)
+        continue;
+      HostSymbols.erase(Host);
+      Superseded.insert(Name);
+    }
   }
-  return MangledName;
-}
-
-JITSymbol KaleidoscopeJIT::findMangledSymbol(const std::string &Name) {
-#ifdef _WIN32
-  // The symbol lookup of ObjectLinkingLayer uses the SymbolRef::SF_Exported
-  // flag to decide whether a symbol will be visible or not, when we call
-  // IRCompileLayer::findSymbolIn with ExportedSymbolsOnly set to true.
-  //
-  // But for Windows COFF objects, this flag is currently never set.
-  // For a potential solution see: https://reviews.llvm.org/rL258665
-  // For now, we allow non-exported symbols on Windows as a workaround.
-  const bool ExportedSymbolsOnly = false;
-#else
-  const bool ExportedSymbolsOnly = true;
-#endif
-
-  // Search modules in reverse order: from last added to first added.
-  // This is the opposite of the usual search order for dlsym, but makes more
-  // sense in a REPL where we want to bind to the newest available definition.
-  for (auto H : make_range(ModuleKeys.rbegin(), ModuleKeys.rend()))
-    if (auto Sym = CompileLayer.findSymbolIn(H, Name, ExportedSymbolsOnly))
-      return Sym;
-
-  // If we can't find the symbol in the JIT, try looking in the host process.
-  if (auto SymAddr = RTDyldMemoryManager::getSymbolAddressInProcess(Name))
-    return JITSymbol(SymAddr, JITSymbolFlags::Exported);
-
-#ifdef _WIN32
-  // For Windows retry without "_" at beginning, as RTDyldMemoryManager uses
-  // GetProcAddress and standard libraries like msvcrt.dll use names
-  // with and without "_" (for example "_itoa" but "sin").
-  if (Name.length() > 2 && Name[0] == '_')
-    if (auto SymAddr =
-            RTDyldMemoryManager::getSymbolAddressInProcess(Name.substr(1)))
-      return JITSymbol(SymAddr, JITSymbolFlags::Exported);
-#endif
-
-  return nullptr;
+  return removeDefinitions(Superseded);
+}
+
+void KaleidoscopeJIT::compileInBackground(const SymbolNameSet &Names) {
+  if (Names.empty())
+    return;
+  // Nothing waits on this lookup: it only exists to get the compile threads
+  // working on the module while the REPL goes on parsing.
+  J->getExecutionSession().lookup(
+      LookupKind::Static, makeJITDylibSearchOrder(Session),
+      SymbolLookupSet(Names), SymbolState::Ready,
+      [](Expected<SymbolMap> Result) {
+        if (!Result)
+          logAllUnhandledErrors(Result.takeError(), errs(),
+                                "Background compilation failed: ");
+      },
+      NoDependenciesToRegister);
+}
+
+Error KaleidoscopeJIT::removeSymbols(JITDylib &JD,
+                                     const SymbolNameSet &Names) {
+  if (Names.empty())
+    return Error::success();
+
+  if (auto Err = JD.remove(Names)) {
+    // Symbols that are still being materialized cannot be removed, so wait
+    // for them to become ready and try again.
+    consumeError(std::move(Err));
+    auto Result = J->getExecutionSession().lookup(
+        makeJITDylibSearchOrder(&JD), SymbolLookupSet(Names));
+    if (!Result)
+      return Result.takeError();
+    return JD.remove(Names);
+  }
+  return Error::success();
+}
+
+Error KaleidoscopeJIT::removeDefinitions(const SymbolNameSet &Names) {
+  if (auto Err = removeSymbols(*Session, Names))
+    return Err;
+  if (!LazyJ)
+    return Error::success();
+
+  // The compile-on-demand layer keeps the actual function bodies in an
+  // implementation dylib behind the stubs we just removed. A body that was
+  // never called has not made it there yet, so a missing symbol is fine.
+  auto *Impl = J->getExecutionSession().getJITDylibByName(Session->getName() +
+                                                          ".impl");
+  if (!Impl)
+    return Error::success();
+  for (auto &Name : Names)
+    consumeError(removeSymbols(*Impl, {Name}));
+  return Error::success();
 }
 
 } // namespace orc
@@ -1,28 +1,35 @@
 #include <sstream> // std::ostringstream
 
+#include "ArrayExprAST.h"
 #include "LetExprAST.h"
 #include "NumberExprAST.h"
 
 /// The constructor for the LetExprAST class.
-LetExprAST::LetExprAST(
-    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames,
-    std::unique_ptr<ExprAST> Body)
-    : VarNames(std::move(VarNames)), Body(std::move(Body)) {}
+LetExprAST::LetExprAST(std::vector<std::pair<Symbol, ExprAST *>> VarNames,
+                       ExprAST *Body)
+    : VarNames(std::move(VarNames)), Body(Body) {}
 
 /// Generate LLVM IR for a let/in expression.
 llvm::Value *LetExprAST::codegen() {
   // If we encounter any new variables that shadow existing ones,
   // we put the old values here so that they can be restored after
   // the new ones go out of scope.
-  std::vector<llvm::AllocaInst *> OldBindings(VarNames.size());
+  std::vector<llvm::AllocaInst *> OldBindings;
+  OldBindings.reserve(VarNames.size());
 
   auto &Builder = getBuilder();
   llvm::Function *Function = Builder.GetInsertBlock()->getParent();
 
+  // Arrays live on the stack until the body is done, so remember how big the
+  // stack was before the first one.
+  llvm::Value *SavedStack = nullptr;
+
   auto &NamedValues = getNamedValues();
   for (const auto &NameValuePair : VarNames) {
-    const std::string &VarName = NameValuePair.first;
-    ExprAST *const InitialExpr = NameValuePair.second.get();
+    const Symbol VarName = NameValuePair.first;
+    ExprAST *const InitialExpr = NameValuePair.second;
+    if (!SavedStack && dynamic_cast<ArrayExprAST *>(InitialExpr))
+      SavedStack = ArrayExprAST::codegenStackSave();
 
     // We generate LLVM IR for the initial value before
     // adding the variable to the scope, this way self-referential
@@ -40,7 +47,11 @@ llvm::Value *LetExprAST::codegen() {
     if (!InitialValue)
       return nullptr;
 
-    llvm::AllocaInst *Alloca = CreateEntryBlockAlloca(Function, VarName);
+    // An array variable holds the pointer to its first element instead of a
+    // double.
+    llvm::AllocaInst *Alloca =
+        CreateEntryBlockAlloca(Function, VarName.str(),
+                               InitialValue->getType());
     Builder.CreateStore(InitialValue, Alloca);
 
     // Add any old value for this variable so that it can be restored after
@@ -55,15 +66,59 @@ llvm::Value *LetExprAST::codegen() {
   llvm::Value *BodyVal = Body->codegen();
   if (!BodyVal)
     return nullptr;
+  if (SavedStack)
+    ArrayExprAST::codegenStackRestore(SavedStack);
 
-  // Restore all the old values of the variables.
-  for (unsigned i = 0; i < VarNames.size(); i++)
+  // Restore all the old values of the variables, latest first in case the
+  // same name was bound more than once.
+  for (unsigned i = VarNames.size(); i-- > 0;)
     NamedValues[VarNames[i].first] = OldBindings[i];
 
   // Return the value that the body evaluates to.
   return BodyVal;
 }
 
+/// Evaluate a let/in expression.
+llvm::Optional<double> LetExprAST::evaluate() {
+  // The values of any variables that the new ones shadow, to be restored once
+  // the new ones go out of scope.
+  std::vector<llvm::Optional<double>> OldBindings;
+
+  auto &EvaluatedValues = getEvaluatedValues();
+  for (const auto &NameValuePair : VarNames) {
+    const Symbol VarName = NameValuePair.first;
+    ExprAST *const InitialExpr = NameValuePair.second;
+
+    // Evaluate the initial value before adding the variable to the scope,
+    // just like codegen does.
+    auto InitialValue = InitialExpr ? InitialExpr->evaluate()
+                                    : llvm::Optional<double>(0.0);
+    if (!InitialValue)
+      return llvm::None;
+
+    auto Old = EvaluatedValues.find(VarName);
+    OldBindings.push_back(Old == EvaluatedValues.end()
+                              ? llvm::Optional<double>()
+                              : llvm::Optional<double>(Old->second));
+    EvaluatedValues[VarName] = *InitialValue;
+  }
+
+  auto BodyVal = Body->evaluate();
+  if (!BodyVal)
+    return llvm::None;
+
+  // Restore all the old values of the variables, latest first in case the
+  // same name was bound more than once.
+  for (unsigned i = VarNames.size(); i-- > 0;) {
+    if (OldBindings[i])
+      EvaluatedValues[VarNames[i].first] = *OldBindings[i];
+    else
+      EvaluatedValues.erase(VarNames[i].first);
+  }
+
+  return BodyVal;
+}
+
 /// "LetExprAST(var0 = val0, var1 = val1, ..., varn = valn; body)"
 std::string LetExprAST::toString(const unsigned depth) const {
   std::ostringstream repr;
@@ -72,13 +127,13 @@ std::string LetExprAST::toString(const unsigned depth) const {
 
   for (auto it = VarNames.begin(); it != VarNames.end(); it++) {
     const auto VarName = it->first;
-    const auto *InitialExpr = it->second.get();
+    const auto *InitialExpr = it->second;
 
     auto InitialExprS = InitialExpr ? InitialExpr->toString(depth + 1)
                                     : NumberExprAST(0.0).toString();
 
     insert_indent(repr, depth + 1);
-    repr << VarName << " = " << strltrim(InitialExprS)
+    repr << VarName.str().str() << " = " << strltrim(InitialExprS)
          << (it == VarNames.end() - 1 ? ';' : ',') << std::endl;
   }
 
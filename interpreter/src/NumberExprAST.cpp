@@ -5,6 +5,9 @@
 /// The constructor for the NumberExprAST class.
 NumberExprAST::NumberExprAST(double Val) : Val(Val) {}
 
+/// Getter for the "Val" field of instances of NumberExprAST.
+double NumberExprAST::getValue() const { return Val; }
+
 /// Generate LLVM IR for a numeric constant.
 llvm::Value *NumberExprAST::codegen() {
   // ConstantFP -> holds a compile-time floating point
@@ -13,6 +16,9 @@ llvm::Value *NumberExprAST::codegen() {
   return llvm::ConstantFP::get(getContext(), llvm::APFloat(Val));
 }
 
+/// Evaluate a numeric constant.
+llvm::Optional<double> NumberExprAST::evaluate() { return Val; }
+
 /// "NumberExprAST(%f)"
 std::string NumberExprAST::toString(const unsigned depth) const {
   std::ostringstream repr;
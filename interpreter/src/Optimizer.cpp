@@ -0,0 +1,168 @@
+#include <llvm/ADT/Triple.h>                    // llvm::Triple
+#include <llvm/Analysis/TargetLibraryInfo.h> // llvm::TargetLibraryAnalysis, llvm::TargetLibraryInfoImpl
+#include <llvm/Support/Host.h>                 // llvm::sys::getProcessTriple
+#include <llvm/Transforms/IPO/AlwaysInliner.h> // llvm::AlwaysInlinerPass
+#include <llvm/Transforms/InstCombine/InstCombine.h> // llvm::InstCombinePass
+#include <llvm/Transforms/Scalar/LICM.h>             // llvm::LICMPass
+#include <llvm/Transforms/Scalar/LoopPassManager.h> // llvm::createFunctionToLoopPassAdaptor
+#include <llvm/Transforms/Scalar/LoopRotation.h>   // llvm::LoopRotatePass
+#include <llvm/Transforms/Scalar/LoopUnrollPass.h> // llvm::LoopUnrollPass
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>    // llvm::SimplifyCFGPass
+#include <llvm/Transforms/Utils/InjectTLIMappings.h> // llvm::InjectTLIMappings
+#include <llvm/Transforms/Vectorize/LoopVectorize.h> // llvm::LoopVectorizePass
+#include <llvm/Transforms/Vectorize/SLPVectorizer.h> // llvm::SLPVectorizerPass
+
+#include "Optimizer.h"
+#include "mathlib.h" // addVectorMathFunctions
+#include "stats.h"   // PhaseRegion
+
+using OptimizationLevel = llvm::PassBuilder::OptimizationLevel;
+
+/// The level that new Optimizers are built for.
+static unsigned OptimizationLevelSetting = 2;
+
+void SetOptimizationLevel(unsigned OptLevel) {
+  OptimizationLevelSetting = OptLevel;
+}
+
+unsigned getOptimizationLevel() { return OptimizationLevelSetting; }
+
+/// Turn a number from 0 to 3 into the matching PassBuilder level.
+static OptimizationLevel toOptimizationLevel(unsigned OptLevel) {
+  switch (OptLevel) {
+  case 0:
+    return OptimizationLevel::O0;
+  case 1:
+    return OptimizationLevel::O1;
+  case 2:
+    return OptimizationLevel::O2;
+  default:
+    return OptimizationLevel::O3;
+  }
+}
+
+/// Get the options the PassBuilder tunes its pipelines with at the given
+/// level, which are the ones clang uses: loops are vectorized and unrolled,
+/// and straight-line code is vectorized, from -O2 on.
+static llvm::PipelineTuningOptions getTuningOptions(OptimizationLevel Level) {
+  llvm::PipelineTuningOptions PTO;
+  const bool Speedup = Level.getSpeedupLevel() >= 2;
+  PTO.LoopVectorization = Speedup;
+  PTO.SLPVectorization = Speedup;
+  PTO.LoopUnrolling = Speedup;
+  return PTO;
+}
+
+/// Constructor for the Optimizer class.
+Optimizer::Optimizer(unsigned OptLevel, llvm::TargetMachine *TM)
+    : Level(toOptimizationLevel(OptLevel)), PB(TM, getTuningOptions(Level)) {
+  // What the optimizations know about the C library comes from the target,
+  // and the vector math functions they may call from the library set with
+  // SetVectorLibrary. Registering this first keeps the PassBuilder from
+  // registering an analysis without them.
+  llvm::TargetLibraryInfoImpl TLII(
+      TM ? TM->getTargetTriple() : llvm::Triple(llvm::sys::getProcessTriple()));
+  addVectorMathFunctions(TLII, TM);
+  FAM.registerPass([&] { return llvm::TargetLibraryAnalysis(TLII); });
+
+  // Register all the basic analyses with the managers, and let them find
+  // each other's results.
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  // -O0 means leaving the code exactly as it was generated.
+  if (Level == OptimizationLevel::O0)
+    return;
+
+  // The simplification pipeline does what AddPasses used to and more: it
+  // promotes allocas to registers (SROA, which subsumes mem2reg), combines
+  // instructions, removes redundant expressions (GVN), hoists loop
+  // invariants (LICM), simplifies the CFG, and from -O2 on fully unrolls
+  // small loops.
+  FunctionPasses = PB.buildFunctionSimplificationPipeline(
+      Level, llvm::PassBuilder::ThinLTOPhase::None);
+
+  // What follows is the per-function part of the module optimization
+  // pipeline, which is where LLVM puts the vectorizers.
+  if (Level.getSpeedupLevel() >= 2) {
+    // The loop vectorizer only handles rotated loops.
+    FunctionPasses.addPass(
+        llvm::createFunctionToLoopPassAdaptor(llvm::LoopRotatePass()));
+    // The vectorizers only call the vector variants of the calls this marks.
+    FunctionPasses.addPass(llvm::InjectTLIMappings());
+    FunctionPasses.addPass(llvm::LoopVectorizePass());
+    FunctionPasses.addPass(llvm::InstCombinePass());
+    FunctionPasses.addPass(llvm::SLPVectorizerPass());
+    FunctionPasses.addPass(llvm::InstCombinePass());
+  }
+  FunctionPasses.addPass(llvm::LoopUnrollPass(
+      llvm::LoopUnrollOptions(Level.getSpeedupLevel())));
+  FunctionPasses.addPass(llvm::InstCombinePass());
+  // Unrolling can expose more invariant code to hoist.
+  FunctionPasses.addPass(llvm::createFunctionToLoopPassAdaptor(
+      llvm::LICMPass(), /* UseMemorySSA */ true));
+  FunctionPasses.addPass(llvm::SimplifyCFGPass());
+}
+
+void Optimizer::clearAnalyses() {
+  LAM.clear();
+  FAM.clear();
+  CGAM.clear();
+  MAM.clear();
+}
+
+/// Run the function pipeline on one function.
+void Optimizer::runOnFunction(llvm::Function &F) {
+  PhaseRegion Region(Phase::Optimize);
+  if (Level == OptimizationLevel::O0)
+    return;
+  FunctionPasses.run(F, FAM);
+  clearAnalyses();
+}
+
+/// Run the function pipeline on the functions of a module.
+void Optimizer::runOnFunctions(llvm::Module &M) {
+  PhaseRegion Region(Phase::Optimize);
+  if (Level == OptimizationLevel::O0)
+    return;
+  for (auto &F : M)
+    if (!F.isDeclaration())
+      FunctionPasses.run(F, FAM);
+  clearAnalyses();
+}
+
+/// Run the per-module pipeline on a module.
+void Optimizer::runOnModule(llvm::Module &M) {
+  PhaseRegion Region(Phase::Optimize);
+  if (Level == OptimizationLevel::O0) {
+    runAlwaysInliner(M);
+    return;
+  }
+  auto ModulePasses = PB.buildPerModuleDefaultPipeline(Level);
+  ModulePasses.run(M, MAM);
+  clearAnalyses();
+}
+
+/// Run the ThinLTO pre-link pipeline on a module.
+void Optimizer::runThinLTOPreLink(llvm::Module &M) {
+  PhaseRegion Region(Phase::Optimize);
+  if (Level == OptimizationLevel::O0) {
+    runAlwaysInliner(M);
+    return;
+  }
+  auto ModulePasses = PB.buildThinLTOPreLinkDefaultPipeline(Level);
+  ModulePasses.run(M, MAM);
+  clearAnalyses();
+}
+
+/// Run just the always-inliner on a module.
+void Optimizer::runAlwaysInliner(llvm::Module &M) {
+  PhaseRegion Region(Phase::Optimize);
+  llvm::ModulePassManager ModulePasses;
+  ModulePasses.addPass(llvm::AlwaysInlinerPass());
+  ModulePasses.run(M, MAM);
+  clearAnalyses();
+}
@@ -0,0 +1,421 @@
+#include <llvm/ADT/SetVector.h>   // llvm::SmallSetVector
+#include <llvm/IR/InstIterator.h> // llvm::instructions
+#include <llvm/IR/Intrinsics.h>   // llvm::Intrinsic
+#include <llvm/IR/Verifier.h>     // llvm::verifyFunction
+
+#include <algorithm> // std::min
+#include <cmath>     // std::ceil, std::fmin
+#include <sstream>   // std::ostringstream
+#include <utility>   // std::pair, std::swap
+#include <vector>    // std::vector
+
+#include "stats.h"   // Counter, countEvent
+#include "tiering.h" // CountLoopIteration
+
+#include "Optimizer.h"
+#include "ParallelForExprAST.h"
+#include "WorkStealingPool.h"
+
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+/// Whether parallel loops call kaleidoscope_parallel_for.
+static bool ParallelLoops = true;
+
+void SetParallelLoops(bool Enabled) { ParallelLoops = Enabled; }
+
+/// The most chunks the iterations of a parallel loop are split into, which
+/// is plenty to keep every core busy, while keeping a chunk of a long loop
+/// long enough that handing it to a thread costs next to nothing.
+static constexpr std::int64_t MaxChunks = 256;
+
+/// The largest magnitude up to which every integer is a double, which is as
+/// far as a parallel loop counts.
+static constexpr double MaxExactInteger = 9007199254740992.0; // 2^53
+
+/// Get the number of iterations of each chunk, but the last, which can have
+/// fewer.
+///
+/// @param Count the number of iterations of the loop, at least 1
+static std::int64_t getChunkSize(std::int64_t Count) {
+  return (Count + MaxChunks - 1) / MaxChunks;
+}
+
+/// Get the number of times a parallel loop runs its body, which is once more
+/// than the number of steps it takes to get from the start to the bound.
+/// A loop that does not get closer to the bound with every step stops after
+/// the first iteration.
+static std::int64_t getIterationCount(double Start, double Bound,
+                                      double Step) {
+  const double Steps =
+      Step > 0.0 && Start < Bound ? (Bound - Start) / Step : 0.0;
+  return static_cast<std::int64_t>(
+             std::ceil(std::fmin(Steps, MaxExactInteger))) +
+         1;
+}
+
+/// Generate LLVM IR for what getIterationCount works out.
+static llvm::Value *codegenIterationCount(llvm::Value *Start,
+                                          llvm::Value *Bound,
+                                          llvm::Value *Step) {
+  auto &Builder = getBuilder();
+  auto *Zero = llvm::ConstantFP::get(Builder.getDoubleTy(), 0.0);
+  llvm::Value *Forward =
+      Builder.CreateAnd(Builder.CreateFCmpOGT(Step, Zero),
+                        Builder.CreateFCmpOLT(Start, Bound), "forward");
+  llvm::Value *Steps = Builder.CreateFDiv(Builder.CreateFSub(Bound, Start),
+                                          Step, "steps");
+  Steps = Builder.CreateSelect(Forward, Steps, Zero);
+  Steps = Builder.CreateMinNum(
+      Steps, llvm::ConstantFP::get(Builder.getDoubleTy(), MaxExactInteger));
+  Steps = Builder.CreateUnaryIntrinsic(llvm::Intrinsic::ceil, Steps);
+  return Builder.CreateNSWAdd(
+      Builder.CreateFPToSI(Steps, Builder.getInt64Ty()), Builder.getInt64(1),
+      "count");
+}
+
+extern "C" DLLEXPORT double kaleidoscope_parallel_for(
+    double (*Body)(void **Env, double Start, double Step, std::int64_t Begin,
+                   std::int64_t End),
+    void **Env, double Start, double Step, std::int64_t Count) {
+  countEvent(Counter::ParallelLoops);
+  const auto ChunkSize = getChunkSize(Count);
+  const auto NumChunks = (Count + ChunkSize - 1) / ChunkSize;
+  double Sums[MaxChunks];
+  WorkStealingPool::getInstance().run(NumChunks, [&](std::size_t Chunk) {
+    const std::int64_t Begin = Chunk * ChunkSize;
+    Sums[Chunk] =
+        Body(Env, Start, Step, Begin, std::min(Begin + ChunkSize, Count));
+  });
+  double Total = 0.0;
+  for (std::int64_t Chunk = 0; Chunk < NumChunks; Chunk++)
+    Total += Sums[Chunk];
+  return Total;
+}
+
+/// The constructor for the ParallelForExprAST class.
+ParallelForExprAST::ParallelForExprAST(Symbol Name, ExprAST *Start,
+                                       ExprAST *Bound, ExprAST *Step,
+                                       ExprAST *Body)
+    : VarName(Name), Start(Start), Bound(Bound), Step(Step), Body(Body) {}
+
+/// Generate LLVM IR for a parallel for expression.
+llvm::Value *ParallelForExprAST::codegen() {
+  return codegenLoop(
+      VarName, [this] { return Start->codegen(); },
+      [this] { return Bound->codegen(); },
+      [this]() -> llvm::Value * {
+        if (Step)
+          return Step->codegen();
+        return llvm::ConstantFP::get(getContext(), llvm::APFloat(1.0));
+      },
+      [this] { return Body->codegen(); });
+}
+
+/// Generate the function that runs a chunk of the iterations of a parallel
+/// loop, into the module of the given function, whose variables it reads
+/// through its first argument.
+///
+/// @param Function the function the loop is in
+/// @param VarName the name of the induction variable
+/// @param Captured the variables in scope, in the order their addresses are
+///        in the environment
+/// @param GenerateBody generates the body of the loop
+/// @return the function, or nullptr if the body could not be generated
+static llvm::Function *codegenChunk(
+    llvm::Function *Function, Symbol VarName,
+    llvm::ArrayRef<std::pair<Symbol, llvm::AllocaInst *>> Captured,
+    llvm::function_ref<llvm::Value *()> GenerateBody) {
+  auto &Builder = getBuilder();
+  auto *DoubleTy = Builder.getDoubleTy();
+  auto *Int64Ty = Builder.getInt64Ty();
+  auto *PointerTy = Builder.getInt8PtrTy();
+  auto *ChunkTy = llvm::FunctionType::get(
+      DoubleTy,
+      {PointerTy->getPointerTo(), DoubleTy, DoubleTy, Int64Ty, Int64Ty},
+      false);
+  auto *Chunk =
+      llvm::Function::Create(ChunkTy, llvm::Function::InternalLinkage,
+                             Function->getName() + ".parallel",
+                             Function->getParent());
+  auto *Env = Chunk->getArg(0), *Start = Chunk->getArg(1),
+       *Step = Chunk->getArg(2), *Begin = Chunk->getArg(3),
+       *End = Chunk->getArg(4);
+  Env->setName("env");
+  Start->setName("start");
+  Step->setName("step");
+  Begin->setName("begin");
+  End->setName("end");
+
+  llvm::BasicBlock *Entry =
+      llvm::BasicBlock::Create(getContext(), "entry", Chunk);
+  Builder.SetInsertPoint(Entry);
+
+  // Every variable in scope gets one of the chunk's own, next to the address
+  // of the variable it copies.
+  auto &NamedValues = getNamedValues();
+  std::vector<std::pair<llvm::Value *, llvm::AllocaInst *>> Copies;
+  for (std::size_t I = 0; I < Captured.size(); I++) {
+    llvm::AllocaInst *Outer = Captured[I].second;
+    llvm::Type *Type = Outer->getAllocatedType();
+    llvm::Value *Address = Builder.CreateLoad(
+        PointerTy, Builder.CreateConstInBoundsGEP1_64(PointerTy, Env, I));
+    llvm::AllocaInst *Alloca =
+        CreateEntryBlockAlloca(Chunk, Outer->getName(), Type);
+    Copies.emplace_back(Builder.CreateBitCast(Address, Type->getPointerTo()),
+                        Alloca);
+    NamedValues[Captured[I].first] = Alloca;
+  }
+  llvm::AllocaInst *Variable = CreateEntryBlockAlloca(Chunk, VarName.str());
+  NamedValues[VarName] = Variable;
+
+  llvm::BasicBlock *LoopBasicBlock =
+      llvm::BasicBlock::Create(getContext(), "loop", Chunk);
+  Builder.CreateBr(LoopBasicBlock);
+  Builder.SetInsertPoint(LoopBasicBlock);
+  llvm::PHINode *Counter =
+      Builder.CreatePHI(Int64Ty, 2, VarName.str() + ".count");
+  llvm::PHINode *Sum = Builder.CreatePHI(DoubleTy, 2, "sum");
+
+  // Every iteration starts out with the variables in scope before the loop,
+  // whatever the one before it assigned to them. An array variable holds a
+  // pointer, so the array itself is shared.
+  for (const auto &AddressCopyPair : Copies)
+    Builder.CreateStore(
+        Builder.CreateLoad(AddressCopyPair.second->getAllocatedType(),
+                           AddressCopyPair.first),
+        AddressCopyPair.second);
+
+  // Iteration K has the induction variable at Start + K * Step, however many
+  // iterations other chunks ran before it.
+  Builder.CreateStore(
+      Builder.CreateFAdd(
+          Start, Builder.CreateFMul(Builder.CreateSIToFP(Counter, DoubleTy),
+                                    Step)),
+      Variable);
+  llvm::Value *BodyVal = GenerateBody();
+  if (!BodyVal) {
+    ParallelForExprAST::eraseFunction(*Chunk);
+    return nullptr;
+  }
+
+  llvm::Value *NewSum = Builder.CreateFAdd(Sum, BodyVal, "sum");
+  llvm::Value *NextCounter =
+      Builder.CreateNSWAdd(Counter, Builder.getInt64(1), "next");
+  llvm::BasicBlock *LoopEndBasicBlock = Builder.GetInsertBlock();
+  Counter->addIncoming(Begin, Entry);
+  Counter->addIncoming(NextCounter, LoopEndBasicBlock);
+  Sum->addIncoming(llvm::ConstantFP::get(DoubleTy, 0.0), Entry);
+  Sum->addIncoming(NewSum, LoopEndBasicBlock);
+
+  llvm::BasicBlock *AfterBasicBlock =
+      llvm::BasicBlock::Create(getContext(), "afterloop", Chunk);
+  Builder.CreateCondBr(Builder.CreateICmpSLT(NextCounter, End), LoopBasicBlock,
+                       AfterBasicBlock);
+  Builder.SetInsertPoint(AfterBasicBlock);
+  Builder.CreateRet(NewSum);
+
+#ifndef NDEBUG
+  llvm::verifyFunction(*Chunk, &llvm::errs());
+#endif
+  if (auto *FunctionOptimizer = getOptimizer())
+    FunctionOptimizer->runOnFunction(*Chunk);
+  return Chunk;
+}
+
+/// Generate LLVM IR that calls the function made for the chunks of a
+/// parallel loop for each chunk in turn, and adds them up in order, just like
+/// kaleidoscope_parallel_for does.
+static llvm::Value *codegenSequentialChunks(llvm::Function *Chunk,
+                                            llvm::Value *Env,
+                                            llvm::Value *Start,
+                                            llvm::Value *Step,
+                                            llvm::Value *Count) {
+  auto &Builder = getBuilder();
+  llvm::Function *Function = Builder.GetInsertBlock()->getParent();
+  llvm::Value *ChunkSize = Builder.CreateSDiv(
+      Builder.CreateNSWAdd(Count, Builder.getInt64(MaxChunks - 1)),
+      Builder.getInt64(MaxChunks), "chunksize");
+
+  llvm::BasicBlock *HeaderBasicBlock = Builder.GetInsertBlock();
+  llvm::BasicBlock *LoopBasicBlock =
+      llvm::BasicBlock::Create(getContext(), "chunk", Function);
+  Builder.CreateBr(LoopBasicBlock);
+  Builder.SetInsertPoint(LoopBasicBlock);
+  llvm::PHINode *Begin = Builder.CreatePHI(Builder.getInt64Ty(), 2, "begin");
+  llvm::PHINode *Total = Builder.CreatePHI(Builder.getDoubleTy(), 2, "total");
+  llvm::Value *End = Builder.CreateNSWAdd(Begin, ChunkSize);
+  llvm::Value *Last = Builder.CreateICmpSGE(End, Count);
+  End = Builder.CreateSelect(Last, Count, End, "end");
+  llvm::Value *NewTotal = Builder.CreateFAdd(
+      Total, Builder.CreateCall(Chunk, {Env, Start, Step, Begin, End}),
+      "total");
+  Begin->addIncoming(Builder.getInt64(0), HeaderBasicBlock);
+  Begin->addIncoming(End, LoopBasicBlock);
+  Total->addIncoming(llvm::ConstantFP::get(Builder.getDoubleTy(), 0.0),
+                     HeaderBasicBlock);
+  Total->addIncoming(NewTotal, LoopBasicBlock);
+
+  llvm::BasicBlock *AfterBasicBlock =
+      llvm::BasicBlock::Create(getContext(), "afterchunks", Function);
+  Builder.CreateCondBr(Last, AfterBasicBlock, LoopBasicBlock);
+  Builder.SetInsertPoint(AfterBasicBlock);
+  return NewTotal;
+}
+
+llvm::Value *ParallelForExprAST::codegenLoop(
+    Symbol VarName, llvm::function_ref<llvm::Value *()> GenerateStart,
+    llvm::function_ref<llvm::Value *()> GenerateBound,
+    llvm::function_ref<llvm::Value *()> GenerateStep,
+    llvm::function_ref<llvm::Value *()> GenerateBody) {
+  auto &Builder = getBuilder();
+  llvm::Function *Function = Builder.GetInsertBlock()->getParent();
+
+  // Everything the iterations have in common is worked out up front, without
+  // the induction variable in scope.
+  llvm::Value *StartVal = GenerateStart();
+  if (!StartVal)
+    return nullptr;
+  llvm::Value *BoundVal = GenerateBound();
+  if (!BoundVal)
+    return nullptr;
+  llvm::Value *StepVal = GenerateStep();
+  if (!StepVal)
+    return nullptr;
+  llvm::Value *Count = codegenIterationCount(StartVal, BoundVal, StepVal);
+
+  // The chunks get at the variables in scope through an array of their
+  // addresses.
+  auto &NamedValues = getNamedValues();
+  std::vector<std::pair<Symbol, llvm::AllocaInst *>> Captured;
+  for (const auto &NameValuePair : NamedValues)
+    if (NameValuePair.second)
+      Captured.push_back(NameValuePair);
+  auto *PointerTy = Builder.getInt8PtrTy();
+  auto *EnvTy = llvm::ArrayType::get(PointerTy, Captured.size());
+  llvm::AllocaInst *Env = CreateEntryBlockAlloca(Function, "env", EnvTy);
+  for (std::size_t I = 0; I < Captured.size(); I++)
+    Builder.CreateStore(Builder.CreateBitCast(Captured[I].second, PointerTy),
+                        Builder.CreateConstInBoundsGEP2_64(EnvTy, Env, 0, I));
+  llvm::Value *EnvPointer =
+      Builder.CreateBitCast(Env, PointerTy->getPointerTo());
+
+  // Generate the chunk function with a scope of its own, and then carry on
+  // where the loop is.
+  auto InsertPoint = Builder.saveIP();
+  llvm::DenseMap<Symbol, llvm::AllocaInst *> Scope;
+  std::swap(NamedValues, Scope);
+  llvm::Function *Chunk =
+      codegenChunk(Function, VarName, Captured, GenerateBody);
+  std::swap(NamedValues, Scope);
+  Builder.restoreIP(InsertPoint);
+  if (!Chunk)
+    return nullptr;
+
+  if (!ParallelLoops)
+    return codegenSequentialChunks(Chunk, EnvPointer, StartVal, StepVal,
+                                   Count);
+  auto Runtime = borrowModule().getOrInsertFunction(
+      "kaleidoscope_parallel_for", Builder.getDoubleTy(), Chunk->getType(),
+      PointerTy->getPointerTo(), Builder.getDoubleTy(), Builder.getDoubleTy(),
+      Builder.getInt64Ty());
+  return Builder.CreateCall(
+      Runtime, {Chunk, EnvPointer, StartVal, StepVal, Count}, "parallelsum");
+}
+
+/// Evaluate a parallel for expression.
+llvm::Optional<double> ParallelForExprAST::evaluate() {
+  return evaluateLoop(
+      VarName, [this] { return Start->evaluate(); },
+      [this] { return Bound->evaluate(); },
+      [this]() -> llvm::Optional<double> {
+        if (Step)
+          return Step->evaluate();
+        return 1.0;
+      },
+      [this] { return Body->evaluate(); });
+}
+
+llvm::Optional<double> ParallelForExprAST::evaluateLoop(
+    Symbol VarName, llvm::function_ref<llvm::Optional<double>()> EvaluateStart,
+    llvm::function_ref<llvm::Optional<double>()> EvaluateBound,
+    llvm::function_ref<llvm::Optional<double>()> EvaluateStep,
+    llvm::function_ref<llvm::Optional<double>()> EvaluateBody) {
+  auto StartVal = EvaluateStart();
+  if (!StartVal)
+    return llvm::None;
+  auto BoundVal = EvaluateBound();
+  if (!BoundVal)
+    return llvm::None;
+  auto StepVal = EvaluateStep();
+  if (!StepVal)
+    return llvm::None;
+
+  const auto Count = getIterationCount(*StartVal, *BoundVal, *StepVal);
+  const auto ChunkSize = getChunkSize(Count);
+  // Every iteration starts out with the variables in scope before the loop,
+  // whatever the one before it assigned to them.
+  auto &EvaluatedValues = getEvaluatedValues();
+  const auto Scope = EvaluatedValues;
+  double Total = 0.0;
+  for (std::int64_t Begin = 0; Begin < Count; Begin += ChunkSize) {
+    double Sum = 0.0;
+    const auto End = std::min(Begin + ChunkSize, Count);
+    for (std::int64_t K = Begin; K < End; K++) {
+      EvaluatedValues = Scope;
+      EvaluatedValues[VarName] = *StartVal + static_cast<double>(K) * *StepVal;
+      auto BodyVal = EvaluateBody();
+      if (!BodyVal) {
+        EvaluatedValues = Scope;
+        return llvm::None;
+      }
+      Sum += *BodyVal;
+      CountLoopIteration();
+    }
+    Total += Sum;
+  }
+  EvaluatedValues = Scope;
+  return Total;
+}
+
+void ParallelForExprAST::eraseFunction(llvm::Function &F) {
+  // The chunk functions of the loops in F are local, and only F refers to
+  // them.
+  llvm::SmallSetVector<llvm::Function *, 4> Chunks;
+  for (auto &I : llvm::instructions(F))
+    for (auto &Operand : I.operands())
+      if (auto *Chunk =
+              llvm::dyn_cast<llvm::Function>(Operand->stripPointerCasts()))
+        if (Chunk != &F && Chunk->hasLocalLinkage())
+          Chunks.insert(Chunk);
+  F.deleteBody();
+  for (auto *Chunk : Chunks)
+    if (Chunk->use_empty())
+      eraseFunction(*Chunk);
+  // Other functions in the module may have been generated to call F already,
+  // in which case F goes on as a declaration of the code it replaces.
+  if (F.use_empty())
+    F.eraseFromParent();
+}
+
+/// "ParallelForExprAST(var = init, bound, step, body)"
+std::string ParallelForExprAST::toString(const unsigned depth) const {
+  std::ostringstream repr;
+  auto StartS = Start->toString(depth + 1),
+       BoundS = Bound->toString(depth + 1);
+
+  insert_indent(repr, depth);
+  repr << "ParallelForExprAST(" << VarName.str().str() << " = "
+       << strltrim(StartS) << ", " << strltrim(BoundS);
+  if (Step) {
+    auto StepS = Step->toString(depth + 1);
+    repr << ", " << strltrim(StepS);
+  }
+  repr << ',' << std::endl << Body->toString(depth + 1) << std::endl;
+  insert_indent(repr, depth);
+  repr << ')';
+  return repr.str();
+}
@@ -0,0 +1,62 @@
+#include <llvm/Object/SymbolSize.h> // llvm::object::computeSymbolSizes
+#include <llvm/Support/FileSystem.h> // llvm::sys::fs::OF_Text
+#include <llvm/Support/Format.h>     // llvm::format
+#include <llvm/Support/Process.h>    // llvm::sys::Process
+
+#include "PerfMapListener.h"
+
+PerfMapListener::PerfMapListener() {
+  std::error_code EC;
+  auto Path = getPath();
+  Map = std::make_unique<llvm::raw_fd_ostream>(Path, EC,
+                                               llvm::sys::fs::OF_Text);
+  if (EC) {
+    llvm::errs() << "Could not write " << Path << ": " << EC.message()
+                 << '\n';
+    Map->clear_error();
+    Map.reset();
+  }
+}
+
+std::string PerfMapListener::getPath() {
+  return "/tmp/perf-" + std::to_string(llvm::sys::Process::getProcessId()) +
+         ".map";
+}
+
+void PerfMapListener::notifyObjectLoaded(
+    ObjectKey, const llvm::object::ObjectFile &Obj,
+    const llvm::RuntimeDyld::LoadedObjectInfo &L) {
+  if (!Map)
+    return;
+  // The copy of the object made for debuggers has its sections at the
+  // addresses they were loaded at, so its symbols are too.
+  auto DebugObj = L.getObjectForDebug(Obj);
+  if (!DebugObj.getBinary())
+    return;
+
+  std::lock_guard<std::mutex> Guard(Lock);
+  for (const auto &SymbolAndSize :
+       llvm::object::computeSymbolSizes(*DebugObj.getBinary())) {
+    const auto &Sym = SymbolAndSize.first;
+    auto Type = Sym.getType();
+    if (!Type || *Type != llvm::object::SymbolRef::ST_Function) {
+      if (!Type)
+        llvm::consumeError(Type.takeError());
+      continue;
+    }
+    auto Name = Sym.getName();
+    auto Address = Sym.getAddress();
+    if (!Name || !Address) {
+      llvm::consumeError(Name.takeError());
+      llvm::consumeError(Address.takeError());
+      continue;
+    }
+    *Map << llvm::format("%llx %llx ",
+                         static_cast<unsigned long long>(*Address),
+                         static_cast<unsigned long long>(SymbolAndSize.second))
+         << *Name << '\n';
+  }
+  // perf may read the map while this process is still running, or after it
+  // crashed.
+  Map->flush();
+}
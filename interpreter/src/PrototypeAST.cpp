@@ -1,4 +1,8 @@
-#include <sstream> // std::ostringstream
+#include <algorithm> // std::find
+#include <sstream>   // std::ostringstream
+
+#include "inliner.h" // isOperatorInliningEnabled
+#include "mathlib.h" // addMathFunctionAttributes, isLibraryFunction, isMathFunction
 
 #include "ExprAST.h"
 #include "PrototypeAST.h"
@@ -6,27 +10,60 @@
 /// Constructor for the PrototypeAST class.
 PrototypeAST::PrototypeAST(const std::string &Name,
                            std::vector<std::string> Args, bool IsOperator,
-                           unsigned Precedence)
-    : Name(Name), Args(std::move(Args)), IsOperator(IsOperator),
-      Precedence(Precedence) {}
+                           unsigned Precedence, std::vector<bool> ArrayArgs,
+                           bool IsExtern)
+    : Name(Name), NameSymbol(Symbol::intern(Name)), Args(std::move(Args)),
+      ArrayArgs(std::move(ArrayArgs)), IsOperator(IsOperator),
+      Precedence(Precedence), IsExtern(IsExtern) {
+  for (const auto &Arg : this->Args)
+    ArgSymbols.push_back(Symbol::intern(Arg));
+}
 
 /// Getter for the "Name" field of instances of PrototypeAST.
 const std::string &PrototypeAST::getName() const { return Name; }
 
+/// Getter for the "NameSymbol" field of instances of PrototypeAST.
+Symbol PrototypeAST::getSymbol() const { return NameSymbol; }
+
+/// Getter for the "Args" field of instances of PrototypeAST.
+const std::vector<std::string> &PrototypeAST::getArgs() const { return Args; }
+
+/// Getter for the "ArgSymbols" field of instances of PrototypeAST.
+const std::vector<Symbol> &PrototypeAST::getArgSymbols() const {
+  return ArgSymbols;
+}
+
+/// Whether the parameter at the given index is an array.
+bool PrototypeAST::isArrayArg(std::size_t Index) const {
+  return !ArrayArgs.empty() && ArrayArgs[Index];
+}
+
+/// Whether any of the parameters is an array.
+bool PrototypeAST::hasArrayArgs() const {
+  return std::find(ArrayArgs.begin(), ArrayArgs.end(), true) != ArrayArgs.end();
+}
+
+/// Getter for the "IsExtern" field of instances of PrototypeAST.
+bool PrototypeAST::isExtern() const { return IsExtern; }
+
 /// Generate LLVM IR for a function prototype.
 llvm::Function *PrototypeAST::codegen() {
-  // All arguments to functions in our language are doubles so create a vector
-  // of "N" LLVM double types where N is the number of arguments in the function
+  // Arguments to functions in our language are doubles, except for arrays,
+  // which are passed the same way C passes a double *. So create a vector of
+  // "N" LLVM types where N is the number of arguments in the function
   // prototype
-  std::vector<llvm::Type *> Doubles(Args.size(),
-                                    llvm::Type::getDoubleTy(getContext()));
+  std::vector<llvm::Type *> ArgTypes;
+  for (std::size_t i = 0; i < Args.size(); i++)
+    ArgTypes.push_back(isArrayArg(i)
+                           ? llvm::Type::getDoublePtrTy(getContext())
+                           : llvm::Type::getDoubleTy(getContext()));
 
   // Create a function type that returns a double (the first parameter to
-  // FunctionType::get), takes Doubles.size() number of arguments, each
-  // of type double (the second parameter to FunctionType::get), and is
+  // FunctionType::get), takes ArgTypes.size() number of arguments, each
+  // of the type above (the second parameter to FunctionType::get), and is
   // not vararg (the false parameter to FunctionType::get).
   llvm::FunctionType *FT = llvm::FunctionType::get(
-      llvm::Type::getDoubleTy(getContext()), Doubles, false);
+      llvm::Type::getDoubleTy(getContext()), ArgTypes, false);
 
   // Actually generate the LLVM IR from the function type above.
   // External linkage means the function can be defined outside of this module.
@@ -40,6 +77,18 @@ llvm::Function *PrototypeAST::codegen() {
   for (auto &Arg : F->args())
     Arg.setName(Args[Idx++]);
 
+  // Operators are usually tiny, so calling them costs more than running
+  // them. Declarations get the attribute too, which is how a module using an
+  // operator knows to import its body.
+  if (IsOperator && isOperatorInliningEnabled())
+    F->addFnAttr(llvm::Attribute::AlwaysInline);
+  if (isMathFunction(*this))
+    addMathFunctionAttributes(*F);
+  // A function defined in Kaleidoscope is its own, whatever it is called, so
+  // calls to it must not be folded into what the C function would compute.
+  else if (!IsExtern && isLibraryFunction(*F))
+    F->addFnAttr(llvm::Attribute::NoBuiltin);
+
   return F;
 }
 
@@ -50,6 +99,8 @@ std::string PrototypeAST::toString(const unsigned depth) const {
   repr << "PrototypeAST(" << Name << '(';
   for (auto it = Args.begin(); it != Args.end(); it++) {
     repr << *it;
+    if (isArrayArg(it - Args.begin()))
+      repr << "[]";
     if (it != Args.end() - 1)
       repr << ", ";
   }
@@ -0,0 +1,139 @@
+#include <llvm/ADT/StringMap.h>       // llvm::StringMap
+#include <llvm/Support/ErrorHandling.h> // llvm::report_fatal_error
+
+#include <atomic>  // std::atomic
+#include <cstdint> // std::uint32_t
+#include <mutex>   // std::mutex, std::lock_guard
+#include <string>  // std::string
+
+#include "Symbol.h"
+
+/// How many entries each chunk of the symbol table holds, and how many chunks
+/// it can have, which makes for 16M symbols at most.
+static constexpr std::uint32_t ChunkSize = 1 << 12;
+static constexpr std::uint32_t MaxChunks = 1 << 12;
+
+namespace {
+/// The entry of one symbol in the table. Once its ID is handed out, an entry
+/// only ever changes by having its mangled name set.
+struct SymbolEntry {
+  /// The name, which points into the key of the symbol's entry in IDs.
+  llvm::StringRef Name;
+  /// The mangled name, or nullptr if it has not been asked for yet. It is
+  /// set once and freed along with the table.
+  std::atomic<const std::string *> MangledName{nullptr};
+};
+
+/// SymbolTable - Every name interned so far.
+///
+/// The entries live in chunks of ChunkSize, which are allocated as needed and
+/// never move, so looking up an entry by ID is two loads and takes no lock.
+/// An ID is only handed out once its entry is written, and whoever got the
+/// ID from the thread interning it sees the entry as well. Only interning
+/// takes the lock, to look up and add names.
+struct SymbolTable {
+  std::mutex Lock;
+  /// The symbol of each name.
+  llvm::StringMap<std::uint32_t> IDs;
+  /// The chunks of entries, indexed by ID / ChunkSize.
+  std::atomic<SymbolEntry *> Chunks[MaxChunks] = {};
+
+  SymbolTable() {
+    // The default-constructed Symbol is the empty name.
+    intern("");
+  }
+
+  ~SymbolTable() {
+    for (auto &Chunk : Chunks) {
+      auto *Entries = Chunk.load(std::memory_order_relaxed);
+      if (!Entries)
+        break;
+      for (std::uint32_t I = 0; I < ChunkSize; I++)
+        delete Entries[I].MangledName.load(std::memory_order_relaxed);
+      delete[] Entries;
+    }
+  }
+
+  std::uint32_t intern(llvm::StringRef Name) {
+    std::lock_guard<std::mutex> Guard(Lock);
+    const std::uint32_t ID = IDs.size();
+    auto Inserted = IDs.try_emplace(Name, ID);
+    if (Inserted.second) {
+      if (ID / ChunkSize == MaxChunks)
+        llvm::report_fatal_error("Too many distinct names");
+      auto &Chunk = Chunks[ID / ChunkSize];
+      if (ID % ChunkSize == 0)
+        Chunk.store(new SymbolEntry[ChunkSize], std::memory_order_release);
+      Chunk.load(std::memory_order_relaxed)[ID % ChunkSize].Name =
+          Inserted.first->getKey();
+    }
+    return Inserted.first->second;
+  }
+
+  SymbolEntry &operator[](std::uint32_t ID) {
+    auto *Entries = Chunks[ID / ChunkSize].load(std::memory_order_acquire);
+    return Entries[ID % ChunkSize];
+  }
+};
+} // namespace
+
+/// The table of every symbol. It is made the first time it is needed, so that
+/// symbols can be interned while other globals are being initialized.
+static SymbolTable &getTable() {
+  static SymbolTable Table;
+  return Table;
+}
+
+/// The IDs of the symbols for the functions implementing each user-defined
+/// binary and unary operator, or 0 (the empty name) where not interned yet.
+static std::atomic<std::uint32_t> BinaryOperators[256];
+static std::atomic<std::uint32_t> UnaryOperators[256];
+
+Symbol Symbol::intern(llvm::StringRef Name) {
+  return Symbol(getTable().intern(Name));
+}
+
+/// Get the symbol for Prefix followed by Op, caching it in Cache.
+static std::uint32_t internOperator(std::atomic<std::uint32_t> *Cache,
+                                    const char *Prefix, char Op) {
+  // The entry of the symbol was filled in under the table's lock, which a
+  // thread finding the ID here never takes, so the ID is published with
+  // release and acquire, just like the chunks are.
+  auto &Cached = Cache[static_cast<unsigned char>(Op)];
+  std::uint32_t ID = Cached.load(std::memory_order_acquire);
+  if (!ID) {
+    std::string Name = Prefix;
+    Name += Op;
+    ID = Symbol::intern(Name).getID();
+    Cached.store(ID, std::memory_order_release);
+  }
+  return ID;
+}
+
+Symbol Symbol::binaryOperator(char Op) {
+  return Symbol(internOperator(BinaryOperators, "binary", Op));
+}
+
+Symbol Symbol::unaryOperator(char Op) {
+  return Symbol(internOperator(UnaryOperators, "unary", Op));
+}
+
+llvm::StringRef Symbol::str() const { return getTable()[ID].Name; }
+
+llvm::StringRef Symbol::getMangledName(
+    llvm::function_ref<std::string(llvm::StringRef)> Mangle) const {
+  auto &Entry = getTable()[ID];
+  if (const auto *MangledName =
+          Entry.MangledName.load(std::memory_order_acquire))
+    return *MangledName;
+  // Mangling gives the same result every time, so if two threads both mangle
+  // the same name, the one that loses keeps what the other one stored.
+  const auto *MangledName = new std::string(Mangle(Entry.Name));
+  const std::string *Stored = nullptr;
+  if (!Entry.MangledName.compare_exchange_strong(Stored, MangledName,
+                                                 std::memory_order_acq_rel)) {
+    delete MangledName;
+    return *Stored;
+  }
+  return *MangledName;
+}
@@ -1,12 +1,15 @@
 #include <sstream> // std::ostringstream
 
+#include "dependencies.h" // RecordCall
+#include "tiering.h"      // CallFunction
+
 #include "UnaryExprAST.h"
 
 using std::size_t;
 
 /// The constuctor for the UnaryExprAST class.
-UnaryExprAST::UnaryExprAST(char Opcode, std::unique_ptr<ExprAST> Operand)
-    : Op(Opcode), Operand(std::move(Operand)) {}
+UnaryExprAST::UnaryExprAST(char Opcode, ExprAST *Operand)
+    : Op(Opcode), Operand(Operand) {}
 
 /// Generate LLVM IR for a unary expression.
 llvm::Value *UnaryExprAST::codegen() {
@@ -14,7 +17,7 @@ llvm::Value *UnaryExprAST::codegen() {
   if (!OperandValue)
     return nullptr;
 
-  llvm::Function *Operator = getFunction(std::string("unary") + Op);
+  llvm::Function *Operator = getFunction(Symbol::unaryOperator(Op));
   if (!Operator) {
     // "Unknown unary operator " is 23 characters + 1 for Op + 1 for NUL byte
     constexpr size_t errMsgBufSize = 25;
@@ -22,10 +25,29 @@ llvm::Value *UnaryExprAST::codegen() {
     std::snprintf(errMsg, errMsgBufSize, "Unknown unary operator %c", Op);
     return LogErrorV(errMsg);
   }
+  RecordCall(Symbol::unaryOperator(Op));
 
   return getBuilder().CreateCall(Operator, OperandValue, "unop");
 }
 
+/// Evaluate a unary expression.
+llvm::Optional<double> UnaryExprAST::evaluate() {
+  auto OperandValue = Operand->evaluate();
+  if (!OperandValue)
+    return llvm::None;
+
+  const auto Operator = Symbol::unaryOperator(Op);
+  if (!getFunctionProtos().count(Operator)) {
+    // "Unknown unary operator " is 23 characters + 1 for Op + 1 for NUL byte
+    constexpr size_t errMsgBufSize = 25;
+    char errMsg[errMsgBufSize];
+    std::snprintf(errMsg, errMsgBufSize, "Unknown unary operator %c", Op);
+    return LogErrorD(errMsg);
+  }
+
+  return CallFunction(Operator, *OperandValue);
+}
+
 /// "op rhs"
 std::string UnaryExprAST::toString(const unsigned depth) const {
   std::ostringstream repr;
@@ -3,26 +3,48 @@
 #include "VariableExprAST.h"
 
 /// The constructor for the VariableExprAST class.
-VariableExprAST::VariableExprAST(const std::string &Name) : Name(Name) {}
+VariableExprAST::VariableExprAST(Symbol Name) : Name(Name) {}
 
 /// Generate LLVM IR for a variable reference.
 llvm::Value *VariableExprAST::codegen() {
   // Look this variable up in the function.
-  llvm::Value *V = getNamedValues().at(Name);
+  llvm::AllocaInst *V = getNamedValues().lookup(Name);
 
   if (!V) {
     std::ostringstream errMsg("Unknown variable name: ", std::ios_base::ate);
-    errMsg << Name;
+    errMsg << Name.str().str();
     return LogErrorV(errMsg.str().c_str());
   }
 
-  return getBuilder().CreateLoad(V, Name.c_str());
+  // An array is not a value, only its elements are.
+  if (isArrayVariable(V)) {
+    std::ostringstream errMsg;
+    errMsg << Name.str().str()
+           << " is an array, so it can only be indexed or passed to a function";
+    return LogErrorV(errMsg.str().c_str());
+  }
+
+  return getBuilder().CreateLoad(V, Name.str());
+}
+
+/// Evaluate a variable reference.
+llvm::Optional<double> VariableExprAST::evaluate() {
+  const auto &EvaluatedValues = getEvaluatedValues();
+  auto V = EvaluatedValues.find(Name);
+
+  if (V == EvaluatedValues.end()) {
+    std::ostringstream errMsg("Unknown variable name: ", std::ios_base::ate);
+    errMsg << Name.str().str();
+    return LogErrorD(errMsg.str().c_str());
+  }
+
+  return V->second;
 }
 
 /// "NumberExprAST(%s)"
 std::string VariableExprAST::toString(const unsigned depth) const {
   std::ostringstream repr;
   insert_indent(repr, depth);
-  repr << "VariableExprAST(" << Name << ')';
+  repr << "VariableExprAST(" << Name.str().str() << ')';
   return repr.str();
 }
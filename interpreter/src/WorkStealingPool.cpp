@@ -0,0 +1,154 @@
+#include "WorkStealingPool.h"
+#include "stats.h" // Counter, countEvent
+#include "util.h"  // loop
+
+/// The number of threads the shared pool is made with, or 0 for one per
+/// hardware thread.
+static unsigned SharedNumThreads = 0;
+
+/// Whether the calling thread is one of the workers of a pool, or is running
+/// the tasks of a loop it started.
+static thread_local bool InPool = false;
+
+WorkStealingPool::WorkStealingPool(unsigned NumWorkers) {
+  for (unsigned I = 0; I <= NumWorkers; I++)
+    Deques.push_back(std::make_unique<Deque>());
+  for (unsigned I = 1; I <= NumWorkers; I++)
+    Workers.emplace_back([this, I] { workerLoop(I); });
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Stopping = true;
+  }
+  Wake.notify_all();
+  for (auto &Worker : Workers)
+    Worker.join();
+}
+
+void WorkStealingPool::setNumThreads(unsigned NumThreads) {
+  SharedNumThreads = NumThreads;
+}
+
+WorkStealingPool &WorkStealingPool::getInstance() {
+  static WorkStealingPool Pool([] {
+    const unsigned NumThreads = SharedNumThreads
+                                    ? SharedNumThreads
+                                    : std::thread::hardware_concurrency();
+    return NumThreads > 1 ? NumThreads - 1 : 0;
+  }());
+  return Pool;
+}
+
+void WorkStealingPool::run(std::size_t NumTasks,
+                           llvm::function_ref<void(std::size_t)> Task) {
+  if (!NumTasks)
+    return;
+  if (InPool || Workers.empty() || NumTasks == 1) {
+    for (std::size_t I = 0; I < NumTasks; I++)
+      Task(I);
+    return;
+  }
+
+  std::lock_guard<std::mutex> RunGuard(RunLock);
+  Job J;
+  J.Task = Task;
+  J.Remaining = NumTasks;
+  {
+    std::lock_guard<std::mutex> Guard(Deques[0]->Lock);
+    Deques[0]->Ranges.push_back(Range{0, NumTasks});
+  }
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Current = &J;
+    Generation++;
+  }
+  Wake.notify_all();
+
+  InPool = true;
+  work(0, J);
+  InPool = false;
+
+  // The loop lives on this thread's stack, so no worker may still be
+  // looking at it once this returns.
+  std::unique_lock<std::mutex> Guard(Lock);
+  Current = nullptr;
+  Done.wait(Guard, [this] { return !Busy; });
+}
+
+void WorkStealingPool::work(unsigned Self, Job &J) {
+  Range R;
+  while (J.Remaining.load(std::memory_order_acquire)) {
+    if (take(Self, R))
+      runRange(Self, R, J);
+    else
+      // Whatever is left is being run by the other threads.
+      std::this_thread::yield();
+  }
+}
+
+bool WorkStealingPool::take(unsigned Self, Range &R) {
+  {
+    auto &Own = *Deques[Self];
+    std::lock_guard<std::mutex> Guard(Own.Lock);
+    if (!Own.Ranges.empty()) {
+      R = Own.Ranges.back();
+      Own.Ranges.pop_back();
+      return true;
+    }
+  }
+  // Try every other thread in turn, starting after this one so that the
+  // thieves do not all go for the same deque.
+  const auto NumDeques = static_cast<unsigned>(Deques.size());
+  for (unsigned I = 1; I < NumDeques; I++) {
+    auto &Victim = *Deques[(Self + I) % NumDeques];
+    std::lock_guard<std::mutex> Guard(Victim.Lock);
+    if (!Victim.Ranges.empty()) {
+      R = Victim.Ranges.front();
+      Victim.Ranges.pop_front();
+      countEvent(Counter::ParallelSteals);
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::runRange(unsigned Self, Range R, Job &J) {
+  while (R.End - R.Begin > 1) {
+    const auto Middle = R.Begin + (R.End - R.Begin) / 2;
+    {
+      auto &Own = *Deques[Self];
+      std::lock_guard<std::mutex> Guard(Own.Lock);
+      Own.Ranges.push_back(Range{Middle, R.End});
+    }
+    R.End = Middle;
+  }
+  J.Task(R.Begin);
+  // This makes what the task did visible to the thread waiting on the loop.
+  J.Remaining.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void WorkStealingPool::workerLoop(unsigned Self) {
+  InPool = true;
+  std::size_t Seen = 0;
+  loop {
+    Job *J;
+    {
+      std::unique_lock<std::mutex> Guard(Lock);
+      Wake.wait(Guard,
+                [&] { return Stopping || (Current && Generation != Seen); });
+      if (Stopping)
+        return;
+      J = Current;
+      Seen = Generation;
+      Busy++;
+    }
+    work(Self, *J);
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      if (!--Busy)
+        Done.notify_all();
+    }
+  }
+}
@@ -0,0 +1,596 @@
+#include <llvm/ADT/DenseMap.h>          // llvm::DenseMap
+#include <llvm/ADT/DenseSet.h>          // llvm::DenseSet
+#include <llvm/ADT/Optional.h>          // llvm::Optional
+#include <llvm/ADT/STLExtras.h>         // llvm::function_ref
+#include <llvm/Bitcode/BitcodeReader.h> // llvm::parseBitcodeFile
+#include <llvm/Bitcode/BitcodeWriter.h> // llvm::WriteBitcodeToFile
+#include <llvm/Linker/Linker.h>         // llvm::Linker
+#include <llvm/Support/Error.h>         // llvm::StringError
+#include <llvm/Support/MemoryBuffer.h>  // llvm::MemoryBufferRef
+#include <llvm/Support/raw_ostream.h>   // llvm::raw_string_ostream
+
+#include <algorithm> // std::sort
+#include <cstddef>   // std::size_t
+#include <iterator>  // std::make_move_iterator
+#include <map>       // std::map
+#include <sstream>   // std::ostringstream
+#include <string>    // std::string
+#include <utility>   // std::move, std::pair
+#include <vector>    // std::vector
+
+#include "dependencies.h"
+#include "exprcache.h" // invalidateCachedExpressions
+#include "inliner.h"   // ForgetInlineDefinition, takeModuleForJIT
+#include "tiering.h"   // ForgetNativeAddress
+#include "util.h"      // getFunction, InitializeModuleAndPassManager, LogError
+
+#include "CompilationContext.h"
+#include "ExprAST.h"         // borrowModule, getContext, getFunctionProtos
+#include "KaleidoscopeJIT.h" // JIT
+
+using llvm::orc::KaleidoscopeJIT;
+using llvm::orc::ThreadSafeModule;
+using llvm::orc::VModuleKey;
+
+namespace {
+/// A function definition that has been handed over to the JIT.
+struct CompiledFunction {
+  KeptDefinition Definition;
+  /// The module the current code of the function is in.
+  llvm::Optional<VModuleKey> Module;
+  /// Whether a function this one calls, directly or not, has been redefined
+  /// since its current code was generated. That code still calls the old
+  /// definition, so it is generated again before anything new calls it.
+  bool Stale = false;
+};
+
+/// What keeps a module in the JIT.
+struct ModuleInfo {
+  /// How many functions in Functions have their current code in the module.
+  unsigned Users = 0;
+  /// How many modules have code that may still call the old code in this
+  /// one, or 1 for good if the module defines variables.
+  unsigned Pins = 0;
+  /// The modules the old code in this one may still call, which it pins.
+  std::vector<VModuleKey> Pinned;
+};
+} // namespace
+
+/// Every function handed over to the JIT through this file, by name.
+static llvm::DenseMap<Symbol, CompiledFunction> Functions;
+
+/// The compiled functions calling each function, which is Functions' call
+/// graph the other way around.
+static llvm::DenseMap<Symbol, llvm::DenseSet<Symbol>> Callers;
+
+/// The modules holding the code of the functions in Functions, current or
+/// not.
+static std::map<VModuleKey, ModuleInfo> Modules;
+
+void StartRecordingCalls() {
+  CompilationContext::getCurrent().CalledFunctions.clear();
+}
+
+void RecordCall(Symbol Callee) {
+  CompilationContext::getCurrent().CalledFunctions.insert(Callee);
+}
+
+KeptDefinition KeepDefinition(std::unique_ptr<FunctionAST> Function) {
+  KeptDefinition D;
+  D.Name = Function->getProto().getSymbol();
+  D.Definition = std::move(Function);
+  D.Callees = std::move(CompilationContext::getCurrent().CalledFunctions);
+  return D;
+}
+
+KeptDefinition KeepDefinition(std::unique_ptr<FlatAST> Function) {
+  KeptDefinition D;
+  D.Name = Function->getProto().getSymbol();
+  D.FlatDefinition = std::move(Function);
+  D.Callees = std::move(CompilationContext::getCurrent().CalledFunctions);
+  return D;
+}
+
+/// The context that stale functions have their IR generated again in, so
+/// that a definition failing to generate cannot touch the prototypes,
+/// operators or module of the interpreter.
+static CompilationContext &getScratchContext() {
+  static CompilationContext Scratch;
+  return Scratch;
+}
+
+/// Make the scratch context know exactly what the interpreter knows.
+static void prepareScratchContext() {
+  auto &Interpreter = CompilationContext::getCurrent();
+  auto &Scratch = getScratchContext();
+  Scratch.BinopPrecedence = Interpreter.BinopPrecedence;
+  Scratch.FunctionProtos.clear();
+  for (const auto &Proto : Interpreter.FunctionProtos)
+    Scratch.FunctionProtos[Proto.first] =
+        std::make_unique<PrototypeAST>(*Proto.second);
+}
+
+/// Mark every compiled function that calls one of the given functions,
+/// directly or through other compiled functions, stale, leaving out the
+/// given functions themselves. Whatever was compiled against their code, and
+/// whatever the interpreter looked up, has to go.
+///
+/// @param Redefined the names of the functions being redefined
+static void markDependentsStale(const llvm::DenseSet<Symbol> &Redefined) {
+  std::vector<Symbol> Worklist(Redefined.begin(), Redefined.end());
+  llvm::DenseSet<Symbol> Seen(Redefined.begin(), Redefined.end());
+  while (!Worklist.empty()) {
+    auto Direct = Callers.find(Worklist.back());
+    Worklist.pop_back();
+    if (Direct == Callers.end())
+      continue;
+    for (auto Caller : Direct->second) {
+      if (!Seen.insert(Caller).second)
+        continue;
+      Worklist.push_back(Caller);
+      auto Entry = Functions.find(Caller);
+      if (Entry == Functions.end())
+        continue;
+      Entry->second.Stale = true;
+      invalidateCachedExpressions(Caller);
+      ForgetNativeAddress(Caller);
+      ForgetInlineDefinition(Caller.str());
+    }
+  }
+}
+
+/// Find the stale functions among the given ones, along with the stale
+/// functions those call, directly or not, since new code calling a stale
+/// function has to call current code all the way down.
+///
+/// @param Needed the names of the functions about to be called
+/// @param Excluded the names of functions being redefined, which are left out
+/// @return the names of the stale functions
+static std::vector<Symbol> findStale(llvm::ArrayRef<Symbol> Needed,
+                                     const llvm::DenseSet<Symbol> &Excluded) {
+  std::vector<Symbol> Stale;
+  llvm::DenseSet<Symbol> Seen;
+  const auto add = [&](Symbol Name) {
+    if (Excluded.count(Name) || !Seen.insert(Name).second)
+      return;
+    auto Entry = Functions.find(Name);
+    if (Entry != Functions.end() && Entry->second.Stale)
+      Stale.push_back(Name);
+  };
+  for (auto Name : Needed)
+    add(Name);
+  for (std::size_t I = 0; I < Stale.size(); I++)
+    for (auto Callee : Functions[Stale[I]].Definition.Callees)
+      add(Callee);
+  return Stale;
+}
+
+/// Get the functions a module calls or has inlined, which are the ones it
+/// does not define for the JIT.
+///
+/// @param M the module
+/// @return the names of the functions
+static std::vector<Symbol> getCallees(const llvm::Module &M) {
+  std::vector<Symbol> Callees;
+  for (const auto &F : M)
+    if (F.isDeclaration() || F.hasAvailableExternallyLinkage())
+      Callees.push_back(Symbol::intern(F.getName()));
+  return Callees;
+}
+
+/// Generate IR for a function in the current module off of bitcode holding
+/// its definition, linking the definition in along with the local functions
+/// it uses. Everything else in the bitcode becomes a declaration of what the
+/// JIT has for it.
+///
+/// @param D the definition, which holds bitcode
+/// @return whether the definition could be linked into the module
+static bool linkDefinition(const KeptDefinition &D) {
+  auto Parsed = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(*D.Bitcode, "definition"), getContext());
+  if (!Parsed) {
+    LogError(toString(Parsed.takeError()).c_str());
+    return false;
+  }
+  auto &M = **Parsed;
+  const auto Name = D.Name.str().str();
+  auto *Defined = M.getFunction(Name);
+  if (!Defined || Defined->isDeclaration()) {
+    LogError(("No definition of " + Name + " to generate again").c_str());
+    return false;
+  }
+
+  for (auto &F : M)
+    if (&F != Defined && !F.isDeclaration() && !F.hasLocalLinkage())
+      F.deleteBody();
+  for (auto &G : M.globals())
+    if (!G.isDeclaration() && !G.hasLocalLinkage()) {
+      G.setInitializer(nullptr);
+      G.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  // Local functions that only the other functions used are of no use.
+  for (bool Erased = true; Erased;) {
+    Erased = false;
+    for (auto F = M.begin(); F != M.end();) {
+      auto &Local = *F++;
+      if (Local.hasLocalLinkage() && Local.use_empty()) {
+        Local.eraseFromParent();
+        Erased = true;
+      }
+    }
+  }
+
+  // Linking a call against a function that takes something else would
+  // bitcast the call, so the definition has to fit its callees as they are
+  // declared now.
+  for (const auto &F : M) {
+    if (!F.isDeclaration() || F.use_empty() || F.isIntrinsic())
+      continue;
+    const auto Callee = Symbol::intern(F.getName());
+    if (!getFunctionProtos().count(Callee))
+      continue;
+    auto *Current = getFunction(Callee);
+    if (!Current || Current->getFunctionType() == F.getFunctionType())
+      continue;
+    std::ostringstream errMsg;
+    if (Current->arg_size() != F.arg_size())
+      errMsg << "Wrong number of arguments passed to " << Callee.str().str()
+             << ", expecting " << Current->arg_size() << " but got "
+             << F.arg_size();
+    else
+      errMsg << "The definition of " << Name << " does not fit the prototype"
+             << " of " << Callee.str().str() << " anymore";
+    LogError(errMsg.str().c_str());
+    return false;
+  }
+
+  if (llvm::Linker::linkModules(borrowModule(), std::move(*Parsed))) {
+    LogError(("Could not link the definition of " + Name).c_str());
+    return false;
+  }
+  return true;
+}
+
+/// Generate IR for the given stale functions again, in a module of their own
+/// in the scratch context. A function whose IR cannot be generated anymore
+/// has the error reported and is taken out of the JIT, but stays stale, so
+/// that it is tried again the next time it is needed.
+///
+/// @param Stale the names of the functions
+/// @param[out] Generated the names of the functions that were generated
+/// @param[out] Failed the names of the functions that were not
+/// @return the module, or an empty one if no function was generated
+static ThreadSafeModule compileAgain(llvm::ArrayRef<Symbol> Stale,
+                                     std::vector<Symbol> &Generated,
+                                     std::vector<Symbol> &Failed) {
+  if (Stale.empty())
+    return ThreadSafeModule();
+  ThreadSafeModule TSM;
+  prepareScratchContext();
+  {
+    CompilationContext::Scope Scope(getScratchContext());
+    InitializeModuleAndPassManager(true);
+    for (auto Name : Stale) {
+      const auto &D = Functions[Name].Definition;
+      const bool Ok = D.Definition ? D.Definition->codegen() != nullptr
+                      : D.FlatDefinition
+                          ? D.FlatDefinition->codegen() != nullptr
+                          : linkDefinition(D);
+      (Ok ? Generated : Failed).push_back(Name);
+    }
+    if (!Generated.empty())
+      TSM = takeModuleForJIT();
+  }
+
+  // The old code cannot be kept either: if it was never linked, it would be
+  // linked against the new definitions it no longer fits. Its module stays,
+  // since old code that was linked may still call into it.
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  for (auto Name : Failed)
+    if (auto Err = JIT->removeSymbol(Name))
+      LogError(toString(std::move(Err)).c_str());
+  return TSM;
+}
+
+/// Make the old code in one module pin another, whose code it may call.
+///
+/// @param From the module holding the old code
+/// @param To the module it may call into
+static void pin(VModuleKey From, VModuleKey To) {
+  if (From == To)
+    return;
+  Modules[From].Pinned.push_back(To);
+  ++Modules[To].Pins;
+}
+
+/// Remove a module from the JIT if nothing keeps it there anymore, and then
+/// any module only it kept there.
+///
+/// @param K the key of the module
+static void removeIfUnused(VModuleKey K) {
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  std::vector<VModuleKey> Worklist{K};
+  while (!Worklist.empty()) {
+    auto Entry = Modules.find(Worklist.back());
+    Worklist.pop_back();
+    // A module may still define functions that nobody told this file about.
+    if (Entry == Modules.end() || Entry->second.Users ||
+        Entry->second.Pins || JIT->definesSymbols(Entry->first))
+      continue;
+    for (auto Pinned : Entry->second.Pinned) {
+      --Modules[Pinned].Pins;
+      Worklist.push_back(Pinned);
+    }
+    JIT->removeModule(Entry->first);
+    Modules.erase(Entry);
+  }
+}
+
+/// Move the current code of the given functions to the modules the JIT has
+/// it in now. The old code of a function stays in the JIT for as long as the
+/// old code of its callers does, and keeps what it calls there in turn.
+///
+/// @param Moves the name of each function and the key of its new module
+static void moveToModules(llvm::ArrayRef<std::pair<Symbol, VModuleKey>> Moves) {
+  // The old code of every caller calls the old code of the function, which
+  // calls the old code of its callees, all as they were before any of the
+  // functions moved.
+  for (const auto &Move : Moves) {
+    auto Entry = Functions.find(Move.first);
+    if (Entry == Functions.end() || !Entry->second.Module)
+      continue;
+    const auto Old = *Entry->second.Module;
+    for (auto Caller : Callers.lookup(Move.first)) {
+      auto CallerEntry = Functions.find(Caller);
+      if (CallerEntry != Functions.end() && CallerEntry->second.Module)
+        pin(*CallerEntry->second.Module, Old);
+    }
+    for (auto Callee : Entry->second.Definition.Callees) {
+      auto CalleeEntry = Functions.find(Callee);
+      if (CalleeEntry != Functions.end() && CalleeEntry->second.Module)
+        pin(Old, *CalleeEntry->second.Module);
+    }
+  }
+
+  std::vector<VModuleKey> Released;
+  for (const auto &Move : Moves) {
+    auto &F = Functions[Move.first];
+    ++Modules[Move.second].Users;
+    if (F.Module) {
+      --Modules[*F.Module].Users;
+      Released.push_back(*F.Module);
+    }
+    F.Module = Move.second;
+    F.Stale = false;
+  }
+  for (auto K : Released)
+    removeIfUnused(K);
+}
+
+/// Replace the calls a compiled function is known to make.
+///
+/// @param Name the name of the function
+/// @param F the function
+/// @param Callees the functions it calls now
+static void setCallees(Symbol Name, CompiledFunction &F,
+                       llvm::DenseSet<Symbol> Callees) {
+  for (auto Callee : F.Definition.Callees)
+    Callers[Callee].erase(Name);
+  // Calling itself does not make a function depend on anything.
+  Callees.erase(Name);
+  for (auto Callee : Callees)
+    Callers[Callee].insert(Name);
+  F.Definition.Callees = std::move(Callees);
+}
+
+/// Take over new definitions of functions whose code is in the JIT now,
+/// replacing earlier ones.
+///
+/// @param Definitions the name and definition of each function, along with
+///        the key of its new module
+static void install(
+    std::vector<std::pair<KeptDefinition, VModuleKey>> Definitions) {
+  std::vector<std::pair<Symbol, VModuleKey>> Moves;
+  for (const auto &D : Definitions)
+    Moves.emplace_back(D.first.Name, D.second);
+  moveToModules(Moves);
+  for (auto &D : Definitions) {
+    auto &F = Functions[D.first.Name];
+    setCallees(D.first.Name, F, std::move(D.first.Callees));
+    D.first.Callees = std::move(F.Definition.Callees);
+    F.Definition = std::move(D.first);
+  }
+}
+
+/// Drop all but the last of the definitions of each function, which is the
+/// one that ends up in the JIT, and mark whatever calls the functions stale.
+///
+/// @param Definitions the definitions, in the order they were made
+/// @return the names of the functions defined
+static llvm::DenseSet<Symbol>
+redefine(std::vector<KeptDefinition> &Definitions) {
+  llvm::DenseSet<Symbol> Defined;
+  std::vector<KeptDefinition> Last;
+  for (auto D = Definitions.rbegin(); D != Definitions.rend(); ++D)
+    if (Defined.insert(D->Name).second)
+      Last.push_back(std::move(*D));
+  Definitions.assign(std::make_move_iterator(Last.rbegin()),
+                     std::make_move_iterator(Last.rend()));
+
+  // Whatever was compiled against the old code has to go too.
+  markDependentsStale(Defined);
+  for (auto Name : Defined) {
+    invalidateCachedExpressions(Name);
+    ForgetNativeAddress(Name);
+  }
+  return Defined;
+}
+
+/// Hand a module over to the JIT, after generating the code of every stale
+/// function it needs again in a module of its own. The two go to the JIT
+/// together, since the functions in them may call each other.
+///
+/// @param Definitions the definitions of the functions the module defines
+/// @param TakeModule takes the module, once the bodies of stale functions
+///        are no longer imported into it, or returns an empty one if only
+///        stale functions are needed
+/// @param Needed more functions that are about to be called
+/// @return an error if the modules could not be added to the JIT
+static llvm::Error addToJIT(std::vector<KeptDefinition> Definitions,
+                            llvm::function_ref<ThreadSafeModule()> TakeModule,
+                            std::vector<Symbol> Needed) {
+  const auto Defined = redefine(Definitions);
+  auto TSM = TakeModule();
+  bool DefinesVariables = false;
+  if (TSM)
+    TSM.withModuleDo([&](const llvm::Module &M) {
+      auto Callees = getCallees(M);
+      Needed.insert(Needed.end(), Callees.begin(), Callees.end());
+      for (const auto &G : M.globals())
+        DefinesVariables |= !G.isDeclaration() && !G.hasLocalLinkage();
+    });
+
+  std::vector<Symbol> Generated, Failed;
+  auto Scratch = compileAgain(findStale(Needed, Defined), Generated, Failed);
+  // Code calling a function that could not be generated again could not be
+  // linked, so none of it is added, and the functions generated stay stale.
+  if (!Failed.empty()) {
+    std::string Names;
+    for (auto Name : Failed)
+      Names += (Names.empty() ? "" : ", ") + Name.str().str();
+    return llvm::make_error<llvm::StringError>(
+        "Could not compile " + Names +
+            " again after a function it calls was redefined",
+        llvm::inconvertibleErrorCode());
+  }
+  std::vector<ThreadSafeModule> NewModules;
+  if (Scratch)
+    NewModules.push_back(std::move(Scratch));
+  if (TSM)
+    NewModules.push_back(std::move(TSM));
+  if (NewModules.empty())
+    return llvm::Error::success();
+
+  auto Keys = KaleidoscopeJIT::getInstance()->addModules(std::move(NewModules));
+  // The functions generated again stay stale if their module is not added.
+  if (!Keys)
+    return Keys.takeError();
+
+  std::vector<std::pair<KeptDefinition, VModuleKey>> Installed;
+  for (auto &D : Definitions)
+    Installed.emplace_back(std::move(D), Keys->back());
+  std::vector<std::pair<Symbol, VModuleKey>> Moves;
+  for (auto Name : Generated)
+    Moves.emplace_back(Name, Keys->front());
+  moveToModules(Moves);
+  install(std::move(Installed));
+  if (DefinesVariables)
+    ++Modules[Keys->back()].Pins;
+  for (auto K : *Keys)
+    removeIfUnused(K);
+  return llvm::Error::success();
+}
+
+/// Hand the current module over to the JIT once the IR of a function
+/// definition has been generated in it, and keep the definition.
+///
+/// @param D the function definition
+/// @return whether the module could be added to the JIT
+static bool compile(KeptDefinition D) {
+  std::vector<KeptDefinition> Definitions;
+  Definitions.push_back(std::move(D));
+  auto Err = addToJIT(std::move(Definitions), takeModuleForJIT, {});
+  InitializeModuleAndPassManager(true);
+  if (Err) {
+    LogError(toString(std::move(Err)).c_str());
+    return false;
+  }
+  return true;
+}
+
+bool CompileDefinition(std::unique_ptr<FunctionAST> Function) {
+  return compile(KeepDefinition(std::move(Function)));
+}
+
+bool CompileDefinition(std::unique_ptr<FlatAST> Function) {
+  return compile(KeepDefinition(std::move(Function)));
+}
+
+llvm::Error CompileModule(std::vector<KeptDefinition> Definitions,
+                          llvm::function_ref<ThreadSafeModule()> TakeModule) {
+  return addToJIT(std::move(Definitions), TakeModule, {});
+}
+
+void RecordDefinitions(std::vector<KeptDefinition> Definitions) {
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  redefine(Definitions);
+  std::vector<std::pair<KeptDefinition, VModuleKey>> Installed;
+  for (auto &D : Definitions)
+    if (auto K = JIT->getModule(D.Name))
+      Installed.emplace_back(std::move(D), *K);
+  install(std::move(Installed));
+}
+
+bool CompileStaleCallees(const llvm::Module &M) {
+  return CompileStaleFunctions(getCallees(M));
+}
+
+bool CompileStaleFunctions(llvm::ArrayRef<Symbol> Names) {
+  if (auto Err = addToJIT({}, [] { return ThreadSafeModule(); }, Names)) {
+    LogError(toString(std::move(Err)).c_str());
+    return false;
+  }
+  return true;
+}
+
+std::vector<KeptDefinition> ExportDefinitions() {
+  std::vector<Symbol> Names;
+  for (const auto &F : Functions)
+    Names.push_back(F.first);
+  std::sort(Names.begin(), Names.end(), [](Symbol A, Symbol B) {
+    return A.str() < B.str();
+  });
+
+  // Definitions kept as bitcode already are exported as they are, and the
+  // rest share a module of their own. A definition that no longer fits what
+  // it calls goes on running its old code, but is not exported.
+  prepareScratchContext();
+  auto &Scratch = getScratchContext();
+  std::vector<std::string> Ignored;
+  Scratch.Errors = &Ignored;
+  std::vector<std::pair<Symbol, const KeptDefinition *>> Exported;
+  std::shared_ptr<const std::string> Generated;
+  {
+    CompilationContext::Scope Scope(Scratch);
+    InitializeModuleAndPassManager(true);
+    bool Any = false;
+    for (auto Name : Names) {
+      const auto &D = Functions[Name].Definition;
+      const bool Ok = D.Definition ? D.Definition->codegen() != nullptr
+                      : D.FlatDefinition
+                          ? D.FlatDefinition->codegen() != nullptr
+                          : true;
+      if (Ok)
+        Exported.emplace_back(Name, &D);
+      Any |= Ok && !D.Bitcode;
+    }
+    if (Any) {
+      auto Bitcode = std::make_shared<std::string>();
+      llvm::raw_string_ostream OS(*Bitcode);
+      llvm::WriteBitcodeToFile(borrowModule(), OS);
+      OS.flush();
+      Generated = std::move(Bitcode);
+    }
+  }
+  Scratch.Errors = nullptr;
+
+  std::vector<KeptDefinition> Definitions;
+  for (const auto &E : Exported) {
+    KeptDefinition D;
+    D.Name = E.first;
+    D.Bitcode = E.second->Bitcode ? E.second->Bitcode : Generated;
+    D.Callees = E.second->Callees;
+    Definitions.push_back(std::move(D));
+  }
+  return Definitions;
+}
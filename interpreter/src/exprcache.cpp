@@ -0,0 +1,79 @@
+#include <algorithm>     // std::find
+#include <list>          // std::list
+#include <unordered_map> // std::unordered_map
+
+#include "exprcache.h"
+
+#include "KaleidoscopeJIT.h" // JIT
+
+using llvm::orc::KaleidoscopeJIT;
+
+namespace {
+/// A compiled top-level expression that is kept around.
+struct CachedExpression {
+  std::string Key;
+  llvm::orc::VModuleKey Module;
+  CompiledExpression Function;
+  std::vector<Symbol> References;
+};
+} // namespace
+
+/// The most expressions to keep.
+static unsigned CacheSize = 0;
+
+/// The kept expressions, the most recently used one first.
+static std::list<CachedExpression> Entries;
+
+/// Where each kept expression is in Entries, by key.
+static std::unordered_map<std::string, std::list<CachedExpression>::iterator>
+    Index;
+
+/// Forget a kept expression and remove its module from the JIT.
+///
+/// @param Entry the expression to forget
+static void evict(std::list<CachedExpression>::iterator Entry) {
+  KaleidoscopeJIT::getInstance()->removeModule(Entry->Module);
+  Index.erase(Entry->Key);
+  Entries.erase(Entry);
+}
+
+void SetExpressionCacheSize(unsigned N) {
+  CacheSize = N;
+  while (Entries.size() > CacheSize)
+    evict(std::prev(Entries.end()));
+}
+
+bool isExpressionCacheEnabled() { return CacheSize > 0; }
+
+CompiledExpression lookupCachedExpression(const std::string &Key) {
+  auto Found = Index.find(Key);
+  if (Found == Index.end())
+    return nullptr;
+  Entries.splice(Entries.begin(), Entries, Found->second);
+  return Found->second->Function;
+}
+
+void cacheExpression(std::string Key, llvm::orc::VModuleKey Module,
+                     CompiledExpression Function,
+                     std::vector<Symbol> References) {
+  auto Found = Index.find(Key);
+  if (Found != Index.end())
+    evict(Found->second);
+  else if (Entries.size() >= CacheSize)
+    evict(std::prev(Entries.end()));
+
+  Entries.push_front(
+      CachedExpression{Key, Module, Function, std::move(References)});
+  Index[std::move(Key)] = Entries.begin();
+}
+
+void invalidateCachedExpressions(Symbol Name) {
+  for (auto Entry = Entries.begin(); Entry != Entries.end();) {
+    const auto &References = Entry->References;
+    auto Next = std::next(Entry);
+    if (std::find(References.begin(), References.end(), Name) !=
+        References.end())
+      evict(Entry);
+    Entry = Next;
+  }
+}
@@ -0,0 +1,42 @@
+#include "fold.h"
+
+#include "CompilationContext.h"
+
+/// Whether the parser folds constant expressions.
+static bool ConstantFolding = false;
+
+void SetConstantFolding(bool Enabled) { ConstantFolding = Enabled; }
+
+bool isConstantFoldingEnabled() { return ConstantFolding; }
+
+void SetFunctionPurity(Symbol Name, bool Pure) {
+  auto &PureFunctions = CompilationContext::getCurrent().PureFunctions;
+  if (Pure)
+    PureFunctions.insert(Name);
+  else if (PureFunctions.erase(Name))
+    PureFunctions.clear();
+}
+
+bool isPureFunction(Symbol Name) {
+  return CompilationContext::getCurrent().PureFunctions.count(Name);
+}
+
+llvm::Optional<double> evaluateBuiltinOperator(char Op, double L, double R) {
+  switch (Op) {
+  case '+':
+    return L + R;
+  case '-':
+    return L - R;
+  case '*':
+    return L * R;
+  case '/':
+    return L / R;
+  case '<':
+    // Match fcmp ult, which is also true when either operand is NaN.
+    return !(L >= R) ? 1.0 : 0.0;
+  case '>':
+    // Likewise for fcmp ugt.
+    return !(L <= R) ? 1.0 : 0.0;
+  }
+  return llvm::None;
+}
@@ -0,0 +1,155 @@
+#include <llvm/Bitcode/BitcodeReader.h> // llvm::parseBitcodeFile
+#include <llvm/Bitcode/BitcodeWriter.h> // llvm::WriteBitcodeToFile
+#include <llvm/Linker/Linker.h>          // llvm::Linker
+#include <llvm/Support/MemoryBuffer.h>   // llvm::MemoryBufferRef
+#include <llvm/Support/raw_ostream.h>    // llvm::raw_string_ostream
+
+#include <map>           // std::map
+#include <memory>        // std::shared_ptr
+#include <set>           // std::set
+#include <string>        // std::string
+#include <unordered_map> // std::unordered_map
+#include <vector>        // std::vector
+
+#include "inliner.h"
+#include "util.h" // LogError
+
+#include "ExprAST.h"
+#include "Optimizer.h"
+
+/// Whether modules get the bodies of the functions they call before going to
+/// the JIT.
+static bool CrossModuleInlining = false;
+
+/// Whether user-defined operators are always inlined, even without
+/// cross-module inlining.
+static bool OperatorInlining = false;
+
+/// The bitcode of the module that each function was most recently defined in.
+/// Modules defining more than one function share their bitcode.
+static std::unordered_map<std::string, std::shared_ptr<const std::string>>
+    Definitions;
+
+void SetCrossModuleInlining(bool Enabled) { CrossModuleInlining = Enabled; }
+
+void SetOperatorInlining(bool Enabled) { OperatorInlining = Enabled; }
+
+bool isOperatorInliningEnabled() { return OperatorInlining; }
+
+/// Whether F is one of the functions to record and import. With only operator
+/// inlining enabled, those are the functions marked alwaysinline.
+///
+/// @param F the function to check
+/// @param All whether every function counts
+static bool isInlineCandidate(const llvm::Function &F, bool All) {
+  return All || F.hasFnAttribute(llvm::Attribute::AlwaysInline);
+}
+
+/// Remember the IR of every function the given module defines, replacing any
+/// earlier definition of the same name. Top-level expressions and local
+/// functions are left out since nothing else can call them.
+///
+/// @param M the module to record
+/// @param All whether to record every function or only alwaysinline ones
+static void recordDefinitions(const llvm::Module &M, bool All) {
+  std::vector<std::string> Names;
+  for (const auto &F : M)
+    if (!F.isDeclaration() && !F.hasLocalLinkage() &&
+        !F.getName().startswith("__anon_expr") && isInlineCandidate(F, All))
+      Names.push_back(F.getName().str());
+  if (Names.empty())
+    return;
+
+  auto Bitcode = std::make_shared<std::string>();
+  llvm::raw_string_ostream OS(*Bitcode);
+  llvm::WriteBitcodeToFile(M, OS);
+  OS.flush();
+
+  for (auto &Name : Names)
+    Definitions[Name] = Bitcode;
+}
+
+/// Give the given module an available_externally copy of every recorded
+/// function it calls, and of every recorded function those call in turn.
+///
+/// @param M the module to import callees into
+/// @param All whether to import every function or only alwaysinline ones
+/// @return whether anything was imported
+static bool importCallees(llvm::Module &M, bool All) {
+  bool Imported = false;
+  loop {
+    // Group the bodies still missing by the bitcode they were recorded in,
+    // so that each one only has to be read once per round.
+    std::map<const std::string *, std::set<std::string>> Wanted;
+    for (const auto &F : M) {
+      if (!F.isDeclaration() || !isInlineCandidate(F, All))
+        continue;
+      auto Definition = Definitions.find(F.getName().str());
+      if (Definition != Definitions.end())
+        Wanted[Definition->second.get()].insert(Definition->first);
+    }
+    if (Wanted.empty())
+      return Imported;
+
+    for (const auto &Entry : Wanted) {
+      auto Callees = llvm::parseBitcodeFile(
+          llvm::MemoryBufferRef(*Entry.first, "callees"), M.getContext());
+      if (!Callees) {
+        LogError(toString(Callees.takeError()).c_str());
+        return Imported;
+      }
+
+      // Only bring in what was asked for. Anything else that module defined
+      // is either not needed or has been redefined since, in which case the
+      // current definition is imported from its own module next round. Local
+      // functions, like the chunks of a parallel loop, are linked in along
+      // with whatever calls them.
+      for (auto &F : **Callees) {
+        if (F.isDeclaration() || F.hasLocalLinkage())
+          continue;
+        if (Entry.second.count(F.getName().str()))
+          F.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        else
+          F.deleteBody();
+      }
+
+      if (llvm::Linker::linkModules(M, std::move(*Callees))) {
+        LogError("Could not import the definitions of called functions");
+        return Imported;
+      }
+      Imported = true;
+    }
+  }
+}
+
+void ForgetInlineDefinition(llvm::StringRef Name) {
+  Definitions.erase(Name.str());
+}
+
+llvm::orc::ThreadSafeModule takeModuleForJIT() {
+  // There is nothing to inline with when there is no optimizer, as in lazy
+  // mode. Only alwaysinline functions get inlined at -O0.
+  auto *ModuleOptimizer = getOptimizer();
+  const bool InlineAll = CrossModuleInlining && getOptimizationLevel() > 0;
+  if (ModuleOptimizer && (InlineAll || OperatorInlining)) {
+    auto &M = borrowModule();
+    // Record this module before anything is inlined into it, so that a
+    // later caller inlining one of its functions picks up the current
+    // definitions of whatever that function calls.
+    recordDefinitions(M, InlineAll);
+    const bool Imported = importCallees(M, InlineAll);
+    if (InlineAll) {
+      ModuleOptimizer->runOnModule(M);
+    } else if (Imported) {
+      ModuleOptimizer->runAlwaysInliner(M);
+      // Whatever could not be inlined, such as a recursive operator, is
+      // called in the JIT as before.
+      for (auto &F : M)
+        if (F.hasAvailableExternallyLinkage())
+          F.deleteBody();
+      // Clean up the straight-line arithmetic the operators left behind.
+      ModuleOptimizer->runOnFunctions(M);
+    }
+  }
+  return takeModule();
+}
@@ -1,22 +1,169 @@
 #include <cctype>   // std::isspace, std::isalpha, std::isalnum, std::isdigit
-#include <cstdio>   // std::getchar, EOF
+#include <cstddef>  // std::size_t
+#include <cstdio>   // std::getchar, std::snprintf, EOF
 #include <cstdlib>  // std::strtod
 #include <cstring>  // std::strlen
 #include <iostream> // std::cerr, std::endl
 #include <sstream>  // std::ostringstream
 #include <unordered_map> // std::unordered_map
 
-#include <llvm/IR/Function.h> // llvm::Function
+#include <llvm/ADT/StringRef.h>        // llvm::StringRef
+#include <llvm/IR/Function.h>          // llvm::Function
+#include <llvm/Support/MemoryBuffer.h> // llvm::MemoryBuffer
 
 #include "lexer.h" // gettok, enum Token
+#include "stats.h" // PhaseRegion, countEvent
 #include "util.h"  // loop, LogError, LogErrorP
 
-static std::string IdentifierStr; // Filled in if tok_identifier
-static double NumVal;             // Filled in if tok_number
+#include "CompilationContext.h"
+#include "Symbol.h"
 
-const std::string &getIdentifierStr() { return IdentifierStr; }
+// Where the lexer is in its input belongs to the current CompilationContext
+// of the calling thread.
 
-double getNumVal() { return NumVal; }
+const std::string &getIdentifierStr() {
+  return CompilationContext::getCurrent().IdentifierStr;
+}
+
+Symbol getIdentifierSymbol() {
+  return CompilationContext::getCurrent().IdentifierSymbol;
+}
+
+double getNumVal() { return CompilationContext::getCurrent().NumVal; }
+
+/// A keyword and the token it is lexed as.
+struct Keyword {
+  const char *Spelling;
+  Token Tok;
+};
+
+/// Every keyword in the language. Adding a keyword takes a new enum Token and
+/// an entry here, which both the lexer and tokenToString pick up.
+static constexpr Keyword Keywords[] = {
+    {"def", tok_def},   {"extern", tok_extern}, {"if", tok_if},
+    {"then", tok_then}, {"else", tok_else},     {"for", tok_for},
+    {"in", tok_in},     {"binary", tok_binary}, {"unary", tok_unary},
+    {"let", tok_let},   {"parallel", tok_parallel},
+};
+
+static constexpr std::size_t NumKeywords = sizeof(Keywords) / sizeof(*Keywords);
+
+/// The number of slots in the keyword hash table.
+static constexpr std::size_t KeywordTableSize = 16;
+
+static_assert(NumKeywords <= KeywordTableSize,
+              "KeywordTableSize is too small to hold every keyword");
+
+/// The length of a null-terminated string, at compile time.
+static constexpr std::size_t constexprStrlen(const char *Str) {
+  std::size_t Length = 0;
+  while (Str[Length])
+    ++Length;
+  return Length;
+}
+
+/// Hash a non-empty identifier into a slot of the keyword hash table. The
+/// length and the first and last characters are enough to tell every keyword
+/// apart, so only those are looked at.
+///
+/// @param Str the first character of the identifier
+/// @param Length the length of the identifier
+/// @return the slot the identifier would go in
+static constexpr std::size_t hashKeyword(const char *Str, std::size_t Length) {
+  return (2 * Length + static_cast<unsigned char>(Str[0]) +
+          static_cast<unsigned char>(Str[Length - 1])) %
+         KeywordTableSize;
+}
+
+/// Whether hashKeyword puts every keyword in a slot of its own.
+static constexpr bool isPerfectKeywordHash() {
+  for (std::size_t I = 0; I < NumKeywords; I++)
+    for (std::size_t J = I + 1; J < NumKeywords; J++)
+      if (hashKeyword(Keywords[I].Spelling,
+                      constexprStrlen(Keywords[I].Spelling)) ==
+          hashKeyword(Keywords[J].Spelling,
+                      constexprStrlen(Keywords[J].Spelling)))
+        return false;
+  return true;
+}
+
+static_assert(isPerfectKeywordHash(),
+              "Two keywords hash to the same slot, change hashKeyword so that "
+              "they do not");
+
+/// A perfect hash table of Keywords: every slot holds one plus the index of
+/// the keyword that hashes to it, or 0 if no keyword does.
+struct KeywordTable {
+  unsigned char Slots[KeywordTableSize];
+};
+
+static constexpr KeywordTable buildKeywordTable() {
+  KeywordTable Table{};
+  for (std::size_t I = 0; I < NumKeywords; I++)
+    Table.Slots[hashKeyword(Keywords[I].Spelling,
+                            constexprStrlen(Keywords[I].Spelling))] = I + 1;
+  return Table;
+}
+
+static constexpr KeywordTable KeywordSlots = buildKeywordTable();
+
+/// Return the keyword token for an identifier, hashing it and comparing it to
+/// the one keyword it could be.
+///
+/// @param Identifier the identifier just lexed, which cannot be empty
+/// @return the keyword's enum Token, or tok_identifier if it is not a keyword
+static int lookupKeyword(llvm::StringRef Identifier) {
+  const unsigned Slot =
+      KeywordSlots.Slots[hashKeyword(Identifier.data(), Identifier.size())];
+  if (Slot && Identifier == Keywords[Slot - 1].Spelling)
+    return Keywords[Slot - 1].Tok;
+  return tok_identifier;
+}
+
+/// Return the token for an identifier just lexed, interning it as
+/// IdentifierSymbol unless it is a keyword.
+///
+/// @param Identifier the identifier just lexed, which cannot be empty
+/// @return the keyword's enum Token, or tok_identifier if it is not a keyword
+static int lexIdentifier(llvm::StringRef Identifier) {
+  const int Tok = lookupKeyword(Identifier);
+  if (Tok == tok_identifier)
+    CompilationContext::getCurrent().IdentifierSymbol =
+        Symbol::intern(Identifier);
+  return Tok;
+}
+
+/// Write the current token of the given context into its TokenText, after a
+/// space if it is not the first token there.
+static void recordToken(CompilationContext &C) {
+  auto &Text = *C.TokenText;
+  C.CurTokStart = Text.size();
+  if (!Text.empty())
+    Text += ' ';
+  if (C.CurTok == tok_number) {
+    // 17 significant digits tell every double apart.
+    char Number[32];
+    std::snprintf(Number, sizeof(Number), "%.17g", C.NumVal);
+    Text += Number;
+  } else if (C.CurTok >= 0) {
+    Text += static_cast<char>(C.CurTok);
+  } else if (C.CurTok != tok_eof && C.CurTok != tok_err) {
+    // Keywords and identifiers are spelled the way they were lexed.
+    Text += C.IdentifierStr;
+  }
+}
+
+void startRecordingTokens(std::string &Text) {
+  auto &C = CompilationContext::getCurrent();
+  C.TokenText = &Text;
+  recordToken(C);
+}
+
+void stopRecordingTokens() {
+  auto &C = CompilationContext::getCurrent();
+  C.TokenText->resize(C.CurTokStart);
+  C.TokenText = nullptr;
+}
 
 const std::string tokenToString(Token tok) {
   std::ostringstream output;
@@ -27,64 +174,59 @@ const std::string tokenToString(Token tok) {
   case tok_err:
     output << "invalid token";
     break;
-  case tok_def:
-    output << "def";
-    break;
-  case tok_extern:
-    output << "extern";
-    break;
   case tok_identifier:
     output << "identifier";
     break;
   case tok_number:
     output << "number";
     break;
-  case tok_if:
-    output << "if";
-    break;
-  case tok_then:
-    output << "then";
-    break;
-  case tok_else:
-    output << "else";
-    break;
-  case tok_for:
-    output << "for";
-    break;
-  case tok_in:
-    output << "in";
-    break;
-  case tok_binary:
-    output << "binary";
-    break;
-  case tok_unary:
-    output << "unary";
-    break;
-  case tok_let:
-    output << "let";
-    break;
   default:
-    output << "unrecognized token " << static_cast<char>(tok);
+    const Keyword *Match = nullptr;
+    for (const auto &K : Keywords)
+      if (K.Tok == tok)
+        Match = &K;
+    if (Match)
+      output << Match->Spelling;
+    else
+      output << "unrecognized token " << static_cast<char>(tok);
   }
   output << " (" << tok << ')';
   return output.str();
 }
 
+/// Lex the file set with setInputFile() until a token is read.
+///
+/// This function lexes the same tokens as gettok(), but works on the whole
+/// file at once instead of reading one character at a time.
+///
+/// @return an integer, either an enum Token if the lexed token is a recognized
+/// token,
+///         or the ASCII value of the first character read
+static int gettokFromBuffer();
+
 /// CurTok/getNextToken - Provide a simple token buffer. CurTok is the
 /// current token the parser is looking at. getNextToken reads another
 /// token from the lexer and updates CurTok with its results.
-static int CurTok;
 int getNextToken() {
-  // gettok() is forward-declared in lexer.h so we can call it here even
-  // though the definition does not appear until below
-  return CurTok = gettok();
+  PhaseRegion Region(Phase::Lex);
+  countEvent(Counter::Tokens);
+  auto &C = CompilationContext::getCurrent();
+  // gettok() is forward-declared in lexer.h and gettokFromBuffer() above,
+  // so we can call them here even though their definitions appear below
+  C.CurTok = C.InputBuffer ? gettokFromBuffer() : gettok();
+  if (C.TokenText)
+    recordToken(C);
+  return C.CurTok;
 }
 
-int getCurrentToken() { return CurTok; }
+int getCurrentToken() { return CompilationContext::getCurrent().CurTok; }
 
 // gettok - Return the next token from standard input.
 static int gettok() {
-  static int LastChar = ' ';
+  auto &C = CompilationContext::getCurrent();
+  int &LastChar = C.LastChar;
+  std::string &IdentifierStr = C.IdentifierStr;
+  double &NumVal = C.NumVal;
 
   // Skip any whitespace.
   while (std::isspace(LastChar))
@@ -98,27 +240,7 @@ static int gettok() {
            std::isalnum(LastChar) || LastChar == '_' || LastChar == '$')
       IdentifierStr += LastChar;
 
-    if (IdentifierStr == "def")
-      return tok_def;
-    if (IdentifierStr == "extern")
-      return tok_extern;
-    if (IdentifierStr == "if")
-      return tok_if;
-    if (IdentifierStr == "then")
-      return tok_then;
-    if (IdentifierStr == "else")
-      return tok_else;
-    if (IdentifierStr == "for")
-      return tok_for;
-    if (IdentifierStr == "in")
-      return tok_in;
-    if (IdentifierStr == "binary")
-      return tok_binary;
-    if (IdentifierStr == "unary")
-      return tok_unary;
-    if (IdentifierStr == "let")
-      return tok_let;
-    return tok_identifier;
+    return lexIdentifier(IdentifierStr);
   }
 
   // Parse numeric values and store them in NumVal
@@ -195,3 +317,112 @@ static int gettok() {
   LastChar = std::getchar();
   return ThisChar;
 }
+
+std::error_code setInputFile(const std::string &Path) {
+  // MemoryBuffer maps large files into memory instead of reading them, and
+  // guarantees a null terminator after the last character.
+  auto Buffer = llvm::MemoryBuffer::getFile(Path);
+  if (!Buffer)
+    return Buffer.getError();
+  setInputBuffer(std::move(*Buffer));
+  return std::error_code();
+}
+
+void setInputBuffer(std::unique_ptr<llvm::MemoryBuffer> Buffer) {
+  auto &C = CompilationContext::getCurrent();
+  C.InputBuffer = std::move(Buffer);
+  C.BufferPtr = C.InputBuffer->getBufferStart();
+}
+
+/// Whether C can appear in an identifier after its first character.
+static bool isIdentifierChar(char C) {
+  return std::isalnum(static_cast<unsigned char>(C)) || C == '_' || C == '$';
+}
+
+/// Whether C is a digit.
+static bool isDigit(char C) {
+  return std::isdigit(static_cast<unsigned char>(C));
+}
+
+/// Whether C is a letter.
+static bool isAlpha(char C) {
+  return std::isalpha(static_cast<unsigned char>(C));
+}
+
+// gettokFromBuffer - Return the next token from InputBuffer. This lexes the
+// same tokens as gettok, but slices them straight out of the buffer instead of
+// reading and copying them a character at a time.
+static int gettokFromBuffer() {
+  auto &C = CompilationContext::getCurrent();
+  const char *&BufferPtr = C.BufferPtr;
+  const char *BufferEnd = C.InputBuffer->getBufferEnd();
+
+  loop {
+    // Skip any whitespace.
+    while (BufferPtr != BufferEnd &&
+           std::isspace(static_cast<unsigned char>(*BufferPtr)))
+      ++BufferPtr;
+
+    // Comments start with a # and go until the end of the line.
+    if (BufferPtr == BufferEnd || *BufferPtr != '#')
+      break;
+    while (BufferPtr != BufferEnd && *BufferPtr != '\n' && *BufferPtr != '\r')
+      ++BufferPtr;
+  }
+
+  // Check for EOF but don't eat the EOF
+  if (BufferPtr == BufferEnd)
+    return tok_eof;
+
+  const char *TokStart = BufferPtr;
+
+  // Parse identifier and specific keywords
+  if (isAlpha(*BufferPtr) || *BufferPtr == '_' ||
+      *BufferPtr == '$') { // Identifier: [a-zA-Z$_][a-zA-Z0-9$_]*
+    do
+      ++BufferPtr;
+    while (BufferPtr != BufferEnd && isIdentifierChar(*BufferPtr));
+
+    const llvm::StringRef Identifier(TokStart, BufferPtr - TokStart);
+    // Assigning the whole identifier at once reuses IdentifierStr's storage.
+    C.IdentifierStr.assign(Identifier.data(), Identifier.size());
+    return lexIdentifier(Identifier);
+  }
+
+  // Parse numeric values and store them in NumVal
+  if (*BufferPtr == '.' || isDigit(*BufferPtr)) {
+    // A number that starts with a '.' must be followed by digits only, any
+    // other number can have at most one '.' in it
+    bool DecimalPointFound = *BufferPtr == '.';
+    ++BufferPtr;
+    while (BufferPtr != BufferEnd &&
+           (isDigit(*BufferPtr) || (*BufferPtr == '.' && *TokStart != '.'))) {
+      if (*BufferPtr == '.') {
+        // This is not our first decimal point so this is an error
+        if (DecimalPointFound)
+          return tok_err;
+        DecimalPointFound = true;
+      }
+      ++BufferPtr;
+    }
+
+    // It is an error to have a letter immediately follow a number
+    if (BufferPtr != BufferEnd && isAlpha(*BufferPtr))
+      return tok_err;
+
+    // The buffer is null-terminated, so strtod can parse the number in place.
+    // It stops where the lexer did unless the number is just ".", which is
+    // an invalid token. Anything strtod would read past that, like an
+    // exponent or a hexadecimal digit, starts with a letter and was rejected
+    // above.
+    char *NumEnd = nullptr;
+    C.NumVal = std::strtod(TokStart, &NumEnd);
+    if (NumEnd != BufferPtr)
+      return tok_err;
+
+    return tok_number;
+  }
+
+  // Otherwise, just return the character as its ASCII value
+  return static_cast<unsigned char>(*BufferPtr++);
+}
@@ -0,0 +1,343 @@
+#include <llvm/ADT/DenseSet.h>          // llvm::DenseSet
+#include <llvm/Bitcode/BitcodeWriter.h> // llvm::WriteBitcodeToFile
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h> // llvm::orc::JITTargetMachineBuilder
+#include <llvm/IR/InstIterator.h>       // llvm::instructions
+#include <llvm/IRReader/IRReader.h>     // llvm::parseIRFile
+#include <llvm/Support/Path.h>          // llvm::sys::path::extension
+#include <llvm/Support/SourceMgr.h>     // llvm::SMDiagnostic
+#include <llvm/Support/ThreadPool.h>    // llvm::ThreadPool
+#include <llvm/Support/raw_ostream.h>   // llvm::raw_string_ostream
+
+#include <memory> // std::make_shared
+#include <string> // std::string, std::to_string
+#include <vector> // std::vector
+
+#include "dependencies.h" // CompileModule, KeepDefinition
+#include "inliner.h"      // takeModuleForJIT
+#include "lexer.h"        // getNextToken, getCurrentToken, setInputFile
+#include "loader.h"
+#include "parser.h" // ParseDefinition, ParseDefinitionFlat, ParseExtern, ParseTopLevelExpr
+#include "util.h"   // isFlatASTEnabled, LogError
+
+#include "CompilationContext.h"
+#include "ExprAST.h"
+#include "KaleidoscopeJIT.h" // JIT
+#include "Optimizer.h"
+
+using llvm::orc::KaleidoscopeJIT;
+
+namespace {
+/// A source file being loaded.
+struct SourceFile {
+  std::string Path;
+  /// The front-end state of the thread compiling the file, which keeps the
+  /// compiled module until it is handed over to the JIT.
+  CompilationContext Context;
+  /// Why the file could not be compiled, or empty.
+  std::string Error;
+  /// The function definitions compiled into the module of the file, which
+  /// are kept once it is handed over to the JIT.
+  std::vector<KeptDefinition> Definitions;
+};
+} // namespace
+
+/// Make an error with the given message.
+static llvm::Error makeError(const llvm::Twine &Message) {
+  return llvm::make_error<llvm::StringError>(Message,
+                                             llvm::inconvertibleErrorCode());
+}
+
+/// The function attribute that a binary operator written out as IR keeps its
+/// precedence in.
+static constexpr char PrecedenceAttribute[] = "kaleidoscope-precedence";
+
+/// Whether a file holds LLVM IR, as bitcode or as text, going by the
+/// extension of its name.
+static bool isIRFile(llvm::StringRef Path) {
+  const auto Extension = llvm::sys::path::extension(Path);
+  return Extension == ".bc" || Extension == ".ll";
+}
+
+/// Make a prototype for a function of a module read from IR, if Kaleidoscope
+/// can call it: it has to take doubles or arrays of doubles and return a
+/// double. Unnamed parameters are called x0, x1 and so on.
+///
+/// @param F the function to make a prototype for
+/// @return the prototype, or nullptr if Kaleidoscope cannot call F
+static std::unique_ptr<PrototypeAST> makePrototype(const llvm::Function &F) {
+  if (F.isIntrinsic() || F.hasLocalLinkage() || F.isVarArg() ||
+      !F.getReturnType()->isDoubleTy() || F.getName().startswith("__anon_expr"))
+    return nullptr;
+
+  std::vector<std::string> Args;
+  std::vector<bool> ArrayArgs;
+  bool HasArrayArgs = false;
+  for (const auto &Arg : F.args()) {
+    const auto *Ty = Arg.getType();
+    if (!Ty->isDoubleTy() && !Ty->isPointerTy())
+      return nullptr;
+    Args.push_back(Arg.hasName() ? Arg.getName().str()
+                                 : "x" + std::to_string(Arg.getArgNo()));
+    ArrayArgs.push_back(Ty->isPointerTy());
+    HasArrayArgs |= ArrayArgs.back();
+  }
+  if (!HasArrayArgs)
+    ArrayArgs.clear();
+
+  // Operators are named after their character, like the parser names them.
+  const auto Name = F.getName();
+  const bool IsOperator =
+      (Args.size() == 1 && Name.size() == 6 && Name.startswith("unary")) ||
+      (Args.size() == 2 && Name.size() == 7 && Name.startswith("binary"));
+  unsigned Precedence = 30;
+  if (IsOperator && Args.size() == 2)
+    F.getFnAttribute(PrecedenceAttribute)
+        .getValueAsString()
+        .getAsInteger(10, Precedence);
+  return std::make_unique<PrototypeAST>(Name.str(), std::move(Args), IsOperator,
+                                        Precedence, std::move(ArrayArgs),
+                                        F.isDeclaration());
+}
+
+/// Find the functions that a function read from IR refers to, along with
+/// the ones that the local functions it refers to do.
+///
+/// @param F the function
+/// @return the names of the functions, local functions left out
+static llvm::DenseSet<Symbol> findCallees(const llvm::Function &F) {
+  llvm::DenseSet<Symbol> Callees;
+  std::vector<const llvm::Function *> Worklist{&F};
+  llvm::DenseSet<const llvm::Function *> Seen{&F};
+  while (!Worklist.empty()) {
+    const auto *Caller = Worklist.back();
+    Worklist.pop_back();
+    for (const auto &I : llvm::instructions(*Caller))
+      for (const auto &Operand : I.operands()) {
+        const auto *Callee =
+            llvm::dyn_cast<llvm::Function>(Operand->stripPointerCasts());
+        if (!Callee || !Seen.insert(Callee).second)
+          continue;
+        if (Callee->hasLocalLinkage())
+          Worklist.push_back(Callee);
+        else
+          Callees.insert(Symbol::intern(Callee->getName()));
+      }
+  }
+  return Callees;
+}
+
+/// Read a file of LLVM IR into the module of its context, and declare every
+/// function in it that Kaleidoscope can call, keeping the bitcode as their
+/// definition. This runs on the thread of the file, like compileSourceFile.
+///
+/// @param File the file to read
+/// @param DL the data layout of the JIT
+static void loadIRFile(SourceFile &File, const llvm::DataLayout &DL) {
+  llvm::SMDiagnostic Diagnostic;
+  auto M = llvm::parseIRFile(File.Path, Diagnostic, getContext());
+  if (!M) {
+    File.Error = "Could not read " + File.Path + ": " +
+                 Diagnostic.getMessage().str();
+    return;
+  }
+  if (!M->getDataLayoutStr().empty() && M->getDataLayout() != DL) {
+    File.Error = File.Path + " was compiled for another target";
+    return;
+  }
+  M->setDataLayout(DL);
+
+  // Bitcode written for ThinLTO leaves unrolling and vectorizing loops to
+  // the link, which in the JIT is the function pipeline.
+  if (auto *FunctionOptimizer = getOptimizer())
+    FunctionOptimizer->runOnFunctions(*M);
+  auto Bitcode = std::make_shared<std::string>();
+  llvm::raw_string_ostream OS(*Bitcode);
+  llvm::WriteBitcodeToFile(*M, OS);
+  OS.flush();
+
+  auto &FunctionProtos = getFunctionProtos();
+  for (const auto &F : *M) {
+    auto Proto = makePrototype(F);
+    if (!Proto)
+      continue;
+    if (!F.isDeclaration()) {
+      KeptDefinition D;
+      D.Name = Proto->getSymbol();
+      D.Bitcode = Bitcode;
+      D.Callees = findCallees(F);
+      File.Definitions.push_back(std::move(D));
+    }
+    // A declaration says nothing new about a function that is known already.
+    auto Known = FunctionProtos.find(Proto->getSymbol());
+    if (F.isDeclaration() && Known != FunctionProtos.end())
+      continue;
+    if (Proto->isBinaryOp())
+      InstallBinopPrecedence(Proto->getOperatorName(),
+                             Proto->getBinaryPrecedence());
+    FunctionProtos[Proto->getSymbol()] = std::move(Proto);
+  }
+  File.Context.Module = std::move(M);
+}
+
+/// Parse a function definition with the given parser and generate its code.
+///
+/// @param Parse either ParseDefinition or ParseDefinitionFlat
+/// @param Kept where to keep the definition once its code is generated, or
+///        nullptr to drop it
+template <typename Definition>
+static void compileDefinition(std::unique_ptr<Definition> (*Parse)(),
+                              std::vector<KeptDefinition> *Kept) {
+  if (auto Defn = Parse()) {
+    if (Defn->codegen() && Kept)
+      Kept->push_back(KeepDefinition(std::move(Defn)));
+  } else {
+    // Skip token to handle errors.
+    getNextToken();
+  }
+}
+
+/// Parse and generate the code of an extern function declaration.
+static void compileExtern() {
+  if (auto Extern = ParseExtern()) {
+    if (Extern->codegen())
+      getFunctionProtos()[Extern->getSymbol()] = std::move(Extern);
+  } else {
+    // Skip token to handle errors.
+    getNextToken();
+  }
+}
+
+/// Compile a source file into the module of its context. This runs on a
+/// thread of its own, with the context of the file current.
+///
+/// @param File the file to compile
+/// @param DL the data layout of the JIT
+/// @param Optimize whether to optimize each function as it is generated
+static void compileSourceFile(SourceFile &File, const llvm::DataLayout &DL,
+                              bool Optimize) {
+  const bool IsIR = isIRFile(File.Path);
+  if (!IsIR) {
+    if (auto EC = setInputFile(File.Path)) {
+      File.Error = "Could not open " + File.Path + ": " + EC.message();
+      return;
+    }
+  }
+
+  // Target machines and optimizers are not thread-safe, so the file gets
+  // its own.
+  if (Optimize) {
+    auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!JTMB) {
+      File.Error = toString(JTMB.takeError());
+      return;
+    }
+    auto TM = JTMB->createTargetMachine();
+    if (!TM) {
+      File.Error = toString(TM.takeError());
+      return;
+    }
+    File.Context.TM = std::move(*TM);
+    setOptimizer(std::make_unique<Optimizer>(getOptimizationLevel(),
+                                             File.Context.TM.get()));
+  }
+
+  newModule("Kaleidoscope");
+  borrowModule().setDataLayout(DL);
+  if (IsIR)
+    loadIRFile(File, DL);
+  else
+    CompileDefinitions(File.Path, &File.Definitions);
+}
+
+void CompileDefinitions(llvm::StringRef Origin,
+                        std::vector<KeptDefinition> *Kept) {
+  getNextToken();
+  loop {
+    switch (getCurrentToken()) {
+    case tok_eof:
+      return;
+    case ';': // ignore top-level semicolons
+      getNextToken();
+      break;
+    case tok_def:
+      if (isFlatASTEnabled())
+        compileDefinition(ParseDefinitionFlat, Kept);
+      else
+        compileDefinition(ParseDefinition, Kept);
+      break;
+    case tok_extern:
+      compileExtern();
+      break;
+    default:
+      // The expression still has to be parsed to know where it ends.
+      if (!ParseTopLevelExpr("__anon_expr"))
+        getNextToken();
+      LogError(("Skipping a top-level expression in " + Origin +
+                ": only definitions and externs are compiled")
+                   .str()
+                   .c_str());
+    }
+  }
+}
+
+void RecordOperatorPrecedences(llvm::Module &M) {
+  const auto &BinopPrecedence =
+      CompilationContext::getCurrent().BinopPrecedence;
+  for (auto &F : M) {
+    const auto Name = F.getName();
+    if (F.isDeclaration() || Name.size() != 7 || !Name.startswith("binary"))
+      continue;
+    const auto Precedence = BinopPrecedence.find(Name.back());
+    if (Precedence != BinopPrecedence.end())
+      F.addFnAttr(PrecedenceAttribute, std::to_string(Precedence->second));
+  }
+}
+
+llvm::Error LoadSourceFiles(llvm::ArrayRef<std::string> Paths) {
+  auto &Interpreter = CompilationContext::getCurrent();
+  const auto DL = KaleidoscopeJIT::getInstance()->getDataLayout();
+  // A lazy JIT has no optimizer, it optimizes each function when it is
+  // first called instead.
+  const bool Optimize = getOptimizer() != nullptr;
+
+  // Every file starts out with what the interpreter knows so far.
+  std::vector<SourceFile> Files(Paths.size());
+  for (std::size_t I = 0; I < Paths.size(); I++) {
+    auto &File = Files[I];
+    File.Path = Paths[I];
+    File.Context.BinopPrecedence = Interpreter.BinopPrecedence;
+    for (const auto &Proto : Interpreter.FunctionProtos)
+      File.Context.FunctionProtos[Proto.first] =
+          std::make_unique<PrototypeAST>(*Proto.second);
+  }
+
+  llvm::ThreadPool Pool(llvm::hardware_concurrency(Files.size()));
+  for (auto &File : Files)
+    Pool.async([&File, &DL, Optimize] {
+      CompilationContext::Scope Scope(File.Context);
+      compileSourceFile(File, DL, Optimize);
+    });
+  Pool.wait();
+
+  for (const auto &File : Files)
+    if (!File.Error.empty())
+      return makeError(File.Error);
+
+  for (auto &File : Files) {
+    // Code calling what the file redefines is generated again against the
+    // prototypes the file leaves behind.
+    for (auto &Proto : File.Context.FunctionProtos)
+      Interpreter.FunctionProtos[Proto.first] = std::move(Proto.second);
+    for (const auto &Op : File.Context.BinopPrecedence)
+      Interpreter.BinopPrecedence[Op.first] = Op.second;
+
+    // Recording definitions for the inliner and importing the ones a module
+    // calls has to happen in order, on this thread.
+    if (auto Err = CompileModule(std::move(File.Definitions), [&File] {
+          CompilationContext::Scope Scope(File.Context);
+          return takeModuleForJIT();
+        }))
+      return Err;
+  }
+  return llvm::Error::success();
+}
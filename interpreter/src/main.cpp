@@ -1,14 +1,32 @@
 #include <cstdio>   // std::fputc, std::printf
-#include <iostream> // std::cerr, std::endl
+#include <iostream> // std::cerr, std::cout, std::endl
+#include <string>   // std::string
+#include <vector>   // std::vector
 
-#include <llvm/Support/FileSystem.h>     // llvm::sys::fs::OF_None
-#include <llvm/Support/Host.h>           // llvm::sys::getDefaultTargetTriple
+#include <llvm/ADT/SmallVector.h>        // llvm::SmallVector
+#include <llvm/ADT/StringMap.h>          // llvm::StringMap
+#include <llvm/MC/SubtargetFeature.h>    // llvm::SubtargetFeatures
+#include <llvm/Support/Host.h> // llvm::sys::getDefaultTargetTriple, llvm::sys::getHostCPUName, llvm::sys::getHostCPUFeatures
 #include <llvm/Support/TargetRegistry.h> // llvm::TargetRegistry
 #include <llvm/Support/TargetSelect.h> // llvm::InitializeNativeTarget, llvm::InitializeNativeTargetAsmPrinter, llvm::InitializeNativeTargetAsmParser
 
 #include "KaleidoscopeJIT.h" // JIT
-#include "lexer.h"
+#include "Optimizer.h" // SetOptimizationLevel
+#include "ParallelForExprAST.h" // SetParallelLoops
+#include "WorkStealingPool.h"   // WorkStealingPool
+#include "exprcache.h" // SetExpressionCacheSize
+#include "fold.h"      // SetConstantFolding
+#include "inliner.h"   // SetCrossModuleInlining, SetOperatorInlining
+#include "lexer.h" // getNextToken, setInputFile
+#include "loader.h" // LoadSourceFiles, RecordOperatorPrecedences
+#include "mathlib.h" // SetVectorLibrary, loadVectorLibrary, parseVectorLibrary
+#include "objectcode.h" // writeObjectCode
 #include "parser.h" // ParseDefinition, ParseExtern, ParseTopLevelExpr
+#include "snapshot.h" // LoadSnapshot, SaveSnapshot
+#include "stats.h"  // SetStatistics, PrintStatistics, WriteStatisticsJSON
+#include "tailcalls.h" // SetTailCalls
+#include "tiering.h" // SetTierUpThreshold, SetReoptimizationThreshold
+#include "util.h" // FlushTopLevelExpressions, OptimizeModule, SetFastMath, SetFlatAST, SetTopLevelExpressionBatchSize
 
 #define loop for (;;) // Infinite loop
 
@@ -51,9 +69,12 @@ extern "C" DLLEXPORT double putd(double d) {
 ///                 interactive REPL
 static void MainLoop(const char *ProgName, bool native) {
   loop {
-    std::cerr << ProgName << "> ";
+    if (!isBatchModeEnabled())
+      std::cerr << ProgName << "> ";
     switch (getCurrentToken()) {
     case tok_eof:
+      if (native)
+        FlushTopLevelExpressions();
       return;
     case ';':         // ignore top-level semicolons
       getNextToken(); // eat the ';'
@@ -70,27 +91,313 @@ static void MainLoop(const char *ProgName, bool native) {
   }
 }
 
+/// Get the features of the CPU this is running on, such as the vector
+/// instructions it supports, in the form target machines take them.
+static std::string getHostCPUFeatures() {
+  llvm::SubtargetFeatures Features;
+  llvm::StringMap<bool> HostFeatures;
+  if (llvm::sys::getHostCPUFeatures(HostFeatures))
+    for (const auto &Feature : HostFeatures)
+      Features.AddFeature(Feature.first(), Feature.second);
+  return Features.getString();
+}
+
 static int usage(const char *argv0) {
-  std::cerr << "usage: " << argv0 << " [help | <CPU architecture>] [<name>]"
-            << std::endl;
+  std::cerr << "usage: " << argv0
+            << " [<options>] [help | <CPU architecture>] [<name>]" << std::endl;
   std::cerr << std::endl;
   std::cerr
       << "With no arguments, run the main interpreter loop.\n"
          "With <CPU architecture>, every function run in the interpreter loop\n"
          "will be compiled into an object file called <name> (\"session.o\" if "
          "not given)\n"
-         "that matches the given CPU architecture. Run `llvm-as < /dev/null | "
+         "that matches the given CPU architecture. A <name> ending in \".a\" "
+         "or \".so\"\n"
+         "is written as a static archive or shared library instead, compiled "
+         "in parallel\n"
+         "with -threads, and one ending in \".s\", \".bc\" or \".ll\" as "
+         "assembly, bitcode\n"
+         "for ThinLTO or textual IR. Run `llvm-as < /dev/null | "
          "llc -march=x86 -mattr=help`\n"
-         "for a list of supported architectures. With \"help\", display this "
-         "message."
+         "for a list of supported architectures, or give \"native\" for the "
+         "CPU this runs\n"
+         "on and all of its features. With \"help\", display this message."
       << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Options:\n"
+               "  -O<n>         optimize at level <n>, from 0 (not at all) to 3 "
+               "(default: 2)\n"
+               "  -threads=<n>  compile JIT modules on <n> background threads "
+               "(default: 0,\n"
+               "                compile on the interpreter thread), or split "
+               "an archive or\n"
+               "                shared library into <n> partitions compiled in "
+               "parallel\n"
+               "  -parallel-threads=<n>\n"
+               "                run parallel for loops on <n> threads, the "
+               "interpreter thread\n"
+               "                included (default: one per hardware thread)\n"
+               "  -lazy         compile and optimize each function the first "
+               "time it is called\n"
+               "  -inline       let functions inline the functions defined "
+               "before them\n"
+               "  -inline-operators\n"
+               "                always inline user-defined unary and binary "
+               "operators\n"
+               "  -expr-batch=<n>\n"
+               "                compile up to <n> consecutive top-level "
+               "expressions together\n"
+               "                and run them in order once the batch is full "
+               "or a definition,\n"
+               "                extern, or the end of input is reached\n"
+               "  -expr-cache=<n>\n"
+               "                reuse the compiled code of the last <n> "
+               "distinct top-level\n"
+               "                expressions when they come up again\n"
+               "  -tier-up=<n>  interpret functions and top-level expressions, "
+               "compiling a\n"
+               "                function once it has been called or looped "
+               "<n> times\n"
+               "  -reoptimize=<n>\n"
+               "                compile functions with counters first, and "
+               "recompile them at -O3\n"
+               "                with the counts once they have been called or "
+               "branched <n> times.\n"
+               "                Implies -tier-up=1 unless -tier-up is given\n"
+               "  -jit-events=<list>\n"
+               "                tell profilers and debuggers about compiled "
+               "code, with any of\n"
+               "                gdb, perf, intel and perf-map, separated by "
+               "commas\n"
+               "  -cache-dir=<path>\n"
+               "                keep compiled code in <path> and reuse it for "
+               "unchanged\n"
+               "                definitions in later runs\n"
+               "  -input=<path> read the program from <path> instead of "
+               "standard input\n"
+               "  -load=<path>  compile the definitions in <path> before "
+               "reading the program.\n"
+               "                May be given more than once, the files are "
+               "compiled in parallel.\n"
+               "                A <path> ending in .bc or .ll is read as "
+               "LLVM IR\n"
+               "  -snapshot=<path>\n"
+               "                pick up the session saved in <path> before "
+               "reading the program\n"
+               "  -save-snapshot=<path>\n"
+               "                save the functions, operators and compiled "
+               "code of the session\n"
+               "                to <path> at exit\n"
+               "  -flat-ast     store function bodies as flat arrays of nodes "
+               "instead of trees\n"
+               "  -fold         fold constant operators and conditions while "
+               "parsing, and evaluate\n"
+               "                top-level expressions that only call pure "
+               "functions on constants\n"
+               "                right away instead of compiling them\n"
+               "  -fast-math    let LLVM reassociate floating-point arithmetic "
+               "and fuse\n"
+               "                multiplies and adds, which changes how results "
+               "are rounded\n"
+               "  -veclib=<name>\n"
+               "                call the vector math functions of <name> from "
+               "vectorized loops:\n"
+               "                none, runtime (the interpreter's own, the "
+               "default when running\n"
+               "                it), libmvec, svml, massv or accelerate "
+               "(default otherwise: none)\n"
+               "  -tail-calls   compile calls in tail position into jumps at "
+               "every optimization\n"
+               "                level, so that tail recursion does not grow the "
+               "stack\n"
+               "  -batch        run non-interactively: print no prompts or IR, "
+               "and write the\n"
+               "                values of top-level expressions to standard "
+               "output\n"
+               "  -print-ir     print the IR of definitions and externs even "
+               "with -batch\n"
+               "  -time-passes  time each phase and count tokens, AST nodes, "
+               "instructions,\n"
+               "                modules and symbol lookups, printing a table "
+               "at exit\n"
+               "  -stats-json=<path>\n"
+               "                write the times and counts to <path> as JSON "
+               "at exit"
+            << std::endl;
   return 0;
 }
 
+/// If Arg is the command-line option "-<Name>=<value>", store <value> in
+/// Value and return true. Otherwise leave Value alone and return false.
+///
+/// @param Arg the command-line argument to match
+/// @param Name the name of the option, without the leading '-'
+/// @param Value where to store the value of the option
+/// @return whether or not Arg is the option called Name
+static bool matchOption(llvm::StringRef Arg, llvm::StringRef Name,
+                        llvm::StringRef &Value) {
+  if (!Arg.consume_front("-") || !Arg.consume_front(Name) ||
+      !Arg.consume_front("="))
+    return false;
+  Value = Arg;
+  return true;
+}
+
+/// Return whether Arg is the command-line flag "-<Name>", an option that does
+/// not take a value.
+///
+/// @param Arg the command-line argument to match
+/// @param Name the name of the flag, without the leading '-'
+/// @return whether or not Arg is the flag called Name
+static bool matchFlag(llvm::StringRef Arg, llvm::StringRef Name) {
+  return Arg.consume_front("-") && Arg == Name;
+}
+
+/// Parse the unsigned integer value of the command-line option called Name,
+/// printing an error if it is not a number.
+///
+/// @param Name the name of the option, used for the error message
+/// @param Value the value given to the option
+/// @param Result where to store the parsed number
+/// @return whether or not Value is a valid unsigned integer
+static bool parseUnsignedOption(llvm::StringRef Name, llvm::StringRef Value,
+                                unsigned &Result) {
+  if (Value.getAsInteger(10, Result)) {
+    llvm::errs() << "Invalid value for -" << Name << ": " << Value << '\n';
+    return false;
+  }
+  return true;
+}
+
+/// Turn on the JIT event listeners named in Value, the value of -jit-events,
+/// printing an error if any of the names is unknown.
+///
+/// @param Value a comma-separated list of listener names
+/// @param JITOptions where to turn the listeners on
+/// @return whether every name was known
+static bool parseJITEvents(llvm::StringRef Value,
+                           llvm::orc::KaleidoscopeJIT::Options &JITOptions) {
+  llvm::SmallVector<llvm::StringRef, 4> Names;
+  Value.split(Names, ',', -1, false);
+  for (auto Name : Names) {
+    if (Name == "gdb") {
+      JITOptions.GDBEvents = true;
+    } else if (Name == "perf") {
+      JITOptions.PerfEvents = true;
+    } else if (Name == "intel") {
+      JITOptions.IntelEvents = true;
+    } else if (Name == "perf-map") {
+      JITOptions.PerfMap = true;
+    } else {
+      llvm::errs() << "Unknown JIT event listener for -jit-events: " << Name
+                   << " (expected gdb, perf, intel or perf-map)\n";
+      return false;
+    }
+  }
+  return true;
+}
+
 int main(int argc, const char **argv) {
-  const bool CompileToObjectCode = argc > 1;
+  llvm::orc::KaleidoscopeJIT::Options JITOptions;
+  unsigned ExprBatchSize = 1;
+  unsigned ExprCacheSize = 0;
+  unsigned TierUpThreshold = 0;
+  unsigned ReoptimizationThreshold = 0;
+  unsigned ParallelThreads = 0;
+  llvm::Optional<VectorLibrary> VecLib;
+  unsigned OptLevel = getOptimizationLevel();
+  bool Batch = false;
+  bool PrintIR = false;
+  bool TimePasses = false;
+  llvm::StringRef StatsJSON;
+  llvm::StringRef InputFile;
+  std::vector<std::string> LoadFiles;
+  llvm::StringRef SnapshotFile;
+  llvm::StringRef SaveSnapshotFile;
+
+  // Options may appear anywhere on the command line, everything else is a
+  // positional argument.
+  std::vector<const char *> Positional;
+  for (int i = 1; i < argc; i++) {
+    llvm::StringRef Value = argv[i];
+    if (Value.consume_front("-O")) {
+      if (!parseUnsignedOption("O", Value, OptLevel))
+        return 1;
+      if (OptLevel > 3) {
+        llvm::errs() << "Invalid value for -O: " << Value << '\n';
+        return 1;
+      }
+    } else if (matchOption(argv[i], "threads", Value)) {
+      if (!parseUnsignedOption("threads", Value, JITOptions.NumCompileThreads))
+        return 1;
+    } else if (matchOption(argv[i], "parallel-threads", Value)) {
+      if (!parseUnsignedOption("parallel-threads", Value, ParallelThreads))
+        return 1;
+    } else if (matchOption(argv[i], "veclib", Value)) {
+      VecLib = parseVectorLibrary(Value);
+      if (!VecLib) {
+        llvm::errs() << "Unknown vector library for -veclib: " << Value
+                     << " (expected none, runtime, libmvec, svml, massv or "
+                        "accelerate)\n";
+        return 1;
+      }
+    } else if (matchOption(argv[i], "expr-batch", Value)) {
+      if (!parseUnsignedOption("expr-batch", Value, ExprBatchSize))
+        return 1;
+    } else if (matchOption(argv[i], "expr-cache", Value)) {
+      if (!parseUnsignedOption("expr-cache", Value, ExprCacheSize))
+        return 1;
+    } else if (matchOption(argv[i], "tier-up", Value)) {
+      if (!parseUnsignedOption("tier-up", Value, TierUpThreshold))
+        return 1;
+    } else if (matchOption(argv[i], "reoptimize", Value)) {
+      if (!parseUnsignedOption("reoptimize", Value, ReoptimizationThreshold))
+        return 1;
+    } else if (matchOption(argv[i], "cache-dir", Value)) {
+      JITOptions.CacheDir = Value.str();
+    } else if (matchOption(argv[i], "jit-events", Value)) {
+      if (!parseJITEvents(Value, JITOptions))
+        return 1;
+    } else if (matchOption(argv[i], "input", Value)) {
+      InputFile = Value;
+    } else if (matchOption(argv[i], "load", Value)) {
+      LoadFiles.push_back(Value.str());
+    } else if (matchOption(argv[i], "snapshot", Value)) {
+      SnapshotFile = Value;
+    } else if (matchOption(argv[i], "save-snapshot", Value)) {
+      SaveSnapshotFile = Value;
+      JITOptions.KeepObjects = true;
+    } else if (matchFlag(argv[i], "inline")) {
+      SetCrossModuleInlining(true);
+    } else if (matchFlag(argv[i], "inline-operators")) {
+      SetOperatorInlining(true);
+    } else if (matchFlag(argv[i], "flat-ast")) {
+      SetFlatAST(true);
+    } else if (matchFlag(argv[i], "fold")) {
+      SetConstantFolding(true);
+    } else if (matchFlag(argv[i], "fast-math")) {
+      SetFastMath(true);
+    } else if (matchFlag(argv[i], "tail-calls")) {
+      SetTailCalls(true);
+    } else if (matchFlag(argv[i], "batch")) {
+      Batch = true;
+    } else if (matchFlag(argv[i], "print-ir")) {
+      PrintIR = true;
+    } else if (matchFlag(argv[i], "time-passes")) {
+      TimePasses = true;
+    } else if (matchOption(argv[i], "stats-json", Value)) {
+      StatsJSON = Value;
+    } else if (matchFlag(argv[i], "lazy")) {
+      JITOptions.Lazy = true;
+      JITOptions.Optimize = OptimizeModule;
+    } else {
+      Positional.push_back(argv[i]);
+    }
+  }
+
+  const bool CompileToObjectCode = !Positional.empty();
   if (CompileToObjectCode) {
-    std::string CPUOrHelp = argv[1];
+    std::string CPUOrHelp = Positional[0];
     std::transform(
         CPUOrHelp.begin(), CPUOrHelp.end(), CPUOrHelp.begin(),
         [](unsigned char c) -> unsigned char { return std::tolower(c); });
@@ -99,6 +406,25 @@ int main(int argc, const char **argv) {
       return usage(argv[0]);
     }
 
+    if (!LoadFiles.empty()) {
+      llvm::errs() << "-load only works when running the interpreter\n";
+      return 1;
+    }
+    if (!SnapshotFile.empty() || !SaveSnapshotFile.empty()) {
+      llvm::errs() << "Snapshots only work when running the interpreter\n";
+      return 1;
+    }
+
+    // Object code cannot call into the interpreter's pool of threads, or
+    // its vector math functions.
+    SetParallelLoops(false);
+    if (VecLib == VectorLibrary::Runtime) {
+      llvm::errs() << "-veclib=runtime only works when running the "
+                      "interpreter\n";
+      return 1;
+    }
+    SetVectorLibrary(VecLib.getValueOr(VectorLibrary::None));
+
     llvm::InitializeAllTargetInfos();
     llvm::InitializeAllTargets();
     llvm::InitializeAllTargetMCs();
@@ -108,18 +434,72 @@ int main(int argc, const char **argv) {
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
     llvm::InitializeNativeTargetAsmParser();
+    llvm::orc::KaleidoscopeJIT::setOptions(JITOptions);
+    WorkStealingPool::setNumThreads(ParallelThreads);
+    SetVectorLibrary(VecLib.getValueOr(VectorLibrary::Runtime));
+    if (auto Err = loadVectorLibrary(getVectorLibrary())) {
+      llvm::errs() << toString(std::move(Err)) << '\n';
+      return 1;
+    }
+    SetTopLevelExpressionBatchSize(ExprBatchSize);
+    SetExpressionCacheSize(ExprCacheSize);
+    // Only the interpreter can tell when compiled code has gotten hot.
+    if (ReoptimizationThreshold && !TierUpThreshold)
+      TierUpThreshold = 1;
+    SetTierUpThreshold(TierUpThreshold);
+    SetReoptimizationThreshold(ReoptimizationThreshold);
+    // Interpreted functions have no code to save.
+    if (!SaveSnapshotFile.empty() && TierUpThreshold) {
+      llvm::errs() << "-save-snapshot does not work with -tier-up or "
+                      "-reoptimize\n";
+      return 1;
+    }
+  }
+
+  if (!InputFile.empty()) {
+    if (auto EC = setInputFile(InputFile.str())) {
+      llvm::errs() << "Could not open " << InputFile << ": " << EC.message()
+                   << '\n';
+      return 1;
+    }
   }
 
+  SetStatistics(TimePasses || !StatsJSON.empty());
+  SetBatchMode(Batch);
+  SetIRPrinting(!Batch || PrintIR);
+  SetOptimizationLevel(OptLevel);
   SetupBinopPrecedences();
   InitializeModuleAndPassManager(!CompileToObjectCode);
 
+  if (!SnapshotFile.empty()) {
+    if (auto Err = LoadSnapshot(SnapshotFile)) {
+      llvm::errs() << toString(std::move(Err)) << '\n';
+      return 1;
+    }
+  }
+
+  if (!LoadFiles.empty()) {
+    if (auto Err = LoadSourceFiles(LoadFiles)) {
+      llvm::errs() << toString(std::move(Err)) << '\n';
+      return 1;
+    }
+  }
+
   // Get ready to parse the first token.
-  std::cerr << argv[0] << "> ";
+  if (!isBatchModeEnabled())
+    std::cerr << argv[0] << "> ";
   getNextToken();
 
   // Run the REPL now.
   MainLoop(argv[0], !CompileToObjectCode);
 
+  if (!SaveSnapshotFile.empty()) {
+    if (auto Err = SaveSnapshot(SaveSnapshotFile)) {
+      llvm::errs() << toString(std::move(Err)) << '\n';
+      return 1;
+    }
+  }
+
   if (CompileToObjectCode) {
     auto TargetTriple = llvm::sys::getDefaultTargetTriple();
 
@@ -134,44 +514,52 @@ int main(int argc, const char **argv) {
       return 1;
     }
 
-    // Use the CPU architecture supplied at the command line.
-    auto CPU = argv[1];
+    // Use the CPU architecture supplied at the command line, or with
+    // "native" the one this is running on, with every feature it has.
+    std::string CPU = Positional[0];
+    std::string Features;
+    if (CPU == "native") {
+      CPU = llvm::sys::getHostCPUName().str();
+      Features = getHostCPUFeatures();
+    }
 
-    // Do not add any additional features, options, or relocation models for
-    // now.
-    auto Features = "";
+    // Do not add any additional options for now. The relocation model
+    // depends on the kind of file being written.
     llvm::TargetOptions opt;
-    auto RM = llvm::Optional<llvm::Reloc::Model>();
 
-    auto TargetMachine =
-        Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+    auto CreateTargetMachine = [&](llvm::Optional<llvm::Reloc::Model> RM) {
+      return std::unique_ptr<llvm::TargetMachine>(
+          Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM));
+    };
 
-    borrowModule().setDataLayout(TargetMachine->createDataLayout());
+    borrowModule().setDataLayout(
+        CreateTargetMachine(llvm::None)->createDataLayout());
     borrowModule().setTargetTriple(TargetTriple);
 
-    auto Filename = argc > 2 ? argv[2] : "session.o";
-    std::error_code EC;
-    llvm::raw_fd_ostream dest(Filename, EC, llvm::sys::fs::OF_None);
-
-    if (EC) {
-      llvm::errs() << "Could not open " << Filename << ": " << EC.message();
+    auto Filename = Positional.size() > 1 ? Positional[1] : "session.o";
+    RecordOperatorPrecedences(borrowModule());
+    // With -threads, an archive or shared library is compiled in parallel.
+    if (auto Err = writeObjectCode(borrowModule(), Filename,
+                                   CreateTargetMachine,
+                                   JITOptions.NumCompileThreads)) {
+      llvm::errs() << toString(std::move(Err)) << '\n';
       return 1;
     }
+    llvm::outs() << "Wrote " << Filename;
+  }
 
-    llvm::legacy::PassManager pass;
-    AddPasses(&pass);
-
-    auto FileType = llvm::CGFT_ObjectFile;
-
-    if (TargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
-      llvm::errs() << "Cannot emit a file of this type";
+  if (!StatsJSON.empty()) {
+    if (auto EC = WriteStatisticsJSON(StatsJSON.str())) {
+      llvm::errs() << "Could not write " << StatsJSON << ": " << EC.message()
+                   << '\n';
       return 1;
     }
-
-    pass.run(borrowModule());
-    dest.flush();
-    llvm::outs() << "Wrote " << Filename;
   }
-
+  if (TimePasses) {
+    // Keep the results of a batch ahead of the table when both go to the
+    // same place.
+    std::cout.flush();
+    PrintStatistics(llvm::errs());
+  }
   return 0;
 }
@@ -0,0 +1,352 @@
+#include <llvm/ADT/StringSwitch.h>        // llvm::StringSwitch
+#include <llvm/ADT/Triple.h>              // llvm::Triple
+#include <llvm/ADT/Twine.h>               // llvm::Twine
+#include <llvm/IR/Attributes.h>           // llvm::Attribute
+#include <llvm/IR/DerivedTypes.h>         // llvm::FixedVectorType, llvm::FunctionType
+#include <llvm/IR/IRBuilder.h>            // llvm::IRBuilder
+#include <llvm/IR/Intrinsics.h>           // llvm::Intrinsic
+#include <llvm/IR/LLVMContext.h>          // llvm::LLVMContext
+#include <llvm/IR/Module.h>               // llvm::Module
+#include <llvm/Support/Allocator.h>       // llvm::BumpPtrAllocator
+#include <llvm/Support/DynamicLibrary.h>  // llvm::sys::DynamicLibrary
+#include <llvm/Support/Host.h>            // llvm::sys::getProcessTriple
+#include <llvm/Support/StringSaver.h>     // llvm::StringSaver
+
+#include <cmath>   // std::sin, std::cos, std::pow, ...
+#include <cstddef> // std::size_t
+#include <memory>  // std::make_unique
+#include <string>  // std::string
+#include <vector>  // std::vector
+
+#include "ExprAST.h" // borrowModule, getContext, getFunctionProtos
+#include "mathlib.h"
+
+namespace {
+/// MathFunction - A function of the math library.
+struct MathFunction {
+  /// The name of the function, which is also its name in the C library.
+  const char *Name;
+  unsigned NumArgs;
+  /// The intrinsic that calls to the function are generated as, or
+  /// not_intrinsic if LLVM has none.
+  llvm::Intrinsic::ID Intrinsic;
+  /// Whether vectorizing a call takes a library of vector math functions,
+  /// since there is no vector instruction that computes the function.
+  bool NeedsVectorLibrary;
+  /// Where the function is in the interpreter.
+  llvm::JITTargetAddress Address;
+};
+} // namespace
+
+using Unary = double (*)(double);
+using Binary = double (*)(double, double);
+using Ternary = double (*)(double, double, double);
+
+/// Get the address of a function of the C library, picking the overload of
+/// the type given as F.
+template <typename F> static llvm::JITTargetAddress addressOf(F Function) {
+  return llvm::pointerToJITTargetAddress(Function);
+}
+
+/// The functions of the math library.
+static const MathFunction MathFunctions[] = {
+    // Functions LLVM has intrinsics for.
+    {"sqrt", 1, llvm::Intrinsic::sqrt, false, addressOf<Unary>(std::sqrt)},
+    {"fabs", 1, llvm::Intrinsic::fabs, false, addressOf<Unary>(std::fabs)},
+    {"floor", 1, llvm::Intrinsic::floor, false, addressOf<Unary>(std::floor)},
+    {"ceil", 1, llvm::Intrinsic::ceil, false, addressOf<Unary>(std::ceil)},
+    {"trunc", 1, llvm::Intrinsic::trunc, false, addressOf<Unary>(std::trunc)},
+    {"round", 1, llvm::Intrinsic::round, false, addressOf<Unary>(std::round)},
+    {"rint", 1, llvm::Intrinsic::rint, false, addressOf<Unary>(std::rint)},
+    {"nearbyint", 1, llvm::Intrinsic::nearbyint, false,
+     addressOf<Unary>(std::nearbyint)},
+    {"fmin", 2, llvm::Intrinsic::minnum, false, addressOf<Binary>(std::fmin)},
+    {"fmax", 2, llvm::Intrinsic::maxnum, false, addressOf<Binary>(std::fmax)},
+    {"copysign", 2, llvm::Intrinsic::copysign, false,
+     addressOf<Binary>(std::copysign)},
+    {"fma", 3, llvm::Intrinsic::fma, false, addressOf<Ternary>(std::fma)},
+    {"sin", 1, llvm::Intrinsic::sin, true, addressOf<Unary>(std::sin)},
+    {"cos", 1, llvm::Intrinsic::cos, true, addressOf<Unary>(std::cos)},
+    {"exp", 1, llvm::Intrinsic::exp, true, addressOf<Unary>(std::exp)},
+    {"exp2", 1, llvm::Intrinsic::exp2, true, addressOf<Unary>(std::exp2)},
+    {"log", 1, llvm::Intrinsic::log, true, addressOf<Unary>(std::log)},
+    {"log2", 1, llvm::Intrinsic::log2, true, addressOf<Unary>(std::log2)},
+    {"log10", 1, llvm::Intrinsic::log10, true, addressOf<Unary>(std::log10)},
+    {"pow", 2, llvm::Intrinsic::pow, true, addressOf<Binary>(std::pow)},
+    // Functions LLVM only knows about as functions of the C library.
+    {"tan", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::tan)},
+    {"asin", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::asin)},
+    {"acos", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::acos)},
+    {"atan", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::atan)},
+    {"sinh", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::sinh)},
+    {"cosh", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::cosh)},
+    {"tanh", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::tanh)},
+    {"expm1", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::expm1)},
+    {"log1p", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::log1p)},
+    {"cbrt", 1, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Unary>(std::cbrt)},
+    {"atan2", 2, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Binary>(std::atan2)},
+    {"hypot", 2, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Binary>(std::hypot)},
+    {"fmod", 2, llvm::Intrinsic::not_intrinsic, true,
+     addressOf<Binary>(std::fmod)},
+};
+
+/// The widths of vector that the Runtime library has functions for.
+static constexpr unsigned RuntimeVectorWidths[] = {2, 4, 8};
+
+/// The math functions that glibc has had vector variants of since libmvec
+/// first came out, in 2.22.
+static const llvm::StringRef LibmvecFunctions[] = {"sin", "cos", "exp", "log",
+                                                   "pow"};
+
+/// The library Optimizers are built for.
+static VectorLibrary VectorLibrarySetting = VectorLibrary::None;
+
+void SetVectorLibrary(VectorLibrary Library) { VectorLibrarySetting = Library; }
+
+VectorLibrary getVectorLibrary() { return VectorLibrarySetting; }
+
+llvm::Optional<VectorLibrary> parseVectorLibrary(llvm::StringRef Name) {
+  return llvm::StringSwitch<llvm::Optional<VectorLibrary>>(Name.lower())
+      .Case("none", VectorLibrary::None)
+      .Case("runtime", VectorLibrary::Runtime)
+      .Case("libmvec", VectorLibrary::Libmvec)
+      .Case("svml", VectorLibrary::SVML)
+      .Case("massv", VectorLibrary::MASSV)
+      .Case("accelerate", VectorLibrary::Accelerate)
+      .Default(llvm::None);
+}
+
+llvm::Error loadVectorLibrary(VectorLibrary Library) {
+  if (Library != VectorLibrary::Libmvec)
+    return llvm::Error::success();
+  std::string Error;
+  if (llvm::sys::DynamicLibrary::LoadLibraryPermanently("libmvec.so.1",
+                                                        &Error))
+    return llvm::make_error<llvm::StringError>(
+        "Could not load libmvec: " + Error, llvm::inconvertibleErrorCode());
+  return llvm::Error::success();
+}
+
+/// Find the math function with the given name and number of arguments.
+///
+/// @param Name the name of the function
+/// @param NumArgs the number of arguments it takes
+/// @return the function, or nullptr if there is none
+static const MathFunction *findMathFunction(llvm::StringRef Name,
+                                            std::size_t NumArgs) {
+  for (const auto &F : MathFunctions)
+    if (Name == F.Name && NumArgs == F.NumArgs)
+      return &F;
+  return nullptr;
+}
+
+/// Get the name of the Runtime library's vector variant of a math function.
+static std::string getRuntimeVectorName(const MathFunction &F, unsigned VF) {
+  return "kaleidoscope_" + std::string(F.Name) + "_v" + std::to_string(VF);
+}
+
+namespace {
+/// VectorFunctions - The vector variants of math functions that a library
+/// has, with the names that their descriptions refer to, which have to live
+/// as long as any library info they are added to.
+class VectorFunctions {
+  llvm::BumpPtrAllocator Allocator;
+  llvm::StringSaver Names{Allocator};
+  std::vector<llvm::VecDesc> Descriptions;
+
+public:
+  /// The constructor for the VectorFunctions class.
+  ///
+  /// @param Fill adds the vector variants
+  explicit VectorFunctions(llvm::function_ref<void(VectorFunctions &)> Fill) {
+    Fill(*this);
+  }
+  VectorFunctions(const VectorFunctions &) = delete;
+  VectorFunctions &operator=(const VectorFunctions &) = delete;
+
+  /// Add a vector variant of a math function, under both of the names calls
+  /// to the function can have: its own and that of its intrinsic.
+  void add(const MathFunction &F, const llvm::Twine &VectorName, unsigned VF) {
+    const auto Vector = Names.save(VectorName);
+    Descriptions.push_back({F.Name, Vector, VF});
+    if (F.Intrinsic != llvm::Intrinsic::not_intrinsic)
+      Descriptions.push_back(
+          {Names.save("llvm." + llvm::Twine(F.Name) + ".f64"), Vector, VF});
+  }
+
+  llvm::ArrayRef<llvm::VecDesc> get() const { return Descriptions; }
+};
+} // namespace
+
+/// Get the vector variants of the Runtime library.
+static llvm::ArrayRef<llvm::VecDesc> getRuntimeVectorFunctions() {
+  static const VectorFunctions Functions([](VectorFunctions &Functions) {
+    for (const auto &F : MathFunctions)
+      if (F.NeedsVectorLibrary)
+        for (unsigned VF : RuntimeVectorWidths)
+          Functions.add(F, getRuntimeVectorName(F, VF), VF);
+  });
+  return Functions.get();
+}
+
+/// Get the vector variants of libmvec that the given target can call, which
+/// are named after the x86-64 vector function ABI: _ZGVdN4v_sin is sin for
+/// vectors of 4 doubles, using AVX2.
+static llvm::ArrayRef<llvm::VecDesc>
+getLibmvecFunctions(const llvm::TargetMachine &TM) {
+  const auto Features = TM.getTargetFeatureString();
+  const auto HasFeature = [&](llvm::StringRef Feature) {
+    llvm::SmallVector<llvm::StringRef, 64> Enabled;
+    Features.split(Enabled, ',');
+    return llvm::is_contained(Enabled, ("+" + Feature).str());
+  };
+  // Each of them is more than the one before, so functions are only there
+  // for one of the instruction sets that can do vectors of 4.
+  struct Variant {
+    char ISA;
+    unsigned VF;
+    bool Supported;
+  };
+  const bool AVX2 = HasFeature("avx2");
+  const Variant Variants[] = {{'b', 2, true},
+                              {'c', 4, !AVX2 && HasFeature("avx")},
+                              {'d', 4, AVX2},
+                              {'e', 8, HasFeature("avx512f")}};
+
+  // A process only ever compiles for one CPU: the host in the JIT, or the
+  // one given on the command line when compiling to object code.
+  static const VectorFunctions Functions([&](VectorFunctions &Functions) {
+    for (const auto &F : MathFunctions) {
+      if (!llvm::is_contained(LibmvecFunctions, F.Name))
+        continue;
+      for (const auto &V : Variants)
+        if (V.Supported)
+          Functions.add(F,
+                        "_ZGV" + llvm::Twine(V.ISA) + "N" + llvm::Twine(V.VF) +
+                            std::string(F.NumArgs, 'v') + "_" + F.Name,
+                        V.VF);
+    }
+  });
+  return Functions.get();
+}
+
+void addVectorMathFunctions(llvm::TargetLibraryInfoImpl &TLII,
+                            const llvm::TargetMachine *TM) {
+  switch (VectorLibrarySetting) {
+  case VectorLibrary::None:
+    break;
+  case VectorLibrary::Runtime:
+    TLII.addVectorizableFunctions(getRuntimeVectorFunctions());
+    break;
+  case VectorLibrary::Libmvec:
+    if (TM && TM->getTargetTriple().getArch() == llvm::Triple::x86_64)
+      TLII.addVectorizableFunctions(getLibmvecFunctions(*TM));
+    break;
+  case VectorLibrary::SVML:
+    TLII.addVectorizableFunctionsFromVecLib(llvm::TargetLibraryInfoImpl::SVML);
+    break;
+  case VectorLibrary::MASSV:
+    TLII.addVectorizableFunctionsFromVecLib(
+        llvm::TargetLibraryInfoImpl::MASSV);
+    break;
+  case VectorLibrary::Accelerate:
+    TLII.addVectorizableFunctionsFromVecLib(
+        llvm::TargetLibraryInfoImpl::Accelerate);
+    break;
+  }
+}
+
+bool isMathFunction(const PrototypeAST &Proto) {
+  return Proto.isExtern() && !Proto.hasArrayArgs() &&
+         findMathFunction(Proto.getName(), Proto.getArgs().size());
+}
+
+bool isLibraryFunction(const llvm::Function &F) {
+  static const llvm::TargetLibraryInfoImpl TLII(
+      llvm::Triple(llvm::sys::getProcessTriple()));
+  llvm::LibFunc Func;
+  return TLII.getLibFunc(F, Func);
+}
+
+void addMathFunctionAttributes(llvm::Function &F) {
+  // Kaleidoscope cannot read errno, so the math functions setting it does
+  // not count, the same as with clang's -fno-math-errno.
+  F.setDoesNotAccessMemory();
+  F.setDoesNotThrow();
+  F.addFnAttr(llvm::Attribute::WillReturn);
+}
+
+llvm::Function *getMathIntrinsic(Symbol Callee) {
+  const auto &FunctionProtos = getFunctionProtos();
+  auto Proto = FunctionProtos.find(Callee);
+  if (Proto == FunctionProtos.end() || !isMathFunction(*Proto->second))
+    return nullptr;
+  const auto *F = findMathFunction(Proto->second->getName(),
+                                   Proto->second->getArgs().size());
+  if (F->Intrinsic == llvm::Intrinsic::not_intrinsic)
+    return nullptr;
+  return llvm::Intrinsic::getDeclaration(
+      &borrowModule(), F->Intrinsic, llvm::Type::getDoubleTy(getContext()));
+}
+
+void forEachMathFunction(
+    llvm::function_ref<void(llvm::StringRef Name, llvm::JITTargetAddress)>
+        Define) {
+  for (const auto &F : MathFunctions)
+    Define(F.Name, F.Address);
+}
+
+llvm::orc::ThreadSafeModule getVectorMathModule(const llvm::DataLayout &DL) {
+  auto Context = std::make_unique<llvm::LLVMContext>();
+  auto M = std::make_unique<llvm::Module>("mathlib", *Context);
+  M->setDataLayout(DL);
+  llvm::IRBuilder<> Builder(*Context);
+  auto *DoubleTy = Builder.getDoubleTy();
+
+  for (const auto &F : MathFunctions) {
+    if (!F.NeedsVectorLibrary)
+      continue;
+    const std::vector<llvm::Type *> ScalarArgs(F.NumArgs, DoubleTy);
+    auto *Scalar = llvm::Function::Create(
+        llvm::FunctionType::get(DoubleTy, ScalarArgs, false),
+        llvm::Function::ExternalLinkage, F.Name, *M);
+    addMathFunctionAttributes(*Scalar);
+
+    for (unsigned VF : RuntimeVectorWidths) {
+      auto *VectorTy = llvm::FixedVectorType::get(DoubleTy, VF);
+      const std::vector<llvm::Type *> VectorArgs(F.NumArgs, VectorTy);
+      auto *Vector = llvm::Function::Create(
+          llvm::FunctionType::get(VectorTy, VectorArgs, false),
+          llvm::Function::ExternalLinkage, getRuntimeVectorName(F, VF), *M);
+      Builder.SetInsertPoint(
+          llvm::BasicBlock::Create(*Context, "entry", Vector));
+
+      llvm::Value *Result = llvm::UndefValue::get(VectorTy);
+      for (unsigned Lane = 0; Lane < VF; Lane++) {
+        std::vector<llvm::Value *> Args;
+        for (auto &Arg : Vector->args())
+          Args.push_back(Builder.CreateExtractElement(&Arg, Lane));
+        auto *Call = Builder.CreateCall(Scalar, Args);
+        // Without this, the SLP vectorizer would turn the calls back into a
+        // call to this very function.
+        Call->setAttributes(Call->getAttributes().addFnAttribute(
+            *Context, llvm::Attribute::NoBuiltin));
+        Result = Builder.CreateInsertElement(Result, Call, Lane);
+      }
+      Builder.CreateRet(Result);
+    }
+  }
+  return llvm::orc::ThreadSafeModule(std::move(M), std::move(Context));
+}
@@ -0,0 +1,321 @@
+#include <llvm/ADT/DenseMap.h>          // llvm::DenseMap
+#include <llvm/ADT/SmallString.h>       // llvm::SmallString
+#include <llvm/ADT/SmallVector.h>       // llvm::SmallVector
+#include <llvm/ADT/Triple.h>            // llvm::Triple
+#include <llvm/ADT/Twine.h>             // llvm::Twine
+#include <llvm/Analysis/ModuleSummaryAnalysis.h> // llvm::buildModuleSummaryIndex
+#include <llvm/Analysis/ProfileSummaryInfo.h> // llvm::ProfileSummaryInfo
+#include <llvm/Bitcode/BitcodeReader.h> // llvm::parseBitcodeFile
+#include <llvm/Bitcode/BitcodeWriter.h> // llvm::WriteBitcodeToFile
+#include <llvm/IR/LLVMContext.h>        // llvm::LLVMContext
+#include <llvm/IR/LegacyPassManager.h>  // llvm::legacy::PassManager
+#include <llvm/Object/ArchiveWriter.h>  // llvm::writeArchive, llvm::NewArchiveMember
+#include <llvm/Support/FileSystem.h>    // llvm::sys::fs::createTemporaryFile, llvm::sys::fs::remove
+#include <llvm/Support/MemoryBuffer.h>  // llvm::MemoryBufferRef
+#include <llvm/Support/Path.h>          // llvm::sys::path::extension, llvm::sys::path::stem
+#include <llvm/Support/Program.h>       // llvm::sys::findProgramByName, llvm::sys::ExecuteAndWait
+#include <llvm/Support/ThreadPool.h>    // llvm::ThreadPool
+#include <llvm/Support/raw_ostream.h>   // llvm::raw_fd_ostream, llvm::raw_string_ostream, llvm::raw_svector_ostream
+#include <llvm/Transforms/Utils/Cloning.h> // llvm::CloneModule
+
+#include <algorithm> // std::max, std::min, std::min_element, std::stable_sort
+#include <string>    // std::string, std::to_string
+#include <vector>    // std::vector
+
+#include "objectcode.h"
+
+#include "Optimizer.h"
+
+namespace {
+/// The kinds of file a session can be compiled into.
+enum class OutputKind {
+  Object,
+  Archive,
+  SharedLibrary,
+  Assembly,
+  Bitcode,
+  IR
+};
+
+/// One share of the functions of a module that is compiled in parallel.
+struct Partition {
+  /// The partition as bitcode, so that it can be read into a context of its
+  /// own on the thread compiling it.
+  std::string Bitcode;
+  /// The compiled object file.
+  llvm::SmallVector<char, 0> Object;
+  /// Why compiling the partition failed, or empty.
+  std::string Error;
+};
+} // namespace
+
+/// Make an error with the given message.
+static llvm::Error makeError(const llvm::Twine &Message) {
+  return llvm::make_error<llvm::StringError>(Message,
+                                             llvm::inconvertibleErrorCode());
+}
+
+/// Get the kind of file to write, going by the extension of its name.
+static OutputKind getOutputKind(llvm::StringRef Filename) {
+  const auto Extension = llvm::sys::path::extension(Filename);
+  if (Extension == ".a")
+    return OutputKind::Archive;
+  if (Extension == ".so")
+    return OutputKind::SharedLibrary;
+  if (Extension == ".s")
+    return OutputKind::Assembly;
+  if (Extension == ".bc")
+    return OutputKind::Bitcode;
+  if (Extension == ".ll")
+    return OutputKind::IR;
+  return OutputKind::Object;
+}
+
+/// Compile a module that has already been optimized into an object file, or
+/// into assembly.
+static llvm::Error emitObject(llvm::Module &M, llvm::TargetMachine &TM,
+                              llvm::raw_pwrite_stream &OS,
+                              llvm::CodeGenFileType FileType =
+                                  llvm::CGFT_ObjectFile) {
+  llvm::legacy::PassManager PM;
+  if (TM.addPassesToEmitFile(PM, OS, nullptr, FileType))
+    return makeError(FileType == llvm::CGFT_ObjectFile
+                         ? "Cannot emit an object file for this target"
+                         : "Cannot emit assembly for this target");
+  PM.run(M);
+  return llvm::Error::success();
+}
+
+/// Write a module that has already been optimized as bitcode, with the
+/// summary ThinLTO needs to import functions from it into other modules, or
+/// as textual IR.
+static void emitIR(llvm::Module &M, OutputKind Kind, llvm::raw_ostream &OS) {
+  if (Kind == OutputKind::IR) {
+    M.print(OS, nullptr);
+    return;
+  }
+  llvm::ProfileSummaryInfo PSI(M);
+  const auto Index = llvm::buildModuleSummaryIndex(M, nullptr, &PSI);
+  llvm::WriteBitcodeToFile(M, OS, /*ShouldPreserveUseListOrder=*/false,
+                           &Index);
+}
+
+/// Split the function definitions of a module up between at most N
+/// partitions. Each partition gets a copy of the whole module in which only
+/// its own functions are defined, and everything else is declared.
+///
+/// @param M the module to split, whose local symbols are made external so
+///        that the partitions can refer to each other's
+/// @param N the most partitions to make
+/// @return the partitions, at least one
+static std::vector<Partition> splitModule(llvm::Module &M, unsigned N) {
+  for (auto &GV : M.global_values()) {
+    if (GV.isDeclaration() || !GV.hasLocalLinkage())
+      continue;
+    GV.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    GV.setVisibility(llvm::GlobalValue::HiddenVisibility);
+  }
+
+  std::vector<const llvm::Function *> Functions;
+  for (const auto &F : M)
+    if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage())
+      Functions.push_back(&F);
+
+  // Compiling a function takes about as long as it has instructions, so hand
+  // out the largest functions first, each to the partition that has the
+  // fewest instructions so far.
+  std::stable_sort(Functions.begin(), Functions.end(),
+                   [](const llvm::Function *L, const llvm::Function *R) {
+                     return L->getInstructionCount() > R->getInstructionCount();
+                   });
+  N = std::max<std::size_t>(std::min<std::size_t>(N, Functions.size()), 1);
+  std::vector<std::size_t> Sizes(N);
+  llvm::DenseMap<const llvm::GlobalValue *, unsigned> Owners;
+  for (const auto *F : Functions) {
+    const auto Smallest = static_cast<unsigned>(
+        std::min_element(Sizes.begin(), Sizes.end()) - Sizes.begin());
+    Owners[F] = Smallest;
+    Sizes[Smallest] += F->getInstructionCount();
+  }
+
+  std::vector<Partition> Partitions(N);
+  for (unsigned I = 0; I < N; I++) {
+    llvm::ValueToValueMapTy VMap;
+    auto Part = llvm::CloneModule(M, VMap, [&](const llvm::GlobalValue *GV) {
+      // Available externally bodies are never emitted, so every partition
+      // can inline them. Anything that is not a function, like a global
+      // variable, goes with the first partition.
+      const auto *F = llvm::dyn_cast<llvm::Function>(GV);
+      if (!F)
+        return I == 0;
+      return F->hasAvailableExternallyLinkage() || Owners.lookup(F) == I;
+    });
+    llvm::raw_string_ostream OS(Partitions[I].Bitcode);
+    llvm::WriteBitcodeToFile(*Part, OS);
+    OS.flush();
+  }
+  return Partitions;
+}
+
+/// Optimize and compile a partition into an object file. This runs on a
+/// thread of its own, in a context of its own.
+static llvm::Error compilePartition(Partition &P,
+                                    TargetMachineFactory CreateTargetMachine,
+                                    llvm::Optional<llvm::Reloc::Model> RM) {
+  llvm::LLVMContext Context;
+  auto M = llvm::parseBitcodeFile(llvm::MemoryBufferRef(P.Bitcode, "partition"),
+                                  Context);
+  if (!M)
+    return M.takeError();
+
+  auto TM = CreateTargetMachine(RM);
+  if (!TM)
+    return makeError("Could not create a target machine");
+
+  Optimizer(getOptimizationLevel(), TM.get()).runOnModule(**M);
+  llvm::raw_svector_ostream OS(P.Object);
+  return emitObject(**M, *TM, OS);
+}
+
+/// Write the compiled partitions of a module into a static archive, one
+/// member per partition.
+static llvm::Error writeArchive(llvm::StringRef Filename, const llvm::Module &M,
+                                llvm::ArrayRef<Partition> Partitions) {
+  const auto Stem = llvm::sys::path::stem(Filename);
+  // The members only refer to their names.
+  std::vector<std::string> Names;
+  Names.reserve(Partitions.size());
+  std::vector<llvm::NewArchiveMember> Members;
+  for (std::size_t I = 0; I < Partitions.size(); I++) {
+    Names.push_back((Stem + "." + llvm::Twine(I) + ".o").str());
+    const auto &Object = Partitions[I].Object;
+    Members.emplace_back(llvm::MemoryBufferRef(
+        llvm::StringRef(Object.data(), Object.size()), Names.back()));
+  }
+
+  const auto Kind = llvm::Triple(M.getTargetTriple()).isOSDarwin()
+                        ? llvm::object::Archive::K_DARWIN
+                        : llvm::object::Archive::K_GNU;
+  if (auto Err = llvm::writeArchive(Filename, Members, /*WriteSymtab=*/true,
+                                    Kind, /*Deterministic=*/true,
+                                    /*Thin=*/false))
+    return makeError("Could not write " + Filename + ": " +
+                     llvm::toString(std::move(Err)));
+  return llvm::Error::success();
+}
+
+/// Link the compiled partitions of a module into a shared library with the
+/// system C compiler.
+static llvm::Error linkSharedLibrary(llvm::StringRef Filename,
+                                     llvm::ArrayRef<Partition> Partitions) {
+  auto CC = llvm::sys::findProgramByName("cc");
+  if (!CC)
+    return makeError("Could not find a C compiler to link " + Filename +
+                     " with: " + CC.getError().message());
+
+  std::vector<llvm::SmallString<128>> Paths(Partitions.size());
+  std::string ErrMsg;
+  for (std::size_t I = 0; I < Partitions.size() && ErrMsg.empty(); I++) {
+    int FD;
+    if (auto EC = llvm::sys::fs::createTemporaryFile("kaleidoscope", "o", FD,
+                                                      Paths[I])) {
+      ErrMsg = EC.message();
+      break;
+    }
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS.write(Partitions[I].Object.data(), Partitions[I].Object.size());
+    OS.close();
+    if (OS.has_error()) {
+      ErrMsg = OS.error().message();
+      OS.clear_error();
+    }
+  }
+
+  int Status = -1;
+  if (ErrMsg.empty()) {
+    std::vector<llvm::StringRef> Args{*CC, "-shared", "-o", Filename};
+    for (const auto &Path : Paths)
+      Args.push_back(Path);
+    Status = llvm::sys::ExecuteAndWait(*CC, Args, llvm::None, {}, 0, 0,
+                                       &ErrMsg);
+    if (Status > 0 && ErrMsg.empty())
+      ErrMsg = *CC + " exited with status " + std::to_string(Status);
+  }
+
+  for (const auto &Path : Paths)
+    if (!Path.empty())
+      llvm::sys::fs::remove(Path);
+
+  if (Status != 0)
+    return makeError("Could not link " + Filename + ": " + ErrMsg);
+  return llvm::Error::success();
+}
+
+llvm::Error writeObjectCode(llvm::Module &M, llvm::StringRef Filename,
+                            TargetMachineFactory CreateTargetMachine,
+                            unsigned NumThreads) {
+  const auto Kind = getOutputKind(Filename);
+  if (Kind != OutputKind::Archive && Kind != OutputKind::SharedLibrary) {
+    auto TM = CreateTargetMachine(llvm::None);
+    if (!TM)
+      return makeError("Could not create a target machine");
+
+    std::error_code EC;
+    llvm::raw_fd_ostream Dest(Filename, EC,
+                              Kind == OutputKind::Assembly ||
+                                      Kind == OutputKind::IR
+                                  ? llvm::sys::fs::OF_Text
+                                  : llvm::sys::fs::OF_None);
+    if (EC)
+      return makeError("Could not open " + Filename + ": " + EC.message());
+
+    // Nothing was optimized while the session was running, so optimize the
+    // whole module at once, which also gets calls inlined. IR is optimized
+    // the way clang optimizes it for ThinLTO instead, since the link gets to
+    // inline and optimize it once more together with the rest of the program.
+    Optimizer ModuleOptimizer(getOptimizationLevel(), TM.get());
+    if (Kind == OutputKind::Bitcode || Kind == OutputKind::IR) {
+      ModuleOptimizer.runThinLTOPreLink(M);
+      emitIR(M, Kind, Dest);
+    } else {
+      ModuleOptimizer.runOnModule(M);
+      if (auto Err = emitObject(M, *TM, Dest,
+                                Kind == OutputKind::Assembly
+                                    ? llvm::CGFT_AssemblyFile
+                                    : llvm::CGFT_ObjectFile))
+        return Err;
+    }
+
+    // The stream only reports a failed write, such as on a full disk, once
+    // everything has been flushed to the file.
+    Dest.close();
+    if (Dest.has_error()) {
+      const auto Message = Dest.error().message();
+      Dest.clear_error();
+      return makeError("Could not write " + Filename + ": " + Message);
+    }
+    return llvm::Error::success();
+  }
+
+  auto Partitions = splitModule(M, NumThreads);
+  // A shared library has to be position independent.
+  llvm::Optional<llvm::Reloc::Model> RM;
+  if (Kind == OutputKind::SharedLibrary)
+    RM = llvm::Reloc::PIC_;
+
+  llvm::ThreadPool Pool(llvm::hardware_concurrency(Partitions.size()));
+  for (auto &P : Partitions)
+    Pool.async([&P, CreateTargetMachine, RM] {
+      if (auto Err = compilePartition(P, CreateTargetMachine, RM))
+        P.Error = llvm::toString(std::move(Err));
+    });
+  Pool.wait();
+
+  for (const auto &P : Partitions)
+    if (!P.Error.empty())
+      return makeError(P.Error);
+
+  if (Kind == OutputKind::Archive)
+    return writeArchive(Filename, M, Partitions);
+  return linkSharedLibrary(Filename, Partitions);
+}
@@ -1,26 +1,47 @@
 #include <sstream>       // std::ostringstream
 #include <unordered_map> // std::unordered_map
+#include <utility>       // std::pair
+#include <vector>        // std::vector
 
+#include <llvm/ADT/Optional.h>    // llvm::Optional
+#include <llvm/ADT/SmallVector.h> // llvm::SmallVector
+
+#include "fold.h"
 #include "lexer.h"
 #include "parser.h"
+#include "stats.h"
+#include "tiering.h"
 #include "util.h"
 
+#include "ASTArena.h"
+#include "CompilationContext.h"
+#include "FlatAST.h"
+
+#include "ArrayExprAST.h"
 #include "BinaryExprAST.h"
 #include "CallExprAST.h"
 #include "ExprAST.h"
 #include "ForExprAST.h"
 #include "IfExprAST.h"
+#include "IndexExprAST.h"
 #include "LetExprAST.h"
 #include "NumberExprAST.h"
+#include "ParallelForExprAST.h"
 #include "UnaryExprAST.h"
 #include "VariableExprAST.h"
 
-// This holds the precedence for each binary operator that is defined
-static std::unordered_map<char, int> BinopPrecedence;
+// The precedence table and the arena of the parser belong to the current
+// CompilationContext of the calling thread.
+
+/// Get the precedence of each binary operator that is defined.
+static std::unordered_map<char, int> &getBinopPrecedence() {
+  return CompilationContext::getCurrent().BinopPrecedence;
+}
 
 /// Update the internal binary operator precedence table with the appropriate
 /// values.
 void SetupBinopPrecedences() {
+  auto &BinopPrecedence = getBinopPrecedence();
   // Create the binary operators, specifying their precedences.
   // The lower the number, the lower the precedence.
   // TODO: Add more binary operators
@@ -35,24 +56,218 @@ void SetupBinopPrecedences() {
 
 /// Add a new binary operator with the given precedence.
 int InstallBinopPrecedence(const char Op, const int Precedence) {
-  return BinopPrecedence[Op] = Precedence;
+  return getBinopPrecedence()[Op] = Precedence;
 }
 
 bool UninstallBinopPrecedence(const char Op) {
-  return BinopPrecedence.erase(Op);
+  return getBinopPrecedence().erase(Op);
 }
 
+/// Get the arena to make nodes in, making one if no top-level item has
+/// started yet.
+static ASTArena &getArena() {
+  auto &Arena = CompilationContext::getCurrent().Arena;
+  if (!Arena)
+    Arena = std::make_unique<ASTArena>();
+  return *Arena;
+}
+
+// The grammar below is written once for both representations of a function
+// body. Each parser takes a builder that makes the nodes: a TreeBuilder makes
+// ExprAST nodes in the current arena, while a FlatAST appends them to its node
+// array. Either way, a builder has the type of node it makes as Expr, and a
+// method making each kind of expression.
+
+namespace {
+/// TreeBuilder - Makes ExprAST nodes in the arena of the top-level item being
+/// parsed.
+struct TreeBuilder {
+  using Expr = ExprAST *;
+
+  /// Whether any array was indexed or declared, which the interpreter needs
+  /// to know about.
+  bool UsesArrays = false;
+
+  Expr number(double Val) { return getArena().make<NumberExprAST>(Val); }
+
+  Expr variable(Symbol Name) {
+    return getArena().make<VariableExprAST>(Name);
+  }
+
+  Expr unary(char Op, Expr Operand) {
+    return getArena().make<UnaryExprAST>(Op, Operand);
+  }
+
+  Expr binary(char Op, Expr LHS, Expr RHS) {
+    return getArena().make<BinaryExprAST>(Op, LHS, RHS);
+  }
+
+  Expr call(Symbol Callee, llvm::ArrayRef<Expr> Args) {
+    auto &NodeArena = getArena();
+    return NodeArena.make<CallExprAST>(Callee, NodeArena.copy(Args));
+  }
+
+  Expr ifExpr(Expr Cond, Expr Then, Expr Else) {
+    return getArena().make<IfExprAST>(Cond, Then, Else);
+  }
+
+  Expr forExpr(Symbol VarName, Expr Start, Expr End, Expr Step, Expr Body) {
+    return getArena().make<ForExprAST>(VarName, Start, End, Step, Body);
+  }
+
+  Expr parallelFor(Symbol VarName, Expr Start, Expr Bound, Expr Step,
+                   Expr Body) {
+    return getArena().make<ParallelForExprAST>(VarName, Start, Bound, Step,
+                                               Body);
+  }
+
+  Expr let(std::vector<std::pair<Symbol, Expr>> VarNames, Expr Body) {
+    return getArena().make<LetExprAST>(std::move(VarNames), Body);
+  }
+
+  Expr index(Symbol Array, Expr Index) {
+    UsesArrays = true;
+    return getArena().make<IndexExprAST>(Array, Index);
+  }
+
+  Expr array(Expr Size) {
+    UsesArrays = true;
+    return getArena().make<ArrayExprAST>(Size);
+  }
+
+  llvm::Optional<double> getNumber(Expr E) const {
+    if (const auto *Number = dynamic_cast<const NumberExprAST *>(E))
+      return Number->getValue();
+    return llvm::None;
+  }
+};
+
+/// ConstantFolder - Makes nodes with another builder, folding the ones whose
+/// value is already known into numbers if constant folding is enabled. Along
+/// the way, it works out whether the function being parsed is pure and
+/// whether it is constant, see FunctionAST::isConstant.
+template <typename Inner> struct ConstantFolder {
+  using Expr = typename Inner::Expr;
+
+  Inner &B;
+  /// The function being parsed, which does not become impure by calling
+  /// itself, or the empty name for a top-level expression.
+  Symbol Self;
+  bool Pure = true;
+  /// Whether no variable has been referred to or declared.
+  bool Closed = true;
+
+  ConstantFolder(Inner &B, Symbol Self = Symbol()) : B(B), Self(Self) {}
+
+  /// Whether the function being parsed is pure and refers to no variables.
+  bool isConstant() const { return Pure && Closed; }
+
+  Expr number(double Val) { return B.number(Val); }
+
+  Expr variable(Symbol Name) {
+    Closed = false;
+    return B.variable(Name);
+  }
+
+  Expr unary(char Op, Expr Operand) {
+    calls(Symbol::unaryOperator(Op), 1);
+    return B.unary(Op, Operand);
+  }
+
+  Expr binary(char Op, Expr LHS, Expr RHS) {
+    if (isConstantFoldingEnabled()) {
+      const auto L = B.getNumber(LHS), R = B.getNumber(RHS);
+      if (L && R)
+        if (auto Result = evaluateBuiltinOperator(Op, *L, *R))
+          return B.number(*Result);
+    }
+    // Assignment is built in too, but it always refers to a variable.
+    if (!evaluateBuiltinOperator(Op, 0, 0) && Op != '=')
+      calls(Symbol::binaryOperator(Op), 2);
+    return B.binary(Op, LHS, RHS);
+  }
+
+  Expr call(Symbol Callee, llvm::ArrayRef<Expr> Args) {
+    calls(Callee, Args.size());
+    return B.call(Callee, Args);
+  }
+
+  Expr ifExpr(Expr Cond, Expr Then, Expr Else) {
+    if (isConstantFoldingEnabled())
+      if (auto CondV = B.getNumber(Cond))
+        return isTrue(*CondV) ? Then : Else;
+    return B.ifExpr(Cond, Then, Else);
+  }
+
+  Expr forExpr(Symbol VarName, Expr Start, Expr End, Expr Step, Expr Body) {
+    Closed = false;
+    return B.forExpr(VarName, Start, End, Step, Body);
+  }
+
+  Expr parallelFor(Symbol VarName, Expr Start, Expr Bound, Expr Step,
+                   Expr Body) {
+    Closed = false;
+    return B.parallelFor(VarName, Start, Bound, Step, Body);
+  }
+
+  Expr let(std::vector<std::pair<Symbol, Expr>> VarNames, Expr Body) {
+    Closed = false;
+    return B.let(std::move(VarNames), Body);
+  }
+
+  Expr index(Symbol Array, Expr Index) {
+    Closed = false;
+    return B.index(Array, Index);
+  }
+
+  Expr array(Expr Size) {
+    Closed = false;
+    return B.array(Size);
+  }
+
+private:
+  /// Take note of a call, which keeps the function pure only if the callee
+  /// is pure, and keeps it constant only if the interpreter can make the call
+  /// while parsing.
+  void calls(Symbol Callee, std::size_t NumArgs) {
+    if (Callee == Self)
+      return;
+    if (!isPureFunction(Callee)) {
+      Pure = false;
+      return;
+    }
+    const auto &Protos = CompilationContext::getCurrent().FunctionProtos;
+    const auto Proto = Protos.find(Callee);
+    if (Proto == Protos.end() || Proto->second->getArgs().size() != NumArgs ||
+        NumArgs > MaxNativeArgs || Proto->second->hasArrayArgs())
+      Closed = false;
+  }
+};
+} // namespace
+
+template <typename Builder>
+static typename Builder::Expr ParseExpression(Builder &B);
+template <typename Builder>
+static typename Builder::Expr ParseIfExpr(Builder &B);
+template <typename Builder>
+static typename Builder::Expr ParseForExpr(Builder &B, bool Parallel = false);
+template <typename Builder>
+static typename Builder::Expr ParseParallelForExpr(Builder &B);
+
 /// numberexpr ::= number
-std::unique_ptr<ExprAST> ParseNumberExpr() {
-  auto Result = std::make_unique<NumberExprAST>(getNumVal());
+template <typename Builder>
+static typename Builder::Expr ParseNumberExpr(Builder &B) {
+  auto Result = B.number(getNumVal());
   getNextToken(); // consume the number
-  return std::move(Result);
+  return Result;
 }
 
 /// parenexpr ::= '(' expression  ')'
-std::unique_ptr<ExprAST> ParseParenExpr() {
-  getNextToken();             // consume '('
-  auto V = ParseExpression(); // the 'expression' part in our production above
+template <typename Builder>
+static typename Builder::Expr ParseParenExpr(Builder &B) {
+  getNextToken(); // consume '('
+  // the 'expression' part in our production above
+  auto V = ParseExpression(B);
   if (!V)
     return nullptr; // we did not find an expression, just an (
 
@@ -62,26 +277,48 @@ std::unique_ptr<ExprAST> ParseParenExpr() {
   return V;
 }
 
+/// Parse the expression between the brackets of "a[expression]", which is
+/// either an element of an array or the size of an array being declared.
+template <typename Builder>
+static typename Builder::Expr ParseBracketExpr(Builder &B) {
+  getNextToken(); // Consume the '['
+  auto V = ParseExpression(B);
+  if (!V)
+    return nullptr;
+
+  if (getCurrentToken() != ']')
+    return LogError("expected ']'");
+  getNextToken(); // Consume the ']'
+  return V;
+}
+
 /// identifier
 ///   ::= identifier                      Variable references.
+///   ::= identifier '[' expression ']'   Elements of arrays.
 ///   ::= identifier '(' expression ')'   Function calls.
-std::unique_ptr<ExprAST> ParseIdentifierExpr() {
-  const std::string IdName = getIdentifierStr();
+template <typename Builder>
+static typename Builder::Expr ParseIdentifierExpr(Builder &B) {
+  const Symbol IdName = getIdentifierSymbol();
 
   getNextToken(); // Consume the identififer
 
+  if (getCurrentToken() == '[') {
+    auto Index = ParseBracketExpr(B);
+    return Index ? B.index(IdName, Index) : nullptr;
+  }
+
   if (getCurrentToken() != '(') {
     // This is a variable reference, not a function call
-    return std::make_unique<VariableExprAST>(IdName);
+    return B.variable(IdName);
   }
 
   // Otherwise, this is a function call
   getNextToken(); // Consume the '('
-  std::vector<std::unique_ptr<ExprAST>> Args;
+  llvm::SmallVector<typename Builder::Expr, 8> Args;
   if (getCurrentToken() != ')') {
     loop {
-      if (auto Arg = ParseExpression())
-        Args.push_back(std::move(Arg));
+      if (auto Arg = ParseExpression(B))
+        Args.push_back(Arg);
       else
         return nullptr; // Expected an expression
 
@@ -96,15 +333,17 @@ std::unique_ptr<ExprAST> ParseIdentifierExpr() {
 
   getNextToken(); // Consume the ')'
 
-  return std::make_unique<CallExprAST>(IdName, std::move(Args));
+  return B.call(IdName, Args);
 }
 
-/// letexpr ::= 'let' identifier ('=' expression)?
-///         (',' identifier ('=' expression)?)* 'in' expression
-std::unique_ptr<ExprAST> ParseLetExpr() {
+/// letexpr ::= 'let' binding (',' binding)* 'in' expression
+/// binding ::= identifier ('=' expression)?
+///         ::= identifier '[' expression ']'   Arrays, with their size.
+template <typename Builder>
+static typename Builder::Expr ParseLetExpr(Builder &B) {
   getNextToken(); // Consume the "let" token.
 
-  std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+  std::vector<std::pair<Symbol, typename Builder::Expr>> VarNames;
   int curtok;
 
   // At least one variable name is required.
@@ -117,20 +356,25 @@ std::unique_ptr<ExprAST> ParseLetExpr() {
   }
 
   loop {
-    const std::string VarName = getIdentifierStr();
+    const Symbol VarName = getIdentifierSymbol();
     getNextToken(); // Consume the identifier we just read.
 
-    // Read the optional initializer
-    std::unique_ptr<ExprAST> InitialValue;
-    if ((curtok = getCurrentToken()) == '=') {
+    // Read the optional initializer, or the size of an array
+    typename Builder::Expr InitialValue = nullptr;
+    if ((curtok = getCurrentToken()) == '[') {
+      auto Size = ParseBracketExpr(B);
+      if (!Size)
+        return nullptr;
+      InitialValue = B.array(Size);
+    } else if (curtok == '=') {
       getNextToken(); // Consume the '='.
 
-      InitialValue = ParseExpression();
+      InitialValue = ParseExpression(B);
       if (!InitialValue)
         return nullptr;
     }
 
-    VarNames.push_back(std::make_pair(VarName, std::move(InitialValue)));
+    VarNames.push_back(std::make_pair(VarName, InitialValue));
 
     // Break if there are no more variables being declared.
     if ((curtok = getCurrentToken()) != ',')
@@ -157,11 +401,11 @@ std::unique_ptr<ExprAST> ParseLetExpr() {
   }
   getNextToken(); // Consume the 'in' keyword.
 
-  auto Body = ParseExpression();
+  auto Body = ParseExpression(B);
   if (!Body)
     return nullptr;
 
-  return std::make_unique<LetExprAST>(std::move(VarNames), std::move(Body));
+  return B.let(std::move(VarNames), Body);
 }
 
 /// primary
@@ -170,22 +414,27 @@ std::unique_ptr<ExprAST> ParseLetExpr() {
 ///   ::= parenexpr
 ///   ::= ifexpr
 ///   ::= forexpr
+///   ::= parallelforexpr
 ///   ::= varexpr
 /// Determine the type of expression we are parsing.
-std::unique_ptr<ExprAST> ParsePrimary() {
+template <typename Builder>
+static typename Builder::Expr ParsePrimary(Builder &B) {
   switch (int curtok = getCurrentToken()) {
   case tok_identifier:
-    return ParseIdentifierExpr();
+    return ParseIdentifierExpr(B);
   case tok_number:
-    return ParseNumberExpr();
+    return ParseNumberExpr(B);
   case '(':
-    return ParseParenExpr(); // An expression arbitrarily wrapped in parentheses
+    // An expression arbitrarily wrapped in parentheses
+    return ParseParenExpr(B);
   case tok_if:
-    return ParseIfExpr();
+    return ParseIfExpr(B);
   case tok_for:
-    return ParseForExpr();
+    return ParseForExpr(B);
+  case tok_parallel:
+    return ParseParallelForExpr(B);
   case tok_let:
-    return ParseLetExpr();
+    return ParseLetExpr(B);
   default: {
     std::ostringstream errMsg(tokenToString(static_cast<Token>(curtok)),
                               std::ios_base::ate);
@@ -201,7 +450,7 @@ int GetTokPrecedence() {
   if (!isascii(CurTok))
     return -1;
 
-  const int TokPrec = BinopPrecedence[CurTok];
+  const int TokPrec = getBinopPrecedence()[CurTok];
   // Ensure the pending binary operator token is a recognized binary operator
   return TokPrec <= 0 ? -1 : TokPrec;
 }
@@ -209,13 +458,14 @@ int GetTokPrecedence() {
 /// unary
 ///		::= primary
 ///		::= '!' unary
-std::unique_ptr<ExprAST> ParseUnary() {
+template <typename Builder>
+static typename Builder::Expr ParseUnary(Builder &B) {
   const int CurTok = getCurrentToken();
   // If CurTok is NOT an ASCII character, assuming an ASCII or UTF-8 encoding
   // (or is an ( or ,), then this is a primary expression and not a unary
   // operator.
   if (!isascii(CurTok) || CurTok == '(' || CurTok == ',')
-    return ParsePrimary();
+    return ParsePrimary(B);
 
   // Otherwise, this is a unary operator
   int Opcode = CurTok;
@@ -223,15 +473,16 @@ std::unique_ptr<ExprAST> ParseUnary() {
   // Notice we call ParseUnary again... we keep doing this until the thing to be
   // parsed can't be parsed as a unary operator. This way, we handle multiple
   // back-to-back unary operators like double negation
-  if (auto Operand = ParseUnary())
-    return std::make_unique<UnaryExprAST>(Opcode, std::move(Operand));
+  if (auto Operand = ParseUnary(B))
+    return B.unary(Opcode, Operand);
   return nullptr;
 }
 
 /// binoprhs
 ///   ::= ('+' unary)*
-std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
-                                       std::unique_ptr<ExprAST> LHS) {
+template <typename Builder>
+static typename Builder::Expr
+ParseBinOpRHS(Builder &B, int ExprPrec, typename Builder::Expr LHS) {
   // If this is a binary operator, find its precedence
   loop {
     int TokPrec = GetTokPrecedence();
@@ -250,7 +501,7 @@ std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
     // Parse the unary expression after the binary operator.
     // (If there is no unary operator, then this just parses
     // as a primary expression)
-    auto RHS = ParseUnary();
+    auto RHS = ParseUnary(B);
     if (!RHS)
       return nullptr;
 
@@ -259,32 +510,35 @@ std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
     // binary operator.
     int NextPrec = GetTokPrecedence();
     if (TokPrec < NextPrec) {
-      RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
+      RHS = ParseBinOpRHS(B, TokPrec + 1, RHS);
       if (!RHS)
         return nullptr;
     }
 
     // Otherwise, the current binary operator takes precedence, so let's build
     // an AST node containing the current binary operator and its operands.
-    LHS =
-        std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
+    LHS = B.binary(BinOp, LHS, RHS);
   } // Loop back to the top, looking for more binary operators until there are
     // no more expressions to parse.
 }
 
 /// expression
 ///   ::= unary binoprhs
-std::unique_ptr<ExprAST> ParseExpression() {
-  auto LHS = ParseUnary();
+template <typename Builder>
+static typename Builder::Expr ParseExpression(Builder &B) {
+  auto LHS = ParseUnary(B);
   // Attempt to parse an expression; if it is successfull (a valid token)
   // then parse a potential RHS in case it is a binary operator
-  return LHS ? ParseBinOpRHS(0, std::move(LHS)) : nullptr;
+  return LHS ? ParseBinOpRHS(B, 0, LHS) : nullptr;
 }
 
 /// prototype
-///   ::= id '(' id* ')'
+///   ::= id '(' param* ')'
 ///   ::= binary LETTER number? (id, id)
-std::unique_ptr<PrototypeAST> ParsePrototype() {
+/// param
+///   ::= id
+///   ::= id '[' ']'   Array parameters.
+std::unique_ptr<PrototypeAST> ParsePrototype(bool IsExtern) {
   std::string FnName;
 
   enum { identifier, unary, binary } Kind;
@@ -344,10 +598,25 @@ std::unique_ptr<PrototypeAST> ParsePrototype() {
     return LogErrorP(errMsg.str().c_str());
   }
 
-  // Read the list of argument names.
+  // Read the list of argument names, and which of the arguments are arrays.
   std::vector<std::string> ArgNames;
-  while (getNextToken() == tok_identifier)
+  std::vector<bool> ArrayArgs;
+  bool HasArrayArgs = false;
+  getNextToken(); // Eat the '('
+  while (getCurrentToken() == tok_identifier) {
     ArgNames.push_back(getIdentifierStr());
+    ArrayArgs.push_back(false);
+    if (getNextToken() != '[')
+      continue;
+    if (getNextToken() != ']') {
+      std::ostringstream errMsg("Expected ']' in prototype but found ",
+                                std::ios_base::ate);
+      errMsg << tokenToString(static_cast<Token>(getCurrentToken()));
+      return LogErrorP(errMsg.str().c_str());
+    }
+    ArrayArgs.back() = HasArrayArgs = true;
+    getNextToken(); // Eat the ']'
+  }
   if (getCurrentToken() != ')') {
     std::ostringstream errMsg("Expected ')' in prototype but found ");
     errMsg << tokenToString(static_cast<Token>(getCurrentToken()));
@@ -364,35 +633,72 @@ std::unique_ptr<PrototypeAST> ParsePrototype() {
     errMsg << FnName << ": expected " << Kind << " but got " << ArgNames.size();
     return LogErrorP(errMsg.str().c_str());
   }
+  if (Kind && HasArrayArgs) {
+    std::ostringstream errMsg("Operands of operators cannot be arrays: ",
+                              std::ios_base::ate);
+    errMsg << FnName;
+    return LogErrorP(errMsg.str().c_str());
+  }
 
+  if (!HasArrayArgs)
+    ArrayArgs.clear();
   return std::make_unique<PrototypeAST>(FnName, std::move(ArgNames), Kind != 0,
-                                        BinaryPrecedence);
+                                        BinaryPrecedence, std::move(ArrayArgs),
+                                        IsExtern);
 }
 
 /// definition ::= 'def' prototype expression
 std::unique_ptr<FunctionAST> ParseDefinition() {
+  PhaseRegion Region(Phase::Parse);
   getNextToken(); // eat the 'def' keyword
   auto Proto = ParsePrototype();
   if (!Proto)
     return nullptr;
 
-  if (auto E = ParseExpression())
-    return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
+  // Start a new arena for the body, dropping whatever an earlier item that
+  // failed to parse left behind.
+  auto &Arena = CompilationContext::getCurrent().Arena;
+  Arena = std::make_unique<ASTArena>();
+  TreeBuilder Tree;
+  ConstantFolder<TreeBuilder> B(Tree, Proto->getSymbol());
+  if (auto E = ParseExpression(B))
+    return std::make_unique<FunctionAST>(std::move(Proto), E, std::move(Arena),
+                                         Tree.UsesArrays, B.Pure,
+                                         B.isConstant());
   return nullptr;
 }
 
+/// definition ::= 'def' prototype expression
+std::unique_ptr<FlatAST> ParseDefinitionFlat() {
+  PhaseRegion Region(Phase::Parse);
+  getNextToken(); // eat the 'def' keyword
+  auto Proto = ParsePrototype();
+  if (!Proto)
+    return nullptr;
+
+  auto Definition = std::make_unique<FlatAST>();
+  ConstantFolder<FlatAST> B(*Definition, Proto->getSymbol());
+  auto E = ParseExpression(B);
+  if (!E)
+    return nullptr;
+  Definition->define(std::move(Proto), E, B.Pure, B.isConstant());
+  return Definition;
+}
+
 /// external ::= 'extern' prototype
 std::unique_ptr<PrototypeAST> ParseExtern() {
+  PhaseRegion Region(Phase::Parse);
   getNextToken(); // eat the 'extern' keyword
-  return ParsePrototype();
+  return ParsePrototype(/* IsExtern */ true);
 }
 
 /// ifexpr ::= 'if' expression 'then' expression 'else' expression
-std::unique_ptr<ExprAST> ParseIfExpr() {
+template <typename Builder>
+static typename Builder::Expr ParseIfExpr(Builder &B) {
   getNextToken(); // Assume CurTok is tok_if and consume it
 
   // <cond>
-  auto Cond = ParseExpression();
+  auto Cond = ParseExpression(B);
   if (!Cond)
     return nullptr;
 
@@ -405,7 +711,7 @@ std::unique_ptr<ExprAST> ParseIfExpr() {
   getNextToken(); // Consume 'then'
 
   // <then>
-  auto Then = ParseExpression();
+  auto Then = ParseExpression(B);
   if (!Then)
     return nullptr;
 
@@ -418,18 +724,21 @@ std::unique_ptr<ExprAST> ParseIfExpr() {
   getNextToken(); // Consume 'else'
 
   // <else>
-  auto Else = ParseExpression();
+  auto Else = ParseExpression(B);
   if (!Else)
     return nullptr;
 
-  return std::make_unique<IfExprAST>(std::move(Cond), std::move(Then),
-                                     std::move(Else));
+  return B.ifExpr(Cond, Then, Else);
 }
 
 /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
 /// the (',' expr)? is for the optional step which is assumed to be 1 if not
 /// included
-std::unique_ptr<ExprAST> ParseForExpr() {
+///
+/// The loop of a parallelforexpr has to have a condition of the form
+/// identifier '<' expr, whose expr is the bound.
+template <typename Builder>
+static typename Builder::Expr ParseForExpr(Builder &B, bool Parallel) {
   // Assume the current token is the "for" keyword and consume it
   getNextToken();
 
@@ -441,7 +750,7 @@ std::unique_ptr<ExprAST> ParseForExpr() {
     return LogError(errMsg.str().c_str());
   }
 
-  std::string IdName = getIdentifierStr();
+  const Symbol IdName = getIdentifierSymbol();
   getNextToken(); // Consume the identifier
 
   if (getCurrentToken() != '=') {
@@ -454,7 +763,7 @@ std::unique_ptr<ExprAST> ParseForExpr() {
 
   getNextToken(); // Consume '='
 
-  auto Start = ParseExpression();
+  auto Start = ParseExpression(B);
   if (!Start)
     return nullptr;
 
@@ -468,16 +777,44 @@ std::unique_ptr<ExprAST> ParseForExpr() {
 
   getNextToken(); // Consume ','
 
-  auto End = ParseExpression();
+  typename Builder::Expr End = nullptr;
+  if (Parallel) {
+    // Parse the bound the same way it would be parsed as the right-hand side
+    // of the '<', which is everything that binds tighter than it does.
+    if (getCurrentToken() != tok_identifier ||
+        getIdentifierSymbol() != IdName) {
+      std::ostringstream errMsg("Expected '", std::ios_base::ate);
+      errMsg << IdName.str().str()
+             << " <' after parallel for initializer, but instead got:\n\t"
+             << tokenToString(static_cast<Token>(getCurrentToken()));
+      return LogError(errMsg.str().c_str());
+    }
+    getNextToken(); // Consume the identifier
+    if (getCurrentToken() != '<') {
+      std::ostringstream errMsg("Expected '<' after '", std::ios_base::ate);
+      errMsg << IdName.str().str()
+             << "' in parallel for condition, but instead got:\n\t"
+             << tokenToString(static_cast<Token>(getCurrentToken()));
+      return LogError(errMsg.str().c_str());
+    }
+    const int Precedence = GetTokPrecedence();
+    getNextToken(); // Consume '<'
+    auto LHS = ParseUnary(B);
+    if (!LHS)
+      return nullptr;
+    End = ParseBinOpRHS(B, Precedence + 1, LHS);
+  } else {
+    End = ParseExpression(B);
+  }
   if (!End)
     return nullptr;
 
   // The 'step' value is optional. Will assume 1 in the emitting of
   // LLVM IR if not provided
-  std::unique_ptr<ExprAST> Step;
+  typename Builder::Expr Step = nullptr;
   if (getCurrentToken() == ',') {
     getNextToken(); // Consume ','
-    Step = ParseExpression();
+    Step = ParseExpression(B);
     if (!Step)
       return nullptr;
   }
@@ -492,21 +829,110 @@ std::unique_ptr<ExprAST> ParseForExpr() {
 
   getNextToken(); // Consume 'in'
 
-  auto Body = ParseExpression();
+  auto Body = ParseExpression(B);
   if (!Body)
     return nullptr;
 
-  return std::make_unique<ForExprAST>(IdName, std::move(Start), std::move(End),
-                                      std::move(Step), std::move(Body));
+  if (Parallel)
+    return B.parallelFor(IdName, Start, End, Step, Body);
+  return B.forExpr(IdName, Start, End, Step, Body);
+}
+
+/// parallelforexpr ::= 'parallel' forexpr
+template <typename Builder>
+static typename Builder::Expr ParseParallelForExpr(Builder &B) {
+  getNextToken(); // Consume 'parallel'
+  if (getCurrentToken() != tok_for) {
+    std::ostringstream errMsg(
+        "Expected 'for' after 'parallel' keyword, but instead got:\n\t",
+        std::ios_base::ate);
+    errMsg << tokenToString(static_cast<Token>(getCurrentToken()));
+    return LogError(errMsg.str().c_str());
+  }
+  return ParseForExpr(B, /* Parallel */ true);
 }
 
 /// toplevelexpr ::= expression
-std::unique_ptr<FunctionAST> ParseTopLevelExpr() {
-  if (auto E = ParseExpression()) {
+std::unique_ptr<FunctionAST> ParseTopLevelExpr(const std::string &Name) {
+  PhaseRegion Region(Phase::Parse);
+  auto &Arena = CompilationContext::getCurrent().Arena;
+  Arena = std::make_unique<ASTArena>();
+  TreeBuilder Tree;
+  ConstantFolder<TreeBuilder> B(Tree);
+  if (auto E = ParseExpression(B)) {
     // Make an anonymous function prototype.
-    auto Proto = std::make_unique<PrototypeAST>("__anon_expr",
-                                                std::vector<std::string>());
-    return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
+    auto Proto =
+        std::make_unique<PrototypeAST>(Name, std::vector<std::string>());
+    return std::make_unique<FunctionAST>(std::move(Proto), E, std::move(Arena),
+                                         Tree.UsesArrays, B.Pure,
+                                         B.isConstant());
   }
   return nullptr;
 }
+
+/// toplevelexpr ::= expression
+std::unique_ptr<FlatAST> ParseTopLevelExprFlat(const std::string &Name) {
+  PhaseRegion Region(Phase::Parse);
+  auto Definition = std::make_unique<FlatAST>();
+  ConstantFolder<FlatAST> B(*Definition);
+  auto E = ParseExpression(B);
+  if (!E)
+    return nullptr;
+  // Make an anonymous function prototype.
+  Definition->define(
+      std::make_unique<PrototypeAST>(Name, std::vector<std::string>()), E,
+      B.Pure, B.isConstant());
+  return Definition;
+}
+
+// The expression parsers that make ExprAST nodes.
+
+ExprAST *ParseNumberExpr() {
+  TreeBuilder B;
+  return ParseNumberExpr(B);
+}
+
+ExprAST *ParseParenExpr() {
+  TreeBuilder B;
+  return ParseParenExpr(B);
+}
+
+ExprAST *ParseIdentifierExpr() {
+  TreeBuilder B;
+  return ParseIdentifierExpr(B);
+}
+
+ExprAST *ParseLetExpr() {
+  TreeBuilder B;
+  return ParseLetExpr(B);
+}
+
+ExprAST *ParsePrimary() {
+  TreeBuilder B;
+  return ParsePrimary(B);
+}
+
+ExprAST *ParseUnary() {
+  TreeBuilder B;
+  return ParseUnary(B);
+}
+
+ExprAST *ParseBinOpRHS(int ExprPrec, ExprAST *LHS) {
+  TreeBuilder B;
+  return ParseBinOpRHS(B, ExprPrec, LHS);
+}
+
+ExprAST *ParseExpression() {
+  TreeBuilder B;
+  return ParseExpression(B);
+}
+
+ExprAST *ParseIfExpr() {
+  TreeBuilder B;
+  return ParseIfExpr(B);
+}
+
+ExprAST *ParseForExpr() {
+  TreeBuilder B;
+  return ParseForExpr(B);
+}
@@ -0,0 +1,124 @@
+#include <llvm/IR/Constants.h>    // llvm::ConstantExpr
+#include <llvm/IR/IRBuilder.h>    // llvm::IRBuilder
+#include <llvm/IR/Instructions.h> // llvm::AtomicRMWInst, llvm::BranchInst, llvm::CallInst
+#include <llvm/IR/MDBuilder.h>    // llvm::MDBuilder
+
+#include <algorithm> // std::max
+#include <cstdint>   // std::uintptr_t, UINT32_MAX
+#include <vector>    // std::vector
+
+#include "profile.h"
+
+namespace {
+/// The instructions of a function that get counted, in the order they appear.
+struct CountedInstructions {
+  std::vector<llvm::BranchInst *> Branches;
+  std::vector<llvm::CallInst *> Calls;
+};
+} // namespace
+
+/// Find the conditional branches and calls of a function. Calls to intrinsics
+/// are left out, since they are not real calls.
+static CountedInstructions findCountedInstructions(llvm::Function &F) {
+  CountedInstructions Counted;
+  for (auto &BB : F)
+    for (auto &I : BB) {
+      if (auto *Branch = llvm::dyn_cast<llvm::BranchInst>(&I)) {
+        if (Branch->isConditional())
+          Counted.Branches.push_back(Branch);
+      } else if (auto *Call = llvm::dyn_cast<llvm::CallInst>(&I)) {
+        auto *Callee = Call->getCalledFunction();
+        if (!Callee || !Callee->isIntrinsic())
+          Counted.Calls.push_back(Call);
+      }
+    }
+  return Counted;
+}
+
+FunctionProfile::FunctionProfile(unsigned NumBranches, unsigned NumCalls)
+    : Counts(new std::uint64_t[1 + 2 * NumBranches + NumCalls]()),
+      NumBranches(NumBranches), NumCalls(NumCalls) {}
+
+std::uint64_t FunctionProfile::getHotness() const {
+  std::uint64_t Hotness = getEntryCount();
+  for (unsigned I = 1; I <= 2 * NumBranches; I++)
+    Hotness += Counts[I];
+  return Hotness;
+}
+
+std::unique_ptr<FunctionProfile>
+FunctionProfile::instrument(llvm::Function &F) {
+  auto Counted = findCountedInstructions(F);
+  auto Profile = std::make_unique<FunctionProfile>(Counted.Branches.size(),
+                                                   Counted.Calls.size());
+
+  llvm::IRBuilder<> Builder(F.getContext());
+  auto *CounterTy = Builder.getInt64Ty();
+  // The code is only ever run in this process, so it can refer to the
+  // counters by their address. It can run on several threads at once, in a
+  // parallel loop, so the counters are added to atomically; monotonic is
+  // enough since nothing else is ordered by them.
+  unsigned Next = 0;
+  const auto Increment = [&](llvm::Value *By) {
+    auto *Address = llvm::ConstantExpr::getIntToPtr(
+        Builder.getInt64(reinterpret_cast<std::uintptr_t>(
+            &Profile->Counts[Next++])),
+        CounterTy->getPointerTo());
+    Builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, Address, By,
+                            llvm::AtomicOrdering::Monotonic);
+  };
+
+  Builder.SetInsertPoint(&*F.getEntryBlock().getFirstInsertionPt());
+  Increment(Builder.getInt64(1));
+  for (auto *Branch : Counted.Branches) {
+    Builder.SetInsertPoint(Branch);
+    auto *Taken = Builder.CreateZExt(Branch->getCondition(), CounterTy);
+    Increment(Taken);
+    Increment(Builder.CreateSub(Builder.getInt64(1), Taken));
+  }
+  for (auto *Call : Counted.Calls) {
+    Builder.SetInsertPoint(Call);
+    Increment(Builder.getInt64(1));
+  }
+  return Profile;
+}
+
+/// Scale a pair of counts down until both fit into branch weights.
+static llvm::MDNode *createBranchWeights(llvm::LLVMContext &Context,
+                                         std::uint64_t True,
+                                         std::uint64_t False) {
+  const std::uint64_t Scale = std::max(True, False) / UINT32_MAX + 1;
+  return llvm::MDBuilder(Context).createBranchWeights(
+      static_cast<std::uint32_t>(True / Scale),
+      static_cast<std::uint32_t>(False / Scale));
+}
+
+bool FunctionProfile::applyTo(llvm::Function &F) const {
+  auto Counted = findCountedInstructions(F);
+  if (Counted.Branches.size() != NumBranches ||
+      Counted.Calls.size() != NumCalls)
+    return false;
+
+  const auto EntryCount = getEntryCount();
+  F.setEntryCount(EntryCount);
+
+  for (unsigned I = 0; I < NumBranches; I++) {
+    const auto True = Counts[1 + 2 * I], False = Counts[2 + 2 * I];
+    // A branch that never ran says nothing about which way it goes.
+    if (True || False)
+      Counted.Branches[I]->setMetadata(
+          llvm::LLVMContext::MD_prof,
+          createBranchWeights(F.getContext(), True, False));
+  }
+
+  // Calls made on every call of F, or more often from inside a loop, are
+  // worth inlining even when the callee is somewhat big.
+  const auto *CallCounts = &Counts[1 + 2 * NumBranches];
+  for (unsigned I = 0; I < NumCalls; I++) {
+    auto *Callee = Counted.Calls[I]->getCalledFunction();
+    if (Callee && EntryCount && CallCounts[I] >= EntryCount &&
+        !Callee->hasFnAttribute(llvm::Attribute::NoInline))
+      Callee->addFnAttr(llvm::Attribute::InlineHint);
+  }
+  return true;
+}
@@ -0,0 +1,305 @@
+#include <llvm/ADT/DenseMap.h>        // llvm::DenseMap
+#include <llvm/ADT/Twine.h>           // llvm::Twine
+#include <llvm/Support/Alignment.h>   // llvm::Align, llvm::offsetToAlignment
+#include <llvm/Support/FileSystem.h>  // llvm::sys::fs::TempFile
+#include <llvm/Support/MemoryBuffer.h> // llvm::MemoryBuffer, llvm::MemoryBufferRef
+#include <llvm/Support/raw_ostream.h> // llvm::raw_fd_ostream
+
+#include <algorithm> // std::sort
+#include <cstdint>   // std::int32_t, std::uint8_t, std::uint32_t, std::uint64_t
+#include <cstring>   // std::memcpy
+#include <map>       // std::map
+#include <memory>    // std::make_shared, std::shared_ptr, std::unique_ptr
+#include <string>    // std::string
+#include <vector>    // std::vector
+
+#include "dependencies.h" // CompileStaleFunctions, ExportDefinitions, RecordDefinitions
+#include "parser.h"       // InstallBinopPrecedence
+#include "snapshot.h"
+
+#include "CompilationContext.h"
+#include "ExprAST.h"         // getFunctionProtos
+#include "KaleidoscopeJIT.h" // JIT
+
+using llvm::orc::KaleidoscopeJIT;
+
+/// What every snapshot starts with. The number goes up whenever the format
+/// changes.
+static constexpr char Magic[] = "KSNAPSHOT3\n";
+
+/// Object files are aligned to this many bytes from the start of the file,
+/// which keeps their headers aligned once it is mapped.
+static constexpr unsigned ObjectAlignment = 16;
+
+/// The snapshots loaded so far, which the JIT links code straight out of.
+static std::vector<std::unique_ptr<llvm::MemoryBuffer>> LoadedSnapshots;
+
+namespace {
+/// SnapshotWriter - Writes the fields of a snapshot one after the other, in
+/// the byte order of the machine.
+class SnapshotWriter {
+  llvm::raw_ostream &OS;
+
+public:
+  explicit SnapshotWriter(llvm::raw_ostream &OS) : OS(OS) {}
+
+  template <typename T> void write(T Value) {
+    OS.write(reinterpret_cast<const char *>(&Value), sizeof(Value));
+  }
+
+  void writeString(llvm::StringRef S) {
+    write<std::uint32_t>(S.size());
+    OS << S;
+  }
+
+  /// Pad the snapshot up to a multiple of the given number of bytes.
+  void align(unsigned Alignment) {
+    OS.write_zeros(
+        llvm::offsetToAlignment(OS.tell(), llvm::Align(Alignment)));
+  }
+};
+
+/// SnapshotReader - Reads back what a SnapshotWriter wrote, giving zeros
+/// once it runs past the end of the snapshot.
+class SnapshotReader {
+  llvm::StringRef Data;
+  std::size_t Offset = 0;
+  bool Truncated = false;
+
+public:
+  explicit SnapshotReader(llvm::StringRef Data) : Data(Data) {}
+
+  llvm::StringRef readBytes(std::size_t Size) {
+    if (Data.size() - Offset < Size) {
+      Truncated = true;
+      Offset = Data.size();
+      return llvm::StringRef();
+    }
+    auto Bytes = Data.substr(Offset, Size);
+    Offset += Size;
+    return Bytes;
+  }
+
+  template <typename T> T read() {
+    T Value{};
+    auto Bytes = readBytes(sizeof(Value));
+    if (!Bytes.empty())
+      std::memcpy(&Value, Bytes.data(), sizeof(Value));
+    return Value;
+  }
+
+  llvm::StringRef readString() { return readBytes(read<std::uint32_t>()); }
+
+  void align(unsigned Alignment) {
+    readBytes(llvm::offsetToAlignment(Offset, llvm::Align(Alignment)));
+  }
+
+  /// Whether anything was read past the end of the snapshot.
+  bool isTruncated() const { return Truncated; }
+};
+} // namespace
+
+/// Make an error with the given message.
+static llvm::Error makeError(const llvm::Twine &Message) {
+  return llvm::make_error<llvm::StringError>(Message,
+                                             llvm::inconvertibleErrorCode());
+}
+
+/// Describe the machine the JIT compiles code for, which the code in a
+/// snapshot only runs on.
+static std::string getTargetKey(KaleidoscopeJIT &JIT) {
+  auto &TM = JIT.getTargetMachine();
+  return TM.getTargetTriple().str() + '\n' + TM.getTargetCPU().str() + '\n' +
+         TM.getTargetFeatureString().str() + '\n' +
+         JIT.getDataLayout().getStringRepresentation();
+}
+
+/// Whether a function is one of the functions top-level expressions are
+/// compiled into, which are never saved.
+static bool isAnonymous(llvm::StringRef Name) {
+  return Name.startswith("__anon_expr");
+}
+
+llvm::Error SaveSnapshot(llvm::StringRef Path) {
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  const auto &FunctionProtos = getFunctionProtos();
+  // Sorting keeps the snapshot of the same session the same.
+  std::vector<const PrototypeAST *> Protos;
+  for (const auto &Proto : FunctionProtos)
+    if (!isAnonymous(Proto.second->getName()))
+      Protos.push_back(Proto.second.get());
+  std::sort(Protos.begin(), Protos.end(),
+            [](const PrototypeAST *A, const PrototypeAST *B) {
+              return A->getName() < B->getName();
+            });
+  const std::map<char, int> Precedences(
+      CompilationContext::getCurrent().BinopPrecedence.begin(),
+      CompilationContext::getCurrent().BinopPrecedence.end());
+  // Code calling a function that was redefined is only generated again once
+  // it is needed, and it is needed now.
+  std::vector<Symbol> Names;
+  for (const auto *Proto : Protos)
+    Names.push_back(Proto->getSymbol());
+  CompileStaleFunctions(Names);
+  auto Objects = JIT->getObjects([&](llvm::StringRef Name) {
+    return !isAnonymous(Name) && FunctionProtos.count(Symbol::intern(Name));
+  });
+  // Definitions sharing the bitcode of a module share a blob.
+  const auto Definitions = ExportDefinitions();
+  std::vector<const std::string *> Blobs;
+  llvm::DenseMap<const std::string *, std::uint32_t> BlobIndices;
+  for (const auto &D : Definitions)
+    if (BlobIndices.try_emplace(D.Bitcode.get(), Blobs.size()).second)
+      Blobs.push_back(D.Bitcode.get());
+
+  auto Temp = llvm::sys::fs::TempFile::create(Path + ".%%%%%%.tmp");
+  if (!Temp)
+    return makeError("Could not write " + Path + ": " +
+                     toString(Temp.takeError()));
+  llvm::raw_fd_ostream OS(Temp->FD, /* shouldClose */ false);
+  SnapshotWriter W(OS);
+  OS << Magic;
+  W.writeString(getTargetKey(*JIT));
+
+  W.write<std::uint32_t>(Precedences.size());
+  for (const auto &Op : Precedences) {
+    W.write<char>(Op.first);
+    W.write<std::int32_t>(Op.second);
+  }
+
+  W.write<std::uint32_t>(Protos.size());
+  for (const auto *Proto : Protos) {
+    W.writeString(Proto->getName());
+    W.write<std::uint8_t>(Proto->isUnaryOp() || Proto->isBinaryOp());
+    W.write<std::uint32_t>(Proto->getBinaryPrecedence());
+    W.write<std::uint8_t>(Proto->isExtern());
+    const auto &Args = Proto->getArgs();
+    W.write<std::uint32_t>(Args.size());
+    for (std::size_t I = 0; I < Args.size(); I++) {
+      W.writeString(Args[I]);
+      W.write<std::uint8_t>(Proto->isArrayArg(I));
+    }
+  }
+
+  W.write<std::uint32_t>(Objects.size());
+  for (const auto &Obj : Objects) {
+    W.write<std::uint64_t>(Obj.getBufferSize());
+    W.align(ObjectAlignment);
+    OS << Obj.getBuffer();
+  }
+
+  W.write<std::uint32_t>(Blobs.size());
+  for (const auto *Blob : Blobs)
+    W.writeString(*Blob);
+  W.write<std::uint32_t>(Definitions.size());
+  for (const auto &D : Definitions) {
+    W.writeString(D.Name.str());
+    W.write<std::uint32_t>(BlobIndices.lookup(D.Bitcode.get()));
+    std::vector<llvm::StringRef> Callees;
+    for (auto Callee : D.Callees)
+      Callees.push_back(Callee.str());
+    std::sort(Callees.begin(), Callees.end());
+    W.write<std::uint32_t>(Callees.size());
+    for (auto Callee : Callees)
+      W.writeString(Callee);
+  }
+
+  OS.flush();
+  if (OS.has_error()) {
+    const auto EC = OS.error();
+    OS.clear_error();
+    llvm::consumeError(Temp->discard());
+    return makeError("Could not write " + Path + ": " + EC.message());
+  }
+  if (auto Err = Temp->keep(Path))
+    return makeError("Could not write " + Path + ": " +
+                     toString(std::move(Err)));
+  return llvm::Error::success();
+}
+
+llvm::Error LoadSnapshot(llvm::StringRef Path) {
+  auto File = llvm::MemoryBuffer::getFile(Path, /* FileSize */ -1,
+                                          /* RequiresNullTerminator */ false);
+  if (!File)
+    return makeError("Could not read " + Path + ": " +
+                     File.getError().message());
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  SnapshotReader R((*File)->getBuffer());
+  if (R.readBytes(sizeof(Magic) - 1) != Magic)
+    return makeError(Path + " is not a snapshot");
+  if (R.readString() != getTargetKey(*JIT))
+    return makeError(Path + " was saved for another target");
+
+  // Read everything before changing anything, so that a broken snapshot
+  // leaves the session alone.
+  std::vector<std::pair<char, int>> Precedences;
+  for (auto N = R.read<std::uint32_t>(); N && !R.isTruncated(); N--) {
+    const auto Op = R.read<char>();
+    Precedences.emplace_back(Op, R.read<std::int32_t>());
+  }
+
+  std::vector<std::unique_ptr<PrototypeAST>> Protos;
+  for (auto N = R.read<std::uint32_t>(); N && !R.isTruncated(); N--) {
+    const auto Name = R.readString().str();
+    const bool IsOperator = R.read<std::uint8_t>();
+    const auto Precedence = R.read<std::uint32_t>();
+    const bool IsExtern = R.read<std::uint8_t>();
+    std::vector<std::string> Args;
+    std::vector<bool> ArrayArgs;
+    bool HasArrayArgs = false;
+    for (auto NumArgs = R.read<std::uint32_t>(); NumArgs && !R.isTruncated();
+         NumArgs--) {
+      Args.push_back(R.readString().str());
+      ArrayArgs.push_back(R.read<std::uint8_t>());
+      HasArrayArgs |= ArrayArgs.back();
+    }
+    if (!HasArrayArgs)
+      ArrayArgs.clear();
+    Protos.push_back(std::make_unique<PrototypeAST>(Name, std::move(Args),
+                                                    IsOperator, Precedence,
+                                                    std::move(ArrayArgs),
+                                                    IsExtern));
+  }
+
+  std::vector<llvm::StringRef> Objects;
+  for (auto N = R.read<std::uint32_t>(); N && !R.isTruncated(); N--) {
+    const auto Size = R.read<std::uint64_t>();
+    R.align(ObjectAlignment);
+    Objects.push_back(R.readBytes(Size));
+  }
+
+  std::vector<std::shared_ptr<const std::string>> Blobs;
+  for (auto N = R.read<std::uint32_t>(); N && !R.isTruncated(); N--)
+    Blobs.push_back(std::make_shared<const std::string>(R.readString().str()));
+  std::vector<KeptDefinition> Definitions;
+  for (auto N = R.read<std::uint32_t>(); N && !R.isTruncated(); N--) {
+    KeptDefinition D;
+    D.Name = Symbol::intern(R.readString());
+    const auto Blob = R.read<std::uint32_t>();
+    for (auto NumCallees = R.read<std::uint32_t>();
+         NumCallees && !R.isTruncated(); NumCallees--)
+      D.Callees.insert(Symbol::intern(R.readString()));
+    if (R.isTruncated())
+      break;
+    if (Blob >= Blobs.size())
+      return makeError(Path + " is corrupt");
+    D.Bitcode = Blobs[Blob];
+    Definitions.push_back(std::move(D));
+  }
+  if (R.isTruncated())
+    return makeError(Path + " is truncated");
+
+  for (const auto &Op : Precedences)
+    InstallBinopPrecedence(Op.first, Op.second);
+  auto &FunctionProtos = getFunctionProtos();
+  for (auto &Proto : Protos)
+    FunctionProtos[Proto->getSymbol()] = std::move(Proto);
+  LoadedSnapshots.push_back(std::move(*File));
+  for (auto Obj : Objects) {
+    auto K = JIT->addObject(llvm::MemoryBufferRef(Obj, Path));
+    if (!K)
+      return K.takeError();
+  }
+  RecordDefinitions(std::move(Definitions));
+  return llvm::Error::success();
+}
@@ -0,0 +1,154 @@
+#include <llvm/Support/FileSystem.h> // llvm::sys::fs::OF_Text
+#include <llvm/Support/Format.h>     // llvm::format
+#include <llvm/Support/Timer.h>      // llvm::Timer, llvm::TimerGroup
+
+#include <atomic> // std::atomic
+#include <memory> // std::unique_ptr
+#include <thread> // std::this_thread
+
+#include "stats.h"
+
+namespace {
+/// The number of phases and counters.
+constexpr unsigned NumPhases = static_cast<unsigned>(Phase::Execute) + 1;
+constexpr unsigned NumCounters =
+    static_cast<unsigned>(Counter::ParallelSteals) + 1;
+
+/// The names and descriptions phases are reported under.
+const char *const PhaseNames[NumPhases][2] = {
+    {"lex", "Lexing"},
+    {"parse", "Parsing"},
+    {"codegen", "IR generation"},
+    {"optimize", "Optimization"},
+    {"jit", "JIT compilation"},
+    {"execute", "Execution"},
+};
+
+/// The names and descriptions counters are reported under.
+const char *const CounterNames[NumCounters][2] = {
+    {"tokens", "Tokens lexed"},
+    {"ast-nodes", "AST nodes made"},
+    {"ir-instructions", "IR instructions generated"},
+    {"modules-added", "Modules added to the JIT"},
+    {"modules-removed", "Modules removed from the JIT"},
+    {"symbol-lookups", "Symbols looked up in the JIT"},
+    {"jit-memory-peak", "Most bytes of JIT memory in use"},
+    {"jit-memory-freed", "Bytes of JIT memory given back"},
+    {"parallel-loops", "Parallel loops run"},
+    {"parallel-steals", "Parallel loop tasks stolen"},
+};
+
+/// The timers of every phase, made once statistics are enabled.
+struct PhaseTimers {
+  llvm::TimerGroup Group{"kaleidoscope", "Kaleidoscope phases"};
+  // The timers are destroyed before their group, which would print whatever
+  // they timed unless it has been printed already.
+  llvm::Timer Timers[NumPhases];
+
+  PhaseTimers() {
+    for (unsigned P = 0; P < NumPhases; P++)
+      Timers[P].init(PhaseNames[P][0], PhaseNames[P][1], Group);
+  }
+};
+} // namespace
+
+/// Whether statistics are collected.
+static bool StatisticsEnabled = false;
+
+/// The timers, and the thread that uses them, since timers are not
+/// thread-safe.
+static std::unique_ptr<PhaseTimers> Timers;
+static std::thread::id TimingThread;
+
+/// The timer of the innermost PhaseRegion on the timing thread.
+static llvm::Timer *RunningTimer = nullptr;
+
+/// Counters can be added to from the threads compiling on behalf of the
+/// interpreter.
+static std::atomic<std::uint64_t> Counters[NumCounters];
+
+void SetStatistics(bool Enabled) {
+  StatisticsEnabled = Enabled;
+  if (Enabled && !Timers)
+    Timers = std::make_unique<PhaseTimers>();
+  TimingThread = std::this_thread::get_id();
+}
+
+bool areStatisticsEnabled() { return StatisticsEnabled; }
+
+void countEvent(Counter C, std::uint64_t N) {
+  if (StatisticsEnabled)
+    Counters[static_cast<unsigned>(C)].fetch_add(N, std::memory_order_relaxed);
+}
+
+void raiseCounter(Counter C, std::uint64_t Value) {
+  if (!StatisticsEnabled)
+    return;
+  auto &Max = Counters[static_cast<unsigned>(C)];
+  auto Current = Max.load(std::memory_order_relaxed);
+  while (Current < Value &&
+         !Max.compare_exchange_weak(Current, Value, std::memory_order_relaxed))
+    ;
+}
+
+PhaseRegion::PhaseRegion(Phase P) {
+  if (!StatisticsEnabled || std::this_thread::get_id() != TimingThread)
+    return;
+  Outer = RunningTimer;
+  if (Outer)
+    Outer->stopTimer();
+  Timer = &Timers->Timers[static_cast<unsigned>(P)];
+  Timer->startTimer();
+  RunningTimer = Timer;
+}
+
+PhaseRegion::~PhaseRegion() {
+  if (!Timer)
+    return;
+  Timer->stopTimer();
+  RunningTimer = Outer;
+  if (Outer)
+    Outer->startTimer();
+}
+
+void PrintStatistics(llvm::raw_ostream &OS) {
+  if (!Timers)
+    return;
+  Timers->Group.print(OS);
+  // Printing only keeps the times in the group, so forget them in the timers
+  // too, or they are printed again when the timers are destroyed.
+  for (auto &T : Timers->Timers)
+    T.clear();
+
+  const char *const Line = "===-----------------------------------------------"
+                           "--------------------------===\n";
+  OS << Line << "                          Kaleidoscope statistics\n"
+     << Line << '\n';
+  for (unsigned C = 0; C < NumCounters; C++)
+    OS << llvm::format("%12llu %s - %s\n",
+                       static_cast<unsigned long long>(Counters[C].load()),
+                       CounterNames[C][0], CounterNames[C][1]);
+  OS << '\n';
+  OS.flush();
+}
+
+std::error_code WriteStatisticsJSON(const std::string &Path) {
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_Text);
+  if (EC)
+    return EC;
+
+  OS << "{\n\"timers\": {\n";
+  if (Timers)
+    Timers->Group.printJSONValues(OS, "");
+  OS << "\n},\n\"counters\": {\n";
+  for (unsigned C = 0; C < NumCounters; C++)
+    OS << (C ? ",\n" : "") << "\t\"" << CounterNames[C][0]
+       << "\": " << Counters[C].load();
+  OS << "\n}\n}\n";
+  OS.close();
+  EC = OS.error();
+  // The stream reports an error it was not asked about when it is destroyed.
+  OS.clear_error();
+  return EC;
+}
@@ -0,0 +1,65 @@
+#include <llvm/IR/BasicBlock.h>   // llvm::BasicBlock
+#include <llvm/IR/CFG.h>          // llvm::pred_empty
+#include <llvm/IR/Instructions.h> // llvm::BranchInst, llvm::CallInst, llvm::PHINode, llvm::ReturnInst
+
+#include <vector> // std::vector
+
+#include "tailcalls.h"
+
+/// Whether calls in tail position are compiled into jumps.
+static bool TailCalls = false;
+
+void SetTailCalls(bool Enabled) { TailCalls = Enabled; }
+
+bool areTailCallsEnabled() { return TailCalls; }
+
+/// Get the phi that a block returns right away, which is what the blocks
+/// after an if/then/else look like when the function returns its value.
+///
+/// @return the phi, or nullptr if the block does anything else
+static llvm::PHINode *getReturnedPhi(llvm::BasicBlock &BB) {
+  auto *Phi = llvm::dyn_cast<llvm::PHINode>(&BB.front());
+  if (!Phi)
+    return nullptr;
+  auto *Ret = llvm::dyn_cast<llvm::ReturnInst>(Phi->getNextNode());
+  if (!Ret || Ret->getReturnValue() != Phi)
+    return nullptr;
+  return Phi;
+}
+
+void PlaceTailCalls(llvm::Function &F) {
+  std::vector<llvm::BasicBlock *> Worklist;
+  for (auto &BB : F)
+    if (getReturnedPhi(BB))
+      Worklist.push_back(&BB);
+
+  // Return straight from every block that branches to a returned phi,
+  // nested if/then/elses included, with the value it would have given it.
+  while (!Worklist.empty()) {
+    auto *BB = Worklist.back();
+    Worklist.pop_back();
+    auto *Phi = getReturnedPhi(*BB);
+    for (unsigned I = Phi->getNumIncomingValues(); I-- > 0;) {
+      auto *Pred = Phi->getIncomingBlock(I);
+      auto *Br = llvm::dyn_cast<llvm::BranchInst>(Pred->getTerminator());
+      if (!Br || Br->isConditional())
+        continue;
+      llvm::ReturnInst::Create(F.getContext(), Phi->getIncomingValue(I), Br);
+      Br->eraseFromParent();
+      Phi->removeIncomingValue(I, /* DeletePHIIfEmpty */ false);
+      if (getReturnedPhi(*Pred))
+        Worklist.push_back(Pred);
+    }
+    if (llvm::pred_empty(BB))
+      BB->eraseFromParent();
+  }
+
+  for (auto &BB : F) {
+    auto *Ret = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator());
+    if (!Ret || Ret == &BB.front())
+      continue;
+    auto *Call = llvm::dyn_cast<llvm::CallInst>(Ret->getPrevNode());
+    if (Call && Ret->getReturnValue() == Call)
+      Call->setTailCall();
+  }
+}
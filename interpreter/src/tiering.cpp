@@ -0,0 +1,534 @@
+#include <llvm/ADT/DenseMap.h> // llvm::DenseMap
+#include <llvm/ADT/DenseSet.h> // llvm::DenseSet
+#include <llvm/ADT/StringMap.h> // llvm::StringMap
+#include <llvm/ExecutionEngine/JITSymbol.h> // llvm::JITTargetAddress, llvm::jitTargetAddressToFunction
+
+#include <sstream>       // std::ostringstream
+#include <string>        // std::string, std::to_string
+#include <unordered_map> // std::unordered_map
+#include <utility>       // std::pair
+#include <vector>        // std::vector
+
+#include "dependencies.h" // CompileStaleCallees, CompileStaleFunctions
+#include "inliner.h"      // takeModuleForJIT
+#include "parser.h"       // InstallBinopPrecedence, UninstallBinopPrecedence
+#include "profile.h"      // FunctionProfile
+#include "tiering.h"
+#include "util.h" // InitializeModuleAndPassManager, LogError, LogErrorD
+
+#include "CompilationContext.h"
+#include "ExprAST.h"
+#include "KaleidoscopeJIT.h" // JIT
+#include "Optimizer.h"
+
+using llvm::JITTargetAddress;
+using llvm::orc::KaleidoscopeJIT;
+
+namespace {
+/// A function definition known to the interpreter, together with how hot it
+/// has gotten so far.
+struct TieredFunction {
+  /// The definition, which stays around after the function is compiled so
+  /// that it can still be interpreted when the native code cannot be called.
+  /// Exactly one of these is set, depending on how the body was parsed.
+  std::unique_ptr<FunctionAST> Definition;
+  std::unique_ptr<FlatAST> FlatDefinition;
+  /// How many times the function has been called plus how many loop
+  /// iterations have been run inside of it while it was interpreted.
+  unsigned Count = 0;
+  /// Whether the function has been handed over to the JIT.
+  bool Compiled = false;
+  /// The functions the compiled code of the function calls, which is empty
+  /// while it is interpreted.
+  llvm::DenseSet<Symbol> Callees;
+  /// Whether generating LLVM IR for the function failed, in which case it is
+  /// not tried again.
+  bool Uncompilable = false;
+  /// What the instrumented code of the function has counted, or nullptr if it
+  /// was compiled without instrumentation or not at all.
+  std::unique_ptr<FunctionProfile> Profile;
+  /// Whether the function has been recompiled with its profile, or at least
+  /// been tried to.
+  bool Reoptimized = false;
+
+  /// The prototype of whichever definition is set.
+  const PrototypeAST &getProto() const {
+    return Definition ? Definition->getProto() : FlatDefinition->getProto();
+  }
+
+  /// Generate LLVM IR for whichever definition is set.
+  llvm::Function *codegen() {
+    return Definition ? Definition->codegen() : FlatDefinition->codegen();
+  }
+
+  /// Whether whichever definition is set uses arrays, which only compiled
+  /// code can do.
+  bool usesArrays() const {
+    return Definition ? Definition->usesArrays()
+                      : FlatDefinition->usesArrays();
+  }
+
+  /// Interpret whichever definition is set.
+  llvm::Optional<double> evaluate(llvm::ArrayRef<double> Args) {
+    return Definition ? Definition->evaluate(Args)
+                      : FlatDefinition->evaluate(Args);
+  }
+};
+} // namespace
+
+/// The number of calls and loop iterations after which a function is compiled,
+/// or 0 when tiering is disabled.
+static unsigned TierUpThreshold = 0;
+
+/// How hot the instrumented code of a function has to get before the function
+/// is recompiled with its profile, or 0 when functions are compiled without
+/// instrumentation.
+static unsigned ReoptimizationThreshold = 0;
+
+/// Every function definition made while tiering is enabled. CurrentFunction
+/// points into this map, so it must not move its entries around.
+static std::unordered_map<Symbol, TieredFunction> Functions;
+
+/// The native addresses of the compiled and external functions called from the
+/// interpreter so far.
+static llvm::DenseMap<Symbol, JITTargetAddress> NativeAddresses;
+
+/// The compiled functions calling each function, which is the Callees of the
+/// entries in Functions the other way around.
+static llvm::DenseMap<Symbol, llvm::DenseSet<Symbol>> Callers;
+
+/// The function whose body is being interpreted right now, or nullptr at the
+/// top level.
+static TieredFunction *CurrentFunction = nullptr;
+
+/// The profiles of instrumented code that has been superseded by a new
+/// definition. The code may still be called by native code that was compiled
+/// before the new definition, and then it still counts.
+static std::vector<std::unique_ptr<FunctionProfile>> RetiredProfiles;
+
+/// The number of functions renamed so far to be called through a stub, which
+/// keeps the names given to their implementations apart.
+static unsigned NumImplementations = 0;
+
+/// The optimizer for recompiling functions with their profiles, made the
+/// first time a function gets hot enough.
+static std::unique_ptr<Optimizer> ProfileOptimizer;
+
+void SetTierUpThreshold(unsigned Threshold) { TierUpThreshold = Threshold; }
+
+bool isTieringEnabled() { return TierUpThreshold > 0; }
+
+void SetReoptimizationThreshold(unsigned Threshold) {
+  ReoptimizationThreshold = Threshold;
+}
+
+static void promote(Symbol Name);
+
+/// Forget which functions the compiled code of the given function calls.
+///
+/// @param Name the name of the function
+/// @param Entry the function
+static void forgetCallees(Symbol Name, TieredFunction &Entry) {
+  for (auto Callee : Entry.Callees) {
+    auto Direct = Callers.find(Callee);
+    if (Direct != Callers.end())
+      Direct->second.erase(Name);
+  }
+  Entry.Callees.clear();
+}
+
+/// Go back to interpreting every compiled function that calls the function
+/// with the given name, directly or through other compiled functions. Their
+/// code still calls the code the function had when they were compiled, so
+/// they are compiled again against the new definition once they are hot,
+/// which any that got hot before still are.
+///
+/// @param Name the name of the function being redefined
+static void demoteCallers(Symbol Name) {
+  std::vector<Symbol> Worklist{Name};
+  while (!Worklist.empty()) {
+    auto Direct = Callers.find(Worklist.back());
+    Worklist.pop_back();
+    if (Direct == Callers.end())
+      continue;
+    const auto DirectCallers = std::move(Direct->second);
+    Callers.erase(Direct);
+    for (auto Caller : DirectCallers) {
+      auto &Entry = Functions.at(Caller);
+      if (!Entry.Compiled)
+        continue;
+      Entry.Compiled = false;
+      Entry.Reoptimized = false;
+      if (Entry.Profile)
+        RetiredProfiles.push_back(std::move(Entry.Profile));
+      forgetCallees(Caller, Entry);
+      NativeAddresses.erase(Caller);
+      Worklist.push_back(Caller);
+    }
+  }
+}
+
+/// Make the function definition held by the given entry available to the
+/// interpreter, replacing any earlier definition of the same name. A function
+/// that uses arrays is compiled right away, since the interpreter cannot run
+/// it.
+///
+/// @param Function a new entry holding nothing but the definition
+/// @return false if the function had to be compiled but could not be
+static bool defineInterpreted(TieredFunction Function) {
+  const auto &P = Function.getProto();
+
+  // Other definitions are checked against this prototype, and generate a
+  // declaration from it if this function is called from native code.
+  getFunctionProtos()[P.getSymbol()] = std::make_unique<PrototypeAST>(P);
+
+  // If this is a binary operator, add it to
+  // the binary operator precedence table.
+  if (P.isBinaryOp())
+    InstallBinopPrecedence(P.getOperatorName(), P.getBinaryPrecedence());
+
+  const auto Name = P.getSymbol();
+  const bool UsesArrays = Function.usesArrays();
+  NativeAddresses.erase(Name);
+  auto Old = Functions.find(Name);
+  if (Old != Functions.end()) {
+    if (Old->second.Profile)
+      RetiredProfiles.push_back(std::move(Old->second.Profile));
+    forgetCallees(Name, Old->second);
+  }
+  demoteCallers(Name);
+  Functions[Name] = std::move(Function);
+  if (!UsesArrays)
+    return true;
+
+  // The interpreter cannot fall back on a definition that failed to compile,
+  // so it is dropped, just like it would be without tiering.
+  promote(Name);
+  auto &Entry = Functions.at(Name);
+  if (!Entry.Uncompilable)
+    return true;
+  if (Entry.getProto().isBinaryOp())
+    UninstallBinopPrecedence(Entry.getProto().getOperatorName());
+  Functions.erase(Name);
+  return false;
+}
+
+bool DefineInterpretedFunction(std::unique_ptr<FunctionAST> Function) {
+  TieredFunction Entry;
+  Entry.Definition = std::move(Function);
+  return defineInterpreted(std::move(Entry));
+}
+
+bool DefineInterpretedFunction(std::unique_ptr<FlatAST> Function) {
+  TieredFunction Entry;
+  Entry.FlatDefinition = std::move(Function);
+  return defineInterpreted(std::move(Entry));
+}
+
+/// Hand a module with the code of the given functions over to the JIT. With
+/// instrumentation, every function is renamed to a name of its own and called
+/// through a stub by its real name instead, so that the function can be
+/// replaced by a better version later, even in the native code calling it.
+///
+/// @param TSM the module to add, defining every function in Entries
+/// @param Entries the functions to add
+/// @param Tier what kind of code the module holds, which goes into the names of
+///        the implementations
+/// @param CallThroughStubs whether calls to the functions inside the module
+///        use the stubs too, rather than calling the implementation directly
+/// @return an error if the JIT could not take the module
+static llvm::Error addToJIT(llvm::orc::ThreadSafeModule TSM,
+                            llvm::ArrayRef<TieredFunction *> Entries,
+                            llvm::StringRef Tier, bool CallThroughStubs) {
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  if (!TSM.withModuleDo(CompileStaleCallees))
+    return llvm::make_error<llvm::StringError>(
+        "A function the module calls could not be compiled again",
+        llvm::inconvertibleErrorCode());
+  if (!ReoptimizationThreshold)
+    return JIT->addModule(std::move(TSM)).takeError();
+
+  llvm::StringMap<std::string> Impls;
+  TSM.withModuleDo([&](llvm::Module &M) {
+    for (auto *Entry : Entries) {
+      const auto Name = Entry->getProto().getSymbol().str();
+      auto *F = M.getFunction(Name);
+      F->setName(Name + "." + Tier + "." +
+                 std::to_string(NumImplementations++));
+      if (CallThroughStubs)
+        F->replaceAllUsesWith(llvm::Function::Create(
+            F->getFunctionType(), llvm::Function::ExternalLinkage, Name, M));
+      Impls[Name] = F->getName().str();
+    }
+  });
+  return JIT->addModuleBehindStubs(std::move(TSM), Impls).takeError();
+}
+
+/// Generate LLVM IR for the function with the given name along with every
+/// interpreted function it calls, directly or not, and add it all to the JIT.
+/// Native code cannot call back into the interpreter, so none of the callees
+/// can be left behind.
+///
+/// @param Name the name of the function that got hot
+static void promote(Symbol Name) {
+  std::vector<Symbol> Worklist{Name};
+  std::vector<TieredFunction *> Promoted;
+  bool Failed = false;
+
+  while (!Worklist.empty()) {
+    auto &Entry = Functions.at(Worklist.back());
+    Worklist.pop_back();
+    if (Entry.Compiled)
+      continue;
+
+    // Marking the function right away stops recursive calls from adding it
+    // to the worklist again.
+    Entry.Compiled = true;
+    Promoted.push_back(&Entry);
+    auto *F = Entry.codegen();
+    if (!F) {
+      Failed = true;
+      break;
+    }
+    if (ReoptimizationThreshold)
+      Entry.Profile = FunctionProfile::instrument(*F);
+    Entry.Callees = CompilationContext::getCurrent().CalledFunctions;
+
+    // Any declaration left in the module is a function that the new code
+    // calls. Those the interpreter has not compiled yet go next.
+    for (const auto &F : borrowModule()) {
+      if (!F.isDeclaration())
+        continue;
+      auto Callee = Functions.find(Symbol::intern(F.getName()));
+      if (Callee != Functions.end() && !Callee->second.Compiled)
+        Worklist.push_back(Callee->first);
+    }
+  }
+
+  if (!Failed) {
+    // The module stays in the JIT for good: once compiled, a function is
+    // only replaced by a new definition of it, or by its reoptimized code.
+    if (auto Err =
+            addToJIT(takeModuleForJIT(), Promoted, "instrumented", true)) {
+      LogError(toString(std::move(Err)).c_str());
+      Failed = true;
+    }
+  }
+  // Start over with an empty module either way, throwing away whatever was
+  // generated if something went wrong.
+  InitializeModuleAndPassManager(true);
+
+  for (auto *Entry : Promoted) {
+    const auto &P = Entry->getProto();
+    NativeAddresses.erase(P.getSymbol());
+    if (!Failed) {
+      for (auto Callee : Entry->Callees)
+        Callers[Callee].insert(P.getSymbol());
+      continue;
+    }
+
+    // Keep interpreting everything instead.
+    Entry->Compiled = false;
+    Entry->Callees.clear();
+    Entry->Uncompilable = true;
+    Entry->Profile.reset();
+    // A definition that failed to generate also takes its operator out of
+    // the precedence table, but the interpreter can still run it.
+    if (P.isBinaryOp())
+      InstallBinopPrecedence(P.getOperatorName(), P.getBinaryPrecedence());
+  }
+}
+
+/// Whether the instrumented code of a function has gotten hot enough to
+/// recompile the function with its profile.
+static bool isHot(const TieredFunction &Function) {
+  return Function.Profile && !Function.Reoptimized &&
+         Function.Profile->getHotness() >= ReoptimizationThreshold;
+}
+
+/// Recompile the function with the given name at -O3, along with every hot
+/// function it calls, directly or not, annotating their code with what their
+/// instrumented code counted. The inliner and the optimizations after it then
+/// know which branches and calls matter. From then on, every call to the
+/// functions goes to the new code, and callees that are not hot yet stay
+/// instrumented.
+///
+/// @param Name the name of the function that got hot
+static void reoptimize(Symbol Name) {
+  std::vector<Symbol> Worklist{Name};
+  std::vector<std::pair<TieredFunction *, llvm::Function *>> Reoptimized;
+  bool Failed = false;
+
+  while (!Worklist.empty()) {
+    auto &Entry = Functions.at(Worklist.back());
+    Worklist.pop_back();
+    if (Entry.Reoptimized)
+      continue;
+
+    // A function that fails to be recompiled is not tried again, it just
+    // keeps running its instrumented code.
+    Entry.Reoptimized = true;
+    auto *F = Entry.codegen();
+    if (!F) {
+      // Generating the operator took it out of the precedence table, but its
+      // instrumented code still runs.
+      const auto &P = Entry.getProto();
+      if (P.isBinaryOp())
+        InstallBinopPrecedence(P.getOperatorName(), P.getBinaryPrecedence());
+      Failed = true;
+      break;
+    }
+    Reoptimized.emplace_back(&Entry, F);
+
+    // Hot callees go into the same module, where they can be inlined.
+    for (const auto &Callee : borrowModule()) {
+      if (!Callee.isDeclaration())
+        continue;
+      auto Hot = Functions.find(Symbol::intern(Callee.getName()));
+      if (Hot != Functions.end() && isHot(Hot->second))
+        Worklist.push_back(Hot->first);
+    }
+  }
+
+  if (!Failed) {
+    // Every function is generated before any is annotated, since the inline
+    // hints go on the definitions of the callees. A function whose code does
+    // not match its profile anymore still gets optimized at -O3.
+    std::vector<TieredFunction *> Entries;
+    for (auto &R : Reoptimized) {
+      R.first->Profile->applyTo(*R.second);
+      Entries.push_back(R.first);
+    }
+    auto *JIT = KaleidoscopeJIT::getInstance();
+    if (!ProfileOptimizer)
+      ProfileOptimizer =
+          std::make_unique<Optimizer>(3, &JIT->getTargetMachine());
+    ProfileOptimizer->runOnModule(borrowModule());
+    if (auto Err = addToJIT(takeModule(), Entries, "optimized", false))
+      LogError(toString(std::move(Err)).c_str());
+  }
+  // The stubs keep their addresses, so the interpreter can go on calling
+  // whatever it looked up before.
+  InitializeModuleAndPassManager(true);
+}
+
+/// Find the native code for the function with the given name.
+///
+/// @param Name the name of the function
+/// @return the address of the function, or nothing if the JIT could not
+///         find it
+static llvm::Optional<JITTargetAddress> lookupNative(Symbol Name) {
+  auto Cached = NativeAddresses.find(Name);
+  if (Cached != NativeAddresses.end())
+    return Cached->second;
+
+  // Code that calls a redefined function is only generated again once it
+  // is needed.
+  if (!CompileStaleFunctions(Name))
+    return llvm::None;
+  auto Symbol = KaleidoscopeJIT::getInstance()->findSymbol(Name);
+  if (!Symbol) {
+    LogError(toString(Symbol.takeError()).c_str());
+    return llvm::None;
+  }
+  return NativeAddresses[Name] = Symbol->getAddress();
+}
+
+/// Call the native function at the given address.
+///
+/// @param Address the address of a function taking Args.size() doubles and
+///        returning a double
+/// @param Args the values to pass to the function, no more than MaxNativeArgs
+/// @return the value the function returned
+static double callNative(JITTargetAddress Address,
+                         llvm::ArrayRef<double> Args) {
+  using llvm::jitTargetAddressToFunction;
+  using D = double;
+
+  switch (Args.size()) {
+  case 0:
+    return jitTargetAddressToFunction<D (*)()>(Address)();
+  case 1:
+    return jitTargetAddressToFunction<D (*)(D)>(Address)(Args[0]);
+  case 2:
+    return jitTargetAddressToFunction<D (*)(D, D)>(Address)(Args[0], Args[1]);
+  case 3:
+    return jitTargetAddressToFunction<D (*)(D, D, D)>(Address)(
+        Args[0], Args[1], Args[2]);
+  case 4:
+    return jitTargetAddressToFunction<D (*)(D, D, D, D)>(Address)(
+        Args[0], Args[1], Args[2], Args[3]);
+  case 5:
+    return jitTargetAddressToFunction<D (*)(D, D, D, D, D)>(Address)(
+        Args[0], Args[1], Args[2], Args[3], Args[4]);
+  case 6:
+    return jitTargetAddressToFunction<D (*)(D, D, D, D, D, D)>(Address)(
+        Args[0], Args[1], Args[2], Args[3], Args[4], Args[5]);
+  }
+  llvm_unreachable("too many arguments for a native call");
+}
+
+llvm::Optional<double> CallFunction(Symbol Name, llvm::ArrayRef<double> Args) {
+  // A string stream for holding potential error messages.
+  std::ostringstream errMsg;
+  const auto &FunctionProtos = getFunctionProtos();
+  auto Proto = FunctionProtos.find(Name);
+  if (Proto == FunctionProtos.end()) {
+    errMsg << "Unknown function referenced: " << Name.str().str();
+    return LogErrorD(errMsg.str().c_str());
+  }
+
+  // Handle argument mismatch error.
+  const size_t expected = Proto->second->getArgs().size();
+  const size_t actual = Args.size();
+  if (expected != actual) {
+    errMsg << "Wrong number of arguments passed to " << Name.str().str()
+           << ", expecting " << expected << " but got " << actual;
+    return LogErrorD(errMsg.str().c_str());
+  }
+
+  // The interpreter has nothing but doubles to pass.
+  if (Proto->second->hasArrayArgs()) {
+    errMsg << "Cannot pass arrays to " << Name.str().str()
+           << " from the interpreter";
+    return LogErrorD(errMsg.str().c_str());
+  }
+
+  auto Entry = Functions.find(Name);
+  if (Entry != Functions.end()) {
+    auto &F = Entry->second;
+    const bool Callable = actual <= MaxNativeArgs;
+    // A function using arrays that had to go back to being interpreted is
+    // compiled again right away, since the interpreter cannot run it.
+    if (Callable && !F.Compiled && !F.Uncompilable &&
+        (++F.Count >= TierUpThreshold || F.usesArrays()))
+      promote(Name);
+    else if (isHot(F))
+      reoptimize(Name);
+
+    if (!Callable || !F.Compiled) {
+      auto *Caller = CurrentFunction;
+      CurrentFunction = &F;
+      auto Result = F.evaluate(Args);
+      CurrentFunction = Caller;
+      return Result;
+    }
+  } else if (actual > MaxNativeArgs) {
+    errMsg << "Cannot call external function " << Name.str().str()
+           << " with more than " << MaxNativeArgs
+           << " arguments from the interpreter";
+    return LogErrorD(errMsg.str().c_str());
+  }
+
+  auto Address = lookupNative(Name);
+  if (!Address)
+    return llvm::None;
+  return callNative(*Address, Args);
+}
+
+void ForgetNativeAddress(Symbol Name) { NativeAddresses.erase(Name); }
+
+void CountLoopIteration() {
+  if (CurrentFunction)
+    ++CurrentFunction->Count;
+}
@@ -1,21 +1,40 @@
-#include <llvm/Transforms/InstCombine/InstCombine.h> // llvm::createInstructionCombiningPass
-#include <llvm/Transforms/Scalar.h>             // llvm::createReassociatePass
-#include <llvm/Transforms/Scalar/GVN.h>         // llvm::createGVNPass
-#include <llvm/Transforms/Scalar/SimplifyCFG.h> // llvm::createCFGSimplificationPass
-#include <llvm/Transforms/Utils.h> // llvm::createPromoteMemoryToRegisterPass
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h> // llvm::orc::JITTargetMachineBuilder
 
-#include <iostream> // std::cerr, std::endl
+#include <iostream> // std::cerr, std::cout, std::endl
 #include <sstream>  // std::ostringstream
+#include <string>   // std::to_string
+#include <vector>   // std::vector
 
-#include "lexer.h" // getNextToken
+#include "dependencies.h" // CompileDefinition, CompileStaleCallees
+#include "exprcache.h"    // cacheExpression, invalidateCachedExpressions, lookupCachedExpression
+#include "fold.h"         // SetFunctionPurity, isConstantFoldingEnabled
+#include "inliner.h"      // takeModuleForJIT
+#include "lexer.h"        // getNextToken, startRecordingTokens, stopRecordingTokens
+#include "mathlib.h"      // isMathFunction
 #include "parser.h"
+#include "stats.h"   // PhaseRegion
+#include "tiering.h" // CallFunction, DefineInterpretedFunction, isTieringEnabled
 #include "util.h"
 
+#include "CompilationContext.h"
 #include "ExprAST.h"
 #include "KaleidoscopeJIT.h" // JIT
+#include "Optimizer.h"
 
 using llvm::orc::KaleidoscopeJIT;
 
+/// The most top-level expressions to compile together in one module.
+static unsigned ExprBatchSize = 1;
+
+/// The names of the anonymous functions in the current module that have been
+/// generated for top-level expressions but not run yet, in the order they were
+/// entered.
+static std::vector<std::string> PendingExprs;
+
+/// The number of top-level expressions compiled to be kept in the expression
+/// cache so far, which names the next one.
+static unsigned NumCachedExprs = 0;
+
 /// "Showable@<address>"
 std::string Showable::toString(unsigned depth) const {
   // Default implementation is to just return the memory
@@ -26,21 +45,17 @@ std::string Showable::toString(unsigned depth) const {
   return repr.str();
 }
 
-void AddPasses(llvm::legacy::PassManagerBase *pass) {
-  // Turn alloca instructions into registers. (mem2reg)
-  pass->add(llvm::createPromoteMemoryToRegisterPass());
-  // Add an optimization that can combine obvious duplicate expressions, e->g.
-  // (1+2+x)*(x+2+1) becomes (x+3)*(x+3)
-  pass->add(llvm::createInstructionCombiningPass());
-  // Add an optimization to reorder expressions taking advantage of the
-  // commutative and associative properties, e->g. 4 + (x + 5) becomes x + (4 +
-  // 5)
-  pass->add(llvm::createReassociatePass());
-  // Remove redundant expressions
-  pass->add(llvm::createGVNPass());
-  // CFG -> Control Flow Graph simplification, i->e. removing dead code, merging
-  // basic blocks, etc->
-  pass->add(llvm::createCFGSimplificationPass());
+void OptimizeModule(llvm::Module &M) {
+  // Target machines and pass managers are not thread-safe, and this runs on
+  // whichever thread happens to materialize the module, so every thread gets
+  // its own.
+  static thread_local auto TM =
+      llvm::cantFail(llvm::cantFail(
+                         llvm::orc::JITTargetMachineBuilder::detectHost())
+                         .createTargetMachine());
+  static thread_local Optimizer ModuleOptimizer(getOptimizationLevel(),
+                                                TM.get());
+  ModuleOptimizer.runOnFunctions(M);
 }
 
 void InitializeModuleAndPassManager(bool native) {
@@ -48,28 +63,24 @@ void InitializeModuleAndPassManager(bool native) {
   newModule("Kaleidoscope");
 
   if (native) {
-    borrowModule().setDataLayout(
-        KaleidoscopeJIT::getInstance()->getTargetMachine().createDataLayout());
-
-    // Create a new pass manager attached to it. We are using a function pass
-    // manager, which passes over code at the function level, looking for
-    // optimizations.
-    resetFunctionPassManager();
-
-    auto FunctionPassManager = getFunctionPassManager();
-    AddPasses(FunctionPassManager);
+    auto *JIT = KaleidoscopeJIT::getInstance();
+    borrowModule().setDataLayout(JIT->getDataLayout());
 
-    // Initialize all of the above passes.
-    FunctionPassManager->doInitialization();
+    // The optimizer outlives the module, so it only needs creating once. It
+    // passes over code at the function level, looking for optimizations. A
+    // lazy JIT optimizes each function when it is first called instead.
+    if (!getOptimizer() && !JIT->isLazy())
+      setOptimizer(std::make_unique<Optimizer>(getOptimizationLevel(),
+                                               &JIT->getTargetMachine()));
   }
 }
 
 /// Get or code generate a function in the current module with the given name,
 /// returning null if there is no such function and code generation fails.
-llvm::Function *getFunction(const std::string &Name) {
+llvm::Function *getFunction(Symbol Name) {
   // See if the function with the given name has aready been added to
   // the current module
-  if (auto *F = borrowModule().getFunction(Name))
+  if (auto *F = borrowModule().getFunction(Name.str()))
     return F;
 
   // If it hasn't, determine if we can codegen the declaration
@@ -86,30 +97,107 @@ llvm::Function *getFunction(const std::string &Name) {
 /// Create an alloca instruction in the entry block of the given function.
 /// Used for mutable variables.
 llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *Function,
-                                         const std::string &VarName) {
+                                         llvm::StringRef VarName,
+                                         llvm::Type *Type) {
   // Create an IRBuilder that points to the first instruction of the Function.
   llvm::IRBuilder<> TmpB(&Function->getEntryBlock(),
                          Function->getEntryBlock().begin());
-  // Create the alloca with the given name. If we had other types in our
-  // language, we would have to pass in a differnet type besides double here and
-  // probably take that type as a parameter to this funciton.
-  return TmpB.CreateAlloca(llvm::Type::getDoubleTy(getContext()), 0,
-                           VarName.c_str());
+  // Create the alloca with the given name. Variables are doubles unless they
+  // hold an array, in which case they hold a pointer to its first element.
+  return TmpB.CreateAlloca(Type ? Type : llvm::Type::getDoubleTy(getContext()),
+                           0, VarName);
 }
 
-/// What to do when a function definition is encountered at the REPL.
-void HandleDefinition(bool native) {
-  const auto defn = ParseDefinition();
+bool isArrayVariable(const llvm::AllocaInst *Variable) {
+  return Variable->getAllocatedType()->isPointerTy();
+}
+
+/// Whether function bodies are parsed into FlatASTs instead of ExprAST trees.
+static bool UseFlatAST = false;
+
+void SetFlatAST(bool Enabled) { UseFlatAST = Enabled; }
+
+bool isFlatASTEnabled() { return UseFlatAST; }
+
+/// Whether floating-point arithmetic is generated with fast-math flags.
+static bool FastMath = false;
+
+void SetFastMath(bool Enabled) { FastMath = Enabled; }
+
+llvm::FastMathFlags getFastMathFlags() {
+  llvm::FastMathFlags FMF;
+  if (FastMath) {
+    FMF.setAllowReassoc();
+    FMF.setAllowContract();
+  }
+  return FMF;
+}
+
+/// Whether the interpreter runs non-interactively.
+static bool BatchMode = false;
+
+/// Whether generated IR is printed.
+static bool PrintIR = true;
+
+void SetBatchMode(bool Enabled) { BatchMode = Enabled; }
+
+bool isBatchModeEnabled() { return BatchMode; }
+
+void SetIRPrinting(bool Enabled) { PrintIR = Enabled; }
+
+void PrintResult(double Value) {
+  // Flushing after every value is what makes printing to the terminal keep
+  // up, and what makes printing a long program's output slow.
+  if (BatchMode)
+    std::cout << Value << '\n';
+  else
+    std::cerr << Value << std::endl;
+}
+
+/// Run the compiled function of a top-level expression.
+///
+/// @param FP the function
+/// @return the value of the expression
+static double runCompiledExpression(CompiledExpression FP) {
+  PhaseRegion Region(Phase::Execute);
+  return FP();
+}
+
+/// Parse a function definition with the given parser and handle it, whichever
+/// way its body is represented.
+///
+/// @param Parse either ParseDefinition or ParseDefinitionFlat
+/// @param native whether or not the function definition should be handled
+///        relative to the native architecture the interpreter is running on
+template <typename Definition>
+static void handleDefinition(std::unique_ptr<Definition> (*Parse)(),
+                             bool native) {
+  auto defn = Parse();
   if (defn) {
+    // The definition gets a module of its own, so run any pending expressions
+    // first: they were entered against the definitions that existed before.
+    FlushTopLevelExpressions();
+    invalidateCachedExpressions(defn->getProto().getSymbol());
+    // Only a definition that replaced the old one changes whether the
+    // function is pure, but a failed one might have left nothing behind.
+    const auto Name = defn->getProto().getSymbol();
+    const bool Pure = defn->isPure();
+    // Interpreted functions wait until they get hot to be compiled.
+    if (native && isTieringEnabled()) {
+      SetFunctionPurity(Name,
+                        DefineInterpretedFunction(std::move(defn)) && Pure);
+      return;
+    }
     const auto *ir = defn->codegen();
+    SetFunctionPurity(Name, ir && Pure);
     if (ir) {
-      std::cerr << "Generate LLVM IR for function definition:" << std::endl;
-      ir->print(llvm::errs());
-      std::cerr << std::endl;
-      if (native) {
-        KaleidoscopeJIT::getInstance()->addModule(takeModule());
-        InitializeModuleAndPassManager(native);
+      if (PrintIR) {
+        std::cerr << "Generate LLVM IR for function definition:" << std::endl;
+        ir->print(llvm::errs());
+        std::cerr << std::endl;
       }
+      if (native)
+        CompileDefinition(std::move(defn));
     }
   } else {
     // Skip token to handle errors.
@@ -117,15 +205,29 @@ void HandleDefinition(bool native) {
   }
 }
 
+/// What to do when a function definition is encountered at the REPL.
+void HandleDefinition(bool native) {
+  if (UseFlatAST)
+    handleDefinition(ParseDefinitionFlat, native);
+  else
+    handleDefinition(ParseDefinition, native);
+}
+
 /// What to do when an extern function delcaration is encountered at the REPL.
 void HandleExtern() {
   if (auto externDeclaration = ParseExtern()) {
+    FlushTopLevelExpressions();
+    invalidateCachedExpressions(externDeclaration->getSymbol());
+    SetFunctionPurity(externDeclaration->getSymbol(),
+                      isMathFunction(*externDeclaration));
     if (const auto *ir = externDeclaration->codegen()) {
-      llvm::errs() << "Generate LLVM IR for extern function declaration:\n";
-      ir->print(llvm::errs());
-      llvm::errs() << '\n';
+      if (PrintIR) {
+        llvm::errs() << "Generate LLVM IR for extern function declaration:\n";
+        ir->print(llvm::errs());
+        llvm::errs() << '\n';
+      }
       auto &FunctionProtos = getFunctionProtos();
-      FunctionProtos[externDeclaration->getName()] =
+      FunctionProtos[externDeclaration->getSymbol()] =
           std::move(externDeclaration);
     }
   } else {
@@ -134,40 +236,148 @@ void HandleExtern() {
   }
 }
 
-/// What to do when any other expression that is not a function definition or
-/// extern function declaration is encountered at the REPL.
-void HandleTopLevelExpression(bool native) {
-  // Evaluate a top-level expression in an anonymous function.
-  const auto expr = ParseTopLevelExpr();
+/// Evaluate a top-level expression while it is still an AST if constant
+/// folding is enabled and the expression is constant, which only calls the
+/// compiled code of the functions it calls.
+///
+/// @param expr the top-level expression
+/// @return whether the expression was evaluated
+template <typename Definition> static bool evaluateConstant(Definition &expr) {
+  if (!isConstantFoldingEnabled() || !expr.isConstant())
+    return false;
+  // The expressions before this one have to run first.
+  FlushTopLevelExpressions();
+  llvm::Optional<double> Result;
+  {
+    PhaseRegion Region(Phase::Execute);
+    Result = expr.evaluate({});
+  }
+  if (Result)
+    PrintResult(*Result);
+  return true;
+}
+
+/// Parse a top-level expression with the given parser and run it natively,
+/// compiling it only if it is not in the expression cache yet.
+///
+/// @param Parse either ParseTopLevelExpr or ParseTopLevelExprFlat
+template <typename Definition>
+static void handleCachedTopLevelExpression(
+    std::unique_ptr<Definition> (*Parse)(const std::string &)) {
+  // The expression is kept in a module of its own, so its function needs a
+  // name that no other expression in the JIT has.
+  const auto Name = "__anon_expr_cached_" + std::to_string(NumCachedExprs);
+  std::string Key;
+  startRecordingTokens(Key);
+  const auto expr = Parse(Name);
+  stopRecordingTokens();
+  if (!expr) {
+    // Skip token to handle errors.
+    getNextToken();
+    return;
+  }
+  if (evaluateConstant(*expr))
+    return;
+  if (const auto FP = lookupCachedExpression(Key)) {
+    PrintResult(runCompiledExpression(FP));
+    return;
+  }
+  const bool Generated = expr->codegen() != nullptr;
+  // Nothing can call the function by name, so its prototype is not kept.
+  getFunctionProtos().erase(Symbol::intern(Name));
+  if (!Generated)
+    return;
+  NumCachedExprs++;
+
+  // Whatever the expression calls has to be looked up again once it is
+  // redefined, and so does whatever got inlined into it.
+  std::vector<Symbol> References;
+  const auto addReferences = [&](const llvm::Module &M) {
+    for (const auto &F : M)
+      if (F.getName() != Name)
+        References.push_back(Symbol::intern(F.getName()));
+  };
+  addReferences(borrowModule());
+  auto TSM = takeModuleForJIT();
+  TSM.withModuleDo(addReferences);
+  if (!TSM.withModuleDo(CompileStaleCallees)) {
+    InitializeModuleAndPassManager(true);
+    return;
+  }
+
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  auto H = JIT->addModule(std::move(TSM));
+  InitializeModuleAndPassManager(true);
+  if (!H) {
+    LogError(toString(H.takeError()).c_str());
+    return;
+  }
+  auto ExprSymbol = JIT->findSymbol(Name);
+  if (!ExprSymbol) {
+    LogError(toString(ExprSymbol.takeError()).c_str());
+    JIT->removeModule(*H);
+    return;
+  }
+  const auto FP = reinterpret_cast<CompiledExpression>(
+      static_cast<intptr_t>(ExprSymbol->getAddress()));
+  cacheExpression(std::move(Key), *H, FP, std::move(References));
+  PrintResult(runCompiledExpression(FP));
+}
+
+/// Parse a top-level expression with the given parser and handle it,
+/// whichever way it is represented.
+///
+/// @param Parse either ParseTopLevelExpr or ParseTopLevelExprFlat
+/// @param native whether or not the top-level expression should be handled
+///        relative to the native architecture the interpreter is running on
+template <typename Definition>
+static void handleTopLevelExpression(
+    std::unique_ptr<Definition> (*Parse)(const std::string &), bool native) {
+  if (native && isTieringEnabled()) {
+    // Run the expression straight off of its AST, which skips LLVM entirely
+    // unless it calls something hot.
+    if (auto expr = Parse("__anon_expr")) {
+      // Arrays only exist in compiled code, so an expression using them is
+      // defined like a function, which compiles it right away, and called.
+      llvm::Optional<double> Result;
+      {
+        PhaseRegion Region(Phase::Execute);
+        if (expr->usesArrays()) {
+          const auto Name = expr->getProto().getSymbol();
+          if (DefineInterpretedFunction(std::move(expr)))
+            Result = CallFunction(Name, {});
+        } else {
+          Result = expr->evaluate({});
+        }
+      }
+      if (Result)
+        PrintResult(*Result);
+    } else {
+      // Skip token to handle errors.
+      getNextToken();
+    }
+    return;
+  }
+
+  // Evaluate a top-level expression in an anonymous function. Each expression
+  // in a batch needs its own name since they all share a module.
+  const bool Batching = native && ExprBatchSize > 1;
+  if (native && !Batching && isExpressionCacheEnabled()) {
+    handleCachedTopLevelExpression(Parse);
+    return;
+  }
+  const auto Name = Batching
+                        ? "__anon_expr_" + std::to_string(PendingExprs.size())
+                        : std::string("__anon_expr");
+  const auto expr = Parse(Name);
   if (expr) {
+    if (native && evaluateConstant(*expr))
+      return;
     const auto *ir = expr->codegen();
     if (native && ir) {
-      // Just-in-time compile the generated LLVM IR
-      // We need to keep a handle to it so that it can be freed later
-      auto H = KaleidoscopeJIT::getInstance()->addModule(takeModule());
-      InitializeModuleAndPassManager(native);
-
-      // Search the JIT for the __anon_expr symbol
-      auto ExprSymbol =
-          KaleidoscopeJIT::getInstance()->findSymbol("__anon_expr");
-      assert(ExprSymbol);
-
-      // Get the memory address of the function. This could fail if
-      // for some reason the function isn't found. Just report an error
-      // in this case
-      auto ExprSymbolAddress = ExprSymbol.getAddress();
-      if (auto E = ExprSymbolAddress.takeError()) {
-        LogError(toString(std::move(E)).c_str());
-      } else {
-        // Cast the symbol's address to a function pointer
-        // and call the function natively
-        double (*FP)() = reinterpret_cast<double (*)()>(
-            static_cast<intptr_t>(*ExprSymbolAddress));
-        std::cerr << FP() << std::endl;
-      }
-
-      // Delete the module created for the anonymous expression
-      KaleidoscopeJIT::getInstance()->removeModule(H);
+      PendingExprs.push_back(Name);
+      if (PendingExprs.size() >= ExprBatchSize)
+        FlushTopLevelExpressions();
     }
   } else {
     // Skip token to handle errors.
@@ -175,6 +385,62 @@ void HandleTopLevelExpression(bool native) {
   }
 }
 
+/// What to do when any other expression that is not a function definition or
+/// extern function declaration is encountered at the REPL.
+void HandleTopLevelExpression(bool native) {
+  if (UseFlatAST)
+    handleTopLevelExpression(ParseTopLevelExprFlat, native);
+  else
+    handleTopLevelExpression(ParseTopLevelExpr, native);
+}
+
+void SetTopLevelExpressionBatchSize(unsigned N) { ExprBatchSize = N; }
+
+void FlushTopLevelExpressions() {
+  if (PendingExprs.empty())
+    return;
+
+  auto *JIT = KaleidoscopeJIT::getInstance();
+  // Just-in-time compile the generated LLVM IR
+  // We need to keep a handle to it so that it can be freed later
+  auto TSM = takeModuleForJIT();
+  // The whole batch shares the module, so it fails together when a function
+  // it calls cannot be compiled again.
+  if (!TSM.withModuleDo(CompileStaleCallees)) {
+    InitializeModuleAndPassManager(true);
+    PendingExprs.clear();
+    return;
+  }
+  auto H = JIT->addModule(std::move(TSM));
+  InitializeModuleAndPassManager(true);
+  if (!H) {
+    LogError(toString(H.takeError()).c_str());
+    PendingExprs.clear();
+    return;
+  }
+
+  for (const auto &Name : PendingExprs) {
+    // Search the JIT for the anonymous function, which is what actually gets
+    // the module compiled. This could fail if an expression refers to a
+    // symbol that cannot be resolved. Just report an error in this case; the
+    // rest of the batch shares the module and fails the same way.
+    auto ExprSymbol = JIT->findSymbol(Name);
+    if (!ExprSymbol) {
+      LogError(toString(ExprSymbol.takeError()).c_str());
+      break;
+    }
+    // Cast the symbol's address to a function pointer
+    // and call the function natively
+    double (*FP)() = reinterpret_cast<double (*)()>(
+        static_cast<intptr_t>(ExprSymbol->getAddress()));
+    PrintResult(runCompiledExpression(FP));
+  }
+  PendingExprs.clear();
+
+  // Delete the module created for the anonymous expressions
+  JIT->removeModule(*H);
+}
+
 std::ostream &insert_indent(std::ostream &os, const unsigned n) {
   for (unsigned i = 0; i < n; i++)
     os << '\t';
@@ -189,7 +455,11 @@ std::string &strltrim(std::string &s) {
 }
 
 // TODO - make error reports more user friendly
-std::unique_ptr<ExprAST> LogError(const char *Str) {
+std::nullptr_t LogError(const char *Str) {
+  if (auto *Errors = CompilationContext::getCurrent().Errors) {
+    Errors->push_back(Str);
+    return nullptr;
+  }
   std::cerr << "LogError: " << Str << std::endl;
   return nullptr;
 }
@@ -203,3 +473,8 @@ llvm::Value *LogErrorV(const char *Str) {
   LogError(Str);
   return nullptr;
 }
+
+llvm::Optional<double> LogErrorD(const char *Str) {
+  LogError(Str);
+  return llvm::None;
+}
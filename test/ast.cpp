@@ -4,15 +4,28 @@
 #include <cstdio>
 #include <cstdlib>
 
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include "ASTArena.h"
+#include "ArrayExprAST.h"
 #include "BinaryExprAST.h"
 #include "CallExprAST.h"
+#include "CompilationContext.h"
+#include "Engine.h"
+#include "FlatAST.h"
 #include "ForExprAST.h"
 #include "FunctionAST.h"
 #include "IfExprAST.h"
+#include "IndexExprAST.h"
 #include "LetExprAST.h"
 #include "NumberExprAST.h"
+#include "ParallelForExprAST.h"
 #include "UnaryExprAST.h"
 #include "VariableExprAST.h"
+#include "lexer.h"
+#include "mathlib.h"
+#include "parser.h"
 #include "util.h"
 
 using std::size_t;
@@ -38,11 +51,11 @@ void testShowableToString() {
 }
 
 void testBinaryExprASTToString() {
-  // Simple expression
-  std::unique_ptr<NumberExprAST> lhs = std::make_unique<NumberExprAST>(5),
-                                 rhs = std::make_unique<NumberExprAST>(7);
+  ASTArena arena;
 
-  BinaryExprAST expr('*', std::move(lhs), std::move(rhs));
+  // Simple expression
+  BinaryExprAST expr('*', arena.make<NumberExprAST>(5),
+                     arena.make<NumberExprAST>(7));
 
   const char *expected = "NumberExprAST(5) * NumberExprAST(7)";
   auto actual = expr.toString();
@@ -50,15 +63,13 @@ void testBinaryExprASTToString() {
   assertEq(expected, actual);
 
   // More complex expression
-  lhs = std::make_unique<NumberExprAST>(9);
-  std::vector<std::unique_ptr<ExprAST>> testArgs;
-  testArgs.emplace_back(std::make_unique<NumberExprAST>(1.2));
-  testArgs.emplace_back(std::make_unique<NumberExprAST>(2.5));
-  testArgs.emplace_back(std::make_unique<NumberExprAST>(3.8));
+  ExprAST *testArgs[] = {arena.make<NumberExprAST>(1.2),
+                         arena.make<NumberExprAST>(2.5),
+                         arena.make<NumberExprAST>(3.8)};
 
-  expr = BinaryExprAST(
-      '/', std::move(lhs),
-      std::make_unique<CallExprAST>("some_function", std::move(testArgs)));
+  expr = BinaryExprAST('/', arena.make<NumberExprAST>(9),
+                       arena.make<CallExprAST>(Symbol::intern("some_function"),
+                                               testArgs));
 
   expected = "NumberExprAST(9) / CallExprAST(some_function(NumberExprAST(1.2), "
              "NumberExprAST(2.5), NumberExprAST(3.8)))";
@@ -68,14 +79,14 @@ void testBinaryExprASTToString() {
 }
 
 void testCallExprASTToString() {
-  std::vector<std::unique_ptr<ExprAST>> testArgs;
-  testArgs.emplace_back(std::make_unique<NumberExprAST>(1));
-  testArgs.emplace_back(
-      std::make_unique<BinaryExprAST>('+', std::make_unique<NumberExprAST>(2),
-                                      std::make_unique<NumberExprAST>(3)));
-  testArgs.emplace_back(std::make_unique<NumberExprAST>(4));
+  ASTArena arena;
+  ExprAST *testArgs[] = {
+      arena.make<NumberExprAST>(1),
+      arena.make<BinaryExprAST>('+', arena.make<NumberExprAST>(2),
+                                arena.make<NumberExprAST>(3)),
+      arena.make<NumberExprAST>(4)};
 
-  CallExprAST expr("foo", std::move(testArgs));
+  CallExprAST expr(Symbol::intern("foo"), testArgs);
 
   const char *expected = "CallExprAST(foo(NumberExprAST(1), NumberExprAST(2) + "
                          "NumberExprAST(3), NumberExprAST(4)))";
@@ -85,20 +96,21 @@ void testCallExprASTToString() {
 }
 
 void testForExprASTToString() {
-  const std::string inductionVariableName = "i";
+  ASTArena arena;
+  const Symbol inductionVariableName = Symbol::intern("i");
   const VariableExprAST inductionVariable(inductionVariableName);
   const NumberExprAST init(0);
   const NumberExprAST one(1);
   const NumberExprAST five(5);
 
-  ForExprAST expr(inductionVariableName, std::make_unique<NumberExprAST>(init),
-                  std::make_unique<BinaryExprAST>(
-                      '<', std::make_unique<VariableExprAST>(inductionVariable),
-                      std::make_unique<NumberExprAST>(five)),
+  ForExprAST expr(inductionVariableName, arena.make<NumberExprAST>(init),
+                  arena.make<BinaryExprAST>(
+                      '<', arena.make<VariableExprAST>(inductionVariable),
+                      arena.make<NumberExprAST>(five)),
                   nullptr,
-                  std::make_unique<BinaryExprAST>(
-                      '+', std::make_unique<VariableExprAST>(inductionVariable),
-                      std::make_unique<NumberExprAST>(one)));
+                  arena.make<BinaryExprAST>(
+                      '+', arena.make<VariableExprAST>(inductionVariable),
+                      arena.make<NumberExprAST>(one)));
 
   const char *expected = "ForExprAST(i = NumberExprAST(0), VariableExprAST(i) "
                          "< NumberExprAST(5),\n"
@@ -108,15 +120,14 @@ void testForExprASTToString() {
 
   assertEq(expected, actual);
 
-  expr =
-      ForExprAST(inductionVariableName, std::make_unique<NumberExprAST>(init),
-                 std::make_unique<BinaryExprAST>(
-                     '<', std::make_unique<VariableExprAST>(inductionVariable),
-                     std::make_unique<NumberExprAST>(five)),
-                 std::make_unique<NumberExprAST>(0.5),
-                 std::make_unique<BinaryExprAST>(
-                     '+', std::make_unique<VariableExprAST>(inductionVariable),
-                     std::make_unique<NumberExprAST>(one)));
+  expr = ForExprAST(inductionVariableName, arena.make<NumberExprAST>(init),
+                    arena.make<BinaryExprAST>(
+                        '<', arena.make<VariableExprAST>(inductionVariable),
+                        arena.make<NumberExprAST>(five)),
+                    arena.make<NumberExprAST>(0.5),
+                    arena.make<BinaryExprAST>(
+                        '+', arena.make<VariableExprAST>(inductionVariable),
+                        arena.make<NumberExprAST>(one)));
 
   expected = "ForExprAST(i = NumberExprAST(0), VariableExprAST(i) < "
              "NumberExprAST(5), NumberExprAST(0.5),\n"
@@ -128,16 +139,17 @@ void testForExprASTToString() {
 }
 
 void testFunctionASTToString() {
+  auto arena = std::make_unique<ASTArena>();
   std::unique_ptr<PrototypeAST> header = std::make_unique<PrototypeAST>(
       "foo", std::vector<std::string>({"a", "b"}));
-  std::unique_ptr<ExprAST> body = std::make_unique<BinaryExprAST>(
+  const Symbol a = Symbol::intern("a"), b = Symbol::intern("b");
+  ExprAST *body = arena->make<BinaryExprAST>(
       '-',
-      std::make_unique<BinaryExprAST>('+',
-                                      std::make_unique<VariableExprAST>("a"),
-                                      std::make_unique<VariableExprAST>("b")),
-      std::make_unique<NumberExprAST>(2));
+      arena->make<BinaryExprAST>('+', arena->make<VariableExprAST>(a),
+                                 arena->make<VariableExprAST>(b)),
+      arena->make<NumberExprAST>(2));
 
-  FunctionAST func(std::move(header), std::move(body));
+  FunctionAST func(std::move(header), body, std::move(arena));
 
   const char *expected =
       "FunctionAST(\n"
@@ -150,15 +162,15 @@ void testFunctionASTToString() {
 }
 
 void testIfExprASTToString() {
-  std::unique_ptr<ExprAST> elseIf = std::make_unique<IfExprAST>(
-      std::make_unique<BinaryExprAST>('<', std::make_unique<NumberExprAST>(3),
-                                      std::make_unique<NumberExprAST>(4)),
-      std::make_unique<NumberExprAST>(4), std::make_unique<NumberExprAST>(5));
+  ASTArena arena;
+  ExprAST *elseIf = arena.make<IfExprAST>(
+      arena.make<BinaryExprAST>('<', arena.make<NumberExprAST>(3),
+                                arena.make<NumberExprAST>(4)),
+      arena.make<NumberExprAST>(4), arena.make<NumberExprAST>(5));
 
-  IfExprAST ifExpr(
-      std::make_unique<BinaryExprAST>('<', std::make_unique<NumberExprAST>(1),
-                                      std::make_unique<NumberExprAST>(2)),
-      std::make_unique<NumberExprAST>(3), std::move(elseIf));
+  IfExprAST ifExpr(arena.make<BinaryExprAST>('<', arena.make<NumberExprAST>(1),
+                                             arena.make<NumberExprAST>(2)),
+                   arena.make<NumberExprAST>(3), elseIf);
 
   const char *expected = "IfExprAST(NumberExprAST(1) < NumberExprAST(2)\n"
                          "\t? NumberExprAST(3)\n"
@@ -173,25 +185,25 @@ void testIfExprASTToString() {
 }
 
 void testLetExprASTToString() {
-  std::pair<std::string, std::unique_ptr<ExprAST>> a{
-      "a",
-      std::make_unique<IfExprAST>(std::make_unique<BinaryExprAST>(
-                                      '<', std::make_unique<NumberExprAST>(1),
-                                      std::make_unique<NumberExprAST>(2)),
-                                  std::make_unique<NumberExprAST>(3),
-                                  std::make_unique<NumberExprAST>(4))};
+  ASTArena arena;
+  const Symbol aName = Symbol::intern("a"), bName = Symbol::intern("b");
+  std::pair<Symbol, ExprAST *> a{
+      aName, arena.make<IfExprAST>(
+               arena.make<BinaryExprAST>('<', arena.make<NumberExprAST>(1),
+                                         arena.make<NumberExprAST>(2)),
+               arena.make<NumberExprAST>(3), arena.make<NumberExprAST>(4))};
   // I should really create a typedef instead of using decltype
-  decltype(a) b{"b", std::make_unique<NumberExprAST>(10)};
+  decltype(a) b{bName, arena.make<NumberExprAST>(10)};
 
-  std::unique_ptr<ExprAST> letExprBody = std::make_unique<BinaryExprAST>(
-      '*', std::make_unique<VariableExprAST>("a"),
-      std::make_unique<VariableExprAST>("b"));
+  ExprAST *letExprBody =
+      arena.make<BinaryExprAST>('*', arena.make<VariableExprAST>(aName),
+                                arena.make<VariableExprAST>(bName));
 
   std::vector<decltype(a)> variables;
   variables.emplace_back(std::move(a));
   variables.emplace_back(std::move(b));
 
-  LetExprAST letExpr(std::move(variables), std::move(letExprBody));
+  LetExprAST letExpr(std::move(variables), letExprBody);
 
   const char *expected = "LetExprAST(\n"
                          "\ta = IfExprAST(NumberExprAST(1) < NumberExprAST(2)\n"
@@ -229,13 +241,43 @@ void testPrototypeASTToString() {
   assertEq(expected, actual);
 }
 
+void testIndexExprASTToString() {
+  ASTArena arena;
+  const Symbol a = Symbol::intern("a"), i = Symbol::intern("i");
+  IndexExprAST expr(
+      a, arena.make<BinaryExprAST>('+', arena.make<VariableExprAST>(i),
+                                   arena.make<NumberExprAST>(1)));
+
+  const char *expected =
+      "IndexExprAST(a[VariableExprAST(i) + NumberExprAST(1)])";
+  const auto actual = expr.toString();
+
+  assertEq(expected, actual);
+}
+
+void testArrayExprASTToString() {
+  ASTArena arena;
+  ArrayExprAST expr(arena.make<NumberExprAST>(8));
+
+  const char *expected = "ArrayExprAST(NumberExprAST(8))";
+  const auto actual = expr.toString();
+  assertEq(expected, actual);
+
+  // Array parameters are marked in the prototype too.
+  PrototypeAST proto("sum", {"a", "n"}, false, 0, {true, false});
+  const char *expectedProto = "PrototypeAST(sum(a[], n))";
+  const auto actualProto = proto.toString();
+  assertEq(expectedProto, actualProto);
+}
+
 void testUnaryExprASTToString() {
-  std::unique_ptr<ExprAST> ifExpr = std::make_unique<IfExprAST>(
-      std::make_unique<BinaryExprAST>('<', std::make_unique<NumberExprAST>(1),
-                                      std::make_unique<NumberExprAST>(2)),
-      std::make_unique<NumberExprAST>(3), std::make_unique<NumberExprAST>(4));
+  ASTArena arena;
+  ExprAST *ifExpr = arena.make<IfExprAST>(
+      arena.make<BinaryExprAST>('<', arena.make<NumberExprAST>(1),
+                                arena.make<NumberExprAST>(2)),
+      arena.make<NumberExprAST>(3), arena.make<NumberExprAST>(4));
 
-  UnaryExprAST expr('-', std::move(ifExpr));
+  UnaryExprAST expr('-', ifExpr);
 
   const char *expected = "-IfExprAST(NumberExprAST(1) < NumberExprAST(2)\n"
                          "\t? NumberExprAST(3)\n"
@@ -249,7 +291,7 @@ void testUnaryExprASTToString() {
 void testVariableExprASTToString() {
   constexpr size_t varNameSize = 5;
   const char varName[varNameSize] = "foo";
-  const VariableExprAST expr(varName);
+  const VariableExprAST expr(Symbol::intern(varName));
 
   constexpr size_t expectedBufSize = 17 + varNameSize;
   char expected[expectedBufSize];
@@ -260,14 +302,274 @@ void testVariableExprASTToString() {
   assertEq(expected, actual);
 }
 
+void testParallelForExprASTToString() {
+  ASTArena arena;
+  const Symbol inductionVariableName = Symbol::intern("i");
+  const VariableExprAST inductionVariable(inductionVariableName);
+
+  ParallelForExprAST expr(
+      inductionVariableName, arena.make<NumberExprAST>(0),
+      arena.make<VariableExprAST>(Symbol::intern("n")),
+      arena.make<NumberExprAST>(2),
+      arena.make<BinaryExprAST>(
+          '*', arena.make<VariableExprAST>(inductionVariable),
+          arena.make<VariableExprAST>(inductionVariable)));
+
+  const char *expected = "ParallelForExprAST(i = NumberExprAST(0), "
+                         "VariableExprAST(n), NumberExprAST(2),\n"
+                         "\tVariableExprAST(i) * VariableExprAST(i)\n"
+                         ")";
+  const auto actual = expr.toString();
+
+  assertEq(expected, actual);
+}
+
+/// Build def sum(n) let s = 0 in (for i = 1, i < n in s = s + i) + s
+std::unique_ptr<FunctionAST> makeSumFunction() {
+  auto arena = std::make_unique<ASTArena>();
+  const Symbol s = Symbol::intern("s"), i = Symbol::intern("i"),
+               n = Symbol::intern("n");
+  std::vector<std::pair<Symbol, ExprAST *>> variables;
+  variables.emplace_back(s, arena->make<NumberExprAST>(0));
+
+  ExprAST *forExpr = arena->make<ForExprAST>(
+      i, arena->make<NumberExprAST>(1),
+      arena->make<BinaryExprAST>('<', arena->make<VariableExprAST>(i),
+                                 arena->make<VariableExprAST>(n)),
+      nullptr,
+      arena->make<BinaryExprAST>(
+          '=', arena->make<VariableExprAST>(s),
+          arena->make<BinaryExprAST>('+', arena->make<VariableExprAST>(s),
+                                     arena->make<VariableExprAST>(i))));
+
+  ExprAST *body = arena->make<LetExprAST>(
+      std::move(variables),
+      arena->make<BinaryExprAST>('+', forExpr,
+                                 arena->make<VariableExprAST>(s)));
+
+  return std::make_unique<FunctionAST>(
+      std::make_unique<PrototypeAST>("sum", std::vector<std::string>({"n"})),
+      body, std::move(arena));
+}
+
+void testFunctionASTEvaluate() {
+  // Evaluating works on the variables of the current compilation context,
+  // so each test evaluating something needs a context of its own.
+  CompilationContext context;
+  CompilationContext::Scope scope(context);
+  const auto func = makeSumFunction();
+
+  double expected = 10;
+  auto actual = func->evaluate(4.0);
+  if (!actual) {
+    std::cerr << "Could not evaluate " << func->toString() << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  assertEq(expected, *actual);
+}
+
+void testIfExprASTEvaluate() {
+  CompilationContext context;
+  CompilationContext::Scope scope(context);
+  ASTArena arena;
+
+  // Comparisons evaluate to 1.0 or 0.0, and if picks a branch accordingly.
+  IfExprAST ifExpr(arena.make<BinaryExprAST>('>', arena.make<NumberExprAST>(1),
+                                             arena.make<NumberExprAST>(2)),
+                   arena.make<NumberExprAST>(3), arena.make<NumberExprAST>(4));
+
+  double expected = 4;
+  auto actual = ifExpr.evaluate();
+  if (!actual) {
+    std::cerr << "Could not evaluate " << ifExpr.toString() << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  assertEq(expected, *actual);
+}
+
+void testFlatASTEvaluate() {
+  CompilationContext context;
+  CompilationContext::Scope scope(context);
+
+  // The same definition as makeSumFunction builds, as a FlatAST.
+  const Symbol s = Symbol::intern("s"), i = Symbol::intern("i"),
+               n = Symbol::intern("n");
+  FlatAST flat;
+  std::vector<std::pair<Symbol, FlatAST::Ref>> flatVariables;
+  flatVariables.emplace_back(s, flat.number(0));
+
+  auto flatFor = flat.forExpr(
+      i, flat.number(1), flat.binary('<', flat.variable(i), flat.variable(n)),
+      nullptr,
+      flat.binary('=', flat.variable(s),
+                  flat.binary('+', flat.variable(s), flat.variable(i))));
+
+  flat.define(
+      std::make_unique<PrototypeAST>("sum", std::vector<std::string>({"n"})),
+      flat.let(flatVariables,
+               flat.binary('+', flatFor, flat.variable(s))));
+
+  // It prints the same as the tree.
+  const auto expectedS = makeSumFunction()->toString(),
+             actualS = flat.toString();
+  assertEq(expectedS, actualS);
+
+  double expected = 10;
+  auto actual = flat.evaluate(4.0);
+  if (!actual) {
+    std::cerr << "Could not evaluate " << flat.toString() << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  assertEq(expected, *actual);
+}
+
+/// Check that a function of n with the given body returns the same for each
+/// of the given arguments whether its code is generated, at -O0 and -O2, or
+/// its AST is evaluated.
+void assertCodegenMatchesEvaluate(const std::string &body,
+                                  std::initializer_list<double> args) {
+  CompilationContext context;
+  CompilationContext::Scope scope(context);
+  SetupBinopPrecedences();
+  setInputBuffer(llvm::MemoryBuffer::getMemBufferCopy("def f(n) " + body));
+  getNextToken(); // Get the 'def' keyword
+  const auto func = ParseDefinition();
+  if (!func) {
+    std::cerr << "Could not parse " << body << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  for (unsigned optLevel : {0, 2}) {
+    Engine::Options opts;
+    opts.OptLevel = optLevel;
+    auto engine = Engine::create(opts);
+    auto session = engine ? (*engine)->createSession()
+                          : llvm::Expected<std::unique_ptr<Session>>(
+                                engine.takeError());
+    auto compiled = session ? (*session)->compile<double>(body, {"n"})
+                            : llvm::Expected<CompiledFunction<double>>(
+                                  session.takeError());
+    if (!compiled) {
+      std::cerr << "Could not compile " << body << ": "
+                << toString(compiled.takeError()) << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+
+    for (double arg : args) {
+      const double expected = (*compiled)(arg);
+      const auto actual = func->evaluate(arg);
+      if (!actual) {
+        std::cerr << "Could not evaluate " << body << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      assertEq(expected, *actual);
+    }
+  }
+}
+
+void testForExprASTCodegen() {
+  // A bound that is not an integer
+  assertCodegenMatchesEvaluate(
+      "let s = 0 in (for i = 0, i < 2.5 in s = s + i + 1) + s", {0});
+  assertCodegenMatchesEvaluate(
+      "let s = 0 in (for i = 0, i < n in s = s + i + 1) + s",
+      {-1, 0, 0.5, 1, 2.5, 3, 10});
+  // A step that is not an integer
+  assertCodegenMatchesEvaluate(
+      "let s = 0 in (for i = 0, i < n, 0.5 in s = s + i) + s",
+      {-1, 0, 0.5, 1, 2.5, 3, 10});
+  // A body that assigns the variable, which cannot be counted
+  assertCodegenMatchesEvaluate(
+      "let s = 0 in (for i = 0, i < n in s = s + (i = i + 1)) + s",
+      {0, 1, 2.5, 10});
+  assertCodegenMatchesEvaluate(
+      "let s = 0 in (for i = 0, i < n in s = s + (i = i * 2 + 0.5)) + s",
+      {0, 1, 2.5, 100});
+}
+
+void testIsMathFunction() {
+  const std::vector<std::string> x({"x"}), xy({"x", "y"});
+
+  // extern sin(x); declares the math library's sin, while def sin(x) is a
+  // function of its own, as are externs that do not take what the C function
+  // takes.
+  const PrototypeAST externSin("sin", x, false, 0, {}, /* IsExtern */ true);
+  const PrototypeAST defSin("sin", x);
+  const PrototypeAST externPow("pow", xy, false, 0, {}, /* IsExtern */ true);
+  const PrototypeAST unaryPow("pow", x, false, 0, {}, /* IsExtern */ true);
+  const PrototypeAST arraySin("sin", x, false, 0, {true},
+                              /* IsExtern */ true);
+  const PrototypeAST putchard("putchard", x, false, 0, {},
+                              /* IsExtern */ true);
+
+  bool expected = true;
+  bool actual = isMathFunction(externSin);
+  assertEq(expected, actual);
+  actual = isMathFunction(externPow);
+  assertEq(expected, actual);
+
+  expected = false;
+  actual = isMathFunction(defSin);
+  assertEq(expected, actual);
+  actual = isMathFunction(unaryPow);
+  assertEq(expected, actual);
+  actual = isMathFunction(arraySin);
+  assertEq(expected, actual);
+  actual = isMathFunction(putchard);
+  assertEq(expected, actual);
+}
+
+void testSymbolIntern() {
+  // Enough names to fill several chunks of the table, while the other tests
+  // intern names of their own
+  constexpr size_t numNames = 10000;
+  std::vector<Symbol> symbols;
+  for (size_t i = 0; i < numNames; i++)
+    symbols.push_back(Symbol::intern("symbol" + std::to_string(i)));
+
+  for (size_t i = 0; i < numNames; i++) {
+    const std::string expected = "symbol" + std::to_string(i);
+    const std::string actual = symbols[i].str().str();
+    assertEq(expected, actual);
+    const auto expectedID = symbols[i].getID(),
+               actualID = Symbol::intern(expected).getID();
+    assertEq(expectedID, actualID);
+  }
+
+  const Symbol empty;
+  const std::string expected = "", actual = empty.str().str();
+  assertEq(expected, actual);
+
+  const std::string expectedMangled = "_symbol0";
+  const auto mangle = [](llvm::StringRef name) { return "_" + name.str(); };
+  std::string actualMangled = symbols[0].getMangledName(mangle).str();
+  assertEq(expectedMangled, actualMangled);
+  // The mangled name is only made once
+  actualMangled = symbols[0]
+                      .getMangledName([](llvm::StringRef) -> std::string {
+                        std::abort();
+                      })
+                      .str();
+  assertEq(expectedMangled, actualMangled);
+}
+
 int main(int argc, const char **argv) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
   constexpr void (*unitTests[])() = {
       testShowableToString,       testBinaryExprASTToString,
       testCallExprASTToString,    testForExprASTToString,
       testFunctionASTToString,    testNumberExprASTToString,
       testIfExprASTToString,      testLetExprASTToString,
       testPrototypeASTToString,   testUnaryExprASTToString,
-      testVariableExprASTToString};
+      testVariableExprASTToString, testIndexExprASTToString,
+      testArrayExprASTToString,   testParallelForExprASTToString,
+      testFunctionASTEvaluate,    testIfExprASTEvaluate,
+      testFlatASTEvaluate,        testIsMathFunction,
+      testSymbolIntern,           testForExprASTCodegen};
   constexpr size_t numUnitTests = sizeof(unitTests) / sizeof(*unitTests);
   std::array<std::thread, numUnitTests> threads;
 
@@ -0,0 +1,154 @@
+#include <array>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <llvm/Support/TargetSelect.h>
+
+#include "Engine.h"
+
+/// Fail the test with the message of Err, if it is an error.
+void assertSuccess(llvm::Error Err) {
+  if (Err) {
+    std::cerr << "Unexpected error: " << toString(std::move(Err)) << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+/// Get the value of E, failing the test if it is an error.
+template <typename T> T assertSuccess(llvm::Expected<T> E) {
+  if (!E)
+    assertSuccess(E.takeError());
+  return std::move(*E);
+}
+
+/// Fail the test unless Err is an error.
+void assertFailure(llvm::Error Err) {
+  if (!Err) {
+    std::cerr << "Expected an error" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  llvm::consumeError(std::move(Err));
+}
+
+void assertEq(double lhs, double rhs) {
+  if (lhs != rhs) {
+    std::cerr << "Assertion failed: " << lhs << " != " << rhs << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+void testCompile(Engine &E) {
+  auto S = assertSuccess(E.createSession());
+  assertSuccess(S->load("def binary : 1 (x y) y;"
+                        "def fib(n) if n < 3 then 1 else fib(n-1) + fib(n-2);"
+                        "extern sin(x);"));
+
+  const auto Constant = assertSuccess(S->compile<>("fib(10)"));
+  assertEq(Constant(), 55);
+
+  const auto Formula = assertSuccess(
+      S->compile<double, double>("x : y * fib(x)", {"x", "y"}));
+  assertEq(Formula(5, 2), 10);
+  assertEq(Formula(1, 0), 0);
+
+  const auto Sin = assertSuccess(S->compile<double>("sin(x)", {"x"}));
+  assertEq(Sin(0), 0);
+
+  // The functions can be called from any thread.
+  std::array<std::thread, 4> Threads;
+  for (auto &T : Threads)
+    T = std::thread([Formula] {
+      for (int i = 0; i < 1000; i++)
+        assertEq(Formula(6, 3), 24);
+    });
+  for (auto &T : Threads)
+    T.join();
+}
+
+void testErrors(Engine &E) {
+  auto S = assertSuccess(E.createSession());
+  assertFailure(S->compile<>("undefined(1)").takeError());
+  assertFailure(S->compile<double>("x", {"y"}).takeError());
+  assertFailure(S->compile<double>("x", {"x y"}).takeError());
+  assertFailure(S->compile<>("1 2").takeError());
+  assertFailure(S->compile<>("1", {"x"}).takeError());
+  assertFailure(S->load("1 + 2;"));
+
+  // Nothing of a load that fails is kept, so the same function can be
+  // defined again.
+  assertFailure(S->load("def twice(x) x * 2; def oops(x) y;"));
+  assertFailure(S->compile<>("twice(1)").takeError());
+  assertSuccess(S->load("def twice(x) x + x;"));
+  assertEq(assertSuccess(S->compile<>("twice(4)"))(), 8);
+}
+
+void testIsolation(Engine &E) {
+  auto A = assertSuccess(E.createSession());
+  auto B = assertSuccess(E.createSession());
+  assertSuccess(A->load("def f(x) x + 1;"));
+  assertSuccess(B->load("def f(x) x + 2;"));
+  assertFailure(B->load("def f(x) x + 3;"));
+
+  assertEq(assertSuccess(A->compile<double>("f(x)", {"x"}))(1), 2);
+  assertEq(assertSuccess(B->compile<double>("f(x)", {"x"}))(1), 3);
+
+  assertSuccess(A->load("def unary ! (x) 0 - x;"));
+  assertEq(assertSuccess(A->compile<>("!1"))(), -1);
+  assertFailure(B->compile<>("!1").takeError());
+}
+
+void testRelease() {
+  // This looks at how much memory the engine's code takes up, so it has an
+  // engine of its own.
+  auto E = assertSuccess(Engine::create(Engine::Options()));
+  auto S = assertSuccess(E->createSession());
+  assertSuccess(S->load("def square(x) x * x;"));
+  assertEq(assertSuccess(S->compile<double>("square(x)", {"x"}))(3), 9);
+
+  // The code of an expression is freed along with its function, so
+  // compiling expressions over and over takes no more memory.
+  const auto InUse = E->getCodeBytesInUse();
+  for (int i = 0; i < 100; i++) {
+    const auto Function =
+        assertSuccess(S->compile<double>("square(x) + 1", {"x"}));
+    assertEq(Function(3), 10);
+  }
+  assertEq(E->getCodeBytesInUse(), InUse);
+
+  // What a session loaded is freed along with it, and the next session
+  // starts out without any of it.
+  S.reset();
+  assertEq(E->getCodeBytesInUse(), 0);
+  auto T = assertSuccess(E->createSession());
+  assertFailure(T->compile<>("square(2)").takeError());
+  assertSuccess(T->load("def square(x) x * x * x;"));
+  assertEq(assertSuccess(T->compile<>("square(2)"))(), 8);
+}
+
+int main(int argc, const char **argv) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  Engine::Options Opts;
+  Opts.NumCompileThreads = 2;
+  auto E = assertSuccess(Engine::create(Opts));
+
+  constexpr void (*unitTests[])(Engine &) = {testCompile, testErrors,
+                                             testIsolation};
+  constexpr size_t numUnitTests = sizeof(unitTests) / sizeof(*unitTests);
+  std::array<std::thread, numUnitTests> threads;
+
+  // Every test uses sessions of its own in the same engine, at the same time.
+  for (size_t i = 0; i < numUnitTests; i++)
+    threads[i] = std::thread(unitTests[i], std::ref(*E));
+  for (auto threadIt = threads.begin(); threadIt != threads.end(); threadIt++)
+    threadIt->join();
+  testRelease();
+
+  std::printf("Passed! (%s)\n", argv[0]);
+  std::exit(EXIT_SUCCESS);
+}
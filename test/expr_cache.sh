@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+# expr_cache.sh: Test that cached top-level expressions see redefined functions
+
+# shellcheck source=test/kaleidoscope.sh
+source "$(dirname "$0")/kaleidoscope.sh"
+
+for mode in '' -lazy; do
+  # The second f(1) is the same expression as the first, but calls the new f,
+  # and so does g(1), whose cached code calls f through g.
+  output=$(run -expr-cache=8 $mode <<'_EOF'
+def f(x) x + 1;
+def g(x) f(x) * 2;
+f(1);
+g(1);
+def f(x) x + 10;
+f(1);
+g(1);
+_EOF
+  )
+  expect "Redefining a function called by cached expressions under \"$mode\"" \
+    $'2\n4\n11\n22' "$output"
+done
+
+# An expression that was not invalidated still comes from the cache, so
+# running it again adds no module to the JIT.
+program='def f(x) x + 1;
+def g(x) x + 2;
+f(1);
+g(1);
+def f(x) x + 10;
+f(1);'
+before=$(run -expr-cache=8 -time-passes <<<"$program" | statistic modules-added)
+after=$(run -expr-cache=8 -time-passes <<<"$program
+g(1);" | statistic modules-added)
+expect "Keeping cached expressions that do not call the redefined function" \
+  "$before" "$after"
+
+finish
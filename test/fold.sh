@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+# fold.sh: Test that -fold folds constant expressions and nothing with side effects
+
+# shellcheck source=test/kaleidoscope.sh
+source "$(dirname "$0")/kaleidoscope.sh"
+
+# An if with a number for its condition becomes the branch it takes, so the
+# definition has neither a branch nor the multiplication of the other one.
+ir=$(run -fold -print-ir -O0 <<<'def f(x) if 1 then x else x * 2;')
+expect "Folding an if in a definition" 0 "$(grep -cE '\<(br|fmul)\>' <<<"$ir")"
+
+# A top-level expression only calling pure functions is evaluated right
+# away, so it adds no module to the JIT, and neither does a constant one.
+definition='def f(x) x * 2;'
+output=$(run -fold <<<"$definition
+f(3) + 2 * 3;
+2 * 3 + 1;")
+expect "Folding constant top-level expressions" $'12\n7' "$output"
+before=$(run -fold -time-passes <<<"$definition" | statistic modules-added)
+after=$(run -fold -time-passes <<<"$definition
+f(3) + 2 * 3;
+2 * 3 + 1;" | statistic modules-added)
+expect "Evaluating constant top-level expressions right away" "$before" "$after"
+
+# putchard is an extern, so neither it nor a function calling it is pure,
+# and each expression calling one gets a module and prints its character.
+# putchard prints to standard error, so the characters are checked apart
+# from the results.
+program='extern putchard(c);
+def shout(c) putchard(c) * 0 + c;'
+calls='putchard(65) + 1;
+shout(66) * 2;'
+for mode in -fold ''; do
+  output=$(run $mode <<<"$program
+$calls")
+  expect "Calling putchard under \"$mode\"" AB "$(tr -cd A-Z <<<"$output")"
+  expect "Results of calling putchard under \"$mode\"" $'1\n132' \
+    "$(tr -d A-Z <<<"$output")"
+done
+before=$(run -fold -time-passes <<<"$program" | statistic modules-added)
+after=$(run -fold -time-passes <<<"$program
+$calls" | statistic modules-added)
+expect "Compiling expressions calling putchard" $((before + 2)) "$after"
+
+finish
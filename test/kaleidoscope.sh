@@ -0,0 +1,78 @@
+# kaleidoscope.sh: Helpers for the tests that run programs through the interpreter
+#
+# Source this from a test script, which can then be given the interpreter to
+# test as its first argument:
+# test/redefinition.sh target/release/kaleidoscope
+# Without one, the script runs once for every interpreter that has been built.
+
+# If the name of the resulting binary ever changes, then this will have to change
+exe_name=kaleidoscope
+
+if [[ -n $1 ]]; then
+  exe=("$1")
+else
+  exe=()
+  while IFS='' read -r exe_file; do
+    exe+=("$exe_file")
+  done < <(find . -type d \( -path '*examples' -o -path '*scratch' -o -path '*.dSYM' \) -prune -false -o -name $exe_name -type f)
+fi
+
+case ${#exe[@]} in
+  0)
+    echo Could not find main executable \"$exe_name\". >&2
+    echo Ensure you have compiled the interpreter before running this script. >&2
+    exit 1
+    ;;
+  1)
+    # Flatten the array into a single string
+    # shellcheck disable=SC2178
+    exe=${exe[0]}
+    ;;
+  *)
+    # Recursively call the test script with each executable in the exe array
+    status=0
+    for x in ${exe[*]}; do
+      "$0" "$x" || status=1
+    done
+    exit $status
+    ;;
+esac
+
+exitcode=0
+
+# Usage: run [<option>...] <<< <program>
+# Run the program on standard input in batch mode, and print what it printed
+# to standard output and standard error.
+function run() {
+  # At this point $exe is not an array since it is flattened above,
+  # and execution will only reach this point if $exe is not an array.
+  # shellcheck disable=SC2128
+  ASAN_OPTIONS=detect_container_overflow=0 $exe -batch "$@" 2>&1
+}
+
+# Usage: expect <what is being tested> <expected output> <actual output>
+# Report a failure unless the actual output is the expected output.
+function expect() {
+  if [[ $3 != "$2" ]]; then
+    echo "$1" did not work properly. >&2
+    echo Expected the output to be: >&2
+    echo "$2" >&2
+    echo but instead it was: >&2
+    echo "$3" >&2
+    exitcode=1
+  fi
+}
+
+# Usage: statistic <name> <<< <output of run -time-passes>
+# Print the value of one of the counters printed by -time-passes.
+function statistic() {
+  awk -v name="$1" '$2 == name { print $1 }'
+}
+
+# Usage: finish
+# Exit with whether every test passed.
+function finish() {
+  # shellcheck disable=SC2128
+  [[ $exitcode == 0 ]] && echo "Passed! ($exe)"
+  exit $exitcode
+}
@@ -69,6 +69,24 @@ function do_test() {
     echo "	But instead output was: $output" >&2
     exit 1
   fi
+
+  # Lexing the same input from a file should give the same token
+  local input_file
+  input_file=$(mktemp)
+  printf -- "%s\n" "$input" >"$input_file"
+  # shellcheck disable=SC2128
+  echo "$exe" "$input_file"
+  set +e
+  # shellcheck disable=SC2128
+  output=$($exe "$input_file" 2>&1)
+  set -e
+  rm -f "$input_file"
+  if [[ ! $output =~ $expr ]]; then
+    echo Unexpected output for input "$input" read from a file >&2
+    echo Expected output to match the regular expression \""$expr"\" >&2
+    echo "	But instead output was: $output" >&2
+    exit 1
+  fi
 }
 
 # Positive path: these cases should work
@@ -93,6 +111,7 @@ keywords=(
   binary
   unary
   'let'
+  parallel
 )
 for keyword in "${keywords[@]}"; do
   do_test "$keyword" "$keyword $digit_regex"
@@ -76,5 +76,42 @@ if [[ $(./main) != "$expected" ]]; then
   exitcode=1
 fi
 
-rm -f main.c session.o main
+# Static archives and shared libraries are compiled in parallel, one partition
+# per thread
+for lib in session.a session.so; do
+  echo 'def avg(x y) (x + y) / 2;' | ASAN_OPTIONS=detect_container_overflow=0 $exe -threads=2 generic $lib
+
+  ${CC:-clang} main.c ./$lib -o main
+
+  if [[ $(./main) != "$expected" ]]; then
+    echo Compiling to $lib did not work properly. >&2
+    echo Expected output of the program linked against it to be: "$expected" >&2
+    echo but instead was: "$(./main)" >&2
+    exitcode=1
+  fi
+done
+
+# Assembly is compiled by the C compiler like any other source file
+echo 'def avg(x y) (x + y) / 2;' | ASAN_OPTIONS=detect_container_overflow=0 $exe generic session.s
+
+${CC:-clang} main.c session.s -o main
+
+if [[ $(./main) != "$expected" ]]; then
+  echo Compiling to session.s did not work properly. >&2
+  echo Expected output of the program assembled with it to be: "$expected" >&2
+  echo but instead was: "$(./main)" >&2
+  exitcode=1
+fi
+
+# Bitcode can be loaded back into the interpreter
+echo 'def avg(x y) (x + y) / 2;' | ASAN_OPTIONS=detect_container_overflow=0 $exe generic session.bc
+
+loaded=$(echo 'avg(3, 4);' | ASAN_OPTIONS=detect_container_overflow=0 $exe -batch -load=session.bc)
+if [[ $loaded != 3.5 ]]; then
+  echo Loading session.bc did not work properly. >&2
+  echo Expected avg\(3, 4\) to be 3.5 but instead it was: "$loaded" >&2
+  exitcode=1
+fi
+
+rm -f main.c session.o session.a session.so session.s session.bc main
 exit $exitcode
@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+# parallel_for.sh: Test that parallel for loops add up the same on any number of threads
+
+# shellcheck source=test/kaleidoscope.sh
+source "$(dirname "$0")/kaleidoscope.sh"
+
+# Adding up 1 / i gives a different last digit depending on the order the
+# terms are added in, and results only print six digits, so digits prints
+# six more at a time.
+program='extern floor(x);
+def harmonic(n) parallel for i = 1, i < n in 1 / i;
+def digits(x k) (x * k - floor(x * k)) * 1000000;
+harmonic(100000);
+digits(harmonic(100000), 10000);
+digits(harmonic(100000), 10000000000);'
+
+one=$(run -parallel-threads=1 <<<"$program")
+eight=$(run -parallel-threads=8 <<<"$program")
+# With -tier-up, harmonic never gets called often enough to be compiled, so
+# the loop is evaluated on its syntax tree.
+evaluated=$(run -tier-up=1000000000 <<<"$program")
+
+expect "Adding up a parallel for loop on one thread" $'12.0901\n461299\n634262' "$one"
+expect "Adding up a parallel for loop on eight threads" "$one" "$eight"
+expect "Evaluating a parallel for loop" "$one" "$evaluated"
+
+# Every iteration starts out with x at 0, whatever the iterations before it
+# in the same chunk assigned to it, so each adds up 1.
+program='def count(n) let x = 0 in parallel for i = 0, i < n in x = x + 1;
+count(1000);'
+
+compiled=$(run -parallel-threads=8 <<<"$program")
+evaluated=$(run -tier-up=1000000000 <<<"$program")
+
+expect "Assigning to a variable around a parallel for loop" 1001 "$compiled"
+expect "Evaluating assignments to a variable around a parallel for loop" \
+  "$compiled" "$evaluated"
+
+finish
@@ -0,0 +1,84 @@
+#!/usr/bin/env bash
+# redefinition.sh: Test that redefining a function recompiles the functions calling it
+
+# shellcheck source=test/kaleidoscope.sh
+source "$(dirname "$0")/kaleidoscope.sh"
+
+for mode in '' -lazy -threads=2 -flat-ast -tier-up=1; do
+  # Callers call the newest definition.
+  output=$(run $mode <<'_EOF'
+def f(x) x + 1;
+def g(x) f(x) * 2;
+g(1);
+def f(x) x + 10;
+g(1);
+_EOF
+  )
+  expect "Redefining f under \"$mode\"" $'4\n22' "$output"
+
+  # A caller that no longer fits the new definition reports an error once it
+  # is needed, not when f is redefined, and works again once f fits again.
+  # g is never called before f changes, so its old code was never linked.
+  # With -tier-up, g is not compiled before it is called, and once it fails
+  # to compile, the interpreter runs it and reports the call to f instead.
+  failure='LogError: Could not compile g again after a function it calls was redefined'
+  if [[ $mode == -tier-up=* ]]; then
+    failure='LogError: Wrong number of arguments passed to f, expecting 2 but got 1'
+  fi
+  output=$(run $mode <<'_EOF'
+def f(x) x + 1;
+def g(x) f(x) * 2;
+def f(x y) x + y;
+f(1, 2);
+g(1);
+def f(x) x + 100;
+g(1);
+_EOF
+  )
+  expect "Redefining f with another number of arguments under \"$mode\"" \
+    "3
+LogError: Wrong number of arguments passed to f, expecting 2 but got 1
+$failure
+202" "$output"
+done
+
+# Definitions loaded from a file are compiled again just the same.
+loaded=$(mktemp -t redefinitionXXXXXX.ks)
+echo 'def f(x) x + 1; def g(x) f(x) * 2;' >"$loaded"
+output=$(run -load="$loaded" <<'_EOF'
+g(1);
+def f(x) x + 10;
+g(1);
+_EOF
+)
+rm -f "$loaded"
+expect "Redefining a function loaded from a file" $'4\n22' "$output"
+
+# So are functions loaded from bitcode, which is compiled without inlining f
+# into g to have g call it at all.
+bitcode=$(mktemp -t redefinitionXXXXXX.bc)
+echo 'def f(x) x + 1; def g(x) f(x) * 2;' | run -O0 generic "$bitcode" >/dev/null
+output=$(run -load="$bitcode" <<'_EOF'
+g(1);
+def f(x) x + 10;
+g(1);
+_EOF
+)
+rm -f "$bitcode"
+expect "Redefining a function loaded from bitcode" $'4\n22' "$output"
+
+# The code of the old f is kept while the old code of g can still call it,
+# and removed once g has been compiled again. Either way the modules of both
+# top-level expressions are removed too.
+program='def f(x) x + 1;
+def g(x) f(x) * 2;
+g(1);
+def f(x) x + 10;'
+pinned=$(run -time-passes <<<"$program
+f(1);" | statistic modules-removed)
+expect "Keeping the code of the old f" 2 "$pinned"
+unpinned=$(run -time-passes <<<"$program
+g(1);" | statistic modules-removed)
+expect "Removing the code of the old f and g" 4 "$unpinned"
+
+finish
@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+# snapshot.sh: Test that a session saved as a snapshot can be picked up again
+
+# shellcheck source=test/kaleidoscope.sh
+source "$(dirname "$0")/kaleidoscope.sh"
+
+snapshot=$(mktemp -t snapshotXXXXXX)
+resaved=$(mktemp -t snapshotXXXXXX)
+
+output=$(run -save-snapshot="$snapshot" <<'_EOF'
+def f(x) x + 1;
+def g(x) f(x) * 2;
+def binary% 60 (a b) a - b * 10;
+g(1);
+_EOF
+)
+expect "Saving a snapshot" 4 "$output"
+
+# Everything the snapshot holds can be called, operators included, and
+# redefining a function compiles the functions from the snapshot calling it
+# again from their bitcode.
+output=$(run -snapshot="$snapshot" -save-snapshot="$resaved" <<'_EOF'
+g(1);
+f(2) % 1 + 1;
+def f(x) x + 10;
+g(1);
+_EOF
+)
+expect "Loading a snapshot" $'4\n-6\n22' "$output"
+
+# A snapshot saved from a snapshot keeps the newest definitions.
+output=$(run -snapshot="$resaved" <<'_EOF'
+g(1);
+def f(x) x + 100;
+g(1);
+_EOF
+)
+expect "Loading a snapshot saved from a snapshot" $'22\n202' "$output"
+
+rm -f "$snapshot" "$resaved"
+
+finish
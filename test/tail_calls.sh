@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+# tail_calls.sh: Test that -tail-calls compiles calls in tail position into jumps
+
+# shellcheck source=test/kaleidoscope.sh
+source "$(dirname "$0")/kaleidoscope.sh"
+
+# Ten million calls deep would overflow the stack unless every call is a
+# jump, which without -tail-calls only the optimizer makes at -O2 and up.
+output=$(run -O0 -tail-calls <<'_EOF'
+def count(n acc) if n < 1 then acc else count(n - 1, acc + 1);
+count(10000000, 0);
+_EOF
+)
+expect "Recursing in tail position at -O0" 1e+07 "$output"
+
+# The array is freed once g returns, so g cannot be jumped to, while the
+# call to c can.
+ir=$(run -O0 -tail-calls -print-ir <<'_EOF'
+def g(a[]) a[0];
+def h(x) let a[2] in g(a);
+def c(x) if x < 1 then 0 else c(x - 1);
+_EOF
+)
+calls=$(grep -oE '(tail )?call double @[a-z]+' <<<"$ir")
+expect "Placing tail calls around an array" \
+  "call double @g
+tail call double @c" "$calls"
+
+finish